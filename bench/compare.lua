@@ -0,0 +1,124 @@
+-- compare.lua
+-- Compares two result files of run.lua case by case: median times and
+-- their ratio. A change is marked when it is larger than 5% and larger
+-- than twice the combined standard deviation of both runs.
+--
+-- usage: lua compare.lua old.json new.json
+
+-- just enough JSON for the files run.lua writes
+local function decode(s)
+  local pos = 1
+  local value
+
+  local function skip()
+    pos = s:find("[^ \t\r\n]", pos) or #s + 1
+  end
+
+  local function str()
+    local out = {}
+    pos = pos + 1
+    while true do
+      local c = s:sub(pos, pos)
+      if c == '"' then pos = pos + 1; break
+      elseif c == "\\" then
+        local e = s:sub(pos + 1, pos + 1)
+        if e == "u" then
+          out[#out + 1] = utf8.char(tonumber(s:sub(pos + 2, pos + 5), 16))
+          pos = pos + 6
+        else
+          out[#out + 1] = ({ n = "\n", t = "\t", r = "\r", b = "\b", f = "\f" })[e] or e
+          pos = pos + 2
+        end
+      elseif c == "" then error("unterminated string")
+      else
+        local j = s:find('["\\]', pos) or #s + 1
+        out[#out + 1] = s:sub(pos, j - 1)
+        pos = j
+      end
+    end
+    return table.concat(out)
+  end
+
+  function value()
+    skip()
+    local c = s:sub(pos, pos)
+    if c == "{" then
+      local t = {}
+      pos = pos + 1
+      skip()
+      if s:sub(pos, pos) == "}" then pos = pos + 1; return t end
+      repeat
+        skip()
+        local k = str()
+        skip()
+        assert(s:sub(pos, pos) == ":", "':' expected")
+        pos = pos + 1
+        t[k] = value()
+        skip()
+        c = s:sub(pos, pos)
+        pos = pos + 1
+      until c ~= ","
+      assert(c == "}", "'}' expected")
+      return t
+    elseif c == "[" then
+      local t = {}
+      pos = pos + 1
+      skip()
+      if s:sub(pos, pos) == "]" then pos = pos + 1; return t end
+      repeat
+        t[#t + 1] = value()
+        skip()
+        c = s:sub(pos, pos)
+        pos = pos + 1
+      until c ~= ","
+      assert(c == "]", "']' expected")
+      return t
+    elseif c == '"' then
+      return str()
+    end
+    local lit = s:match("^[%w%.%+%-]+", pos)
+    assert(lit, "value expected at " .. pos)
+    pos = pos + #lit
+    if lit == "true" then return true
+    elseif lit == "false" then return false
+    elseif lit == "null" then return nil
+    end
+    return assert(tonumber(lit), "bad number " .. lit)
+  end
+
+  return value()
+end
+
+local function load(name)
+  local f = assert(io.open(name, "rb"))
+  local doc = decode(f:read("a"))
+  f:close()
+  local byid = {}
+  for _, r in ipairs(doc.results) do byid[r.suite .. "/" .. r.name] = r end
+  return doc, byid
+end
+
+assert(arg[1] and arg[2], "usage: lua compare.lua old.json new.json")
+local olddoc, old = load(arg[1])
+local newdoc, new = load(arg[2])
+
+print(string.format("old: %s (%s)  new: %s (%s)", arg[1], olddoc.date, arg[2], newdoc.date))
+print(string.format("%-28s %10s %10s %8s", "case", "old ms", "new ms", "new/old"))
+local faster, slower = 0, 0
+for _, r in ipairs(newdoc.results) do
+  local id = r.suite .. "/" .. r.name
+  local o = old[id]
+  if o and o.n == r.n then
+    local ratio = r.median / o.median
+    local noise = 2 * math.sqrt(o.stddev ^ 2 + r.stddev ^ 2) / o.median
+    local mark = ""
+    if math.abs(ratio - 1) > math.max(0.05, noise) then
+      mark = (ratio < 1) and "  faster" or "  SLOWER"
+      if ratio < 1 then faster = faster + 1 else slower = slower + 1 end
+    end
+    print(string.format("%-28s %10.3f %10.3f %8.3f%s", id, o.median * 1e3, r.median * 1e3, ratio, mark))
+  else
+    print(string.format("%-28s %10s %10.3f", id, o and "(other n)" or "-", r.median * 1e3))
+  end
+end
+print(string.format("%d faster, %d slower", faster, slower))
@@ -0,0 +1,214 @@
+-- run.lua
+-- Runs the benchmark suites in suites/ and writes the results as JSON,
+-- with median, p95, mean and standard deviation per case.
+--
+-- usage: lua run.lua [options] [suite ...]
+--   -r n        timed runs per case (default 7), after one warm-up run
+--   -s scale    multiply the work of every case (default 1)
+--   -f pattern  only cases whose "suite/name" matches the Lua pattern
+--   -o file     JSON output file (default results.json)
+--   -l          list the cases and exit
+--
+-- A suite is a file suites/<name>.lua returning a list of cases, or nil
+-- and a reason when it cannot run (a library missing). A case is
+--   { name = "...", n = work, run = function(ctx, n) ... end,
+--     setup = function(n) return ctx end,      -- optional, not timed
+--     teardown = function(ctx) end,            -- optional
+--     wall = true }                            -- optional, see below
+-- run does n operations of the case; the result reports seconds per
+-- run and nanoseconds per operation. Times are CPU time (os.clock),
+-- or wall time for cases that set 'wall' (threads, processes, timers).
+
+local SUITES = { "core", "fields", "strings", "tables", "serialize", "io",
+  "crypto", "xml", "sqlite", "lfs", "threads", "async", "luac" }
+
+local here = (arg and arg[0] or ""):match("^(.*[/\\])") or ""
+
+local opts = { repeats = 7, scale = 1, out = "results.json" }
+local only = {}
+do
+  local i = 1
+  while arg and arg[i] do
+    local a = arg[i]
+    if a == "-r" then i = i + 1; opts.repeats = assert(math.tointeger(tonumber(arg[i])), "-r needs a count")
+    elseif a == "-s" then i = i + 1; opts.scale = assert(tonumber(arg[i]), "-s needs a number")
+    elseif a == "-f" then i = i + 1; opts.filter = assert(arg[i], "-f needs a pattern")
+    elseif a == "-o" then i = i + 1; opts.out = assert(arg[i], "-o needs a file name")
+    elseif a == "-l" then opts.list = true
+    elseif a:sub(1, 1) == "-" then error("unknown option " .. a)
+    else only[#only + 1] = a
+    end
+    i = i + 1
+  end
+end
+if #only == 0 then only = SUITES end
+
+local cpuclock = os.clock
+-- a monotonic wall clock: os.nanotime, or the millisecond clock of the
+-- async library on interpreters without it
+local wallclock = os.nanotime and function() return os.nanotime() * 1e-9 end
+  or async and async.now or os.clock
+
+
+-- {====================================================== statistics
+
+local function quantile(sorted, q)
+  local pos = 1 + (#sorted - 1) * q
+  local lo = math.floor(pos)
+  local hi = math.min(lo + 1, #sorted)
+  return sorted[lo] + (sorted[hi] - sorted[lo]) * (pos - lo)
+end
+
+local function summarize(samples)
+  local sorted = {}
+  local sum = 0
+  for i, v in ipairs(samples) do sorted[i] = v; sum = sum + v end
+  table.sort(sorted)
+  local mean = sum / #sorted
+  local var = 0
+  for _, v in ipairs(sorted) do var = var + (v - mean) ^ 2 end
+  var = (#sorted > 1) and var / (#sorted - 1) or 0
+  return {
+    median = quantile(sorted, 0.5),
+    p95 = quantile(sorted, 0.95),
+    mean = mean,
+    stddev = math.sqrt(var),
+    min = sorted[1],
+    max = sorted[#sorted],
+  }
+end
+
+-- }======================================================
+
+
+-- {====================================================== JSON output
+
+local function json(v, out)
+  local t = type(v)
+  if t == "table" then
+    if #v > 0 or next(v) == nil then
+      out[#out + 1] = "["
+      for i, x in ipairs(v) do
+        if i > 1 then out[#out + 1] = "," end
+        json(x, out)
+      end
+      out[#out + 1] = "]"
+    else
+      local keys = {}
+      for k in pairs(v) do keys[#keys + 1] = tostring(k) end
+      table.sort(keys)
+      out[#out + 1] = "{"
+      for i, k in ipairs(keys) do
+        if i > 1 then out[#out + 1] = "," end
+        json(k, out)
+        out[#out + 1] = ":"
+        json(v[k], out)
+      end
+      out[#out + 1] = "}"
+    end
+  elseif t == "string" then
+    out[#out + 1] = '"' .. v:gsub('[%c"\\]', function(c)
+      return string.format("\\u%04x", c:byte())
+    end) .. '"'
+  elseif t == "number" then
+    if v ~= v or v == math.huge or v == -math.huge then
+      out[#out + 1] = "null"
+    elseif math.type(v) == "integer" then
+      out[#out + 1] = tostring(v)
+    else
+      out[#out + 1] = string.format("%.9g", v)
+    end
+  elseif t == "boolean" then
+    out[#out + 1] = tostring(v)
+  else
+    out[#out + 1] = "null"
+  end
+  return out
+end
+
+-- }======================================================
+
+
+local function loadsuite(name)
+  local fn, err = loadfile(here .. "suites/" .. name .. ".lua")
+  if not fn then return nil, err end
+  local ok, cases, reason = pcall(fn)
+  if not ok then return nil, cases end
+  if cases == nil then return nil, reason or "not available" end
+  return cases
+end
+
+local function measure(case)
+  local n = math.max(1, math.floor((case.n or 1) * opts.scale))
+  local clock = case.wall and wallclock or cpuclock
+  local ctx = case.setup and case.setup(n)
+  local samples = {}
+  local ok, err = pcall(function()
+    case.run(ctx, n)  -- warm-up
+    for i = 1, opts.repeats do
+      collectgarbage()
+      local t0 = clock()
+      case.run(ctx, n)
+      samples[i] = clock() - t0
+    end
+  end)
+  if case.teardown then case.teardown(ctx) end
+  if not ok then error(err, 0) end
+  local r = summarize(samples)
+  r.n = n
+  r.samples = samples
+  r.clock = case.wall and "wall" or "cpu"
+  r.unit = "s"
+  r.ns_per_op = r.median * 1e9 / n
+  return r
+end
+
+
+local results, skipped = {}, {}
+for _, sname in ipairs(only) do
+  local cases, err = loadsuite(sname)
+  if not cases then
+    skipped[#skipped + 1] = { suite = sname, reason = tostring(err) }
+    io.stderr:write(string.format("%-28s skipped: %s\n", sname, tostring(err)))
+  else
+    for _, case in ipairs(cases) do
+      local id = sname .. "/" .. case.name
+      if not opts.filter or id:find(opts.filter) then
+        if opts.list then
+          print(id)
+        else
+          local ok, r = pcall(measure, case)
+          if ok then
+            r.suite, r.name = sname, case.name
+            results[#results + 1] = r
+            print(string.format("%-28s %9.3f ms  p95 %9.3f  sd %5.1f%%  %10.1f ns/op",
+              id, r.median * 1e3, r.p95 * 1e3, 100 * r.stddev / math.max(r.mean, 1e-12),
+              r.ns_per_op))
+          else
+            skipped[#skipped + 1] = { suite = sname, name = case.name, reason = tostring(r) }
+            io.stderr:write(string.format("%-28s failed: %s\n", id, tostring(r)))
+          end
+        end
+      end
+    end
+  end
+end
+
+if not opts.list then
+  -- older interpreters have no "allocstats" and raise
+  local pooled, stats = pcall(collectgarbage, "allocstats")
+  local doc = {
+    version = _VERSION,
+    interpreter = arg and arg[-1] or "?",
+    allocator = (pooled and stats) and "pool" or "default",
+    date = os.date("!%Y-%m-%dT%H:%M:%SZ"),
+    repeats = opts.repeats,
+    scale = opts.scale,
+    results = results,
+    skipped = skipped,
+  }
+  local f = assert(io.open(opts.out, "w"))
+  f:write(table.concat(json(doc, {})), "\n")
+  f:close()
+  print(string.format("%d cases, results in %s", #results, opts.out))
+end
@@ -0,0 +1,94 @@
+-- async.lua
+-- The event loop: reading a command's output through async.process and
+-- through io.popen, a round trip of data through cat, many tasks on
+-- timers, and task switches through async.sleep(0). Wall time; n
+-- counts bytes for the pipes and tasks or switches for the rest.
+
+if not async then return nil, "async library not available" end
+
+local cases = {}
+local function case(t) cases[#cases + 1] = t end
+
+local WINDOWS = package.config:sub(1, 1) == "\\"
+local CAT = WINDOWS and "type " or "cat "
+
+local function datafile(n)
+  local name = os.tmpname()
+  local f = assert(io.open(name, "wb"))
+  local line = string.rep("0123456789abcdef", 4) .. "\n"
+  f:write(line:rep(n // #line))
+  f:close()
+  return name
+end
+
+case { name = "process read", n = 1 << 25, wall = true, setup = datafile, teardown = os.remove,
+  run = function(name)
+    return async.run(function()
+      local p = async.process(CAT .. name)
+      local len = #p.stdout:read("a")
+      p:wait()
+      return len
+    end)
+  end }
+
+case { name = "popen read", n = 1 << 25, wall = true, setup = datafile, teardown = os.remove,
+  run = function(name)
+    local p = assert(io.popen(CAT .. name))
+    local len = #p:read("a")
+    p:close()
+    return len
+  end }
+
+-- one task writes into cat while another reads its output
+if not WINDOWS then
+  case { name = "pipe through cat", n = 1 << 24, wall = true, run = function(_, n)
+    local chunk = string.rep("x", 65536)
+    return async.run(function()
+      local p = async.process("cat")
+      async.spawn(function()
+        for _ = 1, n // #chunk do p.stdin:write(chunk) end
+        p.stdin:close()
+      end)
+      local len = 0
+      while true do
+        local s = p.stdout:read(65536)
+        if not s then break end
+        len = len + #s
+      end
+      p:wait()
+      return len
+    end)
+  end }
+end
+
+case { name = "timer tasks", n = 1000, wall = true, run = function(_, n)
+  return async.run(function()
+    local done = 0
+    for i = 1, n do
+      async.spawn(function()
+        for _ = 1, 5 do async.sleep((i % 10) / 1000) end
+        done = done + 1
+      end)
+    end
+    while done < n do async.sleep(0.001) end
+    return done
+  end)
+end }
+
+case { name = "task switch", n = 2e5, wall = true, run = function(_, n)
+  return async.run(function()
+    local count = 0
+    for _ = 1, 4 do
+      async.spawn(function()
+        for _ = 1, n // 4 do
+          count = count + 1
+          async.sleep(0)
+        end
+      end)
+    end
+    while count < n do async.sleep(0.001) end
+    return count
+  end)
+end }
+
+return cases
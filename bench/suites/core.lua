@@ -0,0 +1,211 @@
+-- core.lua
+-- VM microbenchmarks: calls, closures, table access, arithmetic,
+-- string operations, GC churn and coroutines, plus three small
+-- workloads (JSON-like encoding, objects, text) with the opcode mix of
+-- real scripts.
+
+local cases = {}
+local function case(t) cases[#cases + 1] = t end
+
+local function add(a, b) return a + b end
+
+case { name = "call", n = 2e6, run = function(_, n)
+  local s = 0
+  for i = 1, n do s = add(s, i) end
+  return s
+end }
+
+case { name = "call vararg", n = 1e6, run = function(_, n)
+  local function count(...) return select("#", ...) end
+  local s = 0
+  for i = 1, n do s = s + count(i, i, i) end
+  return s
+end }
+
+local Obj = {}
+Obj.__index = Obj
+function Obj:get() return self.v end
+
+case { name = "method call", n = 2e6, run = function(_, n)
+  local o, s = setmetatable({ v = 1 }, Obj), 0
+  for _ = 1, n do s = s + o:get() end
+  return s
+end }
+
+case { name = "pcall", n = 1e6, run = function(_, n)
+  local s = 0
+  for i = 1, n do
+    local _, v = pcall(add, s, i)
+    s = v
+  end
+  return s
+end }
+
+case { name = "closure create", n = 1e6, run = function(_, n)
+  local f
+  for i = 1, n do f = function() return i end end
+  return f()
+end }
+
+case { name = "upvalue counter", n = 2e6, run = function(_, n)
+  local c = 0
+  local function inc() c = c + 1 end
+  for _ = 1, n do inc() end
+  return c
+end }
+
+case { name = "array write/read", n = 2e6, run = function(_, n)
+  local t = {}
+  for i = 1, n do t[i] = i end
+  local s = 0
+  for i = 1, n do s = s + t[i] end
+  return s
+end }
+
+case { name = "hash insert/lookup", n = 2e5, run = function(_, n)
+  local t = {}
+  for i = 1, n do t["k" .. (i % 4096)] = i end
+  local s = 0
+  for i = 1, n do s = s + t["k" .. (i % 4096)] end
+  return s
+end }
+
+case { name = "int arithmetic", n = 5e6, run = function(_, n)
+  local s = 0
+  for i = 1, n do s = (s + i * 3) // 2 ~ i end
+  return s
+end }
+
+case { name = "float arithmetic", n = 5e6, run = function(_, n)
+  local s = 0.0
+  for i = 1, n do s = s * 0.5 + i / 3 end
+  return s
+end }
+
+case { name = "string concat", n = 5e5, run = function(_, n)
+  local s
+  for i = 1, n do s = "item " .. i .. ": " .. (i * 2) end
+  return s
+end }
+
+case { name = "string format", n = 3e5, run = function(_, n)
+  local s
+  for i = 1, n do s = string.format("%d %s %.2f", i, "x", i / 7) end
+  return s
+end }
+
+case { name = "string find/sub", n = 5e5, run = function(_, n)
+  local text = "the quick brown fox jumps over the lazy dog"
+  local c = 0
+  for i = 1, n do
+    local p = text:find("lazy", 1, true)
+    c = c + #text:sub(p, p + (i % 4))
+  end
+  return c
+end }
+
+case { name = "string gsub", n = 1e5, run = function(_, n)
+  local text = "key1=value1; key2=value2; key3=value3"
+  local c = 0
+  for _ = 1, n do c = c + #text:gsub("(%w+)=(%w+)", "%2=%1") end
+  return c
+end }
+
+case { name = "gc churn", n = 1e6, run = function(_, n)
+  local keep = {}
+  for i = 1, n do
+    local t = { i, i + 1, x = i }
+    if i % 1000 == 0 then keep[#keep + 1] = t end
+  end
+  return #keep
+end }
+
+case { name = "coroutine switch", n = 5e5, run = function(_, n)
+  local co = coroutine.wrap(function()
+    local v = 0
+    while true do v = v + coroutine.yield(v) end
+  end)
+  co(0)
+  local s = 0
+  for i = 1, n do s = co(i) end
+  return s
+end }
+
+-- JSON-like encoding of nested records
+case { name = "workload json", n = 10000, run = function(_, n)
+  local function encode(v, out)
+    local t = type(v)
+    if t == "table" then
+      if #v > 0 then
+        out[#out + 1] = "["
+        for i = 1, #v do
+          if i > 1 then out[#out + 1] = "," end
+          encode(v[i], out)
+        end
+        out[#out + 1] = "]"
+      else
+        out[#out + 1] = "{"
+        local first = true
+        for k, x in pairs(v) do
+          if not first then out[#out + 1] = "," end
+          first = false
+          out[#out + 1] = '"' .. k .. '":'
+          encode(x, out)
+        end
+        out[#out + 1] = "}"
+      end
+    elseif t == "string" then
+      out[#out + 1] = '"' .. v .. '"'
+    else
+      out[#out + 1] = tostring(v)
+    end
+  end
+  local len = 0
+  for i = 1, n do
+    local rec = { id = i, name = "item" .. i, tags = { "a", "b", "c" },
+      pos = { x = i * 0.5, y = -i }, ok = (i % 2 == 0) }
+    local out = {}
+    encode(rec, out)
+    len = len + #table.concat(out)
+  end
+  return len
+end }
+
+-- class-based simulation
+case { name = "workload oop", n = 1000, run = function(_, n)
+  local Vec = {}
+  Vec.__index = Vec
+  local function vec(x, y) return setmetatable({ x = x, y = y }, Vec) end
+  function Vec:add(o) return vec(self.x + o.x, self.y + o.y) end
+  function Vec:scale(s) return vec(self.x * s, self.y * s) end
+  local bodies = {}
+  for i = 1, 100 do bodies[i] = { pos = vec(i, 100 + i % 13), vel = vec(0, 0) } end
+  local g = vec(0, -9.81)
+  for _ = 1, n do
+    for i = 1, #bodies do
+      local b = bodies[i]
+      b.vel = b.vel:add(g:scale(0.01))
+      b.pos = b.pos:add(b.vel:scale(0.01))
+      if b.pos.y < 0 then b.pos.y = -b.pos.y; b.vel.y = -b.vel.y * 0.9 end
+    end
+  end
+  return bodies[1].pos.y
+end }
+
+-- word frequencies of a generated text
+case { name = "workload text", n = 200000, setup = function(n)
+  local words = { "lorem", "ipsum", "dolor", "sit", "amet", "consectetur",
+    "adipiscing", "elit", "sed", "do", "eiusmod", "tempor" }
+  local t = {}
+  for i = 1, n do t[i] = words[(i * 7) % #words + 1] end
+  return table.concat(t, " ")
+end, run = function(text)
+  local freq = {}
+  for w in text:gmatch("%a+") do freq[w] = (freq[w] or 0) + 1 end
+  local list = {}
+  for w, c in pairs(freq) do list[#list + 1] = w:upper() .. "=" .. c end
+  table.sort(list)
+  return #list
+end }
+
+return cases
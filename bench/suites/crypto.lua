@@ -0,0 +1,100 @@
+-- crypto.lua
+-- Hashes at three message sizes, AES-128/256 in each block mode, the
+-- other ciphers of the library, and the base64 and hex encodings.
+-- n counts bytes; the small sizes repeat one message.
+
+if not crypto then return nil, "crypto library not available" end
+
+local cases = {}
+local function case(t) cases[#cases + 1] = t end
+
+local function message(size)
+  local t = {}
+  for i = 1, size do t[i] = string.char((i * 131 + 7) % 256) end
+  return table.concat(t)
+end
+
+local SIZES = { { "64B", 64 }, { "4KB", 4096 }, { "1MB", 1 << 20 } }
+local TOTAL = 1 << 25
+
+for _, fname in ipairs({ "md5", "sha1", "sha256", "sha512", "crc32" }) do
+  local f = crypto[fname]
+  if f then
+    for _, size in ipairs(SIZES) do
+      case { name = fname .. " " .. size[1], n = TOTAL, setup = function()
+        return message(size[2])
+      end, run = function(msg, n)
+        for _ = 1, n // #msg do f(msg) end
+      end }
+    end
+  end
+end
+
+-- the library takes an IV as long as the key
+local IV = "0123456789abcdef"
+
+for _, bits in ipairs({ 128, 256 }) do
+  for _, mode in ipairs({ "ECB", "CBC", "CFB", "OFB", "CTR" }) do
+    case { name = "aes" .. bits .. " " .. mode, n = 1 << 23, setup = function(n)
+      local key = crypto.aes_prepare_key(message(bits // 8), bits)
+      crypto.set_cipher_mode(key, mode, mode ~= "ECB" and IV:rep(bits // 128) or nil)
+      return { key = key, data = message(n) }
+    end, run = function(ctx)
+      return #crypto.aes_encrypt(ctx.data, ctx.key)
+    end }
+  end
+end
+
+case { name = "aes128 CBC decrypt", n = 1 << 23, setup = function(n)
+  local key = crypto.aes_prepare_key(message(16), 128)
+  crypto.set_cipher_mode(key, "CBC", IV)
+  local data = crypto.aes_encrypt(message(n), key)
+  crypto.set_cipher_mode(key, "CBC", IV)
+  return { key = key, data = data }
+end, run = function(ctx)
+  return #crypto.aes_decrypt(ctx.data, ctx.key)
+end }
+
+if crypto.blowfish_prepare_key then
+  case { name = "blowfish", n = 1 << 23, setup = function(n)
+    return { key = crypto.blowfish_prepare_key(message(16)), data = message(n) }
+  end, run = function(ctx)
+    return #crypto.blowfish_encrypt(ctx.data, ctx.key)
+  end }
+end
+
+if crypto.des_prepare_key then
+  case { name = "3des", n = 1 << 21, setup = function(n)
+    return { key = crypto.des_prepare_key(message(24), true, true), data = message(n) }
+  end, run = function(ctx)
+    return #crypto.des_encrypt(ctx.data, ctx.key)
+  end }
+end
+
+if crypto.rc4 then
+  case { name = "rc4", n = 1 << 24, setup = function(n)
+    return message(n)
+  end, run = function(data)
+    return #crypto.rc4(data, crypto.rc4_prepare_key("benchmark key"))
+  end }
+end
+
+case { name = "base64 encode", n = 1 << 24, setup = message, run = function(data)
+  return #crypto.base64_encode(data)
+end }
+
+if crypto.base64_decode then
+  case { name = "base64 decode", n = 1 << 24, setup = function(n)
+    return crypto.base64_encode(message(n))
+  end, run = function(text)
+    return #crypto.base64_decode(text)
+  end }
+end
+
+if crypto.hex_encode then
+  case { name = "hex encode", n = 1 << 24, setup = message, run = function(data)
+    return #crypto.hex_encode(data)
+  end }
+end
+
+return cases
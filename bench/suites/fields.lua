@@ -0,0 +1,79 @@
+-- fields.lua
+-- Constant-key field access: field reads and writes, method calls
+-- through a class metatable, '__index' chains and global reads.
+
+local cases = {}
+local function case(t) cases[#cases + 1] = t end
+
+-- a record with enough fields to have collisions in its hash part
+local rec = { x = 1, y = 2, z = 3, w = 4, name = "r", kind = "point",
+  flags = 0, next = false }
+
+case { name = "field read", n = 2e6, run = function(_, n)
+  local r, s = rec, 0
+  for _ = 1, n do
+    s = s + r.x + r.y + r.z + r.w
+  end
+  return s
+end }
+
+case { name = "field write", n = 2e6, run = function(_, n)
+  local r = rec
+  for i = 1, n do
+    r.x = i; r.y = i; r.z = i; r.w = i
+  end
+end }
+
+-- class with methods in the metatable's '__index' table
+local Point = {}
+Point.__index = Point
+function Point.new(x, y) return setmetatable({ x = x, y = y }, Point) end
+function Point:getx() return self.x end
+function Point:gety() return self.y end
+
+case { name = "method call", n = 2e6, run = function(_, n)
+  local p, s = Point.new(1, 2), 0
+  for _ = 1, n do
+    s = s + p:getx() + p:gety()
+  end
+  return s
+end }
+
+-- two-level '__index' chain: methods inherited from a base class
+local Base = {}
+Base.__index = Base
+function Base:id() return self.x end
+local Derived = setmetatable({}, Base)
+Derived.__index = Derived
+function Derived:name() return "derived" end
+
+case { name = "inherited call", n = 2e6, run = function(_, n)
+  local o, s = setmetatable({ x = 1 }, Derived), 0
+  for _ = 1, n do
+    s = s + o:id()
+    o:name()
+  end
+  return s
+end }
+
+-- many objects sharing one layout, as in a list of records
+case { name = "many objects", n = 2e6, run = function(_, n)
+  local list = {}
+  for i = 1, 64 do list[i] = Point.new(i, -i) end
+  local s = 0
+  for i = 1, n do
+    local p = list[(i & 63) + 1]
+    s = s + p.x - p.y
+  end
+  return s
+end }
+
+case { name = "global read", n = 2e6, run = function(_, n)
+  local s = 0
+  for _ = 1, n do
+    s = s + (math.pi and 1 or 0) + (string.len and 1 or 0)
+  end
+  return s
+end }
+
+return cases
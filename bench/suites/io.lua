@@ -0,0 +1,139 @@
+-- io.lua
+-- File input: reading a log line by line and in "l*" batches, loading
+-- a data file with dofile and load_data, and require of a set of
+-- modules from source and from the compiled-module cache.
+
+local cases = {}
+local function case(t) cases[#cases + 1] = t end
+
+local function writefile(name, s)
+  local f = assert(io.open(name, "wb"))
+  f:write(s)
+  f:close()
+end
+
+-- a log file of n lines
+local function logfile(n)
+  local name = os.tmpname()
+  local f = assert(io.open(name, "w"))
+  for i = 1, n do
+    f:write(string.format("2021-03-%02d 12:%02d:%02d [INFO] worker-%d: request %d took %d ms\n",
+      i % 28 + 1, i % 60, i % 60, i % 8, i, i % 997))
+  end
+  f:close()
+  return name
+end
+
+case { name = "lines", n = 1e6, setup = logfile, teardown = os.remove,
+  run = function(name)
+    local count = 0
+    for _ in io.lines(name) do count = count + 1 end
+    return count
+  end }
+
+-- the batched format is new; older interpreters raise on it
+local probe = os.tmpname()
+local batched = pcall(function() for _ in io.lines(probe, "l*", 1) do end end)
+os.remove(probe)
+
+if batched then
+  case { name = "lines l* 1000", n = 1e6, setup = logfile, teardown = os.remove,
+    run = function(name)
+      local count = 0
+      for batch in io.lines(name, "l*", 1000) do count = count + #batch end
+      return count
+    end }
+end
+
+case { name = "read all", n = 1e6, setup = logfile, teardown = os.remove,
+  run = function(name)
+    local f = assert(io.open(name, "rb"))
+    local s = f:read("a")
+    f:close()
+    return #s
+  end }
+
+-- a data file of n records, as a large fixture or configuration; the
+-- 420k records of the cases below make about 50 MB
+local function datafile(n)
+  local name = os.tmpname()
+  local f = assert(io.open(name, "w"))
+  f:write("return {\n")
+  for i = 1, n do
+    f:write(string.format('  { id = %d, name = "item%d", value = %.6f, tags = { "a", "b", "c" }, ["key with space"] = %s, -%d },\n',
+      i, i, i * 0.37, i % 2 == 0, i))
+  end
+  f:write("}\n")
+  f:close()
+  return name
+end
+
+case { name = "data dofile", n = 4.2e5, setup = datafile, teardown = os.remove,
+  run = function(name)
+    return #dofile(name)
+  end }
+
+if load_data then
+  case { name = "data load_data", n = 4.2e5, setup = datafile, teardown = os.remove,
+    run = function(name)
+      return #assert(load_data(name))
+    end }
+end
+
+-- n modules of some 40 functions each in a temporary directory, with a
+-- second directory for the compiled-module cache
+if lfs and package.cachepath then
+  local function modules(n)
+    local dir = os.tmpname()
+    os.remove(dir)
+    assert(lfs.mkdir(dir))
+    assert(lfs.mkdir(dir .. "/cache"))
+    for i = 1, n do
+      local src = { "local M = {}\n" }
+      for j = 1, 40 do
+        src[#src + 1] = string.format(
+          "function M.f%d(t, x)\n  local s = 0\n  for i = 1, #t do s = s + t[i] * x + %d end\n  return s, \"f%d\"\nend\n",
+          j, j, j)
+      end
+      src[#src + 1] = "return M\n"
+      writefile(string.format("%s/benchmod%d.lua", dir, i), table.concat(src))
+    end
+    return { dir = dir, n = n }
+  end
+
+  local function removemodules(ctx)
+    for _, sub in ipairs({ ctx.dir .. "/cache", ctx.dir }) do
+      for f in lfs.dir(sub) do
+        if f ~= "." and f ~= ".." and f ~= "cache" then os.remove(sub .. "/" .. f) end
+      end
+    end
+    lfs.rmdir(ctx.dir .. "/cache")
+    lfs.rmdir(ctx.dir)
+  end
+
+  local function requireall(ctx, cachepath)
+    local path, cpath = package.path, package.cachepath
+    package.path, package.cachepath = ctx.dir .. "/?.lua", cachepath
+    for i = 1, ctx.n do
+      local name = "benchmod" .. i
+      package.loaded[name] = nil
+      require(name)
+      package.loaded[name] = nil
+    end
+    package.path, package.cachepath = path, cpath
+    return ctx.n
+  end
+
+  case { name = "require source", n = 200, setup = modules, teardown = removemodules,
+    run = function(ctx)
+      return requireall(ctx, "")
+    end }
+
+  -- the warm-up run fills the cache
+  case { name = "require cached", n = 200, setup = modules, teardown = removemodules,
+    run = function(ctx)
+      return requireall(ctx, ctx.dir .. "/cache")
+    end }
+end
+
+return cases
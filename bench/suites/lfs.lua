@@ -0,0 +1,117 @@
+-- lfs.lua
+-- Directory walks over a synthetic tree (3 levels of 8 directories, 10
+-- files each): a recursive lfs.dir/lfs.attributes walk, the same walk
+-- filtering names with Lua patterns and with a compiled glob, and
+-- lfs.glob. n counts directory entries visited.
+
+if not lfs then return nil, "lfs not available" end
+
+local cases = {}
+local function case(t) cases[#cases + 1] = t end
+
+local DEPTH, FANOUT, FILES = 3, 8, 10
+local EXT = { ".lua", ".txt", ".c", ".h", ".json" }
+
+local function maketree()
+  local root = os.tmpname()
+  os.remove(root)
+  assert(lfs.mkdir(root))
+  local function fill(dir, level)
+    for i = 1, FILES do
+      local f = assert(io.open(string.format("%s/file%d%s", dir, i, EXT[i % #EXT + 1]), "w"))
+      f:close()
+    end
+    if level < DEPTH then
+      for i = 1, FANOUT do
+        local sub = dir .. "/dir" .. i
+        assert(lfs.mkdir(sub))
+        fill(sub, level + 1)
+      end
+    end
+  end
+  fill(root, 0)
+  return root
+end
+
+local function removetree(dir)
+  for name in lfs.dir(dir) do
+    if name ~= "." and name ~= ".." then
+      local path = dir .. "/" .. name
+      if lfs.attributes(path, "mode") == "directory" then
+        removetree(path)
+      else
+        os.remove(path)
+      end
+    end
+  end
+  lfs.rmdir(dir)
+end
+
+-- directories and files in the tree
+local NDIRS = 0
+for level = 0, DEPTH do NDIRS = NDIRS + FANOUT ^ level end
+local NENTRIES = math.tointeger(NDIRS * FILES + NDIRS - 1)
+
+local function walk(dir, accept, found)
+  for name in lfs.dir(dir) do
+    if name ~= "." and name ~= ".." then
+      local path = dir .. "/" .. name
+      if lfs.attributes(path, "mode") == "directory" then
+        walk(path, accept, found)
+      elseif accept(name, path) then
+        found[#found + 1] = path
+      end
+    end
+  end
+  return found
+end
+
+local function passes(n) return math.max(1, n // NENTRIES) end
+
+case { name = "walk attributes", n = NENTRIES * 4, setup = maketree, teardown = removetree,
+  run = function(root, n)
+    local count = 0
+    for _ = 1, passes(n) do
+      count = count + #walk(root, function() return true end, {})
+    end
+    return count
+  end }
+
+case { name = "walk match", n = NENTRIES * 4, setup = maketree, teardown = removetree,
+  run = function(root, n)
+    local count = 0
+    for _ = 1, passes(n) do
+      count = count + #walk(root, function(name) return name:match("%.lua$") end, {})
+    end
+    return count
+  end }
+
+if lfs.compile_glob then
+  case { name = "walk compiled glob", n = NENTRIES * 4, setup = maketree, teardown = removetree,
+    run = function(root, n)
+      local g, count = lfs.compile_glob("*.{lua,c,h}"), 0
+      for _ = 1, passes(n) do
+        count = count + #walk(root, function(name) return g:match(name) end, {})
+      end
+      return count
+    end }
+end
+
+if lfs.glob then
+  case { name = "glob **", n = NENTRIES * 4, setup = maketree, teardown = removetree,
+    run = function(root, n)
+      local count = 0
+      for _ = 1, passes(n) do count = count + #lfs.glob(root .. "/**/*.lua") end
+      return count
+    end }
+
+  -- only one branch can match: the other subtrees are never read
+  case { name = "glob literal prefix", n = NENTRIES * 4, setup = maketree, teardown = removetree,
+    run = function(root, n)
+      local count = 0
+      for _ = 1, passes(n) do count = count + #lfs.glob(root .. "/dir3/dir5/**/*.lua") end
+      return count
+    end }
+end
+
+return cases
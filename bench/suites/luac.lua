@@ -0,0 +1,87 @@
+-- luac.lua
+-- Precompiled scripts, compiled by luac with and without -O: a loop
+-- that checks configuration locals (debug flags, a mode string) and
+-- scales by constants, and a table-update loop with constant keys,
+-- factors and dead trace code. Needs the luac built next to the
+-- interpreter ('make' builds both).
+
+local interp = arg and arg[-1]
+local dir = interp and interp:match("^(.*[/\\])") or ""
+local WINDOWS = package.config:sub(1, 1) == "\\"
+local LUAC = dir .. (WINDOWS and "luac.exe" or "luac")
+
+local f = io.open(LUAC, "rb")
+if not f then return nil, "luac not found next to the interpreter" end
+f:close()
+
+local cases = {}
+local function case(t) cases[#cases + 1] = t end
+
+local CONFIG = [[
+local DEBUG = false
+local TRACE = false
+local MODE = "fast"
+local SCALE = 4
+local HALF = SCALE / 2
+local MASK = SCALE * 64 - 1
+return function(n)
+  local s = 0
+  for i = 1, n do
+    if DEBUG then print("step", i, s) end
+    if MODE == "fast" then
+      s = s + (i & MASK) * SCALE
+    elseif MODE == "safe" then
+      s = s + math.abs(i) * SCALE
+    end
+    if TRACE and s < 0 then error("negative") end
+    s = s - HALF * SCALE
+  end
+  return s
+end
+]]
+
+local UPDATE = [[
+local VERBOSE = false
+local X, Y, W = "x", "y", "weight"
+local GRAVITY = 9.81
+local DT = 1 / 60
+local STEP = GRAVITY * DT
+local LIMIT = 1000
+return function(n)
+  local bodies = {}
+  for i = 1, 16 do bodies[i] = { x = i, y = 0, weight = 1 + i % 3 } end
+  local moved = 0
+  for i = 1, n do
+    local b = bodies[i % 16 + 1]
+    b[Y] = b[Y] - STEP * b[W]
+    if b[Y] < -LIMIT then b[Y] = LIMIT end
+    b[X] = b[X] + DT
+    if VERBOSE then print(b[X], b[Y]) end
+    moved = moved + 1
+  end
+  return moved
+end
+]]
+
+-- compile 'source' with luac and the given options, load the result
+local function compile(source, opts)
+  local src, out = os.tmpname(), os.tmpname()
+  local h = assert(io.open(src, "wb"))
+  h:write(source)
+  h:close()
+  local ok = os.execute(string.format('"%s" %s -o "%s" "%s"', LUAC, opts, out, src))
+  os.remove(src)
+  local fn = ok and loadfile(out, "b")
+  os.remove(out)
+  return assert(fn, "cannot compile with luac " .. opts)()
+end
+
+for _, w in ipairs { { "config", CONFIG, 2e6 }, { "update", UPDATE, 2e6 } } do
+  local name, source, count = w[1], w[2], w[3]
+  case { name = name .. " plain", n = count, setup = function() return compile(source, "") end,
+    run = function(fn, n) return fn(n) end }
+  case { name = name .. " -O", n = count, setup = function() return compile(source, "-O") end,
+    run = function(fn, n) return fn(n) end }
+end
+
+return cases
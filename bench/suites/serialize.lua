@@ -0,0 +1,58 @@
+-- serialize.lua
+-- Round trips of a list of records: serialize.encode/decode against
+-- generating Lua source and loading it back.
+
+if not serialize then return nil, "serialize library not available" end
+
+local cases = {}
+local function case(t) cases[#cases + 1] = t end
+
+local function records(n)
+  local list = {}
+  for i = 1, n do
+    list[i] = { id = i, name = "item" .. i, value = i * 0.37, ok = (i % 2 == 0),
+      tags = { "a", "b", "c" } }
+  end
+  return list
+end
+
+local function tosource(list)
+  local out = { "return {\n" }
+  for i, r in ipairs(list) do
+    out[#out + 1] = string.format('{ id = %d, name = %q, value = %.17g, ok = %s, tags = { "a", "b", "c" } },\n',
+      r.id, r.name, r.value, tostring(r.ok))
+    if i % 1000 == 0 then out = { table.concat(out) } end
+  end
+  out[#out + 1] = "}\n"
+  return table.concat(out)
+end
+
+case { name = "encode", n = 1e5, setup = records, run = function(list)
+  return #serialize.encode(list)
+end }
+
+case { name = "decode", n = 1e5, setup = function(n)
+  return serialize.encode(records(n))
+end, run = function(bytes)
+  return #serialize.decode(bytes)
+end }
+
+case { name = "source generate", n = 1e5, setup = records, run = function(list)
+  return #tosource(list)
+end }
+
+case { name = "source load", n = 1e5, setup = function(n)
+  return tosource(records(n))
+end, run = function(src)
+  return #assert(load(src))()
+end }
+
+if load_data then
+  case { name = "source load_data", n = 1e5, setup = function(n)
+    return tosource(records(n))
+  end, run = function(src)
+    return #assert(load_data(src))
+  end }
+end
+
+return cases
@@ -0,0 +1,96 @@
+-- sqlite.lua
+-- lsqlite3 on an in-memory database: inserts in one transaction through
+-- exec and through a prepared statement, reading all rows with nrows,
+-- urows and step, and point lookups by primary key.
+
+if not sqlite3 then return nil, "lsqlite3 not available" end
+
+local cases = {}
+local function case(t) cases[#cases + 1] = t end
+
+local SCHEMA = [[
+CREATE TABLE item (id INTEGER PRIMARY KEY, name TEXT, city TEXT, zip TEXT,
+  street TEXT, phone TEXT, mail TEXT, created INTEGER, updated INTEGER,
+  flags INTEGER, score REAL);
+]]
+
+local INSERT = "INSERT INTO item VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"
+
+local function fill(db, n)
+  assert(db:exec(SCHEMA) == sqlite3.OK)
+  local stmt = db:prepare(INSERT)
+  db:exec("BEGIN")
+  for i = 1, n do
+    stmt:bind_values(i, "name" .. i, "city" .. (i % 100), tostring(10000 + i % 90000),
+      "street " .. i, "+49 " .. i, "user" .. i .. "@example.com", i, i + 1, i % 16, i * 0.5)
+    stmt:step()
+    stmt:reset()
+  end
+  db:exec("COMMIT")
+  stmt:finalize()
+end
+
+local function opendb(n)
+  local db = sqlite3.open_memory()
+  if n then fill(db, n) end
+  return db
+end
+
+local function closedb(db) db:close() end
+
+case { name = "insert exec", n = 2e4, run = function(_, n)
+  local db = opendb()
+  db:exec(SCHEMA)
+  db:exec("BEGIN")
+  for i = 1, n do
+    db:exec(string.format("INSERT INTO item VALUES (%d, 'name%d', 'city%d', '%d', 'street %d', " ..
+      "'+49 %d', 'user%d@example.com', %d, %d, %d, %.1f)",
+      i, i, i % 100, 10000 + i % 90000, i, i, i, i, i + 1, i % 16, i * 0.5))
+  end
+  db:exec("COMMIT")
+  db:close()
+end }
+
+case { name = "insert prepared", n = 1e5, run = function(_, n)
+  local db = opendb()
+  fill(db, n)
+  db:close()
+end }
+
+case { name = "select nrows", n = 1e5, setup = opendb, teardown = closedb,
+  run = function(db)
+    local sum = 0
+    for row in db:nrows("SELECT * FROM item") do sum = sum + row.score end
+    return sum
+  end }
+
+case { name = "select urows", n = 1e5, setup = opendb, teardown = closedb,
+  run = function(db)
+    local sum = 0
+    for _, _, _, _, _, _, _, _, _, _, score in db:urows("SELECT * FROM item") do
+      sum = sum + score
+    end
+    return sum
+  end }
+
+case { name = "select step", n = 1e5, setup = opendb, teardown = closedb,
+  run = function(db)
+    local stmt, sum = db:prepare("SELECT score FROM item"), 0
+    while stmt:step() == sqlite3.ROW do sum = sum + stmt:get_value(0) end
+    stmt:finalize()
+    return sum
+  end }
+
+case { name = "point lookup", n = 1e5, setup = opendb, teardown = closedb,
+  run = function(db, n)
+    local stmt, sum = db:prepare("SELECT score FROM item WHERE id = ?"), 0
+    for i = 1, n do
+      stmt:bind_values((i * 7919) % n + 1)
+      if stmt:step() == sqlite3.ROW then sum = sum + stmt:get_value(0) end
+      stmt:reset()
+    end
+    stmt:finalize()
+    return sum
+  end }
+
+return cases
@@ -0,0 +1,132 @@
+-- strings.lua
+-- String creation and search: splitting lines into fields, tokenizing,
+-- substrings and distinct keys (all hashed and interned), grep-like
+-- scans of a log with find/gmatch/gsub, and three ways of building a
+-- large string (repeated '..', table.concat, strbuf).
+
+local cases = {}
+local function case(t) cases[#cases + 1] = t end
+
+local function csvlines(n)
+  local lines = {}
+  for i = 1, n do
+    lines[i] = string.format("%d,name_%d,city_%d,%d.%02d,description of item %d",
+      i, i, i % 100, i % 1000, i % 100, i % 50)
+  end
+  return lines
+end
+
+case { name = "split gmatch", n = 1e5, setup = csvlines, run = function(lines, n)
+  local count = 0
+  for i = 1, n do
+    for _ in lines[i]:gmatch("[^,]+") do count = count + 1 end
+  end
+  return count
+end }
+
+if string.split then
+  case { name = "split string.split", n = 1e5, setup = csvlines, run = function(lines, n)
+    local count, split = 0, string.split
+    for i = 1, n do count = count + #split(lines[i], ",") end
+    return count
+  end }
+end
+
+case { name = "xml tokens", n = 1e5, setup = function(n)
+  local tokens = { "<row>", "</row>", "<col name=\"id\">", "</col>", "value",
+    "another value", "x", "<item kind=\"point\" x=\"10\" y=\"20\"/>" }
+  local doc = {}
+  for i = 1, n do doc[i] = tokens[i % #tokens + 1] end
+  return table.concat(doc, " ")
+end, run = function(doc)
+  local count = 0
+  for _ in doc:gmatch("%S+") do count = count + 1 end
+  return count
+end }
+
+case { name = "substrings", n = 1e6, run = function(_, n)
+  local long = string.rep("abcdefghijklmnopqrstuvwxyz0123456789", 256)
+  local count, last = 0, #long - 40
+  while count < n do
+    for i = 1, last, 7 do
+      local _ = long:sub(i, i + i % 40)
+      count = count + 1
+    end
+  end
+  return count
+end }
+
+case { name = "distinct keys", n = 2e5, run = function(_, n)
+  local t = {}
+  for i = 1, n do t["key" .. i] = i end
+  return n
+end }
+
+-- a log of n lines where one line in 100 is an error
+local function log(n)
+  local levels = { "INFO", "DEBUG", "INFO", "WARN" }
+  local t = {}
+  for i = 1, n do
+    local level = (i % 100 == 0) and "ERROR" or levels[i % 4 + 1]
+    t[i] = string.format("2021-03-%02d 12:%02d:%02d [%s] worker-%d: request %d took %d ms",
+      i % 28 + 1, i % 60, i % 60, level, i % 8, i, i % 997)
+  end
+  return table.concat(t, "\n")
+end
+
+case { name = "grep find plain", n = 5e5, setup = log, run = function(text)
+  local count, pos = 0, 1
+  while true do
+    local s, e = text:find("[ERROR]", pos, true)
+    if not s then break end
+    count, pos = count + 1, e + 1
+  end
+  return count
+end }
+
+case { name = "grep gmatch", n = 5e5, setup = log, run = function(text)
+  local count = 0
+  for ms in text:gmatch("%[ERROR%] worker%-%d+: request %d+ took (%d+) ms") do
+    count = count + tonumber(ms)
+  end
+  return count
+end }
+
+case { name = "grep gsub", n = 5e5, setup = log, run = function(text)
+  local _, count = text:gsub("%[WARN%]", "[W]")
+  return count
+end }
+
+-- a plain search that keeps almost matching: linear with Two-Way
+case { name = "find repetitive", n = 50, setup = function()
+  return string.rep("a", 100000) .. "b"
+end, run = function(hay, n)
+  local needle = string.rep("a", 1000) .. "b"
+  local count = 0
+  for _ = 1, n do
+    if hay:find(needle, 1, true) then count = count + 1 end
+  end
+  return count
+end }
+
+case { name = "build concat", n = 2e4, run = function(_, n)
+  local s = ""
+  for i = 1, n do s = s .. "item " .. i .. "\n" end
+  return #s
+end }
+
+case { name = "build table.concat", n = 2e5, run = function(_, n)
+  local t = {}
+  for i = 1, n do t[#t + 1] = "item " .. i .. "\n" end
+  return #table.concat(t)
+end }
+
+if strbuf then
+  case { name = "build strbuf", n = 2e5, run = function(_, n)
+    local b = strbuf.new()
+    for i = 1, n do b:append("item ", i, "\n") end
+    return #b:tostring()
+  end }
+end
+
+return cases
@@ -0,0 +1,141 @@
+-- tables.lua
+-- Row accumulation (a new table per row, table.new, one table cleared
+-- with table.clear), sorting records with a comparator or a key, and
+-- numeric series as tables and as typed arrays.
+
+local cases = {}
+local function case(t) cases[#cases + 1] = t end
+
+local FIELDS = { "id", "name", "city", "zip", "street", "phone", "mail",
+  "created", "updated", "flags", "score" }
+
+-- the shape of a sqlite row loop: 11 fields per row, rows are consumed
+-- right away
+case { name = "rows {}", n = 1e5, run = function(_, n)
+  local sum = 0
+  for i = 1, n do
+    local row = {}
+    for j = 1, #FIELDS do row[FIELDS[j]] = i + j end
+    sum = sum + row.score
+  end
+  return sum
+end }
+
+if table.new then
+  case { name = "rows table.new", n = 1e5, run = function(_, n)
+    local sum, new = 0, table.new
+    for i = 1, n do
+      local row = new(0, #FIELDS)
+      for j = 1, #FIELDS do row[FIELDS[j]] = i + j end
+      sum = sum + row.score
+    end
+    return sum
+  end }
+end
+
+if table.clear then
+  case { name = "rows table.clear", n = 1e5, run = function(_, n)
+    local sum, clear, row = 0, table.clear, {}
+    for i = 1, n do
+      clear(row)
+      for j = 1, #FIELDS do row[FIELDS[j]] = i + j end
+      sum = sum + row.score
+    end
+    return sum
+  end }
+end
+
+local function records(n)
+  local list = {}
+  local seed = 12345
+  for i = 1, n do
+    seed = (seed * 1103515245 + 12345) % 2147483648
+    list[i] = { id = seed % 1000000, name = "name" .. (seed % 50000), pos = i }
+  end
+  return list
+end
+
+local function copy(list)
+  local t = {}
+  for i = 1, #list do t[i] = list[i] end
+  return t
+end
+
+case { name = "sort comparator", n = 1e5, setup = records, run = function(list)
+  local t = copy(list)
+  table.sort(t, function(a, b) return a.id < b.id end)
+  return t[1].id
+end }
+
+case { name = "sort comparator str", n = 1e5, setup = records, run = function(list)
+  local t = copy(list)
+  table.sort(t, function(a, b) return a.name < b.name end)
+  return t[1].name
+end }
+
+-- the options table of table.sort is new; older interpreters raise
+if pcall(table.sort, { 2, 1 }, { key = function(x) return x end }) then
+  case { name = "sort key", n = 1e5, setup = records, run = function(list)
+    local t = copy(list)
+    table.sort(t, { key = function(r) return r.id end })
+    return t[1].id
+  end }
+
+  case { name = "sort key str", n = 1e5, setup = records, run = function(list)
+    local t = copy(list)
+    table.sort(t, { key = function(r) return r.name end })
+    return t[1].name
+  end }
+
+  case { name = "sort key stable", n = 1e5, setup = records, run = function(list)
+    local t = copy(list)
+    table.sort(t, { key = function(r) return r.id end, stable = true })
+    return t[1].id
+  end }
+end
+
+-- series of 100k numbers; n counts elements over repeated passes
+local SERIES = 100000
+
+local function series(n)
+  local t = {}
+  for i = 1, n do t[i] = math.sin(i) end
+  return t
+end
+
+case { name = "series sum table", n = 2e7, setup = function()
+  return series(SERIES)
+end, run = function(t, n)
+  local s = 0
+  for _ = 1, n // SERIES do
+    for i = 1, SERIES do s = s + t[i] end
+  end
+  return s
+end }
+
+if array then
+  case { name = "series sum f64", n = 2e7, setup = function()
+    return array.new("f64", series(SERIES))
+  end, run = function(a, n)
+    local s = 0
+    for _ = 1, n // SERIES do s = s + a:sum() end
+    return s
+  end }
+
+  case { name = "series scale f64", n = 2e7, setup = function()
+    return array.new("f64", series(SERIES))
+  end, run = function(a, n)
+    for _ = 1, n // SERIES do a:mul(1.0000001) end
+    return a:max()
+  end }
+
+  case { name = "series sort f32", n = 1e6, setup = function(n)
+    return series(n)
+  end, run = function(t)
+    local a = array.new("f32", t)
+    a:sort()
+    return a[1]
+  end }
+end
+
+return cases
@@ -0,0 +1,74 @@
+-- threads.lua
+-- A CPU-bound map run serially and with threads.map on every CPU,
+-- spawning and joining workers, and channel traffic between two
+-- threads (ping-pong round trips and one-way throughput). Wall time.
+
+if not threads then return nil, "threads library not available" end
+
+local cases = {}
+local function case(t) cases[#cases + 1] = t end
+
+-- about a millisecond of work per item
+local function work(x)
+  local s = 0
+  for i = 1, 100000 do s = (s + i * x) % 1000003 end
+  return s
+end
+
+local function items(n)
+  local list = {}
+  for i = 1, n do list[i] = i end
+  return list
+end
+
+case { name = "map serial", n = 400, wall = true, setup = items, run = function(list)
+  local out = {}
+  for i = 1, #list do out[i] = work(list[i]) end
+  return #out
+end }
+
+case { name = "map threads", n = 400, wall = true, setup = items, run = function(list)
+  return #threads.map(work, list)
+end }
+
+case { name = "spawn/join", n = 200, wall = true, run = function(_, n)
+  for i = 1, n do
+    assert(threads.spawn("return ...", i):join())
+  end
+end }
+
+-- a worker that sends every message back until its channel is closed
+local ECHO = [[
+local inbox, outbox = ...
+while true do
+  local v = inbox:recv()
+  if v == nil then break end
+  outbox:send(v)
+end
+]]
+
+case { name = "channel ping-pong", n = 2e4, wall = true, run = function(_, n)
+  local inbox, outbox = threads.channel(1), threads.channel(1)
+  local t = threads.spawn(ECHO, inbox, outbox)
+  for i = 1, n do
+    inbox:send(i)
+    outbox:recv()
+  end
+  inbox:close()
+  t:join()
+end }
+
+case { name = "channel stream", n = 1e6, wall = true, run = function(_, n)
+  local ch = threads.channel(1024)
+  local t = threads.spawn([[
+    local ch, n = ...
+    local s = 0
+    for _ = 1, n do s = s + ch:recv() end
+    return s
+  ]], ch, n)
+  for i = 1, n do ch:send(i) end
+  local _, s = t:join()
+  return s
+end }
+
+return cases
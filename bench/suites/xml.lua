@@ -0,0 +1,55 @@
+-- xml.lua
+-- LuaXML: parsing a generated document of n records, serializing the
+-- parsed tree back to text, walking it, and entity encoding.
+-- Needs LuaXML.lua and LuaXML_lib on the search paths ('make run' sets
+-- them up).
+
+local ok, xml = pcall(require, "LuaXML")
+if not ok then return nil, "LuaXML not found" end
+
+local cases = {}
+local function case(t) cases[#cases + 1] = t end
+
+local function document(n)
+  local t = { "<catalog>\n" }
+  for i = 1, n do
+    t[#t + 1] = string.format(
+      '  <item id="%d" kind="%s"><name>item %d</name><price currency="EUR">%d.%02d</price>' ..
+      '<note>a &amp; b &lt; c</note></item>\n',
+      i, (i % 3 == 0) and "part" or "tool", i, i % 1000, i % 100)
+  end
+  t[#t + 1] = "</catalog>\n"
+  return table.concat(t)
+end
+
+case { name = "eval", n = 5e4, setup = document, run = function(text)
+  return #xml.eval(text)
+end }
+
+case { name = "str", n = 5e4, setup = function(n)
+  return xml.eval(document(n))
+end, run = function(doc)
+  return #xml.str(doc)
+end }
+
+case { name = "walk", n = 5e4, setup = function(n)
+  return xml.eval(document(n))
+end, run = function(doc)
+  local sum = 0
+  for _, item in ipairs(doc) do
+    if item.kind == "part" then
+      sum = sum + tonumber(item:find("price")[1])
+    end
+  end
+  return sum
+end }
+
+case { name = "encode/decode", n = 2e5, run = function(_, n)
+  local len = 0
+  for i = 1, n do
+    len = len + #xml.decode(xml.encode("a < b & c > \"d\" " .. i))
+  end
+  return len
+end }
+
+return cases
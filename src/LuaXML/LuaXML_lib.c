@@ -65,6 +65,15 @@ THE SOFTWARE.
 #endif
 
 
+/* output to a strbuf needs luaL_buffsub() (5.4+) */
+#if LUA_VERSION_NUM >= 504
+#include "strbuf/lstrbuf.h"
+#else
+typedef void lstrbuf;
+#define lstrbuf_test(L, idx) NULL
+#endif
+
+
 #define LUAXML_META "LuaXML" // name to be used for metatable
 
 //--- auxliary functions -------------------------------------------
@@ -885,6 +894,29 @@ Xml_decode(lua_State *L)
 	return 1;
 }
 
+// move the contents of "b" to the end of the strbuf "sb", leaving "b" empty
+static void
+Xml_flush(lua_State *L, luaL_Buffer *b, lstrbuf *sb)
+{
+#if LUA_VERSION_NUM >= 504
+	lstrbuf_append(L, sb, luaL_buffaddr(b), luaL_bufflen(b));
+	luaL_buffsub(b, luaL_bufflen(b));
+#endif
+}
+
+// complete Xml_str(): either push the result string, or append it to the
+// strbuf (argument #4) and return that
+static int
+Xml_result(lua_State *L, luaL_Buffer *b, lstrbuf *sb)
+{
+	if (sb) {
+		Xml_flush(L, b, sb);
+		lua_pushvalue(L, 4);
+	} else
+		luaL_pushresult(b);
+	return 1;
+}
+
 /** converts any Lua value to an XML string.
 @function str
 
@@ -901,6 +933,11 @@ indentation level for 'pretty' output. Mainly for internal use, defaults to 0.
 the tag to be used in case `value` doesn't already have an 'implicit' tag.
 Mainly for internal use.
 
+@tparam ?strbuf buffer
+a `strbuf` object. If given, the XML output is appended to it (sub-elements
+are written directly, without creating intermediate strings), and `buffer` is
+returned instead of a string.
+
 @treturn string
 an XML string, or `nil` in case of errors.
 */
@@ -913,7 +950,8 @@ Xml_str(lua_State *L)
 	// should only occur at the same Lua stack level as the previous one!
 	luaL_Buffer b;
 
-	lua_settop(L, 3);
+	lua_settop(L, 4);
+	lstrbuf *sb = lstrbuf_test(L, 4); // optional output buffer
 	int type = lua_type(L, 1); // type of "value"
 	if (type == LUA_TNIL)
 		return 0;
@@ -929,10 +967,10 @@ Xml_str(lua_State *L)
 		if (!tag)
 			tag = lua_typename(L, type);
 
-		// Four elements already on stack: value, indent, tag, value[0]
-		// Use a string (#5) to manage (concatenate) simple attributes
+		// Five elements already on stack: value, indent, tag, buffer, value[0]
+		// Use a string (#6) to manage (concatenate) simple attributes
 		lua_pushliteral(L, "");
-		// And a table (#6) to take care of (collect) 'extended' attributes
+		// And a table (#7) to take care of (collect) 'extended' attributes
 		lua_newtable(L);
 		size_t table_attr = 0;
 
@@ -954,30 +992,29 @@ Xml_str(lua_State *L)
 					lua_pushinteger(L, lua_tointeger(L, 2) + 1); // indent + 1
 					lua_pushvalue(L, -4); // duplicate "k"
 					lua_call(L, 3, 1);    // xml.str(v, indent + 1, k)
-					lua_rawseti(L, 6, ++table_attr); // append string to table
+					lua_rawseti(L, 7, ++table_attr); // append string to table
 				} else {
 					Xml_pushEncode(L, -1); // encode(tostring(v))
 					lua_pushfstring(L,
 					                "%s %s=\"%s\"",
-					                lua_tostring(L, 5),
+					                lua_tostring(L, 6),
 					                lua_tostring(L, -3),
 					                lua_tostring(L, -1));
-					lua_replace(L, 5); // new attribute string
+					lua_replace(L, 6); // new attribute string
 					lua_pop(L, 1);     // realign stack
 				}
 			}
 			lua_pop(L, 1); // pop <v>alue, leaving <k>ey for next iteration
 		}
 		// append "simple" attribute string to the output
-		if (lua_rawlen(L, 5) > 0)
-			luaL_addstring(&b, lua_tostring(L, 5));
+		if (lua_rawlen(L, 6) > 0)
+			luaL_addstring(&b, lua_tostring(L, 6));
 
 		size_t count = lua_rawlen(L, 1); // number of "array" (sub)elements
 		if (count == 0 && table_attr == 0) {
 			// no sub-elements and no extended attr -> close tag and we're done
 			luaL_addlstring(&b, " />\n", 4);
-			luaL_pushresult(&b);
-			return 1;
+			return Xml_result(L, &b, sb);
 		}
 		luaL_addchar(&b, '>'); // close opening tag
 		if (count == 1 && table_attr == 0) {
@@ -991,8 +1028,7 @@ Xml_str(lua_State *L)
 				luaL_addlstring(&b, "</", 2);
 				luaL_addstring(&b, tag);
 				luaL_addlstring(&b, ">\n", 2);
-				luaL_pushresult(&b);
-				return 1;
+				return Xml_result(L, &b, sb);
 			}
 			lua_pop(L, 1); // discard (table) value, to realign stack
 		}
@@ -1013,6 +1049,16 @@ Xml_str(lua_State *L)
 				lua_remove(L, -3);
 				lua_pushliteral(L, "\n");
 				lua_concat(L, 3);
+			} else if (sb) {
+				// let the sub-element write into the buffer as well
+				Xml_flush(L, &b, sb);
+				lua_pushcfunction(L, Xml_str);
+				lua_insert(L, -2); // place function before value
+				lua_pushinteger(L, lua_tointeger(L, 2) + 1); // indent + 1
+				lua_pushnil(L);
+				lua_pushvalue(L, 4);
+				lua_call(L, 4, 0); // xml.str(v, indent + 1, nil, buffer)
+				continue;
 			} else {
 				lua_pushcfunction(L, Xml_str);
 				lua_insert(L, -2); // place function before value
@@ -1027,7 +1073,7 @@ Xml_str(lua_State *L)
 		// not to affect their numbering.
 		// Just process the corresponding table, concatenating all entries:
 		for (k = 1; k <= table_attr; k++) {
-			lua_rawgeti(L, 6, k);
+			lua_rawgeti(L, 7, k);
 			luaL_addvalue(&b);
 		}
 
@@ -1038,8 +1084,7 @@ Xml_str(lua_State *L)
 		luaL_addstring(&b, tag);
 		luaL_addlstring(&b, ">\n", 2);
 
-		luaL_pushresult(&b);
-		return 1;
+		return Xml_result(L, &b, sb);
 	}
 
 	// Getting here means a "flat" Lua value, format to XML as a single string
@@ -1059,8 +1104,7 @@ Xml_str(lua_State *L)
 	luaL_addlstring(&b, "</", 2);
 	luaL_addstring(&b, tag);
 	luaL_addlstring(&b, ">\n", 2);
-	luaL_pushresult(&b);
-	return 1;
+	return Xml_result(L, &b, sb);
 }
 
 /** match XML entity against given (optional) criteria.
@@ -0,0 +1,863 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lua_all.h"
+#include "larray.h"
+
+
+static const char *type_names[] = { "f64", "f32", "i64", "i32", "u8", NULL };
+
+#define IS_FLOAT(a) ((a)->type <= LARRAY_F32)
+
+
+/* Elementwise operations */
+#define OP_ADD 0
+#define OP_SUB 1
+#define OP_MUL 2
+#define OP_DIV 3
+
+
+/* Array type from a type name, or -1 */
+static int check_type(lua_State *L, int idx)
+{
+	if (lua_type(L, idx) == LUA_TSTRING) {
+		const char *name = lua_tostring(L, idx);
+		for (int i = 0; type_names[i] != NULL; i++) {
+			if (!strcmp(name, type_names[i])) {
+				return i;
+			}
+		}
+	}
+	return -1;
+}
+
+
+static larray *check_array(lua_State *L, int idx)
+{
+	return (larray *)luaL_checkudata(L, idx, LARRAY_META);
+}
+
+
+/* New array owning n zero filled elements, stored behind the header */
+static larray *new_array(lua_State *L, int type, size_t n)
+{
+	size_t esize = larray_elemsize(type);
+	if (n > (((size_t)-1) - sizeof(larray)) / esize) {
+		luaL_error(L, "array too large");
+	}
+	larray *a = (larray *)lua_newuserdatauv(L, sizeof(larray) + n * esize, 1);
+	a->data = (char *)(a + 1);
+	a->len = n;
+	a->type = type;
+	a->readonly = 0;
+	memset(a->data, 0, n * esize);
+	luaL_setmetatable(L, LARRAY_META);
+	return a;
+}
+
+
+/* New array using the memory of the value at index owner (an array or a
+ * string), which is kept alive as user value */
+static larray *new_view(lua_State *L, int type, char *data, size_t n, int readonly, int owner)
+{
+	owner = lua_absindex(L, owner);
+	larray *a = (larray *)lua_newuserdatauv(L, sizeof(larray), 1);
+	a->data = data;
+	a->len = n;
+	a->type = type;
+	a->readonly = readonly;
+	luaL_setmetatable(L, LARRAY_META);
+	lua_pushvalue(L, owner);
+	lua_setiuservalue(L, -2, 1);
+	return a;
+}
+
+
+static void push_elem(lua_State *L, const larray *a, size_t i)
+{
+	switch (a->type) {
+	case LARRAY_F64:
+		lua_pushnumber(L, ((const double *)a->data)[i]);
+		break;
+	case LARRAY_F32:
+		lua_pushnumber(L, ((const float *)a->data)[i]);
+		break;
+	case LARRAY_I64:
+		lua_pushinteger(L, ((const int64_t *)a->data)[i]);
+		break;
+	case LARRAY_I32:
+		lua_pushinteger(L, ((const int32_t *)a->data)[i]);
+		break;
+	default:
+		lua_pushinteger(L, ((const uint8_t *)a->data)[i]);
+		break;
+	}
+}
+
+
+/* Convert the Lua value at idx for an array of the given type: any number
+ * for float arrays, an integer within range for integer arrays.
+ * Returns 0 if the value does not fit. */
+static int to_elem(lua_State *L, int idx, int type, double *f, int64_t *v)
+{
+	int ok = 0;
+	if (type <= LARRAY_F32) {
+		*f = (double)lua_tonumberx(L, idx, &ok);
+		return ok;
+	}
+	lua_Integer i = lua_tointegerx(L, idx, &ok);
+	if (!ok) {
+		return 0;
+	}
+	if ((type == LARRAY_I32) && ((i < INT32_MIN) || (i > INT32_MAX))) {
+		return 0;
+	}
+	if ((type == LARRAY_U8) && ((i < 0) || (i > UINT8_MAX))) {
+		return 0;
+	}
+	*v = (int64_t)i;
+	return 1;
+}
+
+
+static void set_elem(larray *a, size_t i, double f, int64_t v)
+{
+	switch (a->type) {
+	case LARRAY_F64:
+		((double *)a->data)[i] = f;
+		break;
+	case LARRAY_F32:
+		((float *)a->data)[i] = (float)f;
+		break;
+	case LARRAY_I64:
+		((int64_t *)a->data)[i] = v;
+		break;
+	case LARRAY_I32:
+		((int32_t *)a->data)[i] = (int32_t)v;
+		break;
+	default:
+		((uint8_t *)a->data)[i] = (uint8_t)v;
+		break;
+	}
+}
+
+
+/* Convert a 1-based position (negative: counted from the end) to 0..len */
+static size_t array_pos(lua_Integer pos, size_t len)
+{
+	if (pos >= 0) {
+		return ((size_t)pos > len) ? len : (size_t)pos;
+	}
+	if ((len <= (size_t)LUA_MAXINTEGER) && (pos >= -(lua_Integer)len)) {
+		return len - (size_t)(-pos) + 1;
+	}
+	return 0;
+}
+
+
+static int lua_array_new(lua_State *L)
+{
+	int type = check_type(L, 1);
+	if (type < 0) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+
+	if (lua_type(L, 2) == LUA_TNUMBER) {
+		lua_Integer n = luaL_checkinteger(L, 2);
+		if (n < 0) {
+			return luaL_error(L, "%s parameter error", __func__);
+		}
+		new_array(L, type, (size_t)n);
+	}
+	else if (lua_type(L, 2) == LUA_TTABLE) {
+		lua_Integer n = luaL_len(L, 2);
+		larray *a = new_array(L, type, (n > 0) ? (size_t)n : 0);
+		for (size_t i = 0; i < a->len; i++) {
+			double f = 0;
+			int64_t v = 0;
+			lua_geti(L, 2, (lua_Integer)i + 1);
+			if (!to_elem(L, -1, type, &f, &v)) {
+				return luaL_error(L, "%s value error at index %d", __func__, (int)i + 1);
+			}
+			set_elem(a, i, f, v);
+			lua_pop(L, 1);
+		}
+	}
+	else {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	return 1;
+}
+
+
+static int lua_array_frombytes(lua_State *L)
+{
+	int type = check_type(L, 1);
+	if ((type < 0) || (lua_type(L, 2) != LUA_TSTRING)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+
+	size_t len = 0;
+	const char *s = lua_tolstring(L, 2, &len);
+	size_t esize = larray_elemsize(type);
+	if ((len % esize) != 0) {
+		return luaL_error(L, "%s input error", __func__);
+	}
+
+	larray *a = new_array(L, type, len / esize);
+	memcpy(a->data, s, len);
+	return 1;
+}
+
+
+/* array.view(type, s [, pos [, count]]): read-only array on the bytes of
+ * string s starting at (1-based) byte pos, without copying them.
+ * Bytes that are not aligned for the element type are copied. */
+static int lua_array_view(lua_State *L)
+{
+	int type = check_type(L, 1);
+	if ((type < 0) || (lua_type(L, 2) != LUA_TSTRING)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+
+	size_t len = 0;
+	const char *s = lua_tolstring(L, 2, &len);
+	size_t esize = larray_elemsize(type);
+	lua_Integer pos = luaL_optinteger(L, 3, 1);
+	if ((pos < 1) || ((size_t)(pos - 1) > len)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	s += pos - 1;
+	len -= (size_t)(pos - 1);
+
+	size_t n = len / esize;
+	if (!lua_isnoneornil(L, 4)) {
+		lua_Integer count = luaL_checkinteger(L, 4);
+		if ((count < 0) || ((size_t)count > n)) {
+			return luaL_error(L, "%s input error", __func__);
+		}
+		n = (size_t)count;
+	}
+
+	if (((uintptr_t)s % esize) != 0) {
+		larray *a = new_array(L, type, n);
+		memcpy(a->data, s, n * esize);
+		return 1;
+	}
+	new_view(L, type, (char *)s, n, 1, 2);
+	return 1;
+}
+
+
+static int lua_array_type(lua_State *L)
+{
+	larray *a = check_array(L, 1);
+	lua_pushstring(L, type_names[a->type]);
+	return 1;
+}
+
+
+static int lua_array_len(lua_State *L)
+{
+	larray *a = check_array(L, 1);
+	lua_pushinteger(L, (lua_Integer)a->len);
+	return 1;
+}
+
+
+static int lua_array_index(lua_State *L)
+{
+	larray *a = check_array(L, 1);
+	if (lua_isinteger(L, 2)) {
+		lua_Integer i = lua_tointeger(L, 2);
+		if ((i >= 1) && ((size_t)i <= a->len)) {
+			push_elem(L, a, (size_t)i - 1);
+		}
+		else {
+			lua_pushnil(L);
+		}
+		return 1;
+	}
+	/* method lookup */
+	lua_pushvalue(L, 2);
+	lua_gettable(L, lua_upvalueindex(1));
+	return 1;
+}
+
+
+static int lua_array_newindex(lua_State *L)
+{
+	larray *a = check_array(L, 1);
+	double f = 0;
+	int64_t v = 0;
+	if (!lua_isinteger(L, 2)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	lua_Integer i = lua_tointeger(L, 2);
+	if ((i < 1) || ((size_t)i > a->len)) {
+		return luaL_error(L, "%s index out of range", __func__);
+	}
+	if (a->readonly) {
+		return luaL_error(L, "%s read-only array", __func__);
+	}
+	if (!to_elem(L, 3, a->type, &f, &v)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	set_elem(a, (size_t)i - 1, f, v);
+	return 0;
+}
+
+
+/* a:slice(i [, j]): view on elements i..j (like string.sub), sharing the
+ * memory of a */
+static int lua_array_slice(lua_State *L)
+{
+	larray *a = check_array(L, 1);
+	lua_Integer i = luaL_checkinteger(L, 2);
+	size_t first = (i > (lua_Integer)a->len) ? a->len + 1 : array_pos(i, a->len);
+	size_t last = array_pos(luaL_optinteger(L, 3, -1), a->len);
+	if (first < 1) {
+		first = 1;
+	}
+	size_t n = (last >= first) ? (last - first + 1) : 0;
+	new_view(L, a->type, a->data + (first - 1) * larray_elemsize(a->type), n, a->readonly, 1);
+	return 1;
+}
+
+
+static int lua_array_copy(lua_State *L)
+{
+	larray *a = check_array(L, 1);
+	larray *c = new_array(L, a->type, a->len);
+	memcpy(c->data, a->data, larray_bytes(a));
+	return 1;
+}
+
+
+static int lua_array_fill(lua_State *L)
+{
+	larray *a = check_array(L, 1);
+	double f = 0;
+	int64_t v = 0;
+	if (a->readonly) {
+		return luaL_error(L, "%s read-only array", __func__);
+	}
+	if (!to_elem(L, 2, a->type, &f, &v)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	for (size_t i = 0; i < a->len; i++) {
+		set_elem(a, i, f, v);
+	}
+	lua_settop(L, 1);
+	return 1;
+}
+
+
+/* Sums of floats use four partial sums, so the compiler can vectorize the
+ * loop without changing the order of additions within each lane */
+#define FLOAT_SUM(T)                                                       \
+	{                                                                      \
+		const T *p = (const T *)a->data;                                   \
+		double s0 = 0, s1 = 0, s2 = 0, s3 = 0;                             \
+		size_t i = 0;                                                      \
+		for (; i + 4 <= n; i += 4) {                                       \
+			s0 += p[i];                                                    \
+			s1 += p[i + 1];                                                \
+			s2 += p[i + 2];                                                \
+			s3 += p[i + 3];                                                \
+		}                                                                  \
+		for (; i < n; i++) {                                               \
+			s0 += p[i];                                                    \
+		}                                                                  \
+		fs = (s0 + s1) + (s2 + s3);                                        \
+	}
+
+/* Integer sums wrap around like Lua integer arithmetic */
+#define INT_SUM(T)                                                         \
+	{                                                                      \
+		const T *p = (const T *)a->data;                                   \
+		for (size_t i = 0; i < n; i++) {                                   \
+			is += (uint64_t)p[i];                                          \
+		}                                                                  \
+	}
+
+
+static int lua_array_sum(lua_State *L)
+{
+	larray *a = check_array(L, 1);
+	size_t n = a->len;
+	double fs = 0;
+	uint64_t is = 0;
+
+	switch (a->type) {
+	case LARRAY_F64:
+		FLOAT_SUM(double);
+		lua_pushnumber(L, fs);
+		break;
+	case LARRAY_F32:
+		FLOAT_SUM(float);
+		lua_pushnumber(L, fs);
+		break;
+	case LARRAY_I64:
+		INT_SUM(int64_t);
+		lua_pushinteger(L, (lua_Integer)is);
+		break;
+	case LARRAY_I32:
+		INT_SUM(int32_t);
+		lua_pushinteger(L, (lua_Integer)is);
+		break;
+	default:
+		INT_SUM(uint8_t);
+		lua_pushinteger(L, (lua_Integer)is);
+		break;
+	}
+	return 1;
+}
+
+
+static int lua_array_mean(lua_State *L)
+{
+	larray *a = check_array(L, 1);
+	size_t n = a->len;
+	double fs = 0;
+
+	if (n == 0) {
+		lua_pushnil(L);
+		return 1;
+	}
+	switch (a->type) {
+	case LARRAY_F64:
+		FLOAT_SUM(double);
+		break;
+	case LARRAY_F32:
+		FLOAT_SUM(float);
+		break;
+	case LARRAY_I64:
+		FLOAT_SUM(int64_t);
+		break;
+	case LARRAY_I32:
+		FLOAT_SUM(int32_t);
+		break;
+	default:
+		FLOAT_SUM(uint8_t);
+		break;
+	}
+	lua_pushnumber(L, fs / (double)n);
+	return 1;
+}
+
+
+/* 'res' is 'fm' for the float types and 'im' for the integer types */
+#define MINMAX(T, res)                                                     \
+	{                                                                      \
+		const T *p = (const T *)a->data;                                   \
+		T m = p[0];                                                        \
+		if (ismax) {                                                       \
+			for (size_t i = 1; i < n; i++) {                               \
+				m = (p[i] > m) ? p[i] : m;                                 \
+			}                                                              \
+		}                                                                  \
+		else {                                                             \
+			for (size_t i = 1; i < n; i++) {                               \
+				m = (p[i] < m) ? p[i] : m;                                 \
+			}                                                              \
+		}                                                                  \
+		res = m;                                                           \
+	}
+
+
+static int array_minmax(lua_State *L, int ismax)
+{
+	larray *a = check_array(L, 1);
+	size_t n = a->len;
+	double fm = 0;
+	int64_t im = 0;
+
+	if (n == 0) {
+		lua_pushnil(L);
+		return 1;
+	}
+	switch (a->type) {
+	case LARRAY_F64:
+		MINMAX(double, fm);
+		break;
+	case LARRAY_F32:
+		MINMAX(float, fm);
+		break;
+	case LARRAY_I64:
+		MINMAX(int64_t, im);
+		break;
+	case LARRAY_I32:
+		MINMAX(int32_t, im);
+		break;
+	default:
+		MINMAX(uint8_t, im);
+		break;
+	}
+	if (IS_FLOAT(a)) {
+		lua_pushnumber(L, fm);
+	}
+	else {
+		lua_pushinteger(L, im);
+	}
+	return 1;
+}
+
+
+static int lua_array_min(lua_State *L)
+{
+	return array_minmax(L, 0);
+}
+
+
+static int lua_array_max(lua_State *L)
+{
+	return array_minmax(L, 1);
+}
+
+
+#define FLOAT_DOT(T)                                                       \
+	{                                                                      \
+		const T *p = (const T *)a->data;                                   \
+		const T *q = (const T *)b->data;                                   \
+		double s0 = 0, s1 = 0, s2 = 0, s3 = 0;                             \
+		size_t i = 0;                                                      \
+		for (; i + 4 <= n; i += 4) {                                       \
+			s0 += (double)p[i] * q[i];                                     \
+			s1 += (double)p[i + 1] * q[i + 1];                             \
+			s2 += (double)p[i + 2] * q[i + 2];                             \
+			s3 += (double)p[i + 3] * q[i + 3];                             \
+		}                                                                  \
+		for (; i < n; i++) {                                               \
+			s0 += (double)p[i] * q[i];                                     \
+		}                                                                  \
+		lua_pushnumber(L, (s0 + s1) + (s2 + s3));                          \
+	}
+
+#define INT_DOT(T)                                                         \
+	{                                                                      \
+		const T *p = (const T *)a->data;                                   \
+		const T *q = (const T *)b->data;                                   \
+		uint64_t s = 0;                                                    \
+		for (size_t i = 0; i < n; i++) {                                   \
+			s += (uint64_t)p[i] * (uint64_t)q[i];                          \
+		}                                                                  \
+		lua_pushinteger(L, (lua_Integer)s);                                \
+	}
+
+
+static int lua_array_dot(lua_State *L)
+{
+	larray *a = check_array(L, 1);
+	larray *b = check_array(L, 2);
+	size_t n = a->len;
+	if ((a->type != b->type) || (a->len != b->len)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+
+	switch (a->type) {
+	case LARRAY_F64:
+		FLOAT_DOT(double);
+		break;
+	case LARRAY_F32:
+		FLOAT_DOT(float);
+		break;
+	case LARRAY_I64:
+		INT_DOT(int64_t);
+		break;
+	case LARRAY_I32:
+		INT_DOT(int32_t);
+		break;
+	default:
+		INT_DOT(uint8_t);
+		break;
+	}
+	return 1;
+}
+
+
+/* a[i] = a[i] <op> b[i] for all i, b being an array or a number.
+ * The loops are written for each operation separately, with no calls
+ * inside, so the compiler can vectorize them. */
+#define FLOAT_ARITH(T)                                                     \
+	{                                                                      \
+		T *p = (T *)a->data;                                               \
+		const T *q = (b != NULL) ? (const T *)b->data : NULL;              \
+		T s = (T)fs;                                                       \
+		size_t i;                                                          \
+		switch (op) {                                                      \
+		case OP_ADD:                                                       \
+			if (q) for (i = 0; i < n; i++) p[i] += q[i];                   \
+			else for (i = 0; i < n; i++) p[i] += s;                        \
+			break;                                                         \
+		case OP_SUB:                                                       \
+			if (q) for (i = 0; i < n; i++) p[i] -= q[i];                   \
+			else for (i = 0; i < n; i++) p[i] -= s;                        \
+			break;                                                         \
+		case OP_MUL:                                                       \
+			if (q) for (i = 0; i < n; i++) p[i] *= q[i];                   \
+			else for (i = 0; i < n; i++) p[i] *= s;                        \
+			break;                                                         \
+		default:                                                           \
+			if (q) for (i = 0; i < n; i++) p[i] /= q[i];                   \
+			else for (i = 0; i < n; i++) p[i] /= s;                        \
+			break;                                                         \
+		}                                                                  \
+	}
+
+/* Integer arithmetic wraps around; division is floor division */
+#define INT_ARITH(T)                                                       \
+	{                                                                      \
+		T *p = (T *)a->data;                                               \
+		const T *q = (b != NULL) ? (const T *)b->data : NULL;              \
+		T s = (T)is;                                                       \
+		size_t i;                                                          \
+		switch (op) {                                                      \
+		case OP_ADD:                                                       \
+			if (q) for (i = 0; i < n; i++) p[i] = (T)((uint64_t)p[i] + (uint64_t)q[i]); \
+			else for (i = 0; i < n; i++) p[i] = (T)((uint64_t)p[i] + (uint64_t)s);     \
+			break;                                                         \
+		case OP_SUB:                                                       \
+			if (q) for (i = 0; i < n; i++) p[i] = (T)((uint64_t)p[i] - (uint64_t)q[i]); \
+			else for (i = 0; i < n; i++) p[i] = (T)((uint64_t)p[i] - (uint64_t)s);     \
+			break;                                                         \
+		case OP_MUL:                                                       \
+			if (q) for (i = 0; i < n; i++) p[i] = (T)((uint64_t)p[i] * (uint64_t)q[i]); \
+			else for (i = 0; i < n; i++) p[i] = (T)((uint64_t)p[i] * (uint64_t)s);     \
+			break;                                                         \
+		default:                                                           \
+			if (q) for (i = 0; i < n; i++) p[i] = (T)floor_div(p[i], q[i]);  \
+			else for (i = 0; i < n; i++) p[i] = (T)floor_div(p[i], s);       \
+			break;                                                         \
+		}                                                                  \
+	}
+
+
+static int64_t floor_div(int64_t x, int64_t y)
+{
+	if (y == -1) {
+		return (int64_t)(0u - (uint64_t)x); /* avoid overflow with MININT */
+	}
+	int64_t q = x / y;
+	if (((x % y) != 0) && ((x ^ y) < 0)) {
+		q -= 1;
+	}
+	return q;
+}
+
+
+static int array_arith(lua_State *L, int op, const char *func)
+{
+	larray *a = check_array(L, 1);
+	larray *b = larray_test(L, 2);
+	size_t n = a->len;
+	double fs = 0;
+	int64_t is = 0;
+
+	if (a->readonly) {
+		return luaL_error(L, "%s read-only array", func);
+	}
+	if (b != NULL) {
+		if ((a->type != b->type) || (a->len != b->len)) {
+			return luaL_error(L, "%s parameter error", func);
+		}
+	}
+	else if (!to_elem(L, 2, a->type, &fs, &is)) {
+		return luaL_error(L, "%s parameter error", func);
+	}
+
+	if ((op == OP_DIV) && !IS_FLOAT(a)) {
+		/* check for division by zero before changing anything */
+		if (b == NULL) {
+			if (is == 0) {
+				return luaL_error(L, "attempt to perform 'n//0'");
+			}
+		}
+		else {
+			for (size_t i = 0; i < n; i++) {
+				int64_t v = 0;
+				switch (b->type) {
+				case LARRAY_I64:
+					v = ((const int64_t *)b->data)[i];
+					break;
+				case LARRAY_I32:
+					v = ((const int32_t *)b->data)[i];
+					break;
+				default:
+					v = ((const uint8_t *)b->data)[i];
+					break;
+				}
+				if (v == 0) {
+					return luaL_error(L, "attempt to perform 'n//0'");
+				}
+			}
+		}
+	}
+
+	switch (a->type) {
+	case LARRAY_F64:
+		FLOAT_ARITH(double);
+		break;
+	case LARRAY_F32:
+		FLOAT_ARITH(float);
+		break;
+	case LARRAY_I64:
+		INT_ARITH(int64_t);
+		break;
+	case LARRAY_I32:
+		INT_ARITH(int32_t);
+		break;
+	default:
+		INT_ARITH(uint8_t);
+		break;
+	}
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+
+static int lua_array_add(lua_State *L)
+{
+	return array_arith(L, OP_ADD, __func__);
+}
+
+
+static int lua_array_sub(lua_State *L)
+{
+	return array_arith(L, OP_SUB, __func__);
+}
+
+
+static int lua_array_mul(lua_State *L)
+{
+	return array_arith(L, OP_MUL, __func__);
+}
+
+
+static int lua_array_div(lua_State *L)
+{
+	return array_arith(L, OP_DIV, __func__);
+}
+
+
+/* qsort comparators; NaN is sorted after all other floats */
+#define CMP_FUNC(name, T)                                                  \
+	static int name(const void *pa, const void *pb)                        \
+	{                                                                      \
+		T x = *(const T *)pa;                                              \
+		T y = *(const T *)pb;                                              \
+		if (x < y) return -1;                                              \
+		if (x > y) return 1;                                               \
+		if (x == y) return 0;                                              \
+		return (x != x) - (y != y);                                        \
+	}
+
+CMP_FUNC(cmp_f64, double)
+CMP_FUNC(cmp_f32, float)
+CMP_FUNC(cmp_i64, int64_t)
+CMP_FUNC(cmp_i32, int32_t)
+CMP_FUNC(cmp_u8, uint8_t)
+
+
+static int lua_array_sort(lua_State *L)
+{
+	static int (*const cmp[])(const void *, const void *) = {
+		cmp_f64, cmp_f32, cmp_i64, cmp_i32, cmp_u8
+	};
+	larray *a = check_array(L, 1);
+	if (a->readonly) {
+		return luaL_error(L, "%s read-only array", __func__);
+	}
+	qsort(a->data, a->len, larray_elemsize(a->type), cmp[a->type]);
+	lua_settop(L, 1);
+	return 1;
+}
+
+
+static int lua_array_totable(lua_State *L)
+{
+	larray *a = check_array(L, 1);
+	if (a->len >= INT32_MAX) {
+		return luaL_error(L, "%s array too large", __func__);
+	}
+	lua_createtable(L, (int)a->len, 0);
+	for (size_t i = 0; i < a->len; i++) {
+		push_elem(L, a, i);
+		lua_rawseti(L, -2, (lua_Integer)i + 1);
+	}
+	return 1;
+}
+
+
+static int lua_array_tobytes(lua_State *L)
+{
+	larray *a = check_array(L, 1);
+	lua_pushlstring(L, a->data, larray_bytes(a));
+	return 1;
+}
+
+
+static int lua_array_tostring(lua_State *L)
+{
+	larray *a = check_array(L, 1);
+	lua_pushfstring(L, "array<%s>[%I]: %p", type_names[a->type], (lua_Integer)a->len, (void *)a);
+	return 1;
+}
+
+
+static const struct luaL_Reg methodlist[] = {
+	{ "type", lua_array_type },
+	{ "len", lua_array_len },
+	{ "slice", lua_array_slice },
+	{ "copy", lua_array_copy },
+	{ "fill", lua_array_fill },
+	{ "sum", lua_array_sum },
+	{ "mean", lua_array_mean },
+	{ "min", lua_array_min },
+	{ "max", lua_array_max },
+	{ "dot", lua_array_dot },
+	{ "add", lua_array_add },
+	{ "sub", lua_array_sub },
+	{ "mul", lua_array_mul },
+	{ "div", lua_array_div },
+	{ "sort", lua_array_sort },
+	{ "totable", lua_array_totable },
+	{ "tobytes", lua_array_tobytes },
+
+	{ NULL, NULL },
+};
+
+
+static const struct luaL_Reg metalist[] = {
+	{ "__newindex", lua_array_newindex },
+	{ "__len", lua_array_len },
+	{ "__tostring", lua_array_tostring },
+
+	{ NULL, NULL },
+};
+
+
+static const struct luaL_Reg funclist[] = {
+	{ "new", lua_array_new },
+	{ "frombytes", lua_array_frombytes },
+	{ "view", lua_array_view },
+
+	{ NULL, NULL },
+};
+
+
+int luaopen_array(lua_State *L)
+{
+	luaL_newmetatable(L, LARRAY_META);
+	luaL_setfuncs(L, metalist, 0);
+	luaL_newlib(L, methodlist);
+	lua_pushcclosure(L, lua_array_index, 1);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
+	luaL_newlib(L, funclist);
+	lua_pushvalue(L, -1);
+	lua_setglobal(L, "array");
+	return 1;
+}
@@ -0,0 +1,63 @@
+#ifndef LARRAY_H
+#define LARRAY_H
+
+#include <stddef.h>
+#include "lua.h"
+#include "lauxlib.h"
+
+
+/* Metatable of array userdata */
+#define LARRAY_META "array"
+
+
+/* Element types */
+#define LARRAY_F64 0
+#define LARRAY_F32 1
+#define LARRAY_I64 2
+#define LARRAY_I32 3
+#define LARRAY_U8 4
+
+
+/* Typed numeric array (the body of an array userdata).
+ * Elements are stored contiguously in native byte order, the same layout
+ * string.pack uses for "=d", "=f", "=i8", "=i4" and "=B". */
+typedef struct larray {
+	char *data;   /* first element */
+	size_t len;   /* number of elements */
+	int type;     /* LARRAY_xxx */
+	int readonly; /* view on an immutable Lua string */
+} larray;
+
+
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#define LARRAY_INLINE static __inline
+#else
+#define LARRAY_INLINE static inline
+#endif
+
+
+/* Return the array at stack index idx, or NULL if it is something else */
+LARRAY_INLINE larray *larray_test(lua_State *L, int idx)
+{
+	return (larray *)luaL_testudata(L, idx, LARRAY_META);
+}
+
+
+/* Size of one element of the given type */
+LARRAY_INLINE size_t larray_elemsize(int type)
+{
+	static const unsigned char size[] = { 8, 4, 8, 4, 1 };
+	return size[type];
+}
+
+
+/* Number of bytes of all elements */
+LARRAY_INLINE size_t larray_bytes(const larray *a)
+{
+	return a->len * larray_elemsize(a->type);
+}
+
+
+int luaopen_array(lua_State *L);
+
+#endif /* LARRAY_H */
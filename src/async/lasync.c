@@ -0,0 +1,2059 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include "lua_all.h"
+#include "lualib.h"
+#include "lasync.h"
+
+
+/* Events taken from the system per loop iteration */
+#define ASYNC_MAXEVENTS 64
+
+/* Interval (ms) of process:wait checking for the exit of a process, where
+ * the system has no descriptor for it (Linux before 5.3) */
+#define ASYNC_WAITPOLL 10
+
+/* async.recv polls a channel without ch:getfd(), first after 1 ms,
+ * doubling up to this */
+#define ASYNC_RECVPOLL 16
+
+/* Stack size of the threads that reap collected processes */
+#define ASYNC_REAPSTACK 65536
+
+/* Returned by operations that parked the calling task */
+#define ASYNC_PARKED (-2)
+
+
+/* A parked task. Waiters from before a failed async.run (an older epoch)
+ * are not woken any more. */
+typedef struct async_waiter {
+	lua_State *co;
+	unsigned epoch;
+} async_waiter;
+
+
+typedef struct async_timer {
+	uint64_t due;
+	uint64_t seq; /* equal due times fire in order */
+	lua_State *co;
+} async_timer;
+
+
+/* The loop userdata, user values: 1 the tasks (coroutine -> true), 2 the
+ * pending async.readable waits (light userdata -> their userdata) */
+typedef struct async_loop {
+#ifdef _WIN32
+	HANDLE iocp;
+#else
+	int epfd;
+#endif
+	int running;
+	int parked;       /* set when the running task parked itself */
+	unsigned epoch;
+	lua_Integer ntasks;
+	lua_Integer waiting; /* tasks parked on I/O */
+	lua_State **ready;
+	size_t nready, capready;
+	async_timer *timers; /* binary heap */
+	size_t ntimers, captimers;
+	uint64_t seq;
+} async_loop;
+
+
+/* Things the loop gets events for start with their kind */
+#define SRC_STREAM 1
+#define SRC_WATCH 2
+
+
+/* {====================================================== */
+/* Tasks, timers and the ready queue */
+
+static uint64_t async_now_ms(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq = { 0, 0 };
+	LARGE_INTEGER count;
+	if (freq.QuadPart == 0) {
+		QueryPerformanceFrequency(&freq);
+	}
+	QueryPerformanceCounter(&count);
+	return (uint64_t)(count.QuadPart / (freq.QuadPart / 1000));
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)(ts.tv_nsec / 1000000);
+#endif
+}
+
+
+static void ready_push(lua_State *L, async_loop *lp, lua_State *co)
+{
+	if (lp->nready == lp->capready) {
+		size_t cap = (lp->capready < 16) ? 16 : lp->capready * 2;
+		lua_State **p = (lua_State **)realloc(lp->ready, cap * sizeof(lua_State *));
+		if (p == NULL) {
+			luaL_error(L, "async out of memory");
+		}
+		lp->ready = p;
+		lp->capready = cap;
+	}
+	lp->ready[lp->nready++] = co;
+}
+
+
+static int timer_less(const async_timer *a, const async_timer *b)
+{
+	return (a->due < b->due) || ((a->due == b->due) && (a->seq < b->seq));
+}
+
+
+static void timer_push(lua_State *L, async_loop *lp, uint64_t due, lua_State *co)
+{
+	size_t i;
+	async_timer t;
+
+	if (lp->ntimers == lp->captimers) {
+		size_t cap = (lp->captimers < 16) ? 16 : lp->captimers * 2;
+		async_timer *p = (async_timer *)realloc(lp->timers, cap * sizeof(async_timer));
+		if (p == NULL) {
+			luaL_error(L, "async out of memory");
+		}
+		lp->timers = p;
+		lp->captimers = cap;
+	}
+	t.due = due;
+	t.seq = lp->seq++;
+	t.co = co;
+	for (i = lp->ntimers++; i > 0; i = (i - 1) / 2) {
+		size_t parent = (i - 1) / 2;
+		if (!timer_less(&t, &lp->timers[parent])) {
+			break;
+		}
+		lp->timers[i] = lp->timers[parent];
+	}
+	lp->timers[i] = t;
+}
+
+
+static void timer_pop(async_loop *lp)
+{
+	async_timer last = lp->timers[--lp->ntimers];
+	size_t i = 0, n = lp->ntimers;
+	for (;;) {
+		size_t c = 2 * i + 1;
+		if (c >= n) {
+			break;
+		}
+		if ((c + 1 < n) && timer_less(&lp->timers[c + 1], &lp->timers[c])) {
+			c++;
+		}
+		if (!timer_less(&lp->timers[c], &last)) {
+			break;
+		}
+		lp->timers[i] = lp->timers[c];
+		i = c;
+	}
+	if (n > 0) {
+		lp->timers[i] = last;
+	}
+}
+
+
+static void park(async_loop *lp, async_waiter *w, lua_State *L)
+{
+	w->co = L;
+	w->epoch = lp->epoch;
+	lp->waiting++;
+	lp->parked = 1;
+}
+
+
+static void wake(lua_State *L, async_loop *lp, async_waiter *w)
+{
+	if (w->co != NULL) {
+		if (w->epoch == lp->epoch) {
+			lp->waiting--;
+			ready_push(L, lp, w->co);
+		}
+		w->co = NULL;
+	}
+}
+
+
+/* Park L until the loop time reaches due */
+static void park_until(lua_State *L, async_loop *lp, uint64_t due)
+{
+	timer_push(L, lp, due, L);
+	lp->parked = 1;
+}
+
+
+static int loop_open(async_loop *lp);
+static void loop_close(async_loop *lp);
+static void loop_poll(lua_State *L, async_loop *lp, long timeout);
+
+
+/* The loop of L, created on first use */
+static async_loop *get_loop(lua_State *L)
+{
+	async_loop *lp;
+
+	if (lua_getfield(L, LUA_REGISTRYINDEX, LASYNC_LOOP) == LUA_TUSERDATA) {
+		lp = (async_loop *)lua_touserdata(L, -1);
+		lua_pop(L, 1);
+		return lp;
+	}
+	lua_pop(L, 1);
+	lp = (async_loop *)lua_newuserdatauv(L, sizeof(async_loop), 2);
+	memset(lp, 0, sizeof(async_loop));
+	luaL_setmetatable(L, LASYNC_LOOP);
+	if (!loop_open(lp)) {
+		luaL_error(L, "async cannot create the event loop");
+	}
+	lua_newtable(L);
+	lua_setiuservalue(L, -2, 1);
+	lua_newtable(L);
+	lua_setiuservalue(L, -2, 2);
+	lua_setfield(L, LUA_REGISTRYINDEX, LASYNC_LOOP);
+	return lp;
+}
+
+
+/* The running loop if L is one of its tasks (and so may be parked),
+ * otherwise NULL: the caller blocks instead */
+static async_loop *current_loop(lua_State *L)
+{
+	async_loop *lp;
+	int istask;
+
+	if (!lua_isyieldable(L)) {
+		return NULL;
+	}
+	lua_getfield(L, LUA_REGISTRYINDEX, LASYNC_LOOP);
+	lp = (async_loop *)lua_touserdata(L, -1);
+	if ((lp == NULL) || !lp->running) {
+		lua_pop(L, 1);
+		return NULL;
+	}
+	lua_getiuservalue(L, -1, 1);
+	lua_pushthread(L);
+	istask = (lua_rawget(L, -2) != LUA_TNIL);
+	lua_pop(L, 3);
+	return istask ? lp : NULL;
+}
+
+
+/* Push a loop user value table (1: tasks, 2: waits) */
+static void get_loopvalue(lua_State *L, int n)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, LASYNC_LOOP);
+	lua_getiuservalue(L, -1, n);
+	lua_remove(L, -2);
+}
+
+
+/* Start the function at idx with the nargs values above it as a task.
+ * The coroutine is left on the stack. */
+static lua_State *task_new(lua_State *L, async_loop *lp, int idx, int nargs)
+{
+	lua_State *co = lua_newthread(L);
+
+	if (!lua_checkstack(co, nargs + 1)) {
+		luaL_error(L, "too many arguments");
+	}
+	for (int i = 0; i <= nargs; i++) {
+		lua_pushvalue(L, idx + i);
+	}
+	lua_xmove(L, co, nargs + 1);
+	get_loopvalue(L, 1);
+	lua_pushvalue(L, -2);
+	lua_pushboolean(L, 1);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+	ready_push(L, lp, co);
+	lp->ntasks++;
+	return co;
+}
+
+
+/* Resume a ready task. The results of main are moved to L, errors are
+ * raised in L. tasks is the stack index of the tasks table. */
+static void task_resume(lua_State *L, async_loop *lp, lua_State *co, lua_State *main, int tasks)
+{
+	int nres = 0;
+	int nargs = (lua_status(co) == LUA_OK) ? lua_gettop(co) - 1 : 0;
+	int status;
+
+	lp->parked = 0;
+	status = lua_resume(co, L, nargs, &nres);
+	if (status == LUA_YIELD) {
+		/* a plain coroutine.yield just lets the other tasks run */
+		lua_pop(co, nres);
+		if (!lp->parked) {
+			ready_push(L, lp, co);
+		}
+		return;
+	}
+
+	lp->ntasks--;
+	if (status == LUA_OK) {
+		if (co == main) {
+			luaL_checkstack(L, nres + LUA_MINSTACK, "too many results");
+			lua_xmove(co, L, nres);
+		}
+		else {
+			lua_pop(co, nres);
+		}
+	}
+	else if (lua_type(co, -1) == LUA_TSTRING) {
+		luaL_traceback(L, co, lua_tostring(co, -1), 0);
+		lua_pop(co, 1);
+	}
+	else {
+		lua_xmove(co, L, 1);
+	}
+	lua_checkstack(co, 1);
+	lua_pushthread(co);
+	lua_xmove(co, L, 1);
+	lua_pushnil(L);
+	lua_rawset(L, tasks);
+	if (status != LUA_OK) {
+		lua_error(L);
+	}
+}
+
+
+/* async.run: 1 the loop, 2 the main task */
+static int loop_run(lua_State *L)
+{
+	async_loop *lp = (async_loop *)lua_touserdata(L, 1);
+	lua_State *main = lua_tothread(L, 2);
+
+	lua_settop(L, 2);
+	lua_getiuservalue(L, 1, 1); /* 3 */
+	while (lp->ntasks > 0) {
+		size_t n = lp->nready;
+		long timeout = -1;
+
+		for (size_t i = 0; i < n; i++) {
+			task_resume(L, lp, lp->ready[i], main, 3);
+		}
+		memmove(lp->ready, lp->ready + n, (lp->nready - n) * sizeof(lua_State *));
+		lp->nready -= n;
+		if (lp->ntasks == 0) {
+			break;
+		}
+
+		if (lp->nready > 0) {
+			timeout = 0;
+		}
+		else if (lp->ntimers > 0) {
+			uint64_t now = async_now_ms();
+			uint64_t due = lp->timers[0].due;
+			timeout = (due <= now) ? 0 : ((due - now > 0x7FFFFFFF) ? 0x7FFFFFFF : (long)(due - now));
+		}
+		else if (lp->waiting == 0) {
+			return luaL_error(L, "async.run: all tasks are blocked");
+		}
+		loop_poll(L, lp, timeout);
+
+		if (lp->ntimers > 0) {
+			uint64_t now = async_now_ms();
+			while ((lp->ntimers > 0) && (lp->timers[0].due <= now)) {
+				lua_State *co = lp->timers[0].co;
+				timer_pop(lp);
+				ready_push(L, lp, co);
+			}
+		}
+	}
+	return lua_gettop(L) - 3;
+}
+
+
+/* Forget all tasks after a failed async.run */
+static void loop_reset(lua_State *L, async_loop *lp)
+{
+	lp->epoch++;
+	lp->nready = 0;
+	lp->ntimers = 0;
+	lp->ntasks = 0;
+	lp->waiting = 0;
+	lua_getfield(L, LUA_REGISTRYINDEX, LASYNC_LOOP);
+	lua_newtable(L);
+	lua_setiuservalue(L, -2, 1);
+	lua_pop(L, 1);
+}
+
+
+static int lua_async_loop_gc(lua_State *L)
+{
+	async_loop *lp = (async_loop *)lua_touserdata(L, 1);
+	loop_close(lp);
+	free(lp->ready);
+	free(lp->timers);
+	lp->ready = NULL;
+	lp->timers = NULL;
+	return 0;
+}
+
+/* }====================================================== */
+
+
+/* {====================================================== */
+/* Streams and readable waits, system specific part */
+
+typedef struct async_stream async_stream;
+
+static void push_error(lua_State *L);
+
+#ifdef _WIN32
+
+#define ASYNC_KEY_IO 0
+#define ASYNC_KEY_WATCH 1
+
+#define OP_IDLE 0
+#define OP_PENDING 1
+#define OP_DONE 2
+
+/* An overlapped read or write with its buffer. If its stream is closed
+ * while the system still owns it, the loop frees it when it completes. */
+typedef struct async_op {
+	OVERLAPPED ov; /* first member: the loop gets it back */
+	int state;
+	int orphan;
+	async_waiter w;
+	HANDLE event;  /* waits outside of a task */
+	char buf[LASYNC_CHUNK];
+} async_op;
+
+struct async_stream {
+	int kind;
+	int closed;
+	int eof;
+	int append;
+	HANDLE h;
+	uint64_t offset; /* file position (ignored for pipes) */
+	async_op *rop, *wop;
+	char *buf;       /* read buffer */
+	size_t bstart, bend, bcap;
+};
+
+typedef struct async_watch {
+	HANDLE iocp;
+	HANDLE wait;
+	async_waiter w;
+} async_watch;
+
+
+static int loop_open(async_loop *lp)
+{
+	lp->iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+	return (lp->iocp != NULL);
+}
+
+
+static void loop_close(async_loop *lp)
+{
+	if (lp->iocp != NULL) {
+		CloseHandle(lp->iocp);
+		lp->iocp = NULL;
+	}
+}
+
+
+static void op_free(async_op *op)
+{
+	if (op->event != NULL) {
+		CloseHandle(op->event);
+	}
+	free(op);
+}
+
+
+/* Take the next readable wait from its table and wake its task */
+static void watch_done(lua_State *L, async_loop *lp, async_watch *w)
+{
+	UnregisterWaitEx(w->wait, NULL);
+	wake(L, lp, &w->w);
+	get_loopvalue(L, 2);
+	lua_pushlightuserdata(L, w);
+	lua_pushnil(L);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+}
+
+
+static void loop_poll(lua_State *L, async_loop *lp, long timeout)
+{
+	OVERLAPPED_ENTRY ev[ASYNC_MAXEVENTS];
+	ULONG n = 0;
+
+	if (!GetQueuedCompletionStatusEx(lp->iocp, ev, ASYNC_MAXEVENTS, &n, (timeout < 0) ? INFINITE : (DWORD)timeout, FALSE)) {
+		return;
+	}
+	for (ULONG i = 0; i < n; i++) {
+		if (ev[i].lpCompletionKey == ASYNC_KEY_WATCH) {
+			watch_done(L, lp, (async_watch *)ev[i].lpOverlapped);
+		}
+		else {
+			async_op *op = (async_op *)ev[i].lpOverlapped;
+			op->state = OP_DONE;
+			wake(L, lp, &op->w);
+			if (op->orphan) {
+				op_free(op);
+			}
+		}
+	}
+}
+
+
+static void push_error(lua_State *L)
+{
+	DWORD err = GetLastError();
+	char msg[256];
+	DWORD len = FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL, err, 0, msg, sizeof(msg), NULL);
+	while ((len > 0) && ((msg[len - 1] == '\n') || (msg[len - 1] == '\r') || (msg[len - 1] == '.'))) {
+		len--;
+	}
+	lua_pushnil(L);
+	if (len > 0) {
+		lua_pushlstring(L, msg, len);
+	}
+	else {
+		lua_pushfstring(L, "error %d", (int)err);
+	}
+	lua_pushinteger(L, (lua_Integer)err);
+}
+
+
+static int is_eof_error(DWORD err)
+{
+	return (err == ERROR_HANDLE_EOF) || (err == ERROR_BROKEN_PIPE) || (err == ERROR_PIPE_NOT_CONNECTED);
+}
+
+
+static async_op *op_get(async_op **pop)
+{
+	if (*pop == NULL) {
+		*pop = (async_op *)calloc(1, sizeof(async_op));
+		if (*pop == NULL) {
+			SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		}
+	}
+	return *pop;
+}
+
+
+/* Set up the OVERLAPPED of the next operation. Outside of a task the
+ * completion goes to an event instead of the port (low bit set). */
+static int op_prepare(async_stream *s, async_op *op, async_loop *lp, int write)
+{
+	memset(&op->ov, 0, sizeof(op->ov));
+	if (write && s->append) {
+		op->ov.Offset = op->ov.OffsetHigh = 0xFFFFFFFF;
+	}
+	else {
+		op->ov.Offset = (DWORD)s->offset;
+		op->ov.OffsetHigh = (DWORD)(s->offset >> 32);
+	}
+	if (lp == NULL) {
+		if (op->event == NULL) {
+			op->event = CreateEventA(NULL, TRUE, FALSE, NULL);
+			if (op->event == NULL) {
+				return 0;
+			}
+		}
+		op->ov.hEvent = (HANDLE)((ULONG_PTR)op->event | 1);
+	}
+	return 1;
+}
+
+
+static int buf_reserve(async_stream *s, size_t n);
+
+
+/* Read more bytes into the buffer: 1 got some, 0 end of file, -1 error
+ * (GetLastError), or ASYNC_PARKED */
+static int stream_fill(lua_State *L, async_stream *s)
+{
+	async_op *op = op_get(&s->rop);
+	DWORD n = 0;
+
+	if (op == NULL) {
+		return -1;
+	}
+	if (op->state == OP_PENDING) {
+		SetLastError(ERROR_BUSY);
+		return -1;
+	}
+	if (op->state == OP_IDLE) {
+		async_loop *lp = current_loop(L);
+		if (!op_prepare(s, op, lp, 0)) {
+			return -1;
+		}
+		if (!ReadFile(s->h, op->buf, LASYNC_CHUNK, NULL, &op->ov) && (GetLastError() != ERROR_IO_PENDING)) {
+			return is_eof_error(GetLastError()) ? 0 : -1;
+		}
+		if (lp != NULL) {
+			op->state = OP_PENDING;
+			park(lp, &op->w, L);
+			return ASYNC_PARKED;
+		}
+	}
+	op->state = OP_IDLE;
+	if (!GetOverlappedResult(s->h, &op->ov, &n, TRUE)) {
+		return is_eof_error(GetLastError()) ? 0 : -1;
+	}
+	if (n == 0) {
+		return 0;
+	}
+	if (!buf_reserve(s, n)) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return -1;
+	}
+	memcpy(s->buf + s->bend, op->buf, n);
+	s->bend += n;
+	s->offset += n;
+	return 1;
+}
+
+
+/* Write some of the len bytes at p: bytes written, -1 error, or
+ * ASYNC_PARKED (called again with the same p when resumed) */
+static lua_Integer stream_put(lua_State *L, async_stream *s, const char *p, size_t len)
+{
+	async_op *op = op_get(&s->wop);
+	DWORD n = 0;
+
+	if (op == NULL) {
+		return -1;
+	}
+	if (op->state == OP_PENDING) {
+		SetLastError(ERROR_BUSY);
+		return -1;
+	}
+	if (op->state == OP_IDLE) {
+		async_loop *lp = current_loop(L);
+		DWORD chunk = (DWORD)((len < LASYNC_CHUNK) ? len : LASYNC_CHUNK);
+		if (!op_prepare(s, op, lp, 1)) {
+			return -1;
+		}
+		memcpy(op->buf, p, chunk);
+		if (!WriteFile(s->h, op->buf, chunk, NULL, &op->ov) && (GetLastError() != ERROR_IO_PENDING)) {
+			return -1;
+		}
+		if (lp != NULL) {
+			op->state = OP_PENDING;
+			park(lp, &op->w, L);
+			return ASYNC_PARKED;
+		}
+	}
+	op->state = OP_IDLE;
+	if (!GetOverlappedResult(s->h, &op->ov, &n, TRUE)) {
+		return -1;
+	}
+	s->offset += n;
+	return (lua_Integer)n;
+}
+
+
+static void stream_closehandle(async_stream *s)
+{
+	async_op **ops[2];
+	ops[0] = &s->rop;
+	ops[1] = &s->wop;
+	for (int i = 0; i < 2; i++) {
+		async_op *op = *ops[i];
+		if (op == NULL) {
+			continue;
+		}
+		if (op->state == OP_PENDING) {
+			CancelIoEx(s->h, &op->ov);
+			op->orphan = 1;
+		}
+		else {
+			op_free(op);
+		}
+		*ops[i] = NULL;
+	}
+	CloseHandle(s->h);
+	s->h = INVALID_HANDLE_VALUE;
+}
+
+
+static int stream_attach(async_loop *lp, async_stream *s)
+{
+	return CreateIoCompletionPort(s->h, lp->iocp, ASYNC_KEY_IO, 0) != NULL;
+}
+
+
+static VOID CALLBACK watch_callback(PVOID param, BOOLEAN timedout)
+{
+	async_watch *w = (async_watch *)param;
+	(void)timedout;
+	PostQueuedCompletionStatus(w->iocp, 0, ASYNC_KEY_WATCH, (LPOVERLAPPED)w);
+}
+
+
+static int readable_k(lua_State *L, int status, lua_KContext ctx)
+{
+	(void)status;
+	(void)ctx;
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+
+/* Park L until h is signaled or ms (-1: no limit) have passed. Returns 0
+ * on failure (GetLastError). */
+static int watch_start(lua_State *L, async_loop *lp, HANDLE h, long ms)
+{
+	async_watch *w = (async_watch *)lua_newuserdatauv(L, sizeof(async_watch), 0);
+	memset(w, 0, sizeof(async_watch));
+	w->iocp = lp->iocp;
+	if (!RegisterWaitForSingleObject(&w->wait, h, watch_callback, w, (ms < 0) ? INFINITE : (DWORD)ms, WT_EXECUTEONLYONCE)) {
+		lua_pop(L, 1);
+		return 0;
+	}
+	get_loopvalue(L, 2);
+	lua_pushlightuserdata(L, w);
+	lua_pushvalue(L, -3);
+	lua_rawset(L, -3);
+	lua_pop(L, 2);
+	park(lp, &w->w, L);
+	return 1;
+}
+
+
+/* Wait for the wakeup handle of a channel (ch:getfd()) at idx */
+static int wakeup_start(lua_State *L, async_loop *lp, int idx, long ms)
+{
+	return watch_start(L, lp, (HANDLE)lua_touserdata(L, idx), ms);
+}
+
+
+static void wakeup_reset(lua_State *L, int idx)
+{
+	ResetEvent((HANDLE)lua_touserdata(L, idx));
+}
+
+
+/* async.readable(handle): wait until a handle (light userdata, like the
+ * one of watcher:getfd()) is signaled */
+static int lua_async_readable(lua_State *L)
+{
+	HANDLE h = (HANDLE)lua_touserdata(L, 1);
+	async_loop *lp;
+
+	if (lua_type(L, 1) != LUA_TLIGHTUSERDATA) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	lp = current_loop(L);
+	if (lp == NULL) {
+		if (WaitForSingleObject(h, INFINITE) == WAIT_FAILED) {
+			push_error(L);
+			return 3;
+		}
+		lua_pushboolean(L, 1);
+		return 1;
+	}
+	lua_settop(L, 1);
+	if (!watch_start(L, lp, h, -1)) {
+		push_error(L);
+		return 3;
+	}
+	return lua_yieldk(L, 0, 0, readable_k);
+}
+
+#else
+
+struct async_stream {
+	int kind;
+	int closed;
+	int eof;
+	int fd;
+	int polled;      /* in the epoll set (regular files are not) */
+	async_waiter rw, ww;
+	char *buf;       /* read buffer */
+	size_t bstart, bend, bcap;
+};
+
+typedef struct async_watch {
+	int kind;
+	int fd;    /* -1 once done */
+	int owned; /* fd is a copy made for the watch */
+	int tfd;   /* timerfd of a time limit, or -1 */
+	async_waiter w;
+} async_watch;
+
+
+static int loop_open(async_loop *lp)
+{
+	lp->epfd = epoll_create1(EPOLL_CLOEXEC);
+	return (lp->epfd >= 0);
+}
+
+
+static void loop_close(async_loop *lp)
+{
+	if (lp->epfd >= 0) {
+		close(lp->epfd);
+		lp->epfd = -1;
+	}
+}
+
+
+/* Take the descriptors of a watch out of the epoll set */
+static void watch_release(async_loop *lp, async_watch *w)
+{
+	if (w->fd >= 0) {
+		epoll_ctl(lp->epfd, EPOLL_CTL_DEL, w->fd, NULL);
+		if (w->owned) {
+			close(w->fd);
+		}
+		w->fd = -1;
+	}
+	if (w->tfd >= 0) {
+		close(w->tfd); /* leaves the epoll set with it */
+		w->tfd = -1;
+	}
+}
+
+
+static void watch_done(lua_State *L, async_loop *lp, async_watch *w)
+{
+	if (w->fd < 0) {
+		return; /* its descriptor and its time limit fired together */
+	}
+	watch_release(lp, w);
+	wake(L, lp, &w->w);
+	get_loopvalue(L, 2);
+	lua_pushlightuserdata(L, w);
+	lua_pushnil(L);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+}
+
+
+/* Streams are registered edge triggered, and a task only parks after a
+ * read or write returned EAGAIN, so the next edge is always seen. */
+static void loop_poll(lua_State *L, async_loop *lp, long timeout)
+{
+	struct epoll_event ev[ASYNC_MAXEVENTS];
+	int n = epoll_wait(lp->epfd, ev, ASYNC_MAXEVENTS, (int)timeout);
+
+	for (int i = 0; i < n; i++) {
+		uint32_t e = ev[i].events;
+		if (*(int *)ev[i].data.ptr == SRC_STREAM) {
+			async_stream *s = (async_stream *)ev[i].data.ptr;
+			if (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+				wake(L, lp, &s->rw);
+			}
+			if (e & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+				wake(L, lp, &s->ww);
+			}
+		}
+		else {
+			watch_done(L, lp, (async_watch *)ev[i].data.ptr);
+		}
+	}
+}
+
+
+static void push_error(lua_State *L)
+{
+	int en = errno;
+	lua_pushnil(L);
+	lua_pushstring(L, strerror(en));
+	lua_pushinteger(L, en);
+}
+
+
+/* Wait outside of a task until fd is ready for events */
+static void wait_fd(int fd, short events)
+{
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = events;
+	while ((poll(&pfd, 1, -1) < 0) && (errno == EINTR)) {
+	}
+}
+
+
+static int buf_reserve(async_stream *s, size_t n);
+
+
+/* Read more bytes into the buffer: 1 got some, 0 end of file, -1 error
+ * (errno), or ASYNC_PARKED */
+static int stream_fill(lua_State *L, async_stream *s)
+{
+	for (;;) {
+		ssize_t n;
+		async_loop *lp;
+		if (!buf_reserve(s, LASYNC_CHUNK)) {
+			errno = ENOMEM;
+			return -1;
+		}
+		n = read(s->fd, s->buf + s->bend, s->bcap - s->bend);
+		if (n > 0) {
+			s->bend += (size_t)n;
+			return 1;
+		}
+		if (n == 0) {
+			return 0;
+		}
+		if (errno == EINTR) {
+			continue;
+		}
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+			return -1;
+		}
+		lp = current_loop(L);
+		if (lp == NULL) {
+			wait_fd(s->fd, POLLIN);
+			continue;
+		}
+		if (s->rw.co != NULL) {
+			errno = EBUSY;
+			return -1;
+		}
+		park(lp, &s->rw, L);
+		return ASYNC_PARKED;
+	}
+}
+
+
+/* Write some of the len bytes at p: bytes written, -1 error, or
+ * ASYNC_PARKED */
+static lua_Integer stream_put(lua_State *L, async_stream *s, const char *p, size_t len)
+{
+	for (;;) {
+		ssize_t n = write(s->fd, p, len);
+		async_loop *lp;
+		if (n >= 0) {
+			return (lua_Integer)n;
+		}
+		if (errno == EINTR) {
+			continue;
+		}
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+			return -1;
+		}
+		lp = current_loop(L);
+		if (lp == NULL) {
+			wait_fd(s->fd, POLLOUT);
+			continue;
+		}
+		if (s->ww.co != NULL) {
+			errno = EBUSY;
+			return -1;
+		}
+		park(lp, &s->ww, L);
+		return ASYNC_PARKED;
+	}
+}
+
+
+static void stream_closehandle(async_stream *s)
+{
+	close(s->fd); /* leaves the epoll set with it */
+	s->fd = -1;
+}
+
+
+static int stream_attach(async_loop *lp, async_stream *s)
+{
+	struct epoll_event ev;
+	int fl = fcntl(s->fd, F_GETFL);
+	if ((fl < 0) || (fcntl(s->fd, F_SETFL, fl | O_NONBLOCK) < 0)) {
+		return 0;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = s;
+	if (epoll_ctl(lp->epfd, EPOLL_CTL_ADD, s->fd, &ev) == 0) {
+		s->polled = 1;
+		return 1;
+	}
+	return (errno == EPERM); /* a regular file, always ready */
+}
+
+
+static int readable_k(lua_State *L, int status, lua_KContext ctx)
+{
+	(void)status;
+	(void)ctx;
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+
+/* Park L until fd is readable or ms (-1: no limit) have passed. With
+ * copy, the watch registers a copy of fd of its own, so that several
+ * tasks can wait for the same descriptor. Returns 0 on failure (errno). */
+static int watch_start(lua_State *L, async_loop *lp, int fd, int copy, long ms)
+{
+	struct epoll_event ev;
+	async_watch *w = (async_watch *)lua_newuserdatauv(L, sizeof(async_watch), 0);
+	int ok;
+
+	memset(w, 0, sizeof(async_watch));
+	w->kind = SRC_WATCH;
+	w->fd = copy ? fcntl(fd, F_DUPFD_CLOEXEC, 0) : fd;
+	w->owned = copy;
+	w->tfd = -1;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = w;
+	ok = (w->fd >= 0) && ((epoll_ctl(lp->epfd, EPOLL_CTL_ADD, w->fd, &ev) == 0)
+	                      || (!copy && (errno == EEXIST) && (epoll_ctl(lp->epfd, EPOLL_CTL_MOD, w->fd, &ev) == 0)));
+	/* EEXIST: left over by a task of a failed async.run */
+	if (ok && (ms >= 0)) {
+		struct itimerspec its;
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = ms / 1000;
+		its.it_value.tv_nsec = (ms % 1000) * 1000000L + 1; /* all zero disarms */
+		w->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		ok = (w->tfd >= 0) && (timerfd_settime(w->tfd, 0, &its, NULL) == 0)
+		     && (epoll_ctl(lp->epfd, EPOLL_CTL_ADD, w->tfd, &ev) == 0);
+	}
+	if (!ok) {
+		int en = errno;
+		if (w->fd >= 0) {
+			watch_release(lp, w);
+		}
+		lua_pop(L, 1);
+		errno = en;
+		return 0;
+	}
+	get_loopvalue(L, 2);
+	lua_pushlightuserdata(L, w);
+	lua_pushvalue(L, -3);
+	lua_rawset(L, -3);
+	lua_pop(L, 2);
+	park(lp, &w->w, L);
+	return 1;
+}
+
+
+/* Wait for the wakeup eventfd of a channel (ch:getfd()) at idx */
+static int wakeup_start(lua_State *L, async_loop *lp, int idx, long ms)
+{
+	return watch_start(L, lp, (int)lua_tointeger(L, idx), 1, ms);
+}
+
+
+static void wakeup_reset(lua_State *L, int idx)
+{
+	uint64_t v;
+	while ((read((int)lua_tointeger(L, idx), &v, sizeof(v)) < 0) && (errno == EINTR)) {
+	}
+}
+
+
+/* async.readable(fd): wait until a file descriptor (like the one of
+ * watcher:getfd()) has data */
+static int lua_async_readable(lua_State *L)
+{
+	async_loop *lp;
+	int fd;
+
+	if (!lua_isinteger(L, 1)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	fd = (int)lua_tointeger(L, 1);
+	lp = current_loop(L);
+	if (lp == NULL) {
+		wait_fd(fd, POLLIN);
+		lua_pushboolean(L, 1);
+		return 1;
+	}
+	lua_settop(L, 1);
+	if (!watch_start(L, lp, fd, 0, -1)) {
+		if (errno == EPERM) {
+			lua_pushboolean(L, 1); /* regular file */
+			return 1;
+		}
+		push_error(L);
+		return 3;
+	}
+	return lua_yieldk(L, 0, 0, readable_k);
+}
+
+#endif
+
+/* }====================================================== */
+
+
+/* {====================================================== */
+/* Streams */
+
+static async_stream *check_stream(lua_State *L, int idx)
+{
+	return (async_stream *)luaL_checkudata(L, idx, LASYNC_STREAM);
+}
+
+
+/* Make room for n more bytes at the end of the read buffer */
+static int buf_reserve(async_stream *s, size_t n)
+{
+	if ((s->bcap - s->bend < n) && (s->bstart > 0)) {
+		memmove(s->buf, s->buf + s->bstart, s->bend - s->bstart);
+		s->bend -= s->bstart;
+		s->bstart = 0;
+	}
+	if (s->bcap - s->bend < n) {
+		size_t cap = (s->bcap > 0) ? s->bcap : LASYNC_CHUNK;
+		char *p;
+		while (cap - s->bend < n) {
+			cap *= 2;
+		}
+		p = (char *)realloc(s->buf, cap);
+		if (p == NULL) {
+			return 0;
+		}
+		s->buf = p;
+		s->bcap = cap;
+	}
+	return 1;
+}
+
+
+/* Push a new stream for an open descriptor or handle */
+#ifdef _WIN32
+static async_stream *stream_new(lua_State *L, HANDLE h)
+#else
+static async_stream *stream_new(lua_State *L, int fd)
+#endif
+{
+	async_loop *lp = get_loop(L);
+	async_stream *s = (async_stream *)lua_newuserdatauv(L, sizeof(async_stream), 0);
+	memset(s, 0, sizeof(async_stream));
+	s->kind = SRC_STREAM;
+#ifdef _WIN32
+	s->h = h;
+#else
+	s->fd = fd;
+#endif
+	luaL_setmetatable(L, LASYNC_STREAM);
+	if (!stream_attach(lp, s)) {
+		stream_closehandle(s);
+		s->closed = 1;
+		return NULL;
+	}
+	return s;
+}
+
+
+static void stream_close(async_stream *s)
+{
+	if (!s->closed) {
+		stream_closehandle(s);
+		s->closed = 1;
+	}
+	free(s->buf);
+	s->buf = NULL;
+	s->bstart = s->bend = s->bcap = 0;
+}
+
+
+/* Take what the format (stack index 2) asks for from the buffer and push
+ * it. Returns 0 if more bytes are needed. */
+static int stream_take(lua_State *L, async_stream *s)
+{
+	size_t avail = s->bend - s->bstart;
+	const char *b;
+	size_t n;
+
+	if (avail == 0) {
+		/* nothing buffered, maybe no buffer yet (buf is NULL): only
+		 * read(0) is done before the end, and only "a" at the end */
+		const char *fmt = (lua_type(L, 2) == LUA_TNUMBER) ? NULL : lua_tostring(L, 2);
+		if ((fmt != NULL) && (*fmt == '*')) {
+			fmt++;
+		}
+		if (!s->eof) {
+			if ((fmt != NULL) || (lua_tointeger(L, 2) > 0)) {
+				return 0;
+			}
+			lua_pushliteral(L, "");
+		}
+		else if ((fmt != NULL) && (*fmt == 'a')) {
+			lua_pushliteral(L, "");
+		}
+		else {
+			lua_pushnil(L);
+		}
+		return 1;
+	}
+	b = s->buf + s->bstart;
+	if (lua_type(L, 2) == LUA_TNUMBER) {
+		n = (size_t)lua_tointeger(L, 2);
+		if ((avail < n) && !s->eof) {
+			return 0;
+		}
+		if (n > avail) {
+			n = avail;
+		}
+	}
+	else {
+		const char *fmt = lua_tostring(L, 2);
+		if (*fmt == '*') {
+			fmt++;
+		}
+		if (*fmt == 'a') {
+			if (!s->eof) {
+				return 0;
+			}
+			n = avail;
+		}
+		else {
+			const char *nl = (const char *)memchr(b, '\n', avail);
+			if (nl == NULL) {
+				if (!s->eof) {
+					return 0;
+				}
+				n = avail;
+				lua_pushlstring(L, b, n);
+			}
+			else {
+				n = (size_t)(nl - b) + 1;
+				lua_pushlstring(L, b, (*fmt == 'L') ? n : n - 1);
+			}
+			s->bstart += n;
+			return 1;
+		}
+	}
+	lua_pushlstring(L, b, n);
+	s->bstart += n;
+	return 1;
+}
+
+
+/* One step of a read: results pushed, ASYNC_PARKED, or -1 error */
+static int read_step(lua_State *L, async_stream *s)
+{
+	for (;;) {
+		int r = stream_take(L, s);
+		if (r > 0) {
+			return r;
+		}
+		r = stream_fill(L, s);
+		if (r < 0) {
+			return r;
+		}
+		if (r == 0) {
+			s->eof = 1;
+		}
+	}
+}
+
+
+static int stream_read_k(lua_State *L, int status, lua_KContext ctx)
+{
+	async_stream *s = check_stream(L, 1);
+	int r;
+	(void)status;
+	(void)ctx;
+
+	if (s->closed) {
+		lua_pushnil(L);
+		lua_pushliteral(L, "closed");
+		return 2;
+	}
+	r = read_step(L, s);
+	if (r == ASYNC_PARKED) {
+		return lua_yieldk(L, 0, 0, stream_read_k);
+	}
+	if (r < 0) {
+		push_error(L);
+		return 3;
+	}
+	return r;
+}
+
+
+static void check_format(lua_State *L, int idx, const char *func)
+{
+	if (lua_isnoneornil(L, idx)) {
+		lua_pushliteral(L, "l");
+		lua_replace(L, idx);
+	}
+	else if (lua_type(L, idx) == LUA_TNUMBER) {
+		if (!lua_isinteger(L, idx) || (lua_tointeger(L, idx) < 0)) {
+			luaL_error(L, "%s parameter error", func);
+		}
+	}
+	else {
+		const char *fmt = (lua_type(L, idx) == LUA_TSTRING) ? lua_tostring(L, idx) : "";
+		if (*fmt == '*') {
+			fmt++;
+		}
+		if ((*fmt != 'l') && (*fmt != 'L') && (*fmt != 'a')) {
+			luaL_error(L, "%s parameter error", func);
+		}
+	}
+}
+
+
+/* stream:read([format]): like file:read with one format ("l", "L", "a"
+ * or a number of bytes); the task is parked until the data is there */
+static int lua_async_stream_read(lua_State *L)
+{
+	check_stream(L, 1);
+	lua_settop(L, 2);
+	check_format(L, 2, __func__);
+	return stream_read_k(L, LUA_OK, 0);
+}
+
+
+static int lines_k(lua_State *L, int status, lua_KContext ctx)
+{
+	async_stream *s = check_stream(L, 1);
+	int r;
+	(void)status;
+	(void)ctx;
+
+	if (s->closed) {
+		return luaL_error(L, "stream is closed");
+	}
+	r = read_step(L, s);
+	if (r == ASYNC_PARKED) {
+		return lua_yieldk(L, 0, 0, lines_k);
+	}
+	if (r < 0) {
+		push_error(L);
+		return luaL_error(L, "%s", lua_tostring(L, -2));
+	}
+	return r;
+}
+
+
+static int lines_iter(lua_State *L)
+{
+	lua_settop(L, 0);
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_pushvalue(L, lua_upvalueindex(2));
+	return lines_k(L, LUA_OK, 0);
+}
+
+
+/* stream:lines([format]): iterator over stream:read(format) */
+static int lua_async_stream_lines(lua_State *L)
+{
+	check_stream(L, 1);
+	lua_settop(L, 2);
+	check_format(L, 2, __func__);
+	lua_pushcclosure(L, lines_iter, 2);
+	return 1;
+}
+
+
+/* Stack: 1 the stream, 2.. the strings still to write; ctx is the number
+ * of bytes of the first one that are written already */
+static int stream_write_k(lua_State *L, int status, lua_KContext ctx)
+{
+	async_stream *s = check_stream(L, 1);
+	size_t done = (size_t)ctx;
+	(void)status;
+
+	if (s->closed) {
+		lua_pushnil(L);
+		lua_pushliteral(L, "closed");
+		return 2;
+	}
+	while (lua_gettop(L) >= 2) {
+		size_t len = 0;
+		const char *p = lua_tolstring(L, 2, &len);
+		while (done < len) {
+			lua_Integer n = stream_put(L, s, p + done, len - done);
+			if (n == ASYNC_PARKED) {
+				return lua_yieldk(L, 0, (lua_KContext)done, stream_write_k);
+			}
+			if (n < 0) {
+				push_error(L);
+				return 3;
+			}
+			done += (size_t)n;
+		}
+		lua_remove(L, 2);
+		done = 0;
+	}
+	return 1;
+}
+
+
+/* stream:write(...): write strings and numbers, returns the stream */
+static int lua_async_stream_write(lua_State *L)
+{
+	int top = lua_gettop(L);
+	check_stream(L, 1);
+	for (int i = 2; i <= top; i++) {
+		if ((lua_type(L, i) != LUA_TSTRING) && (lua_type(L, i) != LUA_TNUMBER)) {
+			return luaL_error(L, "%s parameter error", __func__);
+		}
+		lua_tolstring(L, i, NULL); /* numbers become strings in place */
+	}
+	return stream_write_k(L, LUA_OK, 0);
+}
+
+
+static int lua_async_stream_close(lua_State *L)
+{
+	async_stream *s = check_stream(L, 1);
+#ifndef _WIN32
+	/* parked readers and writers get nil, "closed" (on Windows their
+	 * cancelled operation wakes them) */
+	if ((s->rw.co != NULL) || (s->ww.co != NULL)) {
+		async_loop *lp = get_loop(L);
+		wake(L, lp, &s->rw);
+		wake(L, lp, &s->ww);
+	}
+#endif
+	stream_close(s);
+	return 0;
+}
+
+
+/* async.open(path [, mode]): a stream for a file, mode "r", "w" or "a" */
+static int lua_async_open(lua_State *L)
+{
+	const char *path = lua_tostring(L, 1);
+	const char *mode = luaL_optstring(L, 2, "r");
+
+	if ((path == NULL) || (lua_type(L, 1) != LUA_TSTRING) || (strchr("rwa", *mode) == NULL) || (*mode == 0)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+#ifdef _WIN32
+	{
+		DWORD access = (*mode == 'r') ? GENERIC_READ : ((*mode == 'a') ? FILE_APPEND_DATA : GENERIC_WRITE);
+		DWORD disp = (*mode == 'r') ? OPEN_EXISTING : ((*mode == 'a') ? OPEN_ALWAYS : CREATE_ALWAYS);
+		HANDLE h = CreateFileA(path, access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, disp, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+		async_stream *s;
+		if (h == INVALID_HANDLE_VALUE) {
+			push_error(L);
+			return 3;
+		}
+		s = stream_new(L, h);
+		if (s == NULL) {
+			push_error(L);
+			return 3;
+		}
+		s->append = (*mode == 'a');
+	}
+#else
+	{
+		int flags = (*mode == 'r') ? O_RDONLY : (O_WRONLY | O_CREAT | ((*mode == 'a') ? O_APPEND : O_TRUNC));
+		int fd = open(path, flags | O_CLOEXEC, 0666);
+		if (fd < 0) {
+			push_error(L);
+			return 3;
+		}
+		if (stream_new(L, fd) == NULL) {
+			push_error(L);
+			return 3;
+		}
+	}
+#endif
+	return 1;
+}
+
+
+static int lua_async_stream_gc(lua_State *L)
+{
+	async_stream *s = check_stream(L, 1);
+	stream_close(s);
+	return 0;
+}
+
+/* }====================================================== */
+
+
+/* {====================================================== */
+/* Processes */
+
+typedef struct async_process {
+#ifdef _WIN32
+	HANDLE h;
+	DWORD pid;
+#else
+	pid_t pid;
+	int pidfd; /* readable once the process ended, or -1 */
+#endif
+	int exited;
+	int code;
+} async_process;
+
+
+static async_process *check_process(lua_State *L, int idx)
+{
+	return (async_process *)luaL_checkudata(L, idx, LASYNC_PROCESS);
+}
+
+
+/* Check (or with block, wait) for the end of the process */
+static int process_poll(async_process *p, int block)
+{
+#ifdef _WIN32
+	DWORD code = 0;
+	if (WaitForSingleObject(p->h, block ? INFINITE : 0) != WAIT_OBJECT_0) {
+		return 0;
+	}
+	GetExitCodeProcess(p->h, &code);
+	p->code = (int)code;
+#else
+	int st = 0;
+	pid_t r;
+	do {
+		r = waitpid(p->pid, &st, block ? 0 : WNOHANG);
+	} while ((r < 0) && (errno == EINTR));
+	if (r == 0) {
+		return 0;
+	}
+	if (r < 0) {
+		p->code = -1;
+	}
+	else {
+		p->code = WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+	}
+#endif
+	p->exited = 1;
+	return 1;
+}
+
+
+static int process_wait_k(lua_State *L, int status, lua_KContext ctx)
+{
+	async_process *p = check_process(L, 1);
+	(void)status;
+	(void)ctx;
+
+	if (!p->exited && !process_poll(p, 0)) {
+		async_loop *lp = current_loop(L);
+		if (lp != NULL) {
+			/* park until the process handle or pidfd is signaled, or
+			 * check again a bit later */
+#ifdef _WIN32
+			if (!watch_start(L, lp, p->h, -1)) {
+#else
+			if ((p->pidfd < 0) || !watch_start(L, lp, p->pidfd, 1, -1)) {
+#endif
+				park_until(L, lp, async_now_ms() + ASYNC_WAITPOLL);
+			}
+			return lua_yieldk(L, 0, 0, process_wait_k);
+		}
+		process_poll(p, 1);
+	}
+	lua_pushinteger(L, p->code);
+	return 1;
+}
+
+
+/* process:wait(): the exit code */
+static int lua_async_process_wait(lua_State *L)
+{
+	check_process(L, 1);
+	lua_settop(L, 1);
+	return process_wait_k(L, LUA_OK, 0);
+}
+
+
+static int lua_async_process_kill(lua_State *L)
+{
+	async_process *p = check_process(L, 1);
+	int ok = 1;
+	if (!p->exited) {
+#ifdef _WIN32
+		ok = TerminateProcess(p->h, 1);
+#else
+		ok = (kill(p->pid, SIGTERM) == 0);
+#endif
+	}
+	if (!ok) {
+		push_error(L);
+		return 3;
+	}
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+
+static int lua_async_process_pid(lua_State *L)
+{
+	async_process *p = check_process(L, 1);
+	lua_pushinteger(L, (lua_Integer)p->pid);
+	return 1;
+}
+
+
+/* process.stdin and process.stdout are its pipes, the rest are methods */
+static int lua_async_process_index(lua_State *L)
+{
+	const char *key = lua_tostring(L, 2);
+	check_process(L, 1);
+	if ((key != NULL) && (strcmp(key, "stdin") == 0)) {
+		lua_getiuservalue(L, 1, 1);
+	}
+	else if ((key != NULL) && (strcmp(key, "stdout") == 0)) {
+		lua_getiuservalue(L, 1, 2);
+	}
+	else {
+		lua_pushvalue(L, 2);
+		lua_rawget(L, lua_upvalueindex(1));
+	}
+	return 1;
+}
+
+
+#ifndef _WIN32
+static void *process_reap(void *param)
+{
+	pid_t pid = (pid_t)(intptr_t)param;
+	while ((waitpid(pid, NULL, 0) < 0) && (errno == EINTR)) {
+	}
+	return NULL;
+}
+#endif
+
+
+/* A process still running when its userdata goes is left running. On
+ * POSIX a detached thread waits for its end, so it does not stay a
+ * zombie. */
+static int lua_async_process_gc(lua_State *L)
+{
+	async_process *p = check_process(L, 1);
+#ifdef _WIN32
+	if (p->h != NULL) {
+		CloseHandle(p->h);
+		p->h = NULL;
+	}
+#else
+	if (p->pidfd >= 0) {
+		close(p->pidfd);
+		p->pidfd = -1;
+	}
+	if ((p->pid > 0) && !p->exited && !process_poll(p, 0)) {
+		pthread_attr_t attr;
+		pthread_t t;
+		int ok = (pthread_attr_init(&attr) == 0);
+		if (ok) {
+			pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+			pthread_attr_setstacksize(&attr, ASYNC_REAPSTACK);
+			ok = (pthread_create(&t, &attr, process_reap, (void *)(intptr_t)p->pid) == 0);
+			pthread_attr_destroy(&attr);
+		}
+		if (ok) {
+			p->exited = 1;
+		}
+	}
+#endif
+	return 0;
+}
+
+
+#ifdef _WIN32
+/* An overlapped named pipe for our side and an inheritable handle of the
+ * other end for the child (anonymous pipes cannot do overlapped I/O) */
+static HANDLE make_pipe(HANDLE *child, int inbound)
+{
+	static volatile LONG serial = 0;
+	SECURITY_ATTRIBUTES sa;
+	char name[80];
+	HANDLE ours;
+
+	snprintf(name, sizeof(name), "\\\\.\\pipe\\lp4w-async-%lu-%ld", (unsigned long)GetCurrentProcessId(), (long)InterlockedIncrement(&serial));
+	ours = CreateNamedPipeA(name, (inbound ? PIPE_ACCESS_INBOUND : PIPE_ACCESS_OUTBOUND) | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+	                        PIPE_TYPE_BYTE | PIPE_WAIT, 1, LASYNC_CHUNK, LASYNC_CHUNK, 0, NULL);
+	if (ours == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+	sa.nLength = sizeof(sa);
+	sa.lpSecurityDescriptor = NULL;
+	sa.bInheritHandle = TRUE;
+	*child = CreateFileA(name, inbound ? GENERIC_WRITE : GENERIC_READ, 0, &sa, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (*child == INVALID_HANDLE_VALUE) {
+		CloseHandle(ours);
+		return NULL;
+	}
+	return ours;
+}
+#else
+/* A pipe whose ends are not inherited by other children */
+static int make_pipe(int fd[2])
+{
+	if (pipe(fd) != 0) {
+		return -1;
+	}
+	fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+	return 0;
+}
+#endif
+
+
+/* async.process(cmd): run a shell command with pipes to its stdin and
+ * from its stdout (stderr is inherited) */
+static int lua_async_process(lua_State *L)
+{
+	const char *cmd = lua_tostring(L, 1);
+	async_process *p;
+
+	if ((cmd == NULL) || (lua_type(L, 1) != LUA_TSTRING)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	lua_settop(L, 1);
+	p = (async_process *)lua_newuserdatauv(L, sizeof(async_process), 2);
+	memset(p, 0, sizeof(async_process));
+#ifndef _WIN32
+	p->pidfd = -1;
+#endif
+	luaL_setmetatable(L, LASYNC_PROCESS);
+#ifdef _WIN32
+	{
+		HANDLE cin = NULL, cout = NULL, in, out;
+		STARTUPINFOA si;
+		PROCESS_INFORMATION pi;
+		const char *shell = getenv("COMSPEC");
+		char *line;
+		BOOL ok;
+
+		in = make_pipe(&cin, 0);
+		out = (in != NULL) ? make_pipe(&cout, 1) : NULL;
+		if (out == NULL) {
+			push_error(L);
+			if (in != NULL) {
+				CloseHandle(in);
+				CloseHandle(cin);
+			}
+			return 3;
+		}
+		lua_pushfstring(L, "\"%s\" /c %s", (shell != NULL) ? shell : "cmd.exe", cmd);
+		line = (char *)lua_tostring(L, -1); /* CreateProcessA may modify it: a fresh copy */
+		memset(&si, 0, sizeof(si));
+		si.cb = sizeof(si);
+		si.dwFlags = STARTF_USESTDHANDLES;
+		si.hStdInput = cin;
+		si.hStdOutput = cout;
+		si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+		ok = CreateProcessA(NULL, line, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi);
+		CloseHandle(cin);
+		CloseHandle(cout);
+		lua_pop(L, 1);
+		if (!ok) {
+			push_error(L);
+			CloseHandle(in);
+			CloseHandle(out);
+			return 3;
+		}
+		CloseHandle(pi.hThread);
+		p->h = pi.hProcess;
+		p->pid = pi.dwProcessId;
+		if ((stream_new(L, in) == NULL) || (lua_setiuservalue(L, 2, 1), stream_new(L, out) == NULL)) {
+			push_error(L);
+			if (lua_type(L, -4) != LUA_TUSERDATA) {
+				CloseHandle(out);
+			}
+			return 3;
+		}
+		lua_setiuservalue(L, 2, 2);
+	}
+#else
+	{
+		int in[2], out[2];
+		pid_t pid;
+
+		if (make_pipe(in) != 0) {
+			push_error(L);
+			return 3;
+		}
+		if (make_pipe(out) != 0) {
+			push_error(L);
+			close(in[0]);
+			close(in[1]);
+			return 3;
+		}
+		pid = fork();
+		if (pid == 0) {
+			/* dup2 clears close-on-exec of the copies */
+			dup2(in[0], 0);
+			dup2(out[1], 1);
+			execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+			_exit(127);
+		}
+		close(in[0]);
+		close(out[1]);
+		if (pid < 0) {
+			push_error(L);
+			close(in[1]);
+			close(out[0]);
+			return 3;
+		}
+		p->pid = pid;
+#ifdef SYS_pidfd_open
+		p->pidfd = (int)syscall(SYS_pidfd_open, pid, 0); /* close-on-exec */
+#endif
+		if (stream_new(L, in[1]) == NULL) {
+			push_error(L);
+			close(out[0]);
+			return 3;
+		}
+		lua_setiuservalue(L, 2, 1);
+		if (stream_new(L, out[0]) == NULL) {
+			push_error(L);
+			return 3;
+		}
+		lua_setiuservalue(L, 2, 2);
+	}
+#endif
+	return 1;
+}
+
+/* }====================================================== */
+
+
+/* {====================================================== */
+/* Tasks and timers */
+
+/* async.spawn(fn, ...): start fn(...) as a task, returns its coroutine */
+static int lua_async_spawn(lua_State *L)
+{
+	async_loop *lp = get_loop(L);
+	if (lua_type(L, 1) != LUA_TFUNCTION) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	task_new(L, lp, 1, lua_gettop(L) - 1);
+	return 1;
+}
+
+
+/* async.run(main, ...): run main(...) and all other tasks until they are
+ * done, returns the results of main. An error of a task ends the run. */
+static int lua_async_run(lua_State *L)
+{
+	async_loop *lp = get_loop(L);
+	int nargs = lua_gettop(L) - 1;
+	int status;
+
+	if (lua_type(L, 1) != LUA_TFUNCTION) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	if (lp->running) {
+		return luaL_error(L, "%s already running", __func__);
+	}
+	lua_pushcfunction(L, loop_run);
+	lua_getfield(L, LUA_REGISTRYINDEX, LASYNC_LOOP);
+	task_new(L, lp, 1, nargs);
+	lp->running = 1;
+	status = lua_pcall(L, 2, LUA_MULTRET, 0);
+	lp->running = 0;
+	if (status != LUA_OK) {
+		loop_reset(L, lp);
+		return lua_error(L);
+	}
+	return lua_gettop(L) - (nargs + 1);
+}
+
+
+static int sleep_k(lua_State *L, int status, lua_KContext ctx)
+{
+	(void)L;
+	(void)status;
+	(void)ctx;
+	return 0;
+}
+
+
+/* async.sleep(seconds): park the task (or block) for a while.
+ * async.sleep(0) lets the other ready tasks run first. */
+static int lua_async_sleep(lua_State *L)
+{
+	lua_Number t = lua_tonumber(L, 1);
+	async_loop *lp;
+	uint64_t ms;
+
+	if ((lua_type(L, 1) != LUA_TNUMBER) || !(t >= 0) || (t > 1e9)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	ms = (uint64_t)(t * 1000 + 0.5);
+	lp = current_loop(L);
+	if (lp == NULL) {
+#ifdef _WIN32
+		Sleep((DWORD)ms);
+#else
+		struct timespec ts;
+		ts.tv_sec = (time_t)(ms / 1000);
+		ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+		while ((nanosleep(&ts, &ts) != 0) && (errno == EINTR)) {
+		}
+#endif
+		return 0;
+	}
+	park_until(L, lp, async_now_ms() + ms);
+	return lua_yieldk(L, 0, 0, sleep_k);
+}
+
+
+/* async.now(): monotonic time in seconds */
+static int lua_async_now(lua_State *L)
+{
+	lua_pushnumber(L, (lua_Number)async_now_ms() / 1000);
+	return 1;
+}
+
+
+/* Stack: 1 the channel, 2 the timeout, 3 the deadline (ms), 4 the delay
+ * until the next try (ms) when polling, 5 the wakeup descriptor of the
+ * channel (ch:getfd()) or nil */
+static int recv_k(lua_State *L, int status, lua_KContext ctx)
+{
+	async_loop *lp = current_loop(L);
+	lua_Integer delay = lua_tointeger(L, 4);
+	lua_Integer left = -1;
+	int n;
+	(void)status;
+	(void)ctx;
+
+	lua_settop(L, 5);
+	if (!lua_isnil(L, 5)) {
+		/* a message sent after this signals it again */
+		wakeup_reset(L, 5);
+	}
+	lua_getfield(L, 1, "recv");
+	lua_pushvalue(L, 1);
+	lua_pushinteger(L, 0);
+	lua_call(L, 2, LUA_MULTRET);
+	n = lua_gettop(L) - 5;
+	if ((n != 2) || !lua_isnil(L, 6) || (lua_type(L, 7) != LUA_TSTRING) || (strcmp(lua_tostring(L, 7), "timeout") != 0)) {
+		return n;
+	}
+	if (!lua_isnil(L, 2)) {
+		left = lua_tointeger(L, 3) - (lua_Integer)async_now_ms();
+		if (left <= 0) {
+			return n;
+		}
+	}
+	if (lp == NULL) {
+		return n;
+	}
+	lua_settop(L, 5);
+	if (!lua_isnil(L, 5) && wakeup_start(L, lp, 5, (left > 0x7FFFFFFF) ? 0x7FFFFFFF : (long)left)) {
+		return lua_yieldk(L, 0, 0, recv_k);
+	}
+	park_until(L, lp, async_now_ms() + (uint64_t)delay);
+	lua_pushinteger(L, (delay < ASYNC_RECVPOLL) ? delay * 2 : ASYNC_RECVPOLL);
+	lua_replace(L, 4);
+	return lua_yieldk(L, 0, 0, recv_k);
+}
+
+
+/* async.recv(channel [, timeout]): channel:recv(timeout) that parks the
+ * task instead of blocking the loop. The task waits for the descriptor
+ * of channel:getfd() where there is one, and polls otherwise. Background
+ * work runs in a threads.spawn worker and reports on a channel. */
+static int lua_async_recv(lua_State *L)
+{
+	lua_settop(L, 2);
+	if (!lua_isnil(L, 2) && ((lua_type(L, 2) != LUA_TNUMBER) || !(lua_tonumber(L, 2) >= 0))) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	if (current_loop(L) == NULL) {
+		lua_getfield(L, 1, "recv");
+		lua_insert(L, 1);
+		lua_call(L, 2, LUA_MULTRET);
+		return lua_gettop(L);
+	}
+	lua_pushinteger(L, lua_isnil(L, 2) ? 0 : (lua_Integer)async_now_ms() + (lua_Integer)(lua_tonumber(L, 2) * 1000));
+	lua_pushinteger(L, 1);
+	if (lua_getfield(L, 1, "getfd") == LUA_TFUNCTION) {
+		lua_pushvalue(L, 1);
+		lua_call(L, 1, 1);
+	}
+	else {
+		lua_pop(L, 1);
+		lua_pushnil(L);
+	}
+	return recv_k(L, LUA_OK, 0);
+}
+
+/* }====================================================== */
+
+
+static const struct luaL_Reg stream_methods[] = {
+	{ "read", lua_async_stream_read },
+	{ "lines", lua_async_stream_lines },
+	{ "write", lua_async_stream_write },
+	{ "close", lua_async_stream_close },
+
+	{ NULL, NULL },
+};
+
+
+static const struct luaL_Reg process_methods[] = {
+	{ "wait", lua_async_process_wait },
+	{ "kill", lua_async_process_kill },
+	{ "pid", lua_async_process_pid },
+
+	{ NULL, NULL },
+};
+
+
+static const struct luaL_Reg funclist[] = {
+	{ "run", lua_async_run },
+	{ "spawn", lua_async_spawn },
+	{ "sleep", lua_async_sleep },
+	{ "now", lua_async_now },
+	{ "open", lua_async_open },
+	{ "process", lua_async_process },
+	{ "readable", lua_async_readable },
+	{ "recv", lua_async_recv },
+
+	{ NULL, NULL },
+};
+
+
+int luaopen_async(lua_State *L)
+{
+	luaL_newmetatable(L, LASYNC_LOOP);
+	lua_pushcfunction(L, lua_async_loop_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+
+	luaL_newmetatable(L, LASYNC_STREAM);
+	lua_pushcfunction(L, lua_async_stream_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_newtable(L);
+	luaL_setfuncs(L, stream_methods, 0);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
+	luaL_newmetatable(L, LASYNC_PROCESS);
+	lua_pushcfunction(L, lua_async_process_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_newtable(L);
+	luaL_setfuncs(L, process_methods, 0);
+	lua_pushcclosure(L, lua_async_process_index, 1);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
+	luaL_newlib(L, funclist);
+	lua_pushvalue(L, -1);
+	lua_setglobal(L, "async");
+	return 1;
+}
@@ -0,0 +1,23 @@
+#ifndef LASYNC_H
+#define LASYNC_H
+
+#include "lua.h"
+
+
+/* Registry key of the event loop, metatables of streams and processes */
+#define LASYNC_LOOP "async.loop"
+#define LASYNC_STREAM "async.stream"
+#define LASYNC_PROCESS "async.process"
+
+/* Bytes requested from the system per read, and per write on Windows */
+#define LASYNC_CHUNK 65536
+
+
+/* The event loop runs tasks (coroutines) of one Lua state. A task that
+ * would block in a stream read or write, a sleep or a wait is parked with
+ * lua_yieldk and resumed by the loop once its descriptor is ready (epoll)
+ * or its I/O has completed (IOCP on Windows). Called outside of a task,
+ * the same functions block like their io library counterparts. */
+int luaopen_async(lua_State *L);
+
+#endif /* LASYNC_H */
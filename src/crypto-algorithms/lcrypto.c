@@ -9,6 +9,7 @@
 #endif
 
 #include "lua_all.h"
+#include "strbuf/lstrbuf.h"
 
 #include "aes.h"
 #include "arcfour.h"
@@ -116,6 +117,7 @@ static void Decrypt_DES(uint8_t *dst, uint8_t *src, void *sched)
 static int lua_base64_encode(lua_State *L)
 {
 	int newline = 0;
+	lstrbuf *sb = NULL;
 
 	if (lua_type(L, 1) != LUA_TSTRING) {
 		return luaL_error(L, "%s parameter error", __func__);
@@ -126,15 +128,34 @@ static int lua_base64_encode(lua_State *L)
 	else if ((lua_type(L, 2) != LUA_TNONE) && (lua_type(L, 2) != LUA_TNIL)) {
 		return luaL_error(L, "%s parameter error", __func__);
 	}
+	if (lua_type(L, 3) == LUA_TUSERDATA) {
+		sb = lstrbuf_test(L, 3);
+		if (sb == NULL) {
+			return luaL_error(L, "%s parameter error", __func__);
+		}
+	}
+	else if (lua_type(L, 3) != LUA_TNONE) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
 
 	size_t in_len = 0;
 	const char *in = lua_tolstring(L, 1, &in_len);
-	size_t out_len = base64_encode(in, NULL, in_len, newline);
+	size_t out_len = base64_encode((const BYTE *)in, NULL, in_len, newline);
+	if (sb != NULL) {
+		/* encode directly into the string buffer */
+		char *dst = lstrbuf_prepare(L, sb, out_len + 1);
+		if (base64_encode((const BYTE *)in, (BYTE *)dst, in_len, newline) != out_len) {
+			return luaL_error(L, "%s consistency error", __func__);
+		}
+		lstrbuf_addsize(sb, out_len);
+		lua_settop(L, 3);
+		return 1;
+	}
 	char * out = malloc(out_len + 1);
 	if (out == NULL) {
 		return luaL_error(L, "%s out of memory", __func__);
 	}
-	size_t out_len2 = base64_encode(in, out, in_len, newline);
+	size_t out_len2 = base64_encode((const BYTE *)in, (BYTE *)out, in_len, newline);
 	if (out_len != out_len2) {
 		free(out);
 		return luaL_error(L, "%s consistency error", __func__);
@@ -872,6 +893,7 @@ static unsigned char fromhex(char c)
 static int lua_hex_encode(lua_State *L)
 {
 	int upper = 1;
+	lstrbuf *sb = NULL;
 
 	if (lua_type(L, 1) != LUA_TSTRING) {
 		return luaL_error(L, "%s parameter error", __func__);
@@ -882,12 +904,28 @@ static int lua_hex_encode(lua_State *L)
 	else if ((lua_type(L, 2) != LUA_TNONE) && (lua_type(L, 2) != LUA_TNIL)) {
 		return luaL_error(L, "%s parameter error", __func__);
 	}
+	if (lua_type(L, 3) == LUA_TUSERDATA) {
+		sb = lstrbuf_test(L, 3);
+		if (sb == NULL) {
+			return luaL_error(L, "%s parameter error", __func__);
+		}
+	}
+	else if (lua_type(L, 3) != LUA_TNONE) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
 
 	size_t in_len = 0;
 	const char *in = lua_tolstring(L, 1, &in_len);
 
 	size_t out_len = in_len * 2;
-	char * out = malloc(out_len + 1);
+	char * out;
+	if (sb != NULL) {
+		/* encode directly into the string buffer */
+		out = lstrbuf_prepare(L, sb, out_len);
+	}
+	else {
+		out = malloc(out_len + 1);
+	}
 	if (out == NULL) {
 		return luaL_error(L, "%s out of memory", __func__);
 	}
@@ -897,6 +935,11 @@ static int lua_hex_encode(lua_State *L)
 		out[2 * i + 1] = tohex(((unsigned char)in[i]) & 0x0F, upper);
 	}
 
+	if (sb != NULL) {
+		lstrbuf_addsize(sb, out_len);
+		lua_settop(L, 3);
+		return 1;
+	}
 
 	lua_pushlstring(L, out, out_len);
 	free(out);
@@ -944,6 +987,9 @@ static uint32_t crc32table[256];
 
 static void init_crc_tables()
 {
+	if (crc32table[255] != 0) {
+		return; /* filled when an earlier state opened the library */
+	}
 	for (int i = 0; i<256; i++) {
 		uint8_t c = (uint8_t)i;
 		uint16_t crc16 = 0;
@@ -7,8 +7,10 @@
 ** This library offers these functions:
 **   lfs.attributes (filepath [, attributename | attributetable])
 **   lfs.chdir (path)
+**   lfs.compile_glob (pattern)
 **   lfs.currentdir ()
 **   lfs.dir (path)
+**   lfs.glob (pattern)
 **   lfs.link (old, new[, symlink])
 **   lfs.lock (fh, mode)
 **   lfs.lock_dir (path)
@@ -18,6 +20,7 @@
 **   lfs.symlinkattributes (filepath [, attributename])
 **   lfs.touch (filepath [, atime [, mtime]])
 **   lfs.unlock (fh)
+**   lfs.watch (paths [, options])
 */
 
 #ifndef LFS_DO_NOT_USE_LARGE_FILE
@@ -38,6 +41,7 @@
 #define _LARGEFILE64_SOURCE
 #endif
 
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
@@ -63,6 +67,8 @@
 /* MAX_PATH seems to be 260. Seems kind of small. Is there a better one? */
 #define LFS_MAXPATHLEN MAX_PATH
 
+#define LFS_HAVE_WATCH
+
 #else
 
 #include <unistd.h>
@@ -72,6 +78,12 @@
 #include <utime.h>
 #include <sys/param.h>          /* for MAXPATHLEN */
 
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#define LFS_HAVE_WATCH
+#endif
+
 #ifdef MAXPATHLEN
 #define LFS_MAXPATHLEN MAXPATHLEN
 #else
@@ -121,6 +133,7 @@ typedef struct dir_data {
 } dir_data;
 
 #define LOCK_METATABLE "lock metatable"
+#define WATCH_METATABLE "watcher metatable"
 
 #ifdef _WIN32
 
@@ -1136,6 +1149,1487 @@ static int link_info(lua_State * L)
 }
 
 
+/*
+** File system change notification.
+** A watcher collects the changes below a set of paths and hands them
+** out in batches, so scripts do not have to poll lfs.attributes.
+** Linux uses inotify, Windows uses ReadDirectoryChangesW.
+*/
+#ifdef LFS_HAVE_WATCH
+
+#define WATCH_EV_CREATED  0x01
+#define WATCH_EV_REMOVED  0x02
+#define WATCH_EV_MODIFIED 0x04
+#define WATCH_EV_ATTRIB   0x08
+#define WATCH_EV_RENAMED  0x10
+#define WATCH_EV_ALL      0x1F
+
+static const char *const watch_evnames[] = {
+  "created", "removed", "modified", "attrib", "renamed", NULL
+};
+
+/*
+** First halves of renames still waiting for their second half. They
+** survive across polls: an entry that finds no partner during the poll
+** that read it and the following one is reported as "removed".
+*/
+#define WATCH_MAXPENDING 64
+
+/* how long (ms) a poll waits for the second half of a rename */
+#define WATCH_PAIRWAIT 10
+
+typedef struct watch_pending {
+  unsigned long cookie;
+  char *path;                   /* old path */
+  int isdir;
+  int age;                      /* polls it has been waiting */
+} watch_pending;
+
+#ifdef _WIN32
+/* paths per watcher */
+#define WATCH_MAXDIRS 64
+
+typedef struct watch_dir {
+  HANDLE h;
+  OVERLAPPED ov;
+  int armed;
+  unsigned long cookie;         /* of the last RENAMED_OLD_NAME */
+  char *path;
+  DWORD buf[16384];             /* must be DWORD aligned */
+} watch_dir;
+
+typedef struct lfs_Watcher {
+  int closed;
+  int recursive;
+  int events;
+  int npend;
+  watch_pending pend[WATCH_MAXPENDING];
+  HANDLE ready;                 /* signaled by every watched directory */
+  unsigned long cookies;
+  int n;
+  watch_dir *dirs[WATCH_MAXDIRS];
+} lfs_Watcher;
+#else
+typedef struct watch_node {
+  int wd;
+  int top;                      /* added by the user, not by recursion */
+  char *path;
+} watch_node;
+
+typedef struct lfs_Watcher {
+  int closed;
+  int recursive;
+  int events;
+  int npend;
+  watch_pending pend[WATCH_MAXPENDING];
+  int fd;
+  int n, size;
+  watch_node *nodes;
+} lfs_Watcher;
+#endif
+
+
+static lfs_Watcher *check_watcher(lua_State * L)
+{
+  lfs_Watcher *w = (lfs_Watcher *) luaL_checkudata(L, 1, WATCH_METATABLE);
+  luaL_argcheck(L, w->closed == 0, 1, "closed watcher");
+  return w;
+}
+
+
+/*
+** Returns a malloc'ed "dir/name" (just "dir" if 'namelen' is 0), or
+** NULL if out of memory.
+*/
+static char *watch_join(const char *dir, const char *name, size_t namelen)
+{
+  size_t dl = strlen(dir);
+  char *p = (char *) malloc(dl + namelen + 2);
+  if (p == NULL)
+    return NULL;
+  memcpy(p, dir, dl);
+  if (namelen > 0) {
+    p[dl++] = '/';
+    memcpy(p + dl, name, namelen);
+    dl += namelen;
+  }
+  p[dl] = '\0';
+  return p;
+}
+
+
+/*
+** Appends { path = dir/name, event = ev } to the result table on top
+** of the stack and returns its index in that table.
+*/
+static lua_Integer watch_push_event(lua_State * L, const char *dir,
+                                    const char *name, size_t namelen,
+                                    int ev)
+{
+  lua_Integer n = (lua_Integer) lua_rawlen(L, -1) + 1;
+  lua_createtable(L, 0, 3);
+  if (dir != NULL) {
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    luaL_addstring(&b, dir);
+    if (namelen > 0) {
+      luaL_addchar(&b, '/');
+      luaL_addlstring(&b, name, namelen);
+    }
+    luaL_pushresult(&b);
+    lua_setfield(L, -2, "path");
+  }
+  if (ev == 0) {
+    lua_pushliteral(L, "overflow");
+  } else {
+    int i = 0;
+    while ((1 << i) != ev)
+      i++;
+    lua_pushstring(L, watch_evnames[i]);
+  }
+  lua_setfield(L, -2, "event");
+  lua_rawseti(L, -2, n);
+  return n;
+}
+
+
+/*
+** Reports a completed rename, either as one "renamed" event with the
+** old path in 'from' or, if that is not selected, as "removed" plus
+** "created".
+*/
+static void watch_push_renamed(lua_State * L, lfs_Watcher * w,
+                               const char *from, const char *to)
+{
+  if (w->events & WATCH_EV_RENAMED) {
+    lua_Integer idx = watch_push_event(L, to, NULL, 0, WATCH_EV_RENAMED);
+    lua_rawgeti(L, -1, idx);
+    lua_pushstring(L, from);
+    lua_setfield(L, -2, "from");
+    lua_pop(L, 1);
+  } else {
+    if (w->events & WATCH_EV_REMOVED)
+      watch_push_event(L, from, NULL, 0, WATCH_EV_REMOVED);
+    if (w->events & WATCH_EV_CREATED)
+      watch_push_event(L, to, NULL, 0, WATCH_EV_CREATED);
+  }
+}
+
+
+/* drops whatever is kept for the directory tree at 'path' */
+static void watch_forget(lfs_Watcher * w, const char *path);
+
+
+static int watch_find_pending(lfs_Watcher * w, unsigned long cookie)
+{
+  int i;
+  for (i = 0; i < w->npend; i++) {
+    if (w->pend[i].cookie == cookie)
+      return i;
+  }
+  return -1;
+}
+
+
+static void watch_drop_pending(lfs_Watcher * w, int i)
+{
+  free(w->pend[i].path);
+  w->npend--;
+  memmove(&w->pend[i], &w->pend[i + 1],
+          (w->npend - i) * sizeof(watch_pending));
+}
+
+
+/* reports pending entry 'i' as removed */
+static void watch_expire_pending(lua_State * L, lfs_Watcher * w, int i)
+{
+  if (w->pend[i].isdir)
+    watch_forget(w, w->pend[i].path);
+  if (w->events & WATCH_EV_REMOVED)
+    watch_push_event(L, w->pend[i].path, NULL, 0, WATCH_EV_REMOVED);
+  watch_drop_pending(w, i);
+}
+
+
+/*
+** Stores the first half of a rename. If the table is full, the oldest
+** entry gives up waiting.
+*/
+static void watch_add_pending(lua_State * L, lfs_Watcher * w,
+                              unsigned long cookie, const char *dir,
+                              const char *name, size_t namelen, int isdir)
+{
+  watch_pending *pd;
+  char *path = watch_join(dir, name, namelen);
+  if (path == NULL) {
+    if (w->events & WATCH_EV_REMOVED)
+      watch_push_event(L, dir, name, namelen, WATCH_EV_REMOVED);
+    return;
+  }
+  if (w->npend == WATCH_MAXPENDING)
+    watch_expire_pending(L, w, 0);
+  pd = &w->pend[w->npend++];
+  pd->cookie = cookie;
+  pd->path = path;
+  pd->isdir = isdir;
+  pd->age = 0;
+}
+
+
+/*
+** Called at the end of a poll: entries that have already waited
+** through a whole poll are reported as removed, the others age.
+*/
+static void watch_expire(lua_State * L, lfs_Watcher * w)
+{
+  int i = 0;
+  while (i < w->npend) {
+    if (w->pend[i].age > 0)
+      watch_expire_pending(L, w, i);
+    else
+      w->pend[i++].age++;
+  }
+}
+
+
+static int watch_has_fresh(lfs_Watcher * w)
+{
+  int i;
+  for (i = 0; i < w->npend; i++) {
+    if (w->pend[i].age == 0)
+      return 1;
+  }
+  return 0;
+}
+
+
+static void watch_clear_pending(lfs_Watcher * w)
+{
+  while (w->npend > 0)
+    free(w->pend[--w->npend].path);
+}
+
+
+static int watch_add_path(lua_State * L, lfs_Watcher * w, const char *path);
+
+#ifdef _WIN32
+
+static int watch_arm(watch_dir * d, int recursive)
+{
+  DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME
+      | FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE
+      | FILE_NOTIFY_CHANGE_LAST_WRITE;
+  d->armed = ReadDirectoryChangesW(d->h, d->buf, sizeof(d->buf), recursive,
+                                   filter, NULL, &d->ov, NULL);
+  return d->armed;
+}
+
+
+static void watch_free_dir(watch_dir * d)
+{
+  if (d->h != INVALID_HANDLE_VALUE) {
+    CancelIo(d->h);
+    CloseHandle(d->h);
+  }
+  free(d->path);
+  free(d);
+}
+
+
+static void watch_forget(lfs_Watcher * w, const char *path)
+{
+  /* ReadDirectoryChangesW follows the tree, nothing is kept per path */
+  (void) w;
+  (void) path;
+}
+
+
+static int watch_add_path(lua_State * L, lfs_Watcher * w, const char *path)
+{
+  watch_dir *d;
+  if (w->n >= WATCH_MAXDIRS) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "cannot watch '%s': too many paths", path);
+    return 2;
+  }
+  d = (watch_dir *) calloc(1, sizeof(watch_dir));
+  if (d == NULL || (d->path = _strdup(path)) == NULL) {
+    free(d);
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(ENOMEM));
+    return 2;
+  }
+  d->h = CreateFile(path, FILE_LIST_DIRECTORY,
+                    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                    NULL, OPEN_EXISTING,
+                    FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+  d->ov.hEvent = w->ready;
+  if (d->h == INVALID_HANDLE_VALUE || !watch_arm(d, w->recursive)) {
+    watch_free_dir(d);
+    return lfs_win32_pusherror(L);
+  }
+  w->dirs[w->n++] = d;
+  return 0;
+}
+
+
+static int watch_close(lua_State * L)
+{
+  lfs_Watcher *w = (lfs_Watcher *) luaL_checkudata(L, 1, WATCH_METATABLE);
+  int i;
+  for (i = 0; i < w->n; i++)
+    watch_free_dir(w->dirs[i]);
+  if (w->ready != NULL)
+    CloseHandle(w->ready);
+  w->ready = NULL;
+  w->n = 0;
+  watch_clear_pending(w);
+  w->closed = 1;
+  return 0;
+}
+
+
+static void watch_read_dir(lua_State * L, lfs_Watcher * w, watch_dir * d)
+{
+  DWORD bytes = 0;
+  char name[LFS_MAXPATHLEN * 2];
+  const char *p = (const char *) d->buf;
+  d->armed = 0;
+  if (!GetOverlappedResult(d->h, &d->ov, &bytes, FALSE))
+    return;
+  if (bytes == 0) {
+    /* the system buffer overflowed, the changes are lost */
+    watch_push_event(L, d->path, NULL, 0, 0);
+  }
+  while (bytes > 0) {
+    const FILE_NOTIFY_INFORMATION *fni = (const FILE_NOTIFY_INFORMATION *) p;
+    int len = WideCharToMultiByte(CP_ACP, 0, fni->FileName,
+                                  fni->FileNameLength / sizeof(WCHAR),
+                                  name, sizeof(name), NULL, NULL);
+    int ev = 0;
+    int i;
+    for (i = 0; i < len; i++) {
+      if (name[i] == '\\')
+        name[i] = '/';
+    }
+    switch (fni->Action) {
+    case FILE_ACTION_ADDED:
+      ev = WATCH_EV_CREATED;
+      break;
+    case FILE_ACTION_REMOVED:
+      ev = WATCH_EV_REMOVED;
+      break;
+    case FILE_ACTION_MODIFIED:
+      ev = WATCH_EV_MODIFIED;
+      break;
+    case FILE_ACTION_RENAMED_OLD_NAME:
+      /* the new name follows in the same or the next buffer */
+      if (++w->cookies == 0)
+        w->cookies = 1;
+      d->cookie = w->cookies;
+      watch_add_pending(L, w, d->cookie, d->path, name, len, 0);
+      break;
+    case FILE_ACTION_RENAMED_NEW_NAME:
+      i = d->cookie ? watch_find_pending(w, d->cookie) : -1;
+      d->cookie = 0;
+      if (i >= 0) {
+        char *to = watch_join(d->path, name, len);
+        if (to != NULL) {
+          watch_push_renamed(L, w, w->pend[i].path, to);
+          free(to);
+        }
+        watch_drop_pending(w, i);
+      } else {
+        ev = WATCH_EV_CREATED;
+      }
+      break;
+    }
+    if (ev & w->events)
+      watch_push_event(L, d->path, name, len, ev);
+    if (fni->NextEntryOffset == 0)
+      break;
+    p += fni->NextEntryOffset;
+  }
+  watch_arm(d, w->recursive);
+}
+
+
+/*
+** Reads every directory whose request has completed. Rearming a
+** request resets the shared event, so it is set again afterwards if
+** another directory completed in the meantime.
+*/
+static void watch_read_all(lua_State * L, lfs_Watcher * w)
+{
+  int i;
+  ResetEvent(w->ready);
+  for (i = 0; i < w->n; i++) {
+    if (w->dirs[i]->armed && HasOverlappedIoCompleted(&w->dirs[i]->ov))
+      watch_read_dir(L, w, w->dirs[i]);
+  }
+  for (i = 0; i < w->n; i++) {
+    if (w->dirs[i]->armed && HasOverlappedIoCompleted(&w->dirs[i]->ov))
+      SetEvent(w->ready);
+  }
+}
+
+
+/*
+** Waits up to 'timeout' milliseconds (negative waits forever) for
+** changes and returns them as an array of event tables.
+*/
+static int watch_poll(lua_State * L)
+{
+  lfs_Watcher *w = check_watcher(L);
+  lua_Integer left = luaL_optinteger(L, 2, 0);
+  lua_newtable(L);
+  if (w->n == 0)
+    return 1;
+  for (;;) {
+    lua_Integer timeout = left;
+    DWORD r;
+    if (w->npend > 0 && (timeout < 0 || timeout > WATCH_PAIRWAIT))
+      timeout = WATCH_PAIRWAIT;
+    r = WaitForSingleObject(w->ready,
+                            timeout < 0 ? INFINITE : (DWORD) timeout);
+    if (r == WAIT_FAILED)
+      return lfs_win32_pusherror(L);
+    if (r == WAIT_OBJECT_0) {
+      watch_read_all(L, w);
+      if (watch_has_fresh(w)
+          && WaitForSingleObject(w->ready, WATCH_PAIRWAIT) == WAIT_OBJECT_0)
+        watch_read_all(L, w);
+    }
+    watch_expire(L, w);
+    if (lua_rawlen(L, -1) > 0 || (left >= 0 && timeout == left))
+      return 1;                 /* events, or the time is up */
+    if (left > 0)
+      left = left > timeout ? left - timeout : 0;
+  }
+}
+
+
+/*
+** There is no descriptor on Windows. All watched directories signal
+** one manual-reset event, which is returned instead.
+*/
+static int watch_getfd(lua_State * L)
+{
+  lfs_Watcher *w = check_watcher(L);
+  lua_pushlightuserdata(L, w->ready);
+  return 1;
+}
+
+#else
+
+static int watch_find_node(lfs_Watcher * w, int wd)
+{
+  int i;
+  for (i = 0; i < w->n; i++) {
+    if (w->nodes[i].wd == wd)
+      return i;
+  }
+  return -1;
+}
+
+
+static void watch_remove_node(lfs_Watcher * w, int wd)
+{
+  int i = watch_find_node(w, wd);
+  if (i >= 0) {
+    free(w->nodes[i].path);
+    w->nodes[i] = w->nodes[--w->n];
+  }
+}
+
+
+/* tells whether 'path' is 'dir' or below it */
+static int watch_below(const char *path, const char *dir, size_t dirlen)
+{
+  return strncmp(path, dir, dirlen) == 0
+      && (path[dirlen] == '\0' || path[dirlen] == '/');
+}
+
+
+static void watch_forget(lfs_Watcher * w, const char *path)
+{
+  char *dir = strdup(path);     /* 'path' may be one of the nodes */
+  size_t len;
+  int i;
+  if (dir == NULL)
+    return;
+  len = strlen(dir);
+  for (i = w->n - 1; i >= 0; i--) {
+    if (watch_below(w->nodes[i].path, dir, len)) {
+      inotify_rm_watch(w->fd, w->nodes[i].wd);
+      free(w->nodes[i].path);
+      w->nodes[i] = w->nodes[--w->n];
+    }
+  }
+  free(dir);
+}
+
+
+/*
+** A directory was renamed from 'from' to 'to': the watches stay, but
+** the paths they report must follow.
+*/
+static void watch_move_nodes(lfs_Watcher * w, const char *from,
+                             const char *to)
+{
+  size_t fl = strlen(from), tl = strlen(to);
+  int i;
+  for (i = 0; i < w->n; i++) {
+    char *old = w->nodes[i].path;
+    if (watch_below(old, from, fl)) {
+      size_t rest = strlen(old + fl);
+      char *p = (char *) malloc(tl + rest + 1);
+      if (p == NULL)
+        continue;
+      memcpy(p, to, tl);
+      memcpy(p + tl, old + fl, rest + 1);
+      free(old);
+      w->nodes[i].path = p;
+    }
+  }
+}
+
+
+static int watch_add_node(lfs_Watcher * w, const char *path, int top)
+{
+  uint32_t mask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB
+      | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+  int wd = inotify_add_watch(w->fd, path, mask);
+  char *p;
+  if (wd < 0)
+    return -1;
+  if (watch_find_node(w, wd) >= 0)
+    return 0;                   /* already watched (e.g. through a link) */
+  if (w->n == w->size) {
+    int size = w->size ? 2 * w->size : 8;
+    watch_node *nodes = realloc(w->nodes, size * sizeof(watch_node));
+    if (nodes == NULL)
+      return -1;
+    w->nodes = nodes;
+    w->size = size;
+  }
+  if ((p = strdup(path)) == NULL)
+    return -1;
+  w->nodes[w->n].wd = wd;
+  w->nodes[w->n].top = top;
+  w->nodes[w->n].path = p;
+  w->n++;
+  return 0;
+}
+
+
+/*
+** Adds a watch for 'path' and, for recursive watchers, for every
+** directory below it. Unreadable subdirectories are skipped.
+** If 'L' is not NULL the directory is new: whatever was created in it
+** before its watch existed is reported as "created" (some entries
+** may then be reported twice).
+*/
+static int watch_add_tree(lua_State * L, lfs_Watcher * w, const char *path,
+                          int top)
+{
+  DIR *dir;
+  struct dirent *entry;
+  STAT_STRUCT info;
+  if (watch_add_node(w, path, top) != 0)
+    return top ? -1 : 0;
+  if (!w->recursive || (dir = opendir(path)) == NULL)
+    return 0;
+  while ((entry = readdir(dir)) != NULL) {
+    size_t len;
+    char *sub;
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    len = strlen(path) + strlen(entry->d_name) + 2;
+    if ((sub = malloc(len)) == NULL)
+      break;
+    snprintf(sub, len, "%s/%s", path, entry->d_name);
+    if (L != NULL && (w->events & WATCH_EV_CREATED))
+      watch_push_event(L, sub, NULL, 0, WATCH_EV_CREATED);
+    if (LSTAT_FUNC(sub, &info) == 0 && S_ISDIR(info.st_mode))
+      watch_add_tree(L, w, sub, 0);
+    free(sub);
+  }
+  closedir(dir);
+  return 0;
+}
+
+
+static int watch_add_path(lua_State * L, lfs_Watcher * w, const char *path)
+{
+  if (watch_add_tree(NULL, w, path, 1) != 0) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "cannot watch '%s': %s", path, strerror(errno));
+    return 2;
+  }
+  return 0;
+}
+
+
+static int watch_close(lua_State * L)
+{
+  lfs_Watcher *w = (lfs_Watcher *) luaL_checkudata(L, 1, WATCH_METATABLE);
+  int i;
+  if (w->fd >= 0)
+    close(w->fd);
+  for (i = 0; i < w->n; i++)
+    free(w->nodes[i].path);
+  free(w->nodes);
+  w->nodes = NULL;
+  w->n = w->size = 0;
+  w->fd = -1;
+  watch_clear_pending(w);
+  w->closed = 1;
+  return 0;
+}
+
+
+static int watch_wait(lfs_Watcher * w, int timeout)
+{
+  struct pollfd pfd;
+  int r;
+  pfd.fd = w->fd;
+  pfd.events = POLLIN;
+  do {
+    r = poll(&pfd, 1, timeout);
+  } while (r < 0 && errno == EINTR);
+  return r;
+}
+
+
+/*
+** Handles one event. Subdirectories report their own deletion and
+** moves through their parent, so their IN_DELETE_SELF/IN_MOVE_SELF are
+** only reported for the paths given by the user.
+*/
+static void watch_event(lua_State * L, lfs_Watcher * w,
+                        const struct inotify_event *ie, int node)
+{
+  const char *dir = w->nodes[node].path;
+  const char *name = ie->len ? ie->name : "";
+  size_t namelen = strlen(name);
+  int isdir = (ie->mask & IN_ISDIR) != 0;
+  int ev = 0;
+  if (ie->mask & IN_MOVED_FROM) {
+    watch_add_pending(L, w, ie->cookie, dir, name, namelen, isdir);
+    return;
+  }
+  if (ie->mask & IN_MOVED_TO) {
+    int i = watch_find_pending(w, ie->cookie);
+    if (i >= 0) {
+      char *to = watch_join(dir, name, namelen);
+      if (to != NULL) {
+        if (w->pend[i].isdir)
+          watch_move_nodes(w, w->pend[i].path, to);
+        watch_push_renamed(L, w, w->pend[i].path, to);
+        free(to);
+      }
+      watch_drop_pending(w, i);
+      return;
+    }
+    /* moved in from outside: same as a new entry */
+  }
+  if (ie->mask & (IN_CREATE | IN_MOVED_TO)) {
+    if (w->events & WATCH_EV_CREATED)
+      watch_push_event(L, dir, name, namelen, WATCH_EV_CREATED);
+    if (w->recursive && isdir) {
+      char *sub = watch_join(dir, name, namelen);
+      if (sub != NULL) {
+        watch_add_tree(L, w, sub, 0);
+        free(sub);
+      }
+    }
+    return;
+  }
+  if (ie->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+    if (!w->nodes[node].top)
+      return;
+    if (w->events & WATCH_EV_REMOVED)
+      watch_push_event(L, dir, NULL, 0, WATCH_EV_REMOVED);
+    if (ie->mask & IN_MOVE_SELF)
+      watch_forget(w, dir);     /* its paths are unknown from now on */
+    return;
+  }
+  if (ie->mask & IN_DELETE)
+    ev = WATCH_EV_REMOVED;
+  else if (ie->mask & IN_MODIFY)
+    ev = WATCH_EV_MODIFIED;
+  else if (ie->mask & IN_ATTRIB)
+    ev = WATCH_EV_ATTRIB;
+  if (ev & w->events)
+    watch_push_event(L, dir, name, namelen, ev);
+}
+
+
+/*
+** Reads all queued notifications. Consecutive duplicates (e.g. the
+** many IN_MODIFY of a single write burst) are folded into one entry.
+*/
+static void watch_drain(lua_State * L, lfs_Watcher * w)
+{
+  char buf[16384]
+      __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  int lastwd = -1;
+  uint32_t lastmask = 0;
+  char lastname[256] = "";
+  for (;;) {
+    ssize_t len = read(w->fd, buf, sizeof(buf));
+    const char *p;
+    if (len <= 0) {
+      if (len < 0 && errno == EINTR)
+        continue;
+      break;                    /* EAGAIN: queue drained */
+    }
+    for (p = buf; p < buf + len;
+         p += sizeof(struct inotify_event) +
+         ((const struct inotify_event *) p)->len) {
+      const struct inotify_event *ie = (const struct inotify_event *) p;
+      int node;
+      if (ie->mask & IN_Q_OVERFLOW) {
+        watch_push_event(L, NULL, NULL, 0, 0);
+        lastwd = -1;
+        continue;
+      }
+      if (ie->mask & IN_IGNORED) {
+        watch_remove_node(w, ie->wd);
+        continue;
+      }
+      if ((node = watch_find_node(w, ie->wd)) < 0)
+        continue;
+      if (ie->wd == lastwd && ie->mask == lastmask
+          && strcmp(lastname, ie->len ? ie->name : "") == 0)
+        continue;
+      lastwd = ie->wd;
+      lastmask = ie->mask;
+      snprintf(lastname, sizeof(lastname), "%s", ie->len ? ie->name : "");
+      watch_event(L, w, ie, node);
+    }
+  }
+}
+
+
+/*
+** Waits up to 'timeout' milliseconds (negative waits forever) for
+** changes and returns them as an array of event tables.
+** The two halves of a rename are paired even if they arrive in
+** different polls; while a first half waits, the wait is cut short to
+** WATCH_PAIRWAIT.
+*/
+static int watch_poll(lua_State * L)
+{
+  lfs_Watcher *w = check_watcher(L);
+  lua_Integer left = luaL_optinteger(L, 2, 0);
+  lua_newtable(L);
+  for (;;) {
+    int timeout = left < 0 ? -1 : (int) (left > INT_MAX ? INT_MAX : left);
+    int r;
+    if (w->npend > 0 && (timeout < 0 || timeout > WATCH_PAIRWAIT))
+      timeout = WATCH_PAIRWAIT;
+    if ((r = watch_wait(w, timeout)) < 0)
+      return pusherror(L, "poll");
+    if (r > 0) {
+      watch_drain(L, w);
+      if (watch_has_fresh(w) && watch_wait(w, WATCH_PAIRWAIT) > 0)
+        watch_drain(L, w);
+    }
+    watch_expire(L, w);
+    if (lua_rawlen(L, -1) > 0 || (left >= 0 && timeout == left))
+      return 1;                 /* events, or the time is up */
+    if (left > 0)
+      left = left > timeout ? left - timeout : 0;
+  }
+}
+
+
+/*
+** Returns the inotify descriptor, for use with an external event loop.
+** It becomes readable whenever watch:poll() has something to return.
+*/
+static int watch_getfd(lua_State * L)
+{
+  lfs_Watcher *w = check_watcher(L);
+  lua_pushinteger(L, w->fd);
+  return 1;
+}
+
+#endif
+
+
+/*
+** Adds another path to a watcher.
+** @param #1 Watcher.
+** @param #2 Path.
+*/
+static int watch_add(lua_State * L)
+{
+  lfs_Watcher *w = check_watcher(L);
+  const char *path = luaL_checkstring(L, 2);
+  int ret = watch_add_path(L, w, path);
+  if (ret != 0)
+    return ret;
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+/*
+** Creates a watcher.
+** @param #1 Path or array of paths.
+** @param #2 Options table (optional):
+**   recursive = true to watch subdirectories as well
+**   events = array of "created", "removed", "modified", "attrib",
+**            "renamed" (all of them by default)
+** Renames inside the watched paths are reported as one "renamed" event
+** with 'from' set to the old path; if "renamed" is not selected, they
+** are reported as "removed" plus "created".
+*/
+static int watch_create(lua_State * L)
+{
+  lfs_Watcher *w;
+  int i, ret;
+  if (!lua_istable(L, 1))
+    luaL_checkstring(L, 1);
+  if (!lua_isnoneornil(L, 2))
+    luaL_checktype(L, 2, LUA_TTABLE);
+  lua_settop(L, 2);
+  w = (lfs_Watcher *) lua_newuserdata(L, sizeof(lfs_Watcher));
+  memset(w, 0, sizeof(lfs_Watcher));
+#ifndef _WIN32
+  w->fd = -1;
+#endif
+  w->events = WATCH_EV_ALL;
+  luaL_getmetatable(L, WATCH_METATABLE);
+  lua_setmetatable(L, -2);
+  if (lua_istable(L, 2)) {
+    lua_getfield(L, 2, "recursive");
+    w->recursive = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    lua_getfield(L, 2, "events");
+    if (lua_istable(L, -1)) {
+      w->events = 0;
+      for (i = 1; lua_rawgeti(L, -1, i) != LUA_TNIL; i++) {
+        const char *name = lua_tostring(L, -1);
+        int ev;
+        for (ev = 0; watch_evnames[ev]; ev++) {
+          if (name && strcmp(watch_evnames[ev], name) == 0)
+            break;
+        }
+        if (watch_evnames[ev] == NULL)
+          return luaL_error(L, "invalid event name '%s'", name);
+        w->events |= 1 << ev;
+        lua_pop(L, 1);
+      }
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+  }
+#ifndef _WIN32
+  w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (w->fd < 0)
+    return pusherror(L, "inotify_init1");
+#else
+  w->ready = CreateEvent(NULL, TRUE, FALSE, NULL);
+  if (w->ready == NULL)
+    return lfs_win32_pusherror(L);
+#endif
+  if (lua_istable(L, 1)) {
+    for (i = 1; lua_rawgeti(L, 1, i) != LUA_TNIL; i++) {
+      ret = watch_add_path(L, w, luaL_checkstring(L, -1));
+      if (ret != 0)
+        return ret;
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+  } else {
+    ret = watch_add_path(L, w, lua_tostring(L, 1));
+    if (ret != 0)
+      return ret;
+  }
+  return 1;
+}
+
+
+/*
+** Creates watcher metatable.
+*/
+static int watch_create_meta(lua_State * L)
+{
+  luaL_newmetatable(L, WATCH_METATABLE);
+
+  /* Method table */
+  lua_newtable(L);
+  lua_pushcfunction(L, watch_poll);
+  lua_setfield(L, -2, "poll");
+  lua_pushcfunction(L, watch_add);
+  lua_setfield(L, -2, "add");
+  lua_pushcfunction(L, watch_getfd);
+  lua_setfield(L, -2, "getfd");
+  lua_pushcfunction(L, watch_close);
+  lua_setfield(L, -2, "close");
+
+  /* Metamethods */
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, watch_close);
+  lua_setfield(L, -2, "__gc");
+
+#if LUA_VERSION_NUM >= 504
+  lua_pushcfunction(L, watch_close);
+  lua_setfield(L, -2, "__close");
+#endif
+  return 1;
+}
+
+#else
+
+static int watch_create(lua_State * L)
+{
+  lua_pushnil(L);
+  lua_pushstring(L, "Function 'watch' not provided by system");
+  return 2;
+}
+
+#endif
+
+
+/*
+** Glob patterns.
+** Supported are '?', '*' (both never match a directory separator),
+** '**' (matches across directories; a "**" that starts a segment and
+** is followed by a separator also matches no directory at all),
+** character classes "[a-z]", "[!0-9]"
+** and brace alternation "{c,h,cpp}", which may be nested.
+** Braces are expanded once when the pattern is compiled, so matching
+** itself never allocates.
+*/
+#define GLOB_METATABLE "glob metatable"
+#define GLOB_MAXALT 4096
+
+#ifdef _WIN32
+#define GLOB_ISSEP(c) ((c) == '/' || (c) == '\\')
+#define GLOB_CHAREQ(a, b) (tolower((unsigned char)(a)) == \
+                           tolower((unsigned char)(b)) || \
+                           (GLOB_ISSEP(a) && GLOB_ISSEP(b)))
+#else
+#define GLOB_ISSEP(c) ((c) == '/')
+#define GLOB_CHAREQ(a, b) ((a) == (b))
+#endif
+
+typedef struct lfs_Glob {
+  int nalt;
+  size_t srclen;
+  char buf[1];                  /* source, then each alternative, '\0' separated */
+} lfs_Glob;
+
+
+/*
+** Iterative matcher. Only the last '*' and the last '**' are kept as
+** restart points: a later star can absorb whatever an earlier one of
+** the same kind could, so retrying the earlier one never helps. A '*'
+** restart gives up at a separator and falls back to the '**' one.
+** This keeps matching at O(pattern * subject) for any pattern. It is
+** also why "**" plus a separator only matches no directory when it
+** starts a segment: there, every position it can resume at follows a
+** separator.
+*/
+static int glob_match(const char *p, const char *pe, const char *s,
+                      const char *se)
+{
+  const char *p0 = p;
+  const char *sp = NULL, *ss = NULL;    /* last '*': pattern, subject */
+  const char *gp = NULL, *gs = NULL;    /* last '**' */
+  int gzero = 0;                /* "**" + separator: no directory tried */
+  for (;;) {
+    if (p == pe) {
+      if (s == se)
+        return 1;
+      goto fail;
+    }
+    switch (*p) {
+    case '*':
+      if (p + 1 < pe && p[1] == '*') {
+        int segstart = (p == p0 || GLOB_ISSEP(p[-1]));
+        while (p < pe && *p == '*')
+          p++;
+        if (p == pe)
+          return 1;
+        gp = p;
+        gs = s;
+        sp = NULL;
+        gzero = segstart && GLOB_ISSEP(*p);
+        if (gzero)
+          p++;                  /* first try "**" spanning no directory */
+        continue;
+      }
+      sp = ++p;
+      ss = s;
+      continue;
+    case '?':
+      if (s == se || GLOB_ISSEP(*s))
+        goto fail;
+      p++;
+      s++;
+      continue;
+    case '[':
+      {
+        const char *q = p + 1;
+        const char *start;
+        int neg = 0, ok = 0;
+        if (s == se || GLOB_ISSEP(*s))
+          goto fail;
+        if (q < pe && (*q == '!' || *q == '^')) {
+          neg = 1;
+          q++;
+        }
+        start = q;
+        while (q < pe && (*q != ']' || q == start)) {
+          unsigned char lo = (unsigned char) *q, hi = lo;
+          if (q + 2 < pe && q[1] == '-' && q[2] != ']') {
+            hi = (unsigned char) q[2];
+            q += 2;
+          }
+          if ((unsigned char) *s >= lo && (unsigned char) *s <= hi)
+            ok = 1;
+          q++;
+        }
+        if (q == pe) {          /* no closing ']': plain character */
+          if (*s != '[')
+            goto fail;
+          p++;
+          s++;
+          continue;
+        }
+        if (ok == neg)
+          goto fail;
+        p = q + 1;
+        s++;
+        continue;
+      }
+    default:
+      if (s == se || !GLOB_CHAREQ(*p, *s))
+        goto fail;
+      p++;
+      s++;
+      continue;
+    }
+  fail:
+    if (sp != NULL && ss < se && !GLOB_ISSEP(*ss)) {
+      p = sp;
+      s = ++ss;                 /* '*' absorbs one more character */
+    } else if (gp != NULL) {
+      if (gzero)
+        gzero = 0;
+      else if (gs == se)
+        return 0;
+      else
+        gs++;                   /* '**' absorbs one more character */
+      p = gp;
+      s = gs;
+      sp = NULL;
+    } else {
+      return 0;
+    }
+  }
+}
+
+
+static int glob_is_literal(const char *p, const char *pe)
+{
+  for (; p < pe; p++) {
+    if (*p == '*' || *p == '?' || *p == '[')
+      return 0;
+  }
+  return 1;
+}
+
+
+/* a segment consisting of "**" only */
+static int glob_is_globstar(const char *p, const char *pe)
+{
+  if (pe - p < 2)
+    return 0;
+  for (; p < pe; p++) {
+    if (*p != '*')
+      return 0;
+  }
+  return 1;
+}
+
+
+/*
+** Expands the first brace group of p[0..len) and recurses on each
+** alternative; patterns without braces are appended to table 't'.
+*/
+static void glob_expand(lua_State * L, int t, const char *p, size_t len,
+                        int *n)
+{
+  size_t i, j, k;
+  int depth = 0, commas = 0;
+  for (i = 0; i < len; i++) {
+    if (p[i] != '{')
+      continue;
+    depth = 0;
+    commas = 0;
+    for (j = i; j < len; j++) {
+      if (p[j] == '{')
+        depth++;
+      else if (p[j] == '}' && --depth == 0)
+        break;
+      else if (p[j] == ',' && depth == 1)
+        commas++;
+    }
+    if (j < len && commas > 0)
+      break;
+  }
+  if (i == len) {
+    if (++(*n) > GLOB_MAXALT)
+      luaL_error(L, "glob pattern has too many alternatives");
+    lua_pushlstring(L, p, len);
+    lua_rawseti(L, t, *n);
+    return;
+  }
+  luaL_checkstack(L, 4, "glob pattern too complex");
+  for (k = i + 1; k <= j; k++) {
+    size_t a = k;
+    depth = 0;
+    for (; k < j; k++) {
+      if (p[k] == '{')
+        depth++;
+      else if (p[k] == '}')
+        depth--;
+      else if (p[k] == ',' && depth == 0)
+        break;
+    }
+    lua_pushlstring(L, p, i);
+    lua_pushlstring(L, p + a, k - a);
+    lua_pushlstring(L, p + j + 1, len - j - 1);
+    lua_concat(L, 3);
+    {
+      size_t l;
+      const char *alt = lua_tolstring(L, -1, &l);
+      glob_expand(L, t, alt, l, n);
+    }
+    lua_pop(L, 1);
+  }
+}
+
+
+static lfs_Glob *glob_compile(lua_State * L, int idx)
+{
+  size_t len, size, l;
+  const char *src = luaL_checklstring(L, idx, &len);
+  lfs_Glob *g;
+  char *d;
+  int n = 0, i;
+  lua_newtable(L);
+  glob_expand(L, lua_gettop(L), src, len, &n);
+  size = len + 1;
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, -1, i);
+    size += lua_rawlen(L, -1) + 1;
+    lua_pop(L, 1);
+  }
+  g = (lfs_Glob *) lua_newuserdata(L, sizeof(lfs_Glob) + size);
+  g->nalt = n;
+  g->srclen = len;
+  memcpy(g->buf, src, len + 1);
+  d = g->buf + len + 1;
+  for (i = 1; i <= n; i++) {
+    const char *alt;
+    lua_rawgeti(L, -2, i);
+    alt = lua_tolstring(L, -1, &l);
+    memcpy(d, alt, l + 1);
+    d += l + 1;
+    lua_pop(L, 1);
+  }
+  luaL_getmetatable(L, GLOB_METATABLE);
+  lua_setmetatable(L, -2);
+  lua_remove(L, -2);
+  return g;
+}
+
+
+static lfs_Glob *glob_check(lua_State * L, int idx)
+{
+  lfs_Glob *g = (lfs_Glob *) luaL_testudata(L, idx, GLOB_METATABLE);
+  if (g == NULL) {
+    g = glob_compile(L, idx);
+    lua_replace(L, idx);
+  }
+  return g;
+}
+
+
+/*
+** Compiles a glob pattern.
+** @param #1 Pattern.
+*/
+static int glob_create(lua_State * L)
+{
+  glob_compile(L, 1);
+  return 1;
+}
+
+
+/*
+** Tests a path against a compiled pattern.
+** @param #1 Compiled pattern.
+** @param #2 Path.
+*/
+static int glob_match_name(lua_State * L)
+{
+  lfs_Glob *g = (lfs_Glob *) luaL_checkudata(L, 1, GLOB_METATABLE);
+  size_t len;
+  const char *s = luaL_checklstring(L, 2, &len);
+  const char *p = g->buf + g->srclen + 1;
+  int i;
+  for (i = 0; i < g->nalt; i++) {
+    size_t plen = strlen(p);
+    if (glob_match(p, p + plen, s, s + len)) {
+      lua_pushboolean(L, 1);
+      return 1;
+    }
+    p += plen + 1;
+  }
+  lua_pushboolean(L, 0);
+  return 1;
+}
+
+
+static int glob_tostring(lua_State * L)
+{
+  lfs_Glob *g = (lfs_Glob *) luaL_checkudata(L, 1, GLOB_METATABLE);
+  lua_pushlstring(L, g->buf, g->srclen);
+  return 1;
+}
+
+
+/*
+** Directory walker driven by the pattern: literal path segments are
+** looked up directly, wildcard segments only descend into directories
+** that match them, so subtrees that cannot match are never read.
+*/
+typedef struct glob_walk {
+  lua_State *L;
+  int res, seen;                /* result array and set of reported paths */
+  char path[LFS_MAXPATHLEN];
+} glob_walk;
+
+static void glob_walk_dir(glob_walk * w, size_t plen, const char *p,
+                          const char *pe);
+
+
+static void glob_add(glob_walk * w, size_t len)
+{
+  lua_State *L = w->L;
+  lua_pushlstring(L, w->path, len);
+  lua_pushvalue(L, -1);
+  if (lua_rawget(L, w->seen) != LUA_TNIL) {
+    lua_pop(L, 2);
+    return;
+  }
+  lua_pop(L, 1);
+  lua_pushvalue(L, -1);
+  lua_pushboolean(L, 1);
+  lua_rawset(L, w->seen);
+  lua_rawseti(L, w->res, (lua_Integer) lua_rawlen(L, w->res) + 1);
+}
+
+
+/* appends 'name' to the path at 'plen'; returns the new length or 0 */
+static size_t glob_join(glob_walk * w, size_t plen, const char *name,
+                        size_t nlen)
+{
+  size_t sep = (plen > 0 && !GLOB_ISSEP(w->path[plen - 1])) ? 1 : 0;
+  if (plen + sep + nlen >= sizeof(w->path))
+    return 0;
+  if (sep)
+    w->path[plen] = '/';
+  memcpy(w->path + plen + sep, name, nlen);
+  w->path[plen + sep + nlen] = '\0';
+  return plen + sep + nlen;
+}
+
+
+static int glob_isdir(const char *path)
+{
+  STAT_STRUCT info;
+  return STAT_FUNC(path, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+
+/*
+** Handles one directory entry 'name' of the directory at w->path[0..plen)
+** for the pattern segment p[0..q) followed by q[0..pe).
+*/
+static void glob_entry(glob_walk * w, size_t plen, const char *name,
+                       int isdir, const char *p, const char *q,
+                       const char *pe)
+{
+  size_t nlen = strlen(name), len;
+  if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+    return;
+  if (glob_is_globstar(p, q)) {
+    /* "**": every entry matches, directories are searched further */
+    if ((len = glob_join(w, plen, name, nlen)) == 0)
+      return;
+    if (q == pe)
+      glob_add(w, len);
+    if (isdir)
+      glob_walk_dir(w, len, p, pe);
+    return;
+  }
+  if (!glob_match(p, q, name, name + nlen))
+    return;
+  if ((len = glob_join(w, plen, name, nlen)) == 0)
+    return;
+  if (q == pe)
+    glob_add(w, len);
+  else if (isdir && q + 1 == pe)
+    glob_add(w, len);           /* trailing separator: directories only */
+  else if (isdir)
+    glob_walk_dir(w, len, q + 1, pe);
+}
+
+
+static void glob_walk_dir(glob_walk * w, size_t plen, const char *p,
+                          const char *pe)
+{
+  const char *q = p;
+  const char *dirname = plen ? w->path : ".";
+  while (q < pe && !GLOB_ISSEP(*q))
+    q++;
+  if (p == q) {                 /* empty segment, e.g. "a//b" */
+    if (q < pe)
+      glob_walk_dir(w, plen, q + 1, pe);
+    return;
+  }
+  if (glob_is_literal(p, q)) {
+    size_t len = glob_join(w, plen, p, q - p);
+    if (len == 0)
+      return;
+    if (q == pe) {
+      STAT_STRUCT info;
+      if (LSTAT_FUNC(w->path, &info) == 0)
+        glob_add(w, len);
+    } else if (glob_isdir(w->path)) {
+      if (q + 1 == pe)
+        glob_add(w, len);
+      else
+        glob_walk_dir(w, len, q + 1, pe);
+    }
+    w->path[plen] = '\0';
+    return;
+  }
+  if (glob_is_globstar(p, q) && q < pe) {
+    glob_walk_dir(w, plen, q + 1, pe);  /* "**" spanning no directory */
+    w->path[plen] = '\0';
+  }
+  {
+#ifdef _WIN32
+    struct _finddata_t c_file;
+    char pattern[LFS_MAXPATHLEN + 3];
+    intptr_t h;
+    if (strlen(dirname) + 3 > sizeof(pattern))
+      return;
+    sprintf(pattern, "%s/*", dirname);
+    if ((h = _findfirst(pattern, &c_file)) == -1L)
+      return;
+    do {
+      glob_entry(w, plen, c_file.name, (c_file.attrib & _A_SUBDIR) != 0,
+                 p, q, pe);
+      w->path[plen] = '\0';
+    } while (_findnext(h, &c_file) == 0);
+    _findclose(h);
+#else
+    DIR *dir = opendir(dirname);
+    struct dirent *entry;
+    if (dir == NULL)
+      return;
+    while ((entry = readdir(dir)) != NULL) {
+      int isdir;
+#ifdef _DIRENT_HAVE_D_TYPE
+      if (entry->d_type != DT_UNKNOWN)
+        isdir = entry->d_type == DT_DIR;
+      else
+#endif
+      {
+        STAT_STRUCT info;
+        size_t len = glob_join(w, plen, entry->d_name, strlen(entry->d_name));
+        isdir = len && LSTAT_FUNC(w->path, &info) == 0
+            && S_ISDIR(info.st_mode);
+        w->path[plen] = '\0';
+      }
+      glob_entry(w, plen, entry->d_name, isdir, p, q, pe);
+      w->path[plen] = '\0';
+    }
+    closedir(dir);
+#endif
+  }
+}
+
+
+/*
+** Returns an array with all paths matching a glob pattern.
+** Symbolic links to directories are not followed by wildcards.
+** @param #1 Pattern (string or compiled glob).
+*/
+static int glob_find(lua_State * L)
+{
+  lfs_Glob *g = glob_check(L, 1);
+  const char *p = g->buf + g->srclen + 1;
+  glob_walk w;
+  int i;
+  lua_settop(L, 1);
+  lua_newtable(L);
+  lua_newtable(L);
+  w.L = L;
+  w.res = 2;
+  w.seen = 3;
+  for (i = 0; i < g->nalt; i++) {
+    size_t plen = strlen(p);
+    const char *pe = p + plen;
+    const char *q = p;
+    size_t len = 0;
+    if (GLOB_ISSEP(*q)) {
+      w.path[len++] = '/';      /* absolute path */
+      q++;
+    }
+    w.path[len] = '\0';
+    glob_walk_dir(&w, len, q, pe);
+    p = pe + 1;
+  }
+  lua_settop(L, 2);
+  return 1;
+}
+
+
+/*
+** Creates glob metatable.
+*/
+static int glob_create_meta(lua_State * L)
+{
+  luaL_newmetatable(L, GLOB_METATABLE);
+
+  /* Method table */
+  lua_newtable(L);
+  lua_pushcfunction(L, glob_match_name);
+  lua_setfield(L, -2, "match");
+  lua_pushcfunction(L, glob_find);
+  lua_setfield(L, -2, "glob");
+
+  /* Metamethods */
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, glob_tostring);
+  lua_setfield(L, -2, "__tostring");
+  return 1;
+}
+
+
 /*
 ** Assumes the table is on top of the stack.
 */
@@ -1156,8 +2650,10 @@ static void set_info(lua_State * L)
 static const struct luaL_Reg fslib[] = {
   { "attributes", file_info },
   { "chdir", change_dir },
+  { "compile_glob", glob_create },
   { "currentdir", get_dir },
   { "dir", dir_iter_factory },
+  { "glob", glob_find },
   { "link", make_link },
   { "lock", file_lock },
   { "mkdir", make_dir },
@@ -1167,6 +2663,7 @@ static const struct luaL_Reg fslib[] = {
   { "touch", file_utime },
   { "unlock", file_unlock },
   { "lock_dir", lfs_lock_dir },
+  { "watch", watch_create },
   { NULL, NULL },
 };
 
@@ -1174,6 +2671,10 @@ LFS_EXPORT int luaopen_lfs(lua_State * L)
 {
   dir_create_meta(L);
   lock_create_meta(L);
+  glob_create_meta(L);
+#ifdef LFS_HAVE_WATCH
+  watch_create_meta(L);
+#endif
   new_lib(L, fslib);
   lua_pushvalue(L, -1);
   lua_setglobal(L, LFS_LIBNAME);
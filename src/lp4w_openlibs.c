@@ -1,7 +1,23 @@
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include "lua_all.h"
 #include "lualib.h"
 #include "lfs/lfs.h"
+#include "strbuf/lstrbuf.h"
+#include "array/larray.h"
+#include "serialize/lserialize.h"
+#include "profiler/lprofiler.h"
+#include "threads/lthreads.h"
+#include "async/lasync.h"
 extern int luaopen_lsqlite3(lua_State *L);
 extern int luaopen_crypto(lua_State *L);
 extern int luaopen_windows(lua_State *L);
@@ -111,31 +127,308 @@ void LUAPORTABLE4WINDOWS_PRINTVERSION()
 }
 
 
+/*
+ * Appended payload
+ *
+ * A single file deployment appends an archive of Lua chunks (source or
+ * precompiled) and resources to the executable (see lp4w_pack.lua):
+ *
+ *   uint32 count
+ *   struct tpayload_entry entries[count]   (sorted by name)
+ *   names and data
+ *   struct tfooter { len, inv, sig }
+ *
+ * All integers are little endian, offsets are relative to the start of
+ * the archive, 'len' is the archive size without the footer and 'inv'
+ * is ~len. The executable is mapped into memory once and chunks are
+ * loaded directly from the mapping, without copying and without file
+ * system access for every require.
+ */
+#define PAYLOAD_SIG (0x5750344Cul) /* "LP4W" */
+#define PAYLOAD_MAIN "main"
+
+struct tpayload_entry {
+	uint32_t name_off, name_len, data_off, data_len;
+};
+
+struct tpayload_reader {
+	const char *data;
+	size_t size;
+};
+
+static const uint8_t *payload = NULL;
+static uint32_t payload_count = 0;
+
+
+static uint32_t payload_u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static void payload_entry(uint32_t i, struct tpayload_entry *e)
+{
+	const uint8_t *p = payload + sizeof(uint32_t) + i * sizeof(struct tpayload_entry);
+	e->name_off = payload_u32(p);
+	e->name_len = payload_u32(p + 4);
+	e->data_off = payload_u32(p + 8);
+	e->data_len = payload_u32(p + 12);
+}
+
+
+static int payload_find(const char *name, size_t len, struct tpayload_entry *e)
+{
+	uint32_t lo = 0, hi = payload_count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		payload_entry(mid, e);
+		int c = memcmp(payload + e->name_off, name, (e->name_len < len) ? e->name_len : len);
+		if (c == 0) {
+			c = (e->name_len > len) - (e->name_len < len);
+		}
+		if (c == 0) {
+			return 1;
+		}
+		if (c < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return 0;
+}
+
+
+/* Check the footer and index of a mapped executable of 'size' bytes. */
+static int payload_open(const uint8_t *base, uint64_t size)
+{
+	struct tfooter { uint32_t len, inv, sig; } footer;
+	if (size < sizeof(footer)) {
+		return 0;
+	}
+	const uint8_t *f = base + size - sizeof(footer);
+	footer.len = payload_u32(f);
+	footer.inv = payload_u32(f + 4);
+	footer.sig = payload_u32(f + 8);
+	if ((footer.sig != PAYLOAD_SIG) || (footer.inv != (uint32_t)~footer.len)
+	    || (footer.len < sizeof(uint32_t)) || (footer.len > size - sizeof(footer))) {
+		return 0;
+	}
+	const uint8_t *p = f - footer.len;
+	uint32_t count = payload_u32(p);
+	if ((uint64_t)count * sizeof(struct tpayload_entry) + sizeof(uint32_t) > footer.len) {
+		return 0;
+	}
+	payload = p;
+	payload_count = count;
+	for (uint32_t i = 0; i < count; i++) {
+		struct tpayload_entry e;
+		payload_entry(i, &e);
+		if (((uint64_t)e.name_off + e.name_len > footer.len) || ((uint64_t)e.data_off + e.data_len > footer.len)) {
+			payload = NULL;
+			payload_count = 0;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+/* Map the running executable and look for an appended payload. */
+static int payload_map(void)
+{
+#ifdef _WIN32
+	wchar_t PATH[MAX_PATH+1] = { 0 };
+	GetModuleFileNameW(NULL, PATH, MAX_PATH);
+	HANDLE h = CreateFileW(PATH, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (h == INVALID_HANDLE_VALUE) {
+		return 0;
+	}
+	LARGE_INTEGER size = { 0,0 };
+	HANDLE m = NULL;
+	if (GetFileSizeEx(h, &size)) {
+		m = CreateFileMappingW(h, NULL, PAGE_READONLY, 0, 0, NULL);
+	}
+	CloseHandle(h);
+	if (m == NULL) {
+		return 0;
+	}
+	const uint8_t *base = (const uint8_t *)MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(m); /* the view keeps the mapping alive */
+	if (base == NULL) {
+		return 0;
+	}
+	if (!payload_open(base, (uint64_t)size.QuadPart)) {
+		UnmapViewOfFile(base);
+		return 0;
+	}
+	return 1;
+#else
+	int fd = open("/proc/self/exe", O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+	struct stat st;
+	void *base = MAP_FAILED;
+	if ((fstat(fd, &st) == 0) && (st.st_size > 0)) {
+		base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (base == MAP_FAILED) {
+		return 0;
+	}
+	if (!payload_open((const uint8_t *)base, (uint64_t)st.st_size)) {
+		munmap(base, (size_t)st.st_size);
+		return 0;
+	}
+	return 1;
+#endif
+}
+
+
+/* Hands out the whole chunk at once: lua_load reads straight from the mapping. */
+static const char *payload_reader(lua_State *L, void *ud, size_t *size)
+{
+	struct tpayload_reader *r = (struct tpayload_reader *)ud;
+	(void)L;
+	*size = r->size;
+	r->size = 0;
+	return (*size > 0) ? r->data : NULL;
+}
+
+
+static int payload_load(lua_State *L, const struct tpayload_entry *e, const char *name)
+{
+	struct tpayload_reader r;
+	r.data = (const char *)payload + e->data_off;
+	r.size = e->data_len;
+	const char *chunkname = lua_pushfstring(L, "=payload:%s", name);
+	int status = lua_load(L, payload_reader, &r, chunkname, "bt");
+	lua_remove(L, -2);
+	return status;
+}
+
+
+static int payload_searcher(lua_State *L)
+{
+	size_t len = 0;
+	const char *name = luaL_checklstring(L, 1, &len);
+	struct tpayload_entry e;
+	if (!payload_find(name, len, &e)) {
+		lua_pushfstring(L, "no module '%s' in executable payload", name);
+		return 1;
+	}
+	if (payload_load(L, &e, name) != LUA_OK) {
+		return luaL_error(L, "error loading module '%s' from executable payload:\n\t%s", name, lua_tostring(L, -1));
+	}
+	lua_pushfstring(L, "payload:%s", name);
+	return 2;
+}
+
+
+/* package.resource(name): contents of a payload entry, or nil */
+static int payload_resource(lua_State *L)
+{
+	size_t len = 0;
+	const char *name = luaL_checklstring(L, 1, &len);
+	struct tpayload_entry e;
+	if ((payload == NULL) || !payload_find(name, len, &e)) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushlstring(L, (const char *)payload + e.data_off, e.data_len);
+	return 1;
+}
+
+
+/* Register the payload searcher right after the preload searcher. */
+static void payload_register(lua_State *L)
+{
+	if (lua_getglobal(L, "package") != LUA_TTABLE) {
+		lua_pop(L, 1);
+		return;
+	}
+	lua_pushcfunction(L, payload_resource);
+	lua_setfield(L, -2, "resource");
+	if (payload != NULL) {
+		if (lua_getfield(L, -1, "searchers") == LUA_TTABLE) {
+			lua_Integer n = (lua_Integer)lua_rawlen(L, -1);
+			for (lua_Integer i = n; i >= 2; i--) {
+				lua_rawgeti(L, -1, i);
+				lua_rawseti(L, -2, i + 1);
+			}
+			lua_pushcfunction(L, payload_searcher);
+			lua_rawseti(L, -2, 2);
+		}
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+}
+
+
+/* Main function of a single file deployment: run the "main" entry. */
+static int payload_main(lua_State *L)
+{
+	int argc = (int)lua_tointeger(L, 1);
+	char **argv = (char **)lua_touserdata(L, 2);
+	struct tpayload_entry e;
+
+	luaL_checkversion(L);
+	luaL_openlibs(L);
+	LUAPORTABLE4WINDOWS_OPENLIBS(L);
+
+	lua_createtable(L, argc, 0);
+	for (int i = 0; i < argc; i++) {
+		lua_pushstring(L, argv[i]);
+		lua_rawseti(L, -2, i);
+	}
+	lua_setglobal(L, "arg");
+	lua_gc(L, LUA_GCGEN, 0, 0);
+
+	payload_find(PAYLOAD_MAIN, strlen(PAYLOAD_MAIN), &e);
+	if (payload_load(L, &e, PAYLOAD_MAIN) != LUA_OK) {
+		return lua_error(L);
+	}
+	luaL_checkstack(L, argc, "too many arguments to script");
+	for (int i = 1; i < argc; i++) {
+		lua_pushstring(L, argv[i]);
+	}
+	lua_call(L, (argc > 0) ? (argc - 1) : 0, 0);
+
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+
 void LUAPORTABLE4WINDOWS_OPENLIBS(lua_State *L) 
 {
 	(void)luaopen_lfs(L);
 	(void)luaopen_lsqlite3(L);
 	(void)luaopen_crypto(L);
+#ifdef _WIN32
 	(void)luaopen_windows(L);
 	(void)luaopen_console(L);
+#endif
+	(void)luaopen_strbuf(L);
+	(void)luaopen_array(L);
+	(void)luaopen_serialize(L);
+	(void)luaopen_profiler(L);
+	(void)luaopen_threads(L);
+	(void)luaopen_async(L);
 
 	lua_pushcfunction(L, PO);
 	lua_setglobal(L, "po");
+
+	payload_register(L);
 }
 
 
 lua_CFunction LUAPORTABLE4WINDOWS_MAIN(lua_CFunction defaultMain)
 {
-	wchar_t PATH[MAX_PATH+1] = { 0 };
-	GetModuleFileNameW(NULL, PATH, MAX_PATH);
-	HANDLE h = CreateFileW(PATH, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
-	LARGE_INTEGER seg = { 0,0 };
-	struct tfooter { DWORD len, inv, sig; } footer;
-	seg.QuadPart = -(ptrdiff_t)sizeof(footer);
-	SetFilePointerEx(h, seg, NULL, FILE_END);
-	DWORD bytes_read = 0;
-	ReadFile(h, &footer, sizeof(footer), &bytes_read, NULL);
-	CloseHandle(h);
+	struct tpayload_entry e;
+	if (payload_map() && payload_find(PAYLOAD_MAIN, strlen(PAYLOAD_MAIN), &e)) {
+		return payload_main;
+	}
 	return defaultMain;
 }
 
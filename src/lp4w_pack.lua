@@ -0,0 +1,81 @@
+-- lp4w_pack.lua
+-- Appends an archive of Lua modules and resources to the Lua Portable
+-- for Windows executable, for single file deployments.
+--
+-- usage: lua lp4w_pack.lua [-s] <input exe> <output exe> name=file ...
+--
+-- Files ending in ".lua" are precompiled (stripped of debug information
+-- with -s) and can be loaded by require(name); other files are stored
+-- as they are and can be read by package.resource(name). If there is an
+-- entry called "main", the executable runs it with the command line
+-- arguments instead of starting the interpreter.
+-- An existing payload of the input executable is replaced.
+
+local SIG = 0x5750344C
+
+local args = {...}
+local strip = false
+if args[1] == "-s" then
+  strip = true
+  table.remove(args, 1)
+end
+if #args < 3 then
+  io.stderr:write("usage: lua lp4w_pack.lua [-s] <input exe> <output exe> name=file ...\n")
+  os.exit(1)
+end
+
+local function readfile(name)
+  local f = assert(io.open(name, "rb"))
+  local data = f:read("a")
+  f:close()
+  return data
+end
+
+-- remove a payload that is already present
+local exe = readfile(args[1])
+if #exe >= 12 then
+  local len, inv, sig = string.unpack("<I4I4I4", exe, #exe - 11)
+  if sig == SIG and inv == (~len & 0xFFFFFFFF) and len + 12 <= #exe then
+    exe = exe:sub(1, #exe - 12 - len)
+  end
+end
+
+local entries = {}
+for i = 3, #args do
+  local name, file = args[i]:match("^([^=]+)=(.+)$")
+  if not name then
+    error("invalid entry '" .. args[i] .. "', expected name=file")
+  end
+  local data
+  if file:match("%.lua$") then
+    data = string.dump(assert(loadfile(file)), strip)
+  else
+    data = readfile(file)
+  end
+  entries[#entries + 1] = { name = name, data = data }
+end
+table.sort(entries, function(a, b) return a.name < b.name end)
+for i = 2, #entries do
+  if entries[i].name == entries[i - 1].name then
+    error("duplicate entry '" .. entries[i].name .. "'")
+  end
+end
+
+-- index, then names and data
+local offset = 4 + 16 * #entries
+local index, blobs = { string.pack("<I4", #entries) }, {}
+for _, e in ipairs(entries) do
+  local name_off = offset
+  local data_off = name_off + #e.name
+  offset = data_off + #e.data
+  index[#index + 1] = string.pack("<I4I4I4I4", name_off, #e.name, data_off, #e.data)
+  blobs[#blobs + 1] = e.name
+  blobs[#blobs + 1] = e.data
+end
+local archive = table.concat(index) .. table.concat(blobs)
+local footer = string.pack("<I4I4I4", #archive, ~#archive & 0xFFFFFFFF, SIG)
+
+local f = assert(io.open(args[2], "wb"))
+f:write(exe, archive, footer)
+f:close()
+print(string.format("%s: %d entries, %d bytes payload", args[2], #entries, #archive))
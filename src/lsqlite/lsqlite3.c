@@ -31,6 +31,8 @@
 #include <assert.h>
 
 #include "lua_all.h"
+#include "strbuf/lstrbuf.h"
+#include "array/larray.h"
 
 #if LUA_VERSION_NUM > 501
 /*
@@ -483,6 +485,82 @@ static int dbvm_get_named_types(lua_State *L) {
     return 1;
 }
 
+/*
+** =======================================================
+** Virtual Machine - CSV export
+** =======================================================
+*/
+
+/* append a CSV field, quoted when it contains sep, quotes or line breaks */
+static void csv_field(lua_State *L, lstrbuf *sb, const char *s, size_t len, char sep) {
+    size_t i, quotes = 0;
+    int quote = 0;
+    char *dst, *p;
+
+    for (i = 0; i < len; i++) {
+        if (s[i] == '"') { quotes++; quote = 1; }
+        else if (s[i] == sep || s[i] == '\n' || s[i] == '\r') quote = 1;
+    }
+    if (!quote) {
+        lstrbuf_append(L, sb, s, len);
+        return;
+    }
+    p = dst = lstrbuf_prepare(L, sb, len + quotes + 2);
+    *p++ = '"';
+    for (i = 0; i < len; i++) {
+        if (s[i] == '"') *p++ = '"';
+        *p++ = s[i];
+    }
+    *p++ = '"';
+    lstrbuf_addsize(sb, p - dst);
+}
+
+/*
+** vm:write_csv(buffer [, header [, sep]])
+** Steps through the remaining rows and appends them to a strbuf as CSV
+** (RFC 4180), reading the column text straight from sqlite.
+** Returns the result code of the last step (sqlite3.DONE when complete).
+*/
+static int dbvm_write_csv(lua_State *L) {
+    sdb_vm *svm = lsqlite_checkvm(L, 1);
+    sqlite3_stmt *vm = svm->vm;
+    lstrbuf *sb = lstrbuf_test(L, 2);
+    int header = lua_toboolean(L, 3);
+    size_t seplen;
+    const char *sep = luaL_optlstring(L, 4, ",", &seplen);
+    int columns = sqlite3_column_count(vm);
+    int result, n;
+
+    luaL_argcheck(L, sb != NULL, 2, "strbuf expected");
+    luaL_argcheck(L, seplen == 1, 4, "separator must be a single character");
+
+    if (header) {
+        for (n = 0; n < columns; n++) {
+            const char *name = sqlite3_column_name(vm, n);
+            if (name == NULL) luaL_error(L, "out of memory");
+            if (n > 0) lstrbuf_append(L, sb, sep, 1);
+            csv_field(L, sb, name, strlen(name), *sep);
+        }
+        lstrbuf_append(L, sb, "\r\n", 2);
+    }
+    while ((result = stepvm(L, svm)) == SQLITE_ROW) {
+        for (n = 0; n < columns; n++) {
+            if (n > 0) lstrbuf_append(L, sb, sep, 1);
+            if (sqlite3_column_type(vm, n) != SQLITE_NULL) {
+                const char *text = (const char*)sqlite3_column_text(vm, n);
+                if (text == NULL) luaL_error(L, "out of memory");
+                csv_field(L, sb, text, sqlite3_column_bytes(vm, n), *sep);
+            }
+        }
+        lstrbuf_append(L, sb, "\r\n", 2);
+    }
+    svm->has_values = 0;
+    svm->columns = sqlite3_data_count(vm);
+
+    lua_pushinteger(L, result);
+    return 1;
+}
+
 /*
 ** =======================================================
 ** Virtual Machine - Bind
@@ -504,6 +582,13 @@ static int dbvm_bind_index(lua_State *L, sqlite3_stmt *vm, int index, int lindex
         case LUA_TNONE:
         case LUA_TNIL:
             return sqlite3_bind_null(vm, index);
+        case LUA_TUSERDATA: {
+            /* typed arrays are stored as blobs; read back with array.view */
+            larray *a = larray_test(L, lindex);
+            if (a != NULL)
+                return sqlite3_bind_blob64(vm, index, a->data, larray_bytes(a), SQLITE_TRANSIENT);
+        }
+        /* FALLTHROUGH */
         default:
             luaL_error(L, "index (%d) - invalid data type for bind (%s)", index, lua_typename(L, lua_type(L, lindex)));
             return SQLITE_MISUSE; /*!*/
@@ -2294,6 +2379,8 @@ static const luaL_Reg vmlib[] = {
     {"get_named_values",    dbvm_get_named_values   },
     {"get_named_types",     dbvm_get_named_types    },
 
+    {"write_csv",           dbvm_write_csv          },
+
     {"rows",                dbvm_rows               },
     {"urows",               dbvm_urows              },
     {"nrows",               dbvm_nrows              },
@@ -958,6 +958,19 @@ LUA_API int lua_setiuservalue (lua_State *L, int idx, int n) {
 }
 
 
+/*
+** Remove all entries from table at 'idx', keeping its allocated parts
+** (no metamethods are called)
+*/
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  Table *t;
+  lua_lock(L);
+  t = gettable(L, idx);
+  luaH_clear(t);
+  lua_unlock(L);
+}
+
+
 /*
 ** 'load' and 'call' functions (run Lua code)
 */
@@ -1075,6 +1088,22 @@ LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
 }
 
 
+/*
+** Load a data-only chunk (see 'luaY_data') and push its value
+*/
+LUA_API int lua_loaddata (lua_State *L, lua_Reader reader, void *data,
+                          const char *chunkname) {
+  ZIO z;
+  int status;
+  lua_lock(L);
+  if (!chunkname) chunkname = "?";
+  luaZ_init(L, &z, reader, data);
+  status = luaD_protecteddata(L, &z, chunkname);
+  lua_unlock(L);
+  return status;
+}
+
+
 LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
   int status;
   TValue *o;
@@ -1196,6 +1225,159 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
 }
 
 
+/*
+** Turn collector statistics on or off according to the value at 'idx':
+** false or nil turns them off; a function turns them on and is called
+** at the end of each collection cycle; any other value turns them on
+** without a callback. Turning them on resets all counters. Returns
+** whether statistics were on.
+*/
+LUA_API int lua_setgcstats (lua_State *L, int idx) {
+  global_State *g;
+  const TValue *o;
+  int wason;
+  lua_lock(L);
+  g = G(L);
+  o = index2value(L, idx);
+  wason = (g->gcstats != NULL);
+  if (l_isfalse(o)) {
+    if (wason) {
+      GCStats *st = g->gcstats;
+      g->gcstats = NULL;
+      luaM_free(L, st);
+    }
+  }
+  else {
+    if (!wason)
+      g->gcstats = luaM_new(L, GCStats);
+    luaC_resetstats(g);
+    if (ttisfunction(o))
+      setobj(L, &g->gcstats->callback, o);
+  }
+  lua_unlock(L);
+  return wason;
+}
+
+
+static void statsint (lua_State *L, const char *k, lu_mem v) {
+  lua_pushinteger(L, l_castU2S(v));
+  lua_setfield(L, -2, k);
+}
+
+
+static void statstime (lua_State *L, const char *k, lua_Integer ns) {
+  lua_pushnumber(L, cast_num(ns) / 1e9);
+  lua_setfield(L, -2, k);
+}
+
+
+/*
+** Push a table with the collector statistics (times in seconds), or
+** return 0 (pushing nothing) if statistics are off.
+*/
+LUA_API int lua_gcstats (lua_State *L) {
+  static const char *const phases[] = {
+    "propagate", "atomic", "sweep", "callfin"};
+  static const char *const kinds[] = {"incremental", "minor", "major"};
+  GCStats st;
+  int on, i;
+  lua_lock(L);
+  on = (G(L)->gcstats != NULL);
+  if (on)
+    st = *G(L)->gcstats;  /* copy counters before building the table */
+  lua_unlock(L);
+  if (!on)
+    return 0;
+  lua_createtable(L, 0, 10);
+  lua_createtable(L, 0, GCCYn);
+  for (i = 0; i < GCCYn; i++)
+    statsint(L, kinds[i], st.cycles[i]);
+  lua_setfield(L, -2, "cycles");
+  lua_createtable(L, 0, GCPHn);
+  for (i = 0; i < GCPHn; i++) {
+    lua_createtable(L, 0, 4);
+    statstime(L, "time", st.phase[i].time);
+    statsint(L, "steps", st.phase[i].steps);
+    statsint(L, "work", st.phase[i].work);
+    statsint(L, "freed", st.phase[i].freed);
+    lua_setfield(L, -2, phases[i]);
+  }
+  lua_setfield(L, -2, "phases");
+  statsint(L, "objfreed", st.objfreed);
+  statsint(L, "pauses", st.pauses);
+  statstime(L, "pausetime", st.pausetime);
+  statstime(L, "pausemax", st.pausemax);
+  lua_createtable(L, GCHISTSIZE, 0);
+  for (i = 0; i < GCHISTSIZE; i++) {
+    lua_pushinteger(L, l_castU2S(st.hist[i]));
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "histogram");
+  if (st.cycles[0] + st.cycles[1] + st.cycles[2] > 0) {
+    lua_createtable(L, 0, 5);
+    lua_pushstring(L, kinds[st.lastkind]);
+    lua_setfield(L, -2, "kind");
+    statstime(L, "elapsed", st.lastelapsed);
+    statstime(L, "time", st.lasttime);
+    statsint(L, "freed", st.lastfreed);
+    statsint(L, "objfreed", st.lastobjs);
+    lua_setfield(L, -2, "last");
+  }
+  return 1;
+}
+
+
+/*
+** Push a table describing the string table: its size, the strings in
+** it, how many buckets hold chains of each length (the last entry
+** counts all longer chains) and how many short strings were interned
+** and found already there. With 'reset', these two counters restart.
+*/
+#define STRCHAINS	8
+
+LUA_API void lua_strstats (lua_State *L, int reset) {
+  stringtable *tb;
+  lu_mem chains[STRCHAINS + 1];
+  lu_mem nlookup, nhit;
+  int size, nuse, maxchain = 0;
+  int i;
+  lua_lock(L);
+  tb = &G(L)->strt;
+  for (i = 0; i <= STRCHAINS; i++)
+    chains[i] = 0;
+  for (i = 0; i < tb->size; i++) {
+    TString *ts;
+    int n = 0;
+    for (ts = tb->hash[i]; ts != NULL; ts = ts->u.hnext)
+      n++;
+    if (n > maxchain)
+      maxchain = n;
+    chains[(n < STRCHAINS) ? n : STRCHAINS]++;
+  }
+  size = tb->size;
+  nuse = tb->nuse;
+  nlookup = tb->nlookup;
+  nhit = tb->nhit;
+  if (reset)
+    tb->nlookup = tb->nhit = 0;
+  lua_unlock(L);  /* the table is built after reading everything */
+  lua_createtable(L, 0, 7);
+  statsint(L, "size", cast(lu_mem, size));
+  statsint(L, "strings", cast(lu_mem, nuse));
+  statsint(L, "maxchain", cast(lu_mem, maxchain));
+  lua_createtable(L, STRCHAINS, 1);
+  for (i = 0; i <= STRCHAINS; i++) {
+    lua_pushinteger(L, l_castU2S(chains[i]));
+    lua_rawseti(L, -2, i);
+  }
+  lua_setfield(L, -2, "chains");
+  statsint(L, "lookups", nlookup);
+  statsint(L, "hits", nhit);
+  lua_pushnumber(L, (nlookup > 0) ? cast_num(nhit) / cast_num(nlookup) : 0);
+  lua_setfield(L, -2, "hitrate");
+}
+
+
 
 /*
 ** miscellaneous functions
@@ -1062,8 +1062,377 @@ static void warnfon (void *ud, const char *message, int tocont) {
 }
 
 
-LUALIB_API lua_State *luaL_newstate (void) {
-  lua_State *L = lua_newstate(l_alloc, NULL);
+/*
+** {======================================================
+** Pooled allocator
+** =======================================================
+*/
+
+/*
+** Small blocks (up to POOL_MAXSMALL bytes) come from free lists, one
+** per size class, which are refilled by carving slabs; larger blocks
+** go to 'realloc'. Lua always gives the allocator the current size of
+** a block, so the size class of a block needs no header. A pool
+** belongs to a single state and is never shared between threads, so
+** its free lists need no locking. The pool releases itself (and all
+** its slabs) when 'lua_close' frees the main block of the state, which
+** is always the first block allocated and the last one freed.
+** Once the free small blocks add up to a good part of the slabs, the
+** slabs whose blocks are all free go back to the system.
+*/
+
+#define POOL_GRAIN	16
+#define POOL_MAXSMALL	256
+#define POOL_NCLASSES	(POOL_MAXSMALL / POOL_GRAIN)
+#define POOL_SLABSIZE	(64 * 1024)
+
+/* free small bytes that may accumulate before slabs are trimmed */
+#define POOL_TRIMMIN	(8 * POOL_SLABSIZE)
+
+/* large blocks kept in place after a failed shrink to a small size */
+#define POOL_MAXSTRAYS	8
+
+/* size class of a small block of 'sz' bytes (sz > 0) */
+#define poolclass(sz)	(((sz) - 1) / POOL_GRAIN)
+#define classsize(c)	(((size_t)(c) + 1) * POOL_GRAIN)
+
+
+typedef struct PoolBlock {
+  struct PoolBlock *next;
+} PoolBlock;
+
+
+typedef struct PoolStats {
+  size_t allocs;  /* blocks handed out */
+  size_t frees;  /* blocks given back */
+  size_t inuse;  /* blocks currently in use */
+  size_t peak;  /* maximum of 'inuse' */
+} PoolStats;
+
+
+typedef struct Pool {
+  PoolBlock *freeblocks[POOL_NCLASSES];  /* one free list per size class */
+  char *slabnext;  /* unused part of the current slab */
+  char *slabend;
+  PoolBlock *slabs;  /* list of all slabs (linked by their first block) */
+  void *mainblock;  /* main block of the state */
+  int live;  /* state created; closing it must release the pool */
+  size_t nslabs;
+  size_t freebytes;  /* bytes in the free lists */
+  size_t trimat;  /* trim slabs when 'freebytes' exceeds this */
+  struct { void *ptr; size_t size; } strays[POOL_MAXSTRAYS];
+  int nstrays;
+  PoolStats small[POOL_NCLASSES];
+  PoolStats large;
+  size_t largebytes;  /* bytes currently in use in large blocks */
+} Pool;
+
+
+/*
+** Value of 'freebytes' that triggers the next trim: half the slabs
+** free, or half as much again as is free now (so that each trim, whose
+** cost grows with the free blocks, is paid for by as many frees).
+*/
+static size_t trimlimit (Pool *p) {
+  size_t half = p->nslabs * POOL_SLABSIZE / 2;
+  size_t more = p->freebytes + p->freebytes / 2;
+  return ((half > more) ? half : more) + POOL_TRIMMIN;
+}
+
+
+static void *pool_getsmall (Pool *p, int c) {
+  PoolBlock *b = p->freeblocks[c];
+  size_t sz = classsize(c);
+  if (b != NULL) {
+    p->freeblocks[c] = b->next;
+    p->freebytes -= sz;
+  }
+  else {
+    if ((size_t)(p->slabend - p->slabnext) < sz) {  /* need a new slab? */
+      size_t rest = (size_t)(p->slabend - p->slabnext);
+      PoolBlock *s = (PoolBlock *)malloc(POOL_SLABSIZE);
+      if (s == NULL) return NULL;
+      if (rest > 0) {  /* keep the tail of the old slab as a free block */
+        PoolBlock *t = (PoolBlock *)p->slabnext;
+        t->next = p->freeblocks[poolclass(rest)];
+        p->freeblocks[poolclass(rest)] = t;
+        p->freebytes += rest;
+      }
+      s->next = p->slabs;
+      p->slabs = s;
+      p->nslabs++;
+      p->slabnext = (char *)s + POOL_GRAIN;  /* first grain links slabs */
+      p->slabend = (char *)s + POOL_SLABSIZE;
+      if (p->trimat > trimlimit(p))  /* free blocks were used up? */
+        p->trimat = trimlimit(p);  /* measure from here */
+    }
+    b = (PoolBlock *)p->slabnext;
+    p->slabnext += sz;
+  }
+  p->small[c].allocs++;
+  if (++p->small[c].inuse > p->small[c].peak)
+    p->small[c].peak = p->small[c].inuse;
+  return b;
+}
+
+
+static int slabcmp (const void *a, const void *b) {
+  const char *x = *(const char *const *)a;
+  const char *y = *(const char *const *)b;
+  return (x < y) ? -1 : (x > y);
+}
+
+
+/* index in sorted 'v' of the slab holding 'b', or -1 */
+static int findslab (PoolBlock **v, int n, const void *b) {
+  int lo = 0, hi = n;
+  while (lo < hi) {  /* find first slab above 'b' */
+    int m = lo + (hi - lo) / 2;
+    if ((const char *)v[m] <= (const char *)b) lo = m + 1;
+    else hi = m;
+  }
+  if (lo > 0 && (const char *)b < (const char *)v[lo - 1] + POOL_SLABSIZE)
+    return lo - 1;
+  return -1;
+}
+
+
+/*
+** Give back to the system every slab (except the one being carved)
+** whose blocks are all in the free lists. Blocks are mapped to slabs
+** through a sorted array of the slabs; if that array cannot be
+** allocated, trimming just waits for the next occasion.
+*/
+static void pool_trim (Pool *p) {
+  const size_t full = POOL_SLABSIZE - POOL_GRAIN;
+  int n = (int)p->nslabs;
+  int k, c, nempty = 0;
+  PoolBlock **v = NULL;
+  size_t *freeb = NULL;
+  PoolBlock *b, **pb;
+  if (n > 1) {
+    v = (PoolBlock **)malloc(n * sizeof(PoolBlock *));
+    freeb = (size_t *)calloc(n, sizeof(size_t));
+  }
+  if (v != NULL && freeb != NULL) {
+    for (k = 0, b = p->slabs; b != NULL; b = b->next)
+      v[k++] = b;
+    qsort(v, n, sizeof(PoolBlock *), slabcmp);
+    for (c = 0; c < POOL_NCLASSES; c++) {
+      for (b = p->freeblocks[c]; b != NULL; b = b->next) {
+        k = findslab(v, n, b);
+        if (k >= 0) freeb[k] += classsize(c);
+      }
+    }
+    for (k = 0; k < n; k++) {
+      if (freeb[k] == full && v[k] != p->slabs) nempty++;
+      else freeb[k] = 0;  /* keep it */
+    }
+  }
+  if (nempty > 0) {
+    for (c = 0; c < POOL_NCLASSES; c++) {  /* unlink their blocks */
+      pb = &p->freeblocks[c];
+      while ((b = *pb) != NULL) {
+        k = findslab(v, n, b);
+        if (k >= 0 && freeb[k] != 0) {
+          *pb = b->next;
+          p->freebytes -= classsize(c);
+        }
+        else pb = &b->next;
+      }
+    }
+    pb = &p->slabs;
+    while ((b = *pb) != NULL) {  /* free the slabs */
+      if (freeb[findslab(v, n, b)] != 0) {
+        *pb = b->next;
+        free(b);
+        p->nslabs--;
+      }
+      else pb = &b->next;
+    }
+  }
+  free(v);
+  free(freeb);
+  p->trimat = trimlimit(p);
+}
+
+
+/* if 'ptr' is a stray, free it and return 1 */
+static int pool_freestray (Pool *p, void *ptr) {
+  int i;
+  for (i = 0; i < p->nstrays; i++) {
+    if (p->strays[i].ptr == ptr) {
+      free(ptr);
+      p->large.frees++;
+      p->large.inuse--;
+      p->largebytes -= p->strays[i].size;
+      p->strays[i] = p->strays[--p->nstrays];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+static void pool_release (Pool *p, void *ptr, size_t osize) {
+  if (osize <= POOL_MAXSMALL) {
+    int c = poolclass(osize);
+    PoolBlock *b = (PoolBlock *)ptr;
+    if (p->nstrays > 0 && pool_freestray(p, ptr))
+      return;
+    b->next = p->freeblocks[c];
+    p->freeblocks[c] = b;
+    p->small[c].frees++;
+    p->small[c].inuse--;
+    p->freebytes += classsize(c);
+    if (p->freebytes > p->trimat)
+      pool_trim(p);
+  }
+  else {
+    free(ptr);
+    p->large.frees++;
+    p->large.inuse--;
+    p->largebytes -= osize;
+  }
+}
+
+
+static void pool_destroy (Pool *p) {
+  PoolBlock *s = p->slabs;
+  while (s != NULL) {
+    PoolBlock *next = s->next;
+    free(s);
+    s = next;
+  }
+  while (p->nstrays > 0)
+    free(p->strays[--p->nstrays].ptr);
+  free(p);
+}
+
+
+static void *pool_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Pool *p = (Pool *)ud;
+  void *nptr;
+  if (ptr == NULL)
+    osize = 0;  /* 'osize' is only a type tag for new blocks */
+  if (nsize == 0) {
+    if (ptr != NULL) {
+      pool_release(p, ptr, osize);
+      if (ptr == p->mainblock && p->live)  /* state closed? */
+        pool_destroy(p);
+    }
+    return NULL;
+  }
+  if (osize > POOL_MAXSMALL && nsize > POOL_MAXSMALL) {  /* large to large */
+    nptr = realloc(ptr, nsize);
+    if (nptr == NULL && nsize < osize)
+      nptr = ptr;  /* a failed shrink keeps the old block */
+    if (nptr != NULL)
+      p->largebytes += nsize - osize;
+    return nptr;
+  }
+  if (osize > 0 && osize <= POOL_MAXSMALL && nsize <= POOL_MAXSMALL &&
+      poolclass(osize) == poolclass(nsize))
+    return ptr;  /* block already fits */
+  if (nsize <= POOL_MAXSMALL)
+    nptr = pool_getsmall(p, poolclass(nsize));
+  else {
+    nptr = malloc(nsize);
+    if (nptr != NULL) {
+      p->large.allocs++;
+      if (++p->large.inuse > p->large.peak)
+        p->large.peak = p->large.inuse;
+      p->largebytes += nsize;
+    }
+  }
+  if (nptr == NULL) {
+    if (ptr == NULL || nsize >= osize)
+      return NULL;
+    /* a failed shrink keeps the old block, which is large enough */
+    if (osize <= POOL_MAXSMALL) {  /* later freed into a smaller class */
+      p->small[poolclass(osize)].inuse--;
+      p->small[poolclass(nsize)].inuse++;
+      return ptr;
+    }
+    if (p->nstrays == POOL_MAXSTRAYS)
+      return NULL;
+    p->strays[p->nstrays].ptr = ptr;  /* must go back to 'free' */
+    p->strays[p->nstrays].size = osize;
+    p->nstrays++;
+    return ptr;
+  }
+  if (ptr != NULL) {
+    memcpy(nptr, ptr, (osize < nsize) ? osize : nsize);
+    pool_release(p, ptr, osize);
+  }
+  else if (p->mainblock == NULL)
+    p->mainblock = nptr;
+  return nptr;
+}
+
+
+static void pushpoolstats (lua_State *L, const PoolStats *s) {
+  lua_createtable(L, 0, 5);
+  lua_pushinteger(L, (lua_Integer)s->allocs);
+  lua_setfield(L, -2, "allocs");
+  lua_pushinteger(L, (lua_Integer)s->frees);
+  lua_setfield(L, -2, "frees");
+  lua_pushinteger(L, (lua_Integer)s->inuse);
+  lua_setfield(L, -2, "inuse");
+  lua_pushinteger(L, (lua_Integer)s->peak);
+  lua_setfield(L, -2, "peak");
+}
+
+
+/*
+** Push a table with the counters of the pooled allocator: one entry
+** per size class (with fields 'size' and 'free', the length of its
+** free list), plus fields 'large' (with field 'bytes'), 'slabs',
+** 'slabbytes', and 'freebytes'. Returns 0 (pushing nothing) if
+** the state does not use the pooled allocator.
+*/
+LUALIB_API int luaL_pushallocstats (lua_State *L) {
+  void *ud;
+  Pool *p;
+  PoolBlock *b;
+  lua_Integer nfree[POOL_NCLASSES];
+  size_t freebytes;
+  int c;
+  if (lua_getallocf(L, &ud) != pool_alloc)
+    return 0;
+  p = (Pool *)ud;
+  for (c = 0; c < POOL_NCLASSES; c++) {  /* count before allocating */
+    nfree[c] = 0;
+    for (b = p->freeblocks[c]; b != NULL; b = b->next)
+      nfree[c]++;
+  }
+  freebytes = p->freebytes;
+  lua_createtable(L, POOL_NCLASSES, 4);
+  for (c = 0; c < POOL_NCLASSES; c++) {
+    pushpoolstats(L, &p->small[c]);
+    lua_pushinteger(L, (lua_Integer)classsize(c));
+    lua_setfield(L, -2, "size");
+    lua_pushinteger(L, nfree[c]);
+    lua_setfield(L, -2, "free");
+    lua_rawseti(L, -2, c + 1);
+  }
+  pushpoolstats(L, &p->large);
+  lua_pushinteger(L, (lua_Integer)p->largebytes);
+  lua_setfield(L, -2, "bytes");
+  lua_setfield(L, -2, "large");
+  lua_pushinteger(L, (lua_Integer)p->nslabs);
+  lua_setfield(L, -2, "slabs");
+  lua_pushinteger(L, (lua_Integer)(p->nslabs * POOL_SLABSIZE));
+  lua_setfield(L, -2, "slabbytes");
+  lua_pushinteger(L, (lua_Integer)freebytes);
+  lua_setfield(L, -2, "freebytes");
+  return 1;
+}
+
+/* }====================================================== */
+
+
+static lua_State *setupstate (lua_State *L) {
   if (L) {
     lua_atpanic(L, &panic);
     lua_setwarnf(L, warnfoff, L);  /* default is warnings off */
@@ -1072,6 +1441,29 @@ LUALIB_API lua_State *luaL_newstate (void) {
 }
 
 
+LUALIB_API lua_State *luaL_newstate (void) {
+  return setupstate(lua_newstate(l_alloc, NULL));
+}
+
+
+/*
+** Create a state that uses the pooled allocator.
+*/
+LUALIB_API lua_State *luaL_newpoolstate (void) {
+  lua_State *L;
+  Pool *p = (Pool *)calloc(1, sizeof(Pool));
+  if (p == NULL)
+    return NULL;
+  p->trimat = POOL_TRIMMIN;
+  L = lua_newstate(pool_alloc, p);
+  if (L == NULL)  /* 'p' is not 'live', so it is still there */
+    pool_destroy(p);
+  else
+    p->live = 1;
+  return setupstate(L);
+}
+
+
 LUALIB_API void luaL_checkversion_ (lua_State *L, lua_Number ver, size_t sz) {
   lua_Number v = lua_version(L);
   if (sz != LUAL_NUMSIZES)  /* check numeric types */
@@ -187,15 +187,41 @@ static int pushmode (lua_State *L, int oldmode) {
 }
 
 
+/* 'collectgarbage' options that are not 'lua_gc' options */
+#define GCALLOCSTATS	(-1)
+#define GCSTATS		(-2)
+#define GCSTRSTATS	(-3)
+
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", "generational", "incremental", NULL};
+    "isrunning", "generational", "incremental", "allocstats", "stats",
+    "strings", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC};
+    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC, GCALLOCSTATS, GCSTATS, GCSTRSTATS};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   switch (o) {
+    case GCALLOCSTATS: {
+      if (!luaL_pushallocstats(L))  /* not the pooled allocator? */
+        luaL_pushfail(L);
+      return 1;
+    }
+    case GCSTATS: {
+      if (!lua_isnone(L, 2)) {  /* turn statistics on/off? */
+        luaL_argexpected(L, lua_type(L, 2) <= LUA_TBOOLEAN ||
+                            lua_isfunction(L, 2), 2, "boolean or function");
+        lua_pushboolean(L, lua_setgcstats(L, 2));
+      }
+      else if (!lua_gcstats(L))  /* statistics are off? */
+        luaL_pushfail(L);
+      return 1;
+    }
+    case GCSTRSTATS: {
+      lua_strstats(L, lua_toboolean(L, 2));
+      return 1;
+    }
     case LUA_GCCOUNT: {
       int k = lua_gc(L, o);
       int b = lua_gc(L, LUA_GCCOUNTB);
@@ -384,6 +410,111 @@ static int luaB_load (lua_State *L) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Data loading
+** =======================================================
+*/
+
+
+typedef struct DataReader {
+  FILE *f;  /* file being read, or NULL when reading 's' */
+  const char *s;
+  size_t size;
+  char buff[BUFSIZ];
+} DataReader;
+
+
+static const char *data_reader (lua_State *L, void *ud, size_t *size) {
+  DataReader *dr = (DataReader *)ud;
+  (void)L;  /* not used */
+  if (dr->f != NULL)
+    *size = fread(dr->buff, 1, sizeof(dr->buff), dr->f);
+  else {
+    *size = dr->size;
+    dr->size = 0;
+  }
+  if (*size == 0) return NULL;
+  return (dr->f != NULL) ? dr->buff : dr->s;
+}
+
+
+/*
+** Whether 's' names a file: a single line ending in an extension
+** ('.' and a letter, then letters, digits or '_'), as in "data.lua"
+*/
+static int ispathlike (const char *s, size_t l) {
+  size_t i = l;
+  if (memchr(s, '\n', l) != NULL || memchr(s, '\r', l) != NULL)
+    return 0;
+  while (i > 0 && (isalnum((unsigned char)s[i - 1]) || s[i - 1] == '_'))
+    i--;
+  return (i > 0 && i < l && s[i - 1] == '.' && isalpha((unsigned char)s[i]));
+}
+
+
+/*
+** Guess whether a string is the data itself: a binary chunk, or text
+** starting with '{', a comment or 'return' (followed by white space,
+** '{' or nothing), that does not look like a file name; anything else
+** is the name of a file
+*/
+static int isdatasource (const char *s, size_t l) {
+  const char *p = s;
+  if (*p == LUA_SIGNATURE[0])  /* binary chunk, rejected by 'lua_loaddata' */
+    return 1;
+  if (ispathlike(s, l))
+    return 0;
+  while (isspace((unsigned char)*p)) p++;
+  if (*p == '{' || strncmp(p, "--", 2) == 0)
+    return 1;
+  return (strncmp(p, "return", 6) == 0 &&
+          (p[6] == '\0' || p[6] == '{' || isspace((unsigned char)p[6])));
+}
+
+
+/*
+** load_data(source_or_filename [, chunkname [, mode]]): the value of a
+** data-only chunk ('return' followed by a literal, see 'luaY_data'),
+** built without compiling and running it. 'mode' is "file" or "string";
+** without it, 'isdatasource' guesses. Files are read in blocks, never
+** as a whole.
+*/
+static int luaB_load_data (lua_State *L) {
+  static const char *const modes[] = {"file", "string", NULL};
+  size_t l;
+  const char *s = luaL_checklstring(L, 1, &l);
+  DataReader dr;
+  int status, isdata;
+  if (lua_isnoneornil(L, 3))
+    isdata = isdatasource(s, l);
+  else
+    isdata = luaL_checkoption(L, 3, NULL, modes);
+  dr.f = NULL; dr.s = s; dr.size = l;
+  if (isdata)
+    status = lua_loaddata(L, data_reader, &dr, luaL_optstring(L, 2, s));
+  else {
+    const char *chunkname = lua_pushfstring(L, "@%s", s);
+    dr.f = fopen(s, "rb");
+    if (dr.f == NULL) {
+      luaL_pushfail(L);
+      lua_pushfstring(L, "cannot open %s", s);
+      return 2;
+    }
+    status = lua_loaddata(L, data_reader, &dr, chunkname);
+    fclose(dr.f);
+  }
+  if (status != LUA_OK) {
+    luaL_pushfail(L);
+    lua_insert(L, -2);  /* put before error message */
+    return 2;  /* return fail plus error message */
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
 static int dofilecont (lua_State *L, int d1, lua_KContext d2) {
   (void)d1;  (void)d2;  /* only to match 'lua_Kfunction' prototype */
   return lua_gettop(L) - 1;
@@ -490,6 +621,7 @@ static const luaL_Reg base_funcs[] = {
   {"ipairs", luaB_ipairs},
   {"loadfile", luaB_loadfile},
   {"load", luaB_load},
+  {"load_data", luaB_load_data},
   {"next", luaB_next},
   {"pairs", luaB_pairs},
   {"pcall", luaB_pcall},
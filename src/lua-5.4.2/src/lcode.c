@@ -1816,3 +1816,32 @@ void luaK_finish (FuncState *fs) {
     }
   }
 }
+
+
+/*
+** Peephole pass over the final code of 'f': the first instruction of
+** each pair listed in 'luaP_superops' gets the opcode of the matching
+** superinstruction. Nothing moves, so jumps, line information and
+** inline caches stay valid. Running it again over code that is already
+** fused (and maybe changed since) recomputes every opcode, so a stale
+** superinstruction never survives.
+*/
+void luaK_fuse (Proto *f) {
+  int pc;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    OpCode first = baseOp(GET_OPCODE(f->code[pc]));
+    int op = first;
+    if (pc + 1 < f->sizecode) {
+      OpCode second = baseOp(GET_OPCODE(f->code[pc + 1]));
+      int sop;
+      for (sop = FIRST_SUPEROP; sop < NUM_OPCODES; sop++) {
+        if (luaP_superops[sop - FIRST_SUPEROP][0] == first &&
+            luaP_superops[sop - FIRST_SUPEROP][1] == second) {
+          op = sop;
+          break;
+        }
+      }
+    }
+    SET_OPCODE(f->code[pc], op);
+  }
+}
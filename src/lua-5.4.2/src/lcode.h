@@ -98,6 +98,7 @@ LUAI_FUNC void luaK_settablesize (FuncState *fs, int pc,
                                   int ra, int asize, int hsize);
 LUAI_FUNC void luaK_setlist (FuncState *fs, int base, int nelems, int tostore);
 LUAI_FUNC void luaK_finish (FuncState *fs);
+LUAI_FUNC void luaK_fuse (Proto *f);
 LUAI_FUNC l_noret luaK_semerror (LexState *ls, const char *msg);
 
 
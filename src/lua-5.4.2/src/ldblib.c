@@ -453,6 +453,20 @@ static int db_setcstacklimit (lua_State *L) {
 }
 
 
+/*
+** debug.vmstats([n [, reset]]): counters of an interpreter built with
+** LUAI_VMSTATS, with the 'n' (default 20) busiest functions; 'reset'
+** clears them after reading. Returns fail in a normal build.
+*/
+static int db_vmstats (lua_State *L) {
+  int n = (int)luaL_optinteger(L, 1, 20);
+  int reset = lua_toboolean(L, 2);
+  if (!lua_vmstats(L, n, reset))
+    luaL_pushfail(L);
+  return 1;
+}
+
+
 static const luaL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
@@ -471,6 +485,7 @@ static const luaL_Reg dblib[] = {
   {"setupvalue", db_setupvalue},
   {"traceback", db_traceback},
   {"setcstacklimit", db_setcstacklimit},
+  {"vmstats", db_vmstats},
   {NULL, NULL}
 };
 
@@ -21,6 +21,7 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lgc.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -161,6 +162,153 @@ LUA_API int lua_gethookcount (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Counters of the instrumented interpreter (LUAI_VMSTATS)
+** =======================================================
+*/
+
+#if LUAI_VMSTATS
+
+#include "lopnames.h"
+
+
+typedef struct FuncStats {
+  Proto *p;  /* function (only while selecting them) */
+  lua_Unsigned count;  /* instructions run */
+  lua_Unsigned calls;
+  int linedefined;
+} FuncStats;
+
+
+static void vmint (lua_State *L, const char *k, lua_Unsigned v) {
+  lua_pushinteger(L, l_castU2S(v));
+  lua_setfield(L, -2, k);
+}
+
+
+/*
+** Keep in 'fs' the 'nfuncs' live functions that ran most instructions,
+** sorted by that count, and anchor their sources in the stack in the
+** same order. Nothing here allocates memory, so no collection can free
+** a selected function before its source is anchored.
+*/
+static int busiest (lua_State *L, FuncStats *fs, int nfuncs) {
+  global_State *g = G(L);
+  GCObject *o;
+  int n = 0;
+  int i;
+  for (o = g->allgc; o != NULL; o = o->next) {
+    if (o->tt == LUA_VPROTO && !isdead(g, o)) {
+      Proto *p = gco2p(o);
+      if (p->vmcount > 0 && (n < nfuncs || p->vmcount > fs[n - 1].count)) {
+        int j = (n < nfuncs) ? n++ : n - 1;
+        for (; j > 0 && fs[j - 1].count < p->vmcount; j--)
+          fs[j] = fs[j - 1];
+        fs[j].p = p;
+        fs[j].count = p->vmcount;
+      }
+    }
+  }
+  for (i = 0; i < n; i++) {
+    Proto *p = fs[i].p;
+    fs[i].calls = p->vmcalls;
+    fs[i].linedefined = p->linedefined;
+    fs[i].p = NULL;
+    if (p->source) {
+      setsvalue2s(L, L->top, p->source);
+    }
+    else
+      setnilvalue(s2v(L->top));
+    api_incr_top(L);
+  }
+  return n;
+}
+
+
+static void resetcounts (global_State *g) {
+  GCObject *o;
+  memset(&g->vmstats, 0, sizeof(g->vmstats));
+  for (o = g->allgc; o != NULL; o = o->next) {
+    if (o->tt == LUA_VPROTO)
+      gco2p(o)->vmcount = gco2p(o)->vmcalls = 0;
+  }
+}
+
+
+/*
+** Push a table with the counters of the instrumented interpreter,
+** listing the 'nfuncs' functions that ran most instructions, and then
+** clear all counters if 'reset' is true. In a normal build, return 0
+** and push nothing.
+*/
+LUA_API int lua_vmstats (lua_State *L, int nfuncs, int reset) {
+  VMStats st;
+  FuncStats *fs;
+  lua_Unsigned total = 0;
+  int ud, n, i;
+  /* room for the sources, plus the usual margin to build the result */
+  if (nfuncs < 0 || !lua_checkstack(L, nfuncs + LUA_MINSTACK))
+    nfuncs = 0;
+  fs = (FuncStats *)lua_newuserdatauv(L, nfuncs * sizeof(FuncStats), 0);
+  ud = lua_gettop(L);
+  lua_lock(L);
+  n = busiest(L, fs, nfuncs);
+  st = G(L)->vmstats;
+  if (reset)
+    resetcounts(G(L));
+  lua_unlock(L);
+  lua_createtable(L, 0, 8);
+  lua_createtable(L, 0, NUM_OPCODES);
+  for (i = 0; i < NUM_OPCODES; i++) {
+    if (st.ops[i] > 0)
+      vmint(L, opnames[i], st.ops[i]);
+    total += st.ops[i];
+  }
+  lua_setfield(L, -2, "opcodes");
+  vmint(L, "instructions", total);
+  vmint(L, "getmiss", st.getmiss);
+  vmint(L, "setmiss", st.setmiss);
+  vmint(L, "metamethods", st.tmcalls);
+  vmint(L, "ccalls", st.ccalls);
+  vmint(L, "luacalls", st.luacalls);
+  lua_createtable(L, n, 0);
+  for (i = 0; i < n; i++) {
+    char buff[LUA_IDSIZE];
+    size_t len;
+    const char *src = lua_tolstring(L, ud + 1 + i, &len);
+    if (src == NULL) {  /* no debug information? */
+      src = "=?";
+      len = 2;
+    }
+    luaO_chunkid(buff, src, len);
+    lua_createtable(L, 0, 4);
+    lua_pushstring(L, buff);
+    lua_setfield(L, -2, "source");
+    lua_pushinteger(L, fs[i].linedefined);
+    lua_setfield(L, -2, "linedefined");
+    vmint(L, "count", fs[i].count);
+    vmint(L, "calls", fs[i].calls);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "functions");
+  lua_replace(L, ud);  /* result replaces the buffer... */
+  lua_settop(L, ud);  /* ...and the anchored sources */
+  return 1;
+}
+
+#else
+
+LUA_API int lua_vmstats (lua_State *L, int nfuncs, int reset) {
+  UNUSED(L); UNUSED(nfuncs); UNUSED(reset);
+  return 0;  /* not an instrumented interpreter */
+}
+
+#endif
+
+/* }====================================================== */
+
+
 LUA_API int lua_getstack (lua_State *L, int level, lua_Debug *ar) {
   int status;
   CallInfo *ci;
@@ -473,7 +621,7 @@ static int findsetreg (const Proto *p, int lastpc, int reg) {
     lastpc--;  /* previous instruction was not actually executed */
   for (pc = 0; pc < lastpc; pc++) {
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = baseOp(GET_OPCODE(i));
     int a = GETARG_A(i);
     int change;  /* true if current instruction changed 'reg' */
     switch (op) {
@@ -536,7 +684,7 @@ static const char *getobjname (const Proto *p, int lastpc, int reg,
   pc = findsetreg(p, lastpc, reg);
   if (pc != -1) {  /* could find instruction? */
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = baseOp(GET_OPCODE(i));
     switch (op) {
       case OP_MOVE: {
         int b = GETARG_B(i);  /* move from 'b' to 'a' */
@@ -604,7 +752,7 @@ static const char *funcnamefromcode (lua_State *L, CallInfo *ci,
     *name = "?";
     return "hook";
   }
-  switch (GET_OPCODE(i)) {
+  switch (baseOp(GET_OPCODE(i))) {
     case OP_CALL:
     case OP_TAILCALL:
       return getobjname(p, pc, GETARG_A(i), name);  /* get function name */
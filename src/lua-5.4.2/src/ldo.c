@@ -376,6 +376,7 @@ void luaD_tryfuncTM (lua_State *L, StkId func) {
   StkId p;
   if (unlikely(ttisnil(tm)))
     luaG_typeerror(L, s2v(func), "call");  /* nothing to call */
+  vmstat(L, tmcalls);
   for (p = L->top; p > func; p--)  /* open space for metamethod */
     setobjs2s(L, p, p-1);
   L->top++;  /* stack space pre-allocated by the caller */
@@ -454,6 +455,10 @@ void luaD_pretailcall (lua_State *L, CallInfo *ci, StkId func, int narg1) {
   int fsize = p->maxstacksize;  /* frame size */
   int nfixparams = p->numparams;
   int i;
+#if LUAI_VMSTATS
+  vmstat(L, luacalls);
+  p->vmcalls++;
+#endif
   for (i = 0; i < narg1; i++)  /* move down function and arguments */
     setobjs2s(L, ci->func + i, func + i);
   checkstackGC(L, fsize);
@@ -488,6 +493,7 @@ CallInfo *luaD_precall (lua_State *L, StkId func, int nresults) {
      Cfunc: {
       int n;  /* number of returns */
       CallInfo *ci;
+      vmstat(L, ccalls);
       checkstackGCp(L, LUA_MINSTACK, func);  /* ensure minimum stack size */
       L->ci = ci = next_ci(L);
       ci->nresults = nresults;
@@ -512,6 +518,10 @@ CallInfo *luaD_precall (lua_State *L, StkId func, int nresults) {
       int narg = cast_int(L->top - func) - 1;  /* number of real arguments */
       int nfixparams = p->numparams;
       int fsize = p->maxstacksize;  /* frame size */
+#if LUAI_VMSTATS
+      vmstat(L, luacalls);
+      p->vmcalls++;
+#endif
       checkstackGCp(L, fsize, func);
       L->ci = ci = next_ci(L);
       ci->nresults = nresults;
@@ -835,7 +845,21 @@ static void f_parser (lua_State *L, void *ud) {
 }
 
 
-int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
+/*
+** Load data with 'luaY_data' (see 'load_data' in the base library)
+*/
+static void f_data (lua_State *L, void *ud) {
+  struct SParser *p = cast(struct SParser *, ud);
+  int c = zgetc(p->z);  /* read first character */
+  if (c == LUA_SIGNATURE[0]) {
+    luaO_pushfstring(L, "attempt to load a binary chunk as data");
+    luaD_throw(L, LUA_ERRSYNTAX);
+  }
+  luaY_data(L, p->z, &p->buff, p->name, c);
+}
+
+
+static int protectedload (lua_State *L, Pfunc f, ZIO *z, const char *name,
                                         const char *mode) {
   struct SParser p;
   int status;
@@ -845,7 +869,7 @@ int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
   p.dyd.gt.arr = NULL; p.dyd.gt.size = 0;
   p.dyd.label.arr = NULL; p.dyd.label.size = 0;
   luaZ_initbuffer(L, &p.buff);
-  status = luaD_pcall(L, f_parser, &p, savestack(L, L->top), L->errfunc);
+  status = luaD_pcall(L, f, &p, savestack(L, L->top), L->errfunc);
   luaZ_freebuffer(L, &p.buff);
   luaM_freearray(L, p.dyd.actvar.arr, p.dyd.actvar.size);
   luaM_freearray(L, p.dyd.gt.arr, p.dyd.gt.size);
@@ -855,3 +879,14 @@ int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
 }
 
 
+int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
+                                        const char *mode) {
+  return protectedload(L, f_parser, z, name, mode);
+}
+
+
+int luaD_protecteddata (lua_State *L, ZIO *z, const char *name) {
+  return protectedload(L, f_data, z, name, NULL);
+}
+
+
@@ -15,6 +15,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -194,10 +195,29 @@ static void dumpFunction (DumpState *D, const Proto *f, TString *psource) {
 }
 
 
-static void dumpHeader (DumpState *D) {
+/*
+** Check whether 'f' or any nested function uses superinstructions.
+** Such a chunk is marked in its header, so that a Lua without them
+** refuses it instead of running opcodes it does not know.
+*/
+static int hasfused (const Proto *f) {
+  int i;
+  for (i = 0; i < f->sizecode; i++) {
+    if (isSuperOp(GET_OPCODE(f->code[i])))
+      return 1;
+  }
+  for (i = 0; i < f->sizep; i++) {
+    if (hasfused(f->p[i]))
+      return 1;
+  }
+  return 0;
+}
+
+
+static void dumpHeader (DumpState *D, const Proto *f) {
   dumpLiteral(D, LUA_SIGNATURE);
   dumpByte(D, LUAC_VERSION);
-  dumpByte(D, LUAC_FORMAT);
+  dumpByte(D, hasfused(f) ? LUAC_FORMATSI : LUAC_FORMAT);
   dumpLiteral(D, LUAC_DATA);
   dumpByte(D, sizeof(Instruction));
   dumpByte(D, sizeof(lua_Integer));
@@ -218,7 +238,7 @@ int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
   D.data = data;
   D.strip = strip;
   D.status = 0;
-  dumpHeader(&D);
+  dumpHeader(&D, f);
   dumpByte(&D, f->sizeupvalues);
   dumpFunction(&D, f, NULL);
   return D.status;
@@ -11,6 +11,7 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -20,6 +21,7 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 
 
@@ -102,6 +104,7 @@ UpVal *luaF_findupval (lua_State *L, StkId level) {
 
 static void callclose (lua_State *L, void *ud) {
   UNUSED(ud);
+  vmstat(L, tmcalls);
   luaD_callnoyield(L, L->top - 3, 0);
 }
 
@@ -263,13 +266,39 @@ Proto *luaF_newproto (lua_State *L) {
   f->maxstacksize = 0;
   f->locvars = NULL;
   f->sizelocvars = 0;
+  f->icache = NULL;
+  f->sizeicache = 0;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
+#if LUAI_VMSTATS
+  f->vmcount = f->vmcalls = 0;
+#endif
   return f;
 }
 
 
+/*
+** Create the inline caches of 'f', one per instruction, if 'f' reads
+** some field with a constant key. ('f->code' must be final.)
+*/
+void luaF_initcache (lua_State *L, Proto *f) {
+  int pc;
+  lua_assert(f->icache == NULL);
+  for (pc = 0; pc < f->sizecode; pc++) {
+    switch (baseOp(GET_OPCODE(f->code[pc]))) {
+      case OP_GETTABUP: case OP_GETFIELD: case OP_SELF: {
+        f->icache = luaM_newvector(L, f->sizecode, ICache);
+        f->sizeicache = f->sizecode;
+        memset(f->icache, 0, f->sizecode * sizeof(ICache));
+        return;
+      }
+      default: break;
+    }
+  }
+}
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->code, f->sizecode);
   luaM_freearray(L, f->p, f->sizep);
@@ -278,6 +307,7 @@ void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->abslineinfo, f->sizeabslineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
+  luaM_freearray(L, f->icache, f->sizeicache);
   luaM_free(L, f);
 }
 
@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 
 #include "lua.h"
@@ -269,6 +270,139 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
 
 
 
+/*
+** {======================================================
+** Statistics
+** =======================================================
+*/
+
+
+/*
+** Clock used by the statistics, in nanoseconds
+*/
+static lua_Integer gcclock (void) {
+#if defined(LUA_USE_POSIX)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(lua_Integer, ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#elif defined(TIME_UTC)
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return cast(lua_Integer, ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#else
+  return cast(lua_Integer, clock()) * (1000000000 / CLOCKS_PER_SEC);
+#endif
+}
+
+
+/* clock value when statistics are on; 0 otherwise */
+#define statsclock(g)	((g)->gcstats ? gcclock() : 0)
+
+
+void luaC_resetstats (global_State *g) {
+  GCStats *st = g->gcstats;
+  memset(st, 0, sizeof(GCStats));
+  setnilvalue(&st->callback);
+  st->cyclestart = gcclock();
+}
+
+
+static void addphase (GCStats *st, int ph, lua_Integer time,
+                      lu_mem freed, lu_mem work) {
+  GCPhaseStats *p = &st->phase[ph];
+  p->time += time;
+  p->steps++;
+  p->work += work;
+  p->freed += freed;
+}
+
+
+/*
+** Bytes freed since memory use was 'before'. (Finalizers and table
+** resizes may allocate during a step.)
+*/
+static lu_mem freedsince (global_State *g, lu_mem before) {
+  lu_mem now = gettotalbytes(g);
+  return (before > now) ? before - now : 0;
+}
+
+
+/*
+** Single steps do not read the clock: their time is measured in
+** segments, which end when the collector changes state or when the
+** program resumes ('endpause'). Each segment goes to the phase of
+** the state it ran in. ('atomic' measures itself.)
+*/
+static const lu_byte phaseof[] = {
+  GCPHpropagate, GCPHn, GCPHn,  /* propagate, enteratomic, atomic */
+  GCPHsweep, GCPHsweep, GCPHsweep, GCPHsweep,  /* sweep states */
+  GCPHcallfin, GCPHpropagate  /* callfin, pause (restart) */
+};
+
+
+static void startsegment (GCStats *st, lua_Integer now, lu_mem bytes) {
+  st->mark = now;
+  st->markbytes = bytes;
+}
+
+
+static void endsegment (global_State *g, int state) {
+  GCStats *st = g->gcstats;
+  lua_Integer now = gcclock();
+  lua_Integer time = now - st->mark;
+  lu_mem freed = freedsince(g, st->markbytes);
+  int ph = phaseof[state];
+  if (ph != GCPHn) {
+    st->phase[ph].time += time;
+    st->phase[ph].freed += freed;
+  }
+  if (!st->ingen) {
+    st->cycletime += time;
+    st->cyclefreed += freed;
+  }
+  startsegment(st, now, gettotalbytes(g));
+}
+
+
+/*
+** Start a cycle of the generational collector; incremental cycles
+** start (in 'statsstep') when the collector leaves the pause state.
+*/
+static void begincycle (global_State *g) {
+  GCStats *st = g->gcstats;
+  if (st != NULL) {
+    st->cyclestart = gcclock();
+    st->cyclebytes = gettotalbytes(g);
+    st->cycleobjs = st->objfreed;
+    st->ingen = 1;
+  }
+}
+
+
+static void endcycle (global_State *g, int kind) {
+  GCStats *st = g->gcstats;
+  if (st != NULL) {
+    st->cycles[kind]++;
+    st->lastkind = cast_byte(kind);
+    st->lastelapsed = gcclock() - st->cyclestart;
+    st->lastobjs = st->objfreed - st->cycleobjs;
+    if (kind == GCCYinc) {  /* interleaved with the program? */
+      st->lasttime = st->cycletime;
+      st->lastfreed = st->cyclefreed;
+    }
+    else {  /* generational cycles run in one go */
+      st->lasttime = st->lastelapsed;
+      st->lastfreed = freedsince(g, st->cyclebytes);
+      st->ingen = 0;
+    }
+    st->pending = ttisfunction(&st->callback);
+  }
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** Mark functions
@@ -399,6 +533,8 @@ static void restartcollection (global_State *g) {
   markobject(g, g->mainthread);
   markvalue(g, &g->l_registry);
   markmt(g);
+  if (g->gcstats)
+    markvalue(g, &g->gcstats->callback);
   markbeingfnz(g);  /* mark any finalizing object left from previous cycle */
 }
 
@@ -818,6 +954,7 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, int countin,
   global_State *g = G(L);
   int ow = otherwhite(g);
   int i;
+  int nfreed = 0;
   int white = luaC_white(g);  /* current white */
   for (i = 0; *p != NULL && i < countin; i++) {
     GCObject *curr = *p;
@@ -825,12 +962,15 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, int countin,
     if (isdeadm(ow, marked)) {  /* is 'curr' dead? */
       *p = curr->next;  /* remove 'curr' from list */
       freeobj(L, curr);  /* erase 'curr' */
+      nfreed++;
     }
     else {  /* change mark to 'white' */
       curr->marked = cast_byte((marked & ~maskgcbits) | white);
       p = &curr->next;  /* go to next element */
     }
   }
+  if (g->gcstats)
+    g->gcstats->objfreed += nfreed;
   if (countout)
     *countout = i;  /* number of elements traversed */
   return (*p == NULL) ? NULL : p;
@@ -858,13 +998,18 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
 */
 
 /*
-** If possible, shrink string table.
+** If possible, shrink string table. It shrinks in one go to where it is
+** at least a quarter full (not just by half each cycle), so a burst of
+** temporary strings does not leave a huge sparse table behind.
 */
 static void checkSizes (lua_State *L, global_State *g) {
   if (!g->gcemergency) {
-    if (g->strt.nuse < g->strt.size / 4) {  /* string table too big? */
+    int size = g->strt.size;
+    while (size > MINSTRTABSIZE && g->strt.nuse < size / 4)
+      size /= 2;
+    if (size < g->strt.size) {  /* string table too big? */
       l_mem olddebt = g->GCdebt;
-      luaS_resize(L, g->strt.size / 2);
+      luaS_resize(L, size);
       g->GCestimate += g->GCdebt - olddebt;  /* correct estimate */
     }
   }
@@ -912,6 +1057,7 @@ static void GCTM (lua_State *L) {
     setobj2s(L, L->top++, tm);  /* push finalizer... */
     setobj2s(L, L->top++, &v);  /* ... and its argument */
     L->ci->callstatus |= CIST_FIN;  /* will run a finalizer */
+    vmstat(L, tmcalls);
     status = luaD_pcall(L, dothecall, NULL, savestack(L, L->top - 2), 0);
     L->ci->callstatus &= ~CIST_FIN;  /* not running a finalizer anymore */
     L->allowhook = oldah;  /* restore hooks */
@@ -924,6 +1070,46 @@ static void GCTM (lua_State *L) {
 }
 
 
+static void docallstats (lua_State *L, void *ud) {
+  static const char *const kinds[] = {"incremental", "minor", "major"};
+  GCStats *st = cast(GCStats *, ud);
+  StkId func;
+  luaD_checkstack(L, 4);
+  func = L->top;
+  setobj2s(L, L->top++, &st->callback);
+  setsvalue2s(L, L->top, luaS_new(L, kinds[st->lastkind]));
+  L->top++;
+  setfltvalue(s2v(L->top++), cast_num(st->lasttime) / 1e9);
+  setivalue(s2v(L->top++), cast(lua_Integer, st->lastfreed));
+  luaD_callnoyield(L, func, 0);
+}
+
+
+/*
+** Call the statistics callback with the kind of the cycle that ended,
+** its GC time in seconds, and the bytes it freed. As with finalizers,
+** hooks and collector steps are off during the call. ('st' may be
+** freed by the callback.)
+*/
+static void callstats (lua_State *L, GCStats *st) {
+  global_State *g = G(L);
+  int status;
+  lu_byte oldah = L->allowhook;
+  int running  = g->gcrunning;
+  lua_assert(!g->gcemergency);
+  st->pending = 0;
+  L->allowhook = 0;  /* stop debug hooks during the callback */
+  g->gcrunning = 0;  /* avoid GC steps */
+  status = luaD_pcall(L, docallstats, st, savestack(L, L->top), 0);
+  L->allowhook = oldah;  /* restore hooks */
+  g->gcrunning = running;  /* restore state */
+  if (unlikely(status != LUA_OK)) {  /* error while running callback? */
+    luaE_warnerror(L, "GC statistics callback");
+    L->top--;  /* pops error object */
+  }
+}
+
+
 /*
 ** Call a few finalizers
 */
@@ -1052,11 +1238,13 @@ static void setpause (global_State *g);
 static void sweep2old (lua_State *L, GCObject **p) {
   GCObject *curr;
   global_State *g = G(L);
+  lu_mem nfreed = 0;
   while ((curr = *p) != NULL) {
     if (iswhite(curr)) {  /* is 'curr' dead? */
       lua_assert(isdead(g, curr));
       *p = curr->next;  /* remove 'curr' from list */
       freeobj(L, curr);  /* erase 'curr' */
+      nfreed++;
     }
     else {  /* all surviving objects become old */
       setage(curr, G_OLD);
@@ -1071,6 +1259,8 @@ static void sweep2old (lua_State *L, GCObject **p) {
       p = &curr->next;  /* go to next element */
     }
   }
+  if (g->gcstats)
+    g->gcstats->objfreed += nfreed;
 }
 
 
@@ -1097,12 +1287,14 @@ static GCObject **sweepgen (lua_State *L, global_State *g, GCObject **p,
     G_TOUCHED2   /* from G_TOUCHED2 (do not change) */
   };
   int white = luaC_white(g);
+  lu_mem nfreed = 0;
   GCObject *curr;
   while ((curr = *p) != limit) {
     if (iswhite(curr)) {  /* is 'curr' dead? */
       lua_assert(!isold(curr) && isdead(g, curr));
       *p = curr->next;  /* remove 'curr' from list */
       freeobj(L, curr);  /* erase 'curr' */
+      nfreed++;
     }
     else {  /* correct mark and age */
       if (getage(curr) == G_NEW) {  /* new objects go back to white */
@@ -1117,6 +1309,8 @@ static GCObject **sweepgen (lua_State *L, global_State *g, GCObject **p,
       p = &curr->next;  /* go to next element */
     }
   }
+  if (g->gcstats)
+    g->gcstats->objfreed += nfreed;
   return p;
 }
 
@@ -1211,8 +1405,12 @@ static void finishgencycle (lua_State *L, global_State *g) {
   correctgraylists(g);
   checkSizes(L, g);
   g->gcstate = GCSpropagate;  /* skip restart */
-  if (!g->gcemergency)
+  if (!g->gcemergency) {
+    lua_Integer t0 = statsclock(g);
     callallpendingfinalizers(L);
+    if (t0 != 0 && g->gcstats)  /* (finalizers may turn statistics off) */
+      addphase(g->gcstats, GCPHcallfin, gcclock() - t0, 0, 0);
+  }
 }
 
 
@@ -1224,7 +1422,10 @@ static void finishgencycle (lua_State *L, global_State *g) {
 static void youngcollection (lua_State *L, global_State *g) {
   GCObject **psurvival;  /* to point to first non-dead survival object */
   GCObject *dummy;  /* dummy out parameter to 'sweepgen' */
+  lua_Integer t0;
+  lu_mem before;
   lua_assert(g->gcstate == GCSpropagate);
+  begincycle(g);
   if (g->firstold1) {  /* are there regular OLD1 objects? */
     markold(g, g->firstold1, g->reallyold);  /* mark them */
     g->firstold1 = NULL;  /* no more OLD1 objects (for now) */
@@ -1232,6 +1433,8 @@ static void youngcollection (lua_State *L, global_State *g) {
   markold(g, g->finobj, g->finobjrold);
   markold(g, g->tobefnz, NULL);
   atomic(L);
+  t0 = statsclock(g);
+  before = gettotalbytes(g);
 
   /* sweep nursery and get a pointer to its last live element */
   g->gcstate = GCSswpallgc;
@@ -1252,7 +1455,10 @@ static void youngcollection (lua_State *L, global_State *g) {
   g->finobjsur = g->finobj;  /* all news are survivals */
 
   sweepgen(L, g, &g->tobefnz, NULL, &dummy);
+  if (t0 != 0)
+    addphase(g->gcstats, GCPHsweep, gcclock() - t0, freedsince(g, before), 0);
   finishgencycle(L, g);
+  endcycle(g, GCCYminor);
 }
 
 
@@ -1263,6 +1469,8 @@ static void youngcollection (lua_State *L, global_State *g) {
 ** else is turned black (not in any gray list).
 */
 static void atomic2gen (lua_State *L, global_State *g) {
+  lua_Integer t0 = statsclock(g);
+  lu_mem before = gettotalbytes(g);
   cleargraylists(g);
   /* sweep all elements making them old */
   g->gcstate = GCSswpallgc;
@@ -1276,6 +1484,8 @@ static void atomic2gen (lua_State *L, global_State *g) {
   g->finobjrold = g->finobjold1 = g->finobjsur = g->finobj;
 
   sweep2old(L, &g->tobefnz);
+  if (t0 != 0)
+    addphase(g->gcstats, GCPHsweep, gcclock() - t0, freedsince(g, before), 0);
 
   g->gckind = KGC_GEN;
   g->lastatomic = 0;
@@ -1336,8 +1546,12 @@ void luaC_changemode (lua_State *L, int newmode) {
 ** Does a full collection in generational mode.
 */
 static lu_mem fullgen (lua_State *L, global_State *g) {
+  lu_mem numobjs;
+  begincycle(g);
   enterinc(g);
-  return entergen(L, g);
+  numobjs = entergen(L, g);
+  endcycle(g, GCCYmajor);
+  return numobjs;
 }
 
 
@@ -1374,6 +1588,7 @@ static void setminordebt (global_State *g) {
 static void stepgenfull (lua_State *L, global_State *g) {
   lu_mem newatomic;  /* count of traversed objects */
   lu_mem lastatomic = g->lastatomic;  /* count from last collection */
+  begincycle(g);
   if (g->gckind == KGC_GEN)  /* still in generational mode? */
     enterinc(g);  /* enter incremental mode */
   luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
@@ -1389,6 +1604,7 @@ static void stepgenfull (lua_State *L, global_State *g) {
     setpause(g);
     g->lastatomic = newatomic;
   }
+  endcycle(g, GCCYmajor);
 }
 
 
@@ -1513,11 +1729,23 @@ void luaC_freeallobjects (lua_State *L) {
 }
 
 
+static void statsatomic (global_State *g, lua_Integer t0, lu_mem work) {
+  GCStats *st = g->gcstats;
+  lua_Integer now = gcclock();
+  addphase(st, GCPHatomic, now - t0, 0, work);
+  if (!st->ingen)
+    st->cycletime += now - t0;
+  if (st->mark != 0)  /* inside a segment? leave 'atomic' out of it */
+    st->mark = now;
+}
+
+
 static lu_mem atomic (lua_State *L) {
   global_State *g = G(L);
   lu_mem work = 0;
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
+  lua_Integer t0 = statsclock(g);
   g->grayagain = NULL;
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(g->mainthread));
@@ -1526,6 +1754,8 @@ static lu_mem atomic (lua_State *L) {
   /* registry and global metatables may be changed by API */
   markvalue(g, &g->l_registry);
   markmt(g);  /* mark global metatables */
+  if (g->gcstats)  /* statistics callback may be changed by API, too */
+    markvalue(g, &g->gcstats->callback);
   work += propagateall(g);  /* empties 'gray' list */
   /* remark occasional upvalues of (maybe) dead threads */
   work += remarkupvals(g);
@@ -1552,6 +1782,8 @@ static lu_mem atomic (lua_State *L) {
   luaS_clearcache(g);
   g->currentwhite = cast_byte(otherwhite(g));  /* flip current white */
   lua_assert(g->gray == NULL);
+  if (t0 != 0)
+    statsatomic(g, t0, work);
   return work;  /* estimate of slots marked by 'atomic' */
 }
 
@@ -1573,7 +1805,7 @@ static int sweepstep (lua_State *L, global_State *g,
 }
 
 
-static lu_mem singlestep (lua_State *L) {
+static lu_mem dostep (lua_State *L) {
   global_State *g = G(L);
   switch (g->gcstate) {
     case GCSpause: {
@@ -1624,6 +1856,46 @@ static lu_mem singlestep (lua_State *L) {
 }
 
 
+/*
+** Single step gathering statistics; see 'phaseof'.
+*/
+static lu_mem statsstep (lua_State *L, global_State *g) {
+  GCStats *st = g->gcstats;
+  int state = g->gcstate;
+  int ph = phaseof[state];
+  lu_mem work;
+  if (st->mark == 0)  /* first step of this pause? */
+    startsegment(st, gcclock(), gettotalbytes(g));
+  if (state == GCSpause && !st->ingen) {  /* starting a new cycle? */
+    st->cyclestart = st->mark;
+    st->cycletime = 0;
+    st->cyclefreed = 0;
+    st->cycleobjs = st->objfreed;
+  }
+  work = dostep(L);
+  if (g->gcstats != st)  /* a finalizer turned statistics off? */
+    return work;
+  if (ph != GCPHn) {
+    st->phase[ph].steps++;
+    st->phase[ph].work += work;
+  }
+  if (g->gcstate != state) {  /* state changed? */
+    endsegment(g, state);
+    if (g->gcstate == GCSpause && !st->ingen)
+      endcycle(g, GCCYinc);
+  }
+  return work;
+}
+
+
+static lu_mem singlestep (lua_State *L) {
+  global_State *g = G(L);
+  if (unlikely(g->gcstats != NULL))
+    return statsstep(L, g);
+  return dostep(L);
+}
+
+
 /*
 ** advances the garbage collector until it reaches a state allowed
 ** by 'statemask'
@@ -1660,6 +1932,34 @@ static void incstep (lua_State *L, global_State *g) {
   }
 }
 
+/*
+** Account a pause of the program that started at 't0' (0 if statistics
+** were turned on during the pause), and call the statistics callback
+** if a cycle ended (unless in an emergency).
+*/
+static void endpause (lua_State *L, global_State *g, lua_Integer t0) {
+  GCStats *st = g->gcstats;
+  if (st->mark != 0) {  /* close the last segment */
+    endsegment(g, g->gcstate);
+    st->mark = 0;
+  }
+  if (t0 != 0) {
+    lua_Integer time = gcclock() - t0;
+    lua_Integer us = time / 1000;
+    int b = 0;
+    st->pauses++;
+    st->pausetime += time;
+    if (time > st->pausemax)
+      st->pausemax = time;
+    while (b < GCHISTSIZE - 1 && us >= (cast(lua_Integer, 1) << b))
+      b++;
+    st->hist[b]++;
+  }
+  if (st->pending && !g->gcemergency)
+    callstats(L, st);
+}
+
+
 /*
 ** performs a basic GC step if collector is running
 */
@@ -1667,10 +1967,13 @@ void luaC_step (lua_State *L) {
   global_State *g = G(L);
   lua_assert(!g->gcemergency);
   if (g->gcrunning) {  /* running? */
+    lua_Integer t0 = statsclock(g);
     if(isdecGCmodegen(g))
       genstep(L, g);
     else
       incstep(L, g);
+    if (g->gcstats)
+      endpause(L, g, t0);
   }
 }
 
@@ -1702,12 +2005,15 @@ static void fullinc (lua_State *L, global_State *g) {
 */
 void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
+  lua_Integer t0 = statsclock(g);
   lua_assert(!g->gcemergency);
   g->gcemergency = isemergency;  /* set flag */
   if (g->gckind == KGC_INC)
     fullinc(L, g);
   else
     fullgen(L, g);
+  if (g->gcstats)
+    endpause(L, g, t0);
   g->gcemergency = 0;
 }
 
@@ -174,6 +174,62 @@
 	(isblack(p) && iswhite(o)) ? \
 	luaC_barrier_(L,obj2gco(p),obj2gco(o)) : cast_void(0))
 
+/*
+** Collector statistics, gathered only while 'g->gcstats' is not NULL
+** (see 'lua_setgcstats'). Times are in nanoseconds. Incremental steps
+** are accounted to the phase they run in; the generational collector
+** accounts its atomic work and its sweeps to the same phases.
+*/
+#define GCPHpropagate	0
+#define GCPHatomic	1
+#define GCPHsweep	2
+#define GCPHcallfin	3
+#define GCPHn		4
+
+/* kinds of collection cycles */
+#define GCCYinc		0	/* complete incremental cycle */
+#define GCCYminor	1	/* young collection */
+#define GCCYmajor	2	/* major collection in generational mode */
+#define GCCYn		3
+
+/* bucket 'i' of the pause histogram counts pauses below 2^i microseconds */
+#define GCHISTSIZE	24
+
+typedef struct GCPhaseStats {
+  lua_Integer time;  /* time spent in the phase */
+  lu_mem steps;  /* number of single steps (or passes) in the phase */
+  lu_mem work;  /* slots traversed (marking) or objects visited (sweep) */
+  lu_mem freed;  /* bytes freed */
+} GCPhaseStats;
+
+typedef struct GCStats {
+  TValue callback;  /* function called after each cycle, or nil */
+  GCPhaseStats phase[GCPHn];
+  lu_mem cycles[GCCYn];  /* completed cycles of each kind */
+  lu_mem objfreed;  /* objects freed */
+  lu_mem pauses;  /* GC steps, each one a pause of the program */
+  lua_Integer pausetime;  /* total time of all pauses */
+  lua_Integer pausemax;  /* longest pause */
+  lu_mem hist[GCHISTSIZE];  /* pause histogram */
+  /* current cycle */
+  lua_Integer cyclestart;  /* clock when it started */
+  lua_Integer cycletime;  /* GC time spent in it */
+  lu_mem cyclefreed;  /* bytes freed by it */
+  lu_mem cyclebytes;  /* bytes in use when it started (generational) */
+  lu_mem cycleobjs;  /* value of 'objfreed' when it started */
+  lua_Integer mark;  /* clock when current time segment started (or 0) */
+  lu_mem markbytes;  /* bytes in use when current time segment started */
+  lu_byte ingen;  /* current cycle is a generational one */
+  lu_byte pending;  /* a cycle ended and 'callback' was not called yet */
+  /* last completed cycle */
+  lu_byte lastkind;
+  lua_Integer lastelapsed;  /* wall time from its start to its end */
+  lua_Integer lasttime;  /* GC time spent in it */
+  lu_mem lastfreed;  /* bytes it freed */
+  lu_mem lastobjs;  /* objects it freed */
+} GCStats;
+
+
 LUAI_FUNC void luaC_fix (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
@@ -184,6 +240,7 @@ LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_changemode (lua_State *L, int newmode);
+LUAI_FUNC void luaC_resetstats (global_State *g);
 
 
 #endif
@@ -510,24 +510,76 @@ static int test_eof (lua_State *L, FILE *f) {
 }
 
 
+/*
+** Read a piece of a line into 'buff' with 'fgets', which scans the
+** stream buffer block-wise (typically with 'memchr') under a single
+** lock, instead of taking one 'l_getc' per character. To know how much
+** was read even when the line contains zeros, 'buff' is filled with
+** newlines first: the first newline in it is either the one read
+** (followed by the terminating zero) or a fill byte right after the
+** terminating zero. Sets '*nl' if the line is complete.
+*/
+static size_t read_block (FILE *f, char *buff, size_t size, int *nl) {
+  char *p;
+  *nl = 0;
+  memset(buff, '\n', size);
+  if (fgets(buff, (int)size, f) == NULL)  /* end of file or error? */
+    return 0;
+  p = (char *)memchr(buff, '\n', size);
+  if (p == NULL)  /* buffer full without a newline */
+    return size - 1;
+  else if (p + 1 < buff + size && p[1] == '\0') {  /* newline read? */
+    *nl = 1;
+    return (size_t)(p - buff) + 1;
+  }
+  else  /* 'p' is a fill byte, after the zero that ends the data */
+    return (size_t)(p - buff) - 1;
+}
+
+
+/*
+** Pieces start small and double up to LUAL_BUFFERSIZE, so that the
+** fill and the scan in 'read_block' stay close to the length of the
+** line instead of covering a whole buffer for every short line.
+*/
+#define LINE_FIRSTBLOCK		128
+
 static int read_line (lua_State *L, FILE *f, int chop) {
   luaL_Buffer b;
-  int c;
+  size_t size = LINE_FIRSTBLOCK;
+  int nl;
   luaL_buffinit(L, &b);
   do {  /* may need to read several chunks to get whole line */
-    char *buff = luaL_prepbuffer(&b);  /* preallocate buffer space */
-    int i = 0;
-    l_lockfile(f);  /* no memory errors can happen inside the lock */
-    while (i < LUAL_BUFFERSIZE && (c = l_getc(f)) != EOF && c != '\n')
-      buff[i++] = c;  /* read up to end of line or buffer limit */
-    l_unlockfile(f);
-    luaL_addsize(&b, i);
-  } while (c != EOF && c != '\n');  /* repeat until end of line */
-  if (!chop && c == '\n')  /* want a newline and have one? */
-    luaL_addchar(&b, c);  /* add ending newline to result */
+    char *buff = luaL_prepbuffsize(&b, size);  /* preallocate space */
+    size_t n = read_block(f, buff, size, &nl);
+    if (n == 0)  /* end of file? */
+      break;
+    luaL_addsize(&b, (nl && chop) ? n - 1 : n);
+    if (size < LUAL_BUFFERSIZE)
+      size *= 2;
+  } while (!nl);  /* repeat until end of line */
   luaL_pushresult(&b);  /* close buffer */
   /* return ok if read something (either a newline or something else) */
-  return (c == '\n' || lua_rawlen(L, -1) > 0);
+  return (nl || lua_rawlen(L, -1) > 0);
+}
+
+
+/*
+** Read up to 'count' lines into a new table ("l*" and "L*" formats),
+** so that iterating over a big file needs one call per batch instead
+** of one call per line.
+*/
+static int read_lines (lua_State *L, FILE *f, int chop, lua_Integer count) {
+  lua_Integer i;
+  lua_createtable(L, (count < 1024) ? (int)count : 1024, 0);
+  for (i = 1; i <= count; i++) {
+    if (!read_line(L, f, chop)) {
+      lua_pop(L, 1);  /* remove empty string */
+      break;
+    }
+    lua_rawseti(L, -2, i);
+  }
+  return (i > 1);  /* ok if read at least one line */
 }
 
 
@@ -559,17 +611,17 @@ static int read_chars (lua_State *L, FILE *f, size_t n) {
 
 static int g_read (lua_State *L, FILE *f, int first) {
   int nargs = lua_gettop(L) - 1;
-  int n, success;
+  int n, nres, success;
   clearerr(f);
   if (nargs == 0) {  /* no arguments? */
     success = read_line(L, f, 1);
-    n = first + 1;  /* to return 1 result */
+    nres = 1;  /* to return 1 result */
   }
   else {
     /* ensure stack space for all results and for auxlib's buffer */
     luaL_checkstack(L, nargs+LUA_MINSTACK, "too many arguments");
     success = 1;
-    for (n = first; nargs-- && success; n++) {
+    for (n = first, nres = 0; nargs-- && success; n++, nres++) {
       if (lua_type(L, n) == LUA_TNUMBER) {
         size_t l = (size_t)luaL_checkinteger(L, n);
         success = (l == 0) ? test_eof(L, f) : read_chars(L, f, l);
@@ -577,6 +629,13 @@ static int g_read (lua_State *L, FILE *f, int first) {
       else {
         const char *p = luaL_checkstring(L, n);
         if (*p == '*') p++;  /* skip optional '*' (for compatibility) */
+        if ((*p == 'l' || *p == 'L') && p[1] == '*') {  /* batch of lines? */
+          lua_Integer count = luaL_checkinteger(L, n + 1);
+          luaL_argcheck(L, count > 0, n + 1, "batch size must be positive");
+          success = read_lines(L, f, *p == 'l', count);
+          n++; nargs--;  /* count was consumed too */
+          continue;
+        }
         switch (*p) {
           case 'n':  /* number */
             success = read_number(L, f);
@@ -603,7 +662,7 @@ static int g_read (lua_State *L, FILE *f, int first) {
     lua_pop(L, 1);  /* remove last result */
     luaL_pushfail(L);  /* push nil instead */
   }
-  return n - first;
+  return nres;
 }
 
 
@@ -8,6 +8,7 @@
 #undef vmdispatch
 #undef vmcase
 #undef vmbreak
+#undef vmjump
 
 #define vmdispatch(x)     goto *disptab[x];
 
@@ -15,6 +16,8 @@
 
 #define vmbreak		vmfetch(); vmdispatch(GET_OPCODE(i));
 
+#define vmjump(l)	goto L_##l;
+
 
 static const void *const disptab[NUM_OPCODES] = {
 
@@ -107,6 +110,14 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_CLOSURE,
 &&L_OP_VARARG,
 &&L_OP_VARARGPREP,
-&&L_OP_EXTRAARG
+&&L_OP_EXTRAARG,
+&&L_OP_MOVE_MOVE,
+&&L_OP_MOVE_CALL,
+&&L_OP_GETUPVAL_MOVE,
+&&L_OP_GETUPVAL_GETFIELD,
+&&L_OP_GETTABUP_GETFIELD,
+&&L_OP_GETFIELD_GETFIELD,
+&&L_OP_SETFIELD_SETFIELD,
+&&L_OP_SELF_MOVE
 
 };
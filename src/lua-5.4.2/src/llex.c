@@ -124,12 +124,16 @@ l_noret luaX_syntaxerror (LexState *ls, const char *msg) {
 /*
 ** creates a new string and anchors it in scanner's table so that
 ** it will not be collected until the end of the compilation
-** (by that time it should be anchored somewhere)
+** (by that time it should be anchored somewhere). Without a scanner
+** table (see 'luaY_data') the caller anchors the string of each
+** token before reading the next one.
 */
 TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
   lua_State *L = ls->L;
   TValue *o;  /* entry for 'str' */
   TString *ts = luaS_newlstr(L, str, l);  /* create new string */
+  if (ls->h == NULL)
+    return ts;
   setsvalue2s(L, L->top++, ts);  /* temporarily anchor it in stack */
   o = luaH_set(L, ls->h, s2v(L->top - 1));
   if (isempty(o)) {  /* not in use yet? */
@@ -210,10 +210,11 @@ typedef l_uint32 Instruction;
 ** Initial size for the string table (must be power of 2).
 ** The Lua core alone registers ~50 strings (reserved words +
 ** metaevent keys + a few others). Libraries would typically add
-** a few dozens more.
+** a few dozens more; with the lp4w libraries a new state holds ~500,
+** so it starts big enough not to rehash while opening them.
 */
 #if !defined(MINSTRTABSIZE)
-#define MINSTRTABSIZE	128
+#define MINSTRTABSIZE	1024
 #endif
 
 
@@ -228,6 +229,27 @@ typedef l_uint32 Instruction;
 #endif
 
 
+/*
+** Fuse frequent instruction pairs into superinstructions after code
+** generation and after loading plain binary chunks ('luaK_fuse').
+** Define it as 0 to keep the code exactly as the parser emits it.
+*/
+#if !defined(LUAI_SUPERINSTR)
+#define LUAI_SUPERINSTR		1
+#endif
+
+
+/*
+** Build an instrumented interpreter that counts instructions per
+** opcode and per function, table accesses off the fast path,
+** metamethod calls and C/Lua calls ('debug.vmstats'). Counting slows
+** down every instruction, so it is meant for a separate build only.
+*/
+#if !defined(LUAI_VMSTATS)
+#define LUAI_VMSTATS		0
+#endif
+
+
 /* minimum size for string buffer */
 #if !defined(LUA_MINBUFFER)
 #define LUA_MINBUFFER	32
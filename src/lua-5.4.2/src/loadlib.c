@@ -18,6 +18,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/stat.h>
+
 #include "lua.h"
 
 #include "lauxlib.h"
@@ -275,6 +277,14 @@ static lua_CFunction lsys_sym (lua_State *L, void *lib, const char *sym) {
 #define LUA_CPATH_VAR   "LUA_CPATH"
 #endif
 
+/*
+** LUA_CACHEPATH_VAR is the name of the environment variable with the
+** directory for compiled Lua modules (see 'loadcached').
+*/
+#if !defined(LUA_CACHEPATH_VAR)
+#define LUA_CACHEPATH_VAR	"LUA_CACHEPATH"
+#endif
+
 
 
 /*
@@ -324,6 +334,22 @@ static void setpath (lua_State *L, const char *fieldname,
   lua_pop(L, 1);  /* pop versioned variable name ('nver') */
 }
 
+
+/*
+** Set the directory for compiled modules. The cache is off (empty
+** string) unless the environment asks for it.
+*/
+static void setcachepath (lua_State *L) {
+  const char *nver = lua_pushfstring(L, "%s%s", LUA_CACHEPATH_VAR,
+                                               LUA_VERSUFFIX);
+  const char *path = getenv(nver);  /* try versioned name */
+  if (path == NULL)  /* no versioned environment variable? */
+    path = getenv(LUA_CACHEPATH_VAR);  /* try unversioned name */
+  lua_pushstring(L, (path == NULL || noenv(L)) ? "" : path);
+  lua_setfield(L, -3, "cachepath");
+  lua_pop(L, 1);  /* pop versioned variable name ('nver') */
+}
+
 /* }================================================================== */
 
 
@@ -540,12 +566,151 @@ static int checkload (lua_State *L, int stat, const char *filename) {
 }
 
 
+/*
+** {======================================================
+** Cache of compiled Lua modules
+** =======================================================
+*/
+
+/*
+** When 'package.cachepath' names a directory, 'searcher_Lua' keeps the
+** precompiled form of each module there, so that later runs skip the
+** parser. A cache file is named after a hash of the module key (file
+** name, modification time, size, and Lua release) and starts with the
+** key itself, so that a changed source (or a hash collision) is
+** detected and the module is compiled again.
+*/
+
+typedef struct CacheF {
+  FILE *f;
+  char buff[BUFSIZ];
+} CacheF;
+
+
+static const char *cachereader (lua_State *L, void *ud, size_t *size) {
+  CacheF *cf = (CacheF *)ud;
+  (void)L;  /* not used */
+  if (feof(cf->f)) return NULL;
+  *size = fread(cf->buff, 1, sizeof(cf->buff), cf->f);
+  return cf->buff;
+}
+
+
+static int cachewriter (lua_State *L, const void *p, size_t sz, void *ud) {
+  (void)L;  /* not used */
+  return (fwrite(p, 1, sz, (FILE *)ud) != sz);
+}
+
+
+/*
+** Push the cache key for 'filename' and the name of its cache file
+** in 'cachedir'. Return 0 (pushing nothing) if the file cannot be
+** inspected.
+*/
+static int cachekey (lua_State *L, const char *cachedir,
+                                   const char *filename) {
+  struct stat st;
+  const char *key;
+  unsigned int h1 = 2166136261u, h2 = 5381;
+  char hex[20];
+  if (stat(filename, &st) != 0)
+    return 0;
+  key = lua_pushfstring(L, "%s|%I|%I|" LUA_RELEASE, filename,
+                           (lua_Integer)st.st_mtime, (lua_Integer)st.st_size);
+  for (; *key; key++) {
+    unsigned char c = (unsigned char)*key;
+    h1 = (h1 ^ c) * 16777619u;  /* FNV-1a */
+    h2 = (h2 * 33) ^ c;  /* djb2 */
+  }
+  sprintf(hex, "%08x%08x", h1 & 0xffffffffu, h2 & 0xffffffffu);
+  lua_pushfstring(L, "%s" LUA_DIRSEP "%s.luac", cachedir, hex);
+  return 1;
+}
+
+
+/*
+** Store the function on the top of the stack as compiled chunk with
+** the given key. The file is written under a temporary name and then
+** renamed, so that concurrent readers never see a partial chunk.
+** Failures are ignored: the module simply stays uncached.
+*/
+static void cachestore (lua_State *L, const char *key, size_t klen,
+                                      const char *cname) {
+  const char *tmpname = lua_pushfstring(L, "%s.tmp", cname);
+  FILE *f = fopen(tmpname, "wb");
+  int ok;
+  if (f == NULL) {
+    lua_pop(L, 1);
+    return;
+  }
+  lua_pushvalue(L, -2);  /* function to be dumped */
+  ok = fwrite(key, 1, klen, f) == klen && fputc('\n', f) != EOF &&
+       lua_dump(L, cachewriter, f, 0) == 0;
+  lua_pop(L, 1);
+  ok = (fclose(f) == 0) && ok;
+  if (ok) {
+    remove(cname);  /* 'rename' does not replace files everywhere */
+    ok = (rename(tmpname, cname) == 0);
+  }
+  if (!ok)
+    remove(tmpname);
+  lua_pop(L, 1);  /* pop 'tmpname' */
+}
+
+
+/*
+** Load the Lua module in 'filename', going through the cache of
+** compiled modules when it is enabled.
+*/
+static int loadcached (lua_State *L, const char *filename) {
+  const char *cachedir;
+  const char *key;
+  const char *cname;
+  size_t klen;
+  CacheF cf;
+  int status;
+  lua_getfield(L, lua_upvalueindex(1), "cachepath");
+  cachedir = lua_tostring(L, -1);
+  if (cachedir == NULL || *cachedir == '\0' ||
+      !cachekey(L, cachedir, filename)) {
+    lua_pop(L, 1);  /* no cache: load the source */
+    return luaL_loadfile(L, filename);
+  }
+  key = lua_tolstring(L, -2, &klen);
+  cname = lua_tostring(L, -1);
+  cf.f = (klen < sizeof(cf.buff)) ? fopen(cname, "rb") : NULL;
+  if (cf.f != NULL) {
+    int hit = (fread(cf.buff, 1, klen + 1, cf.f) == klen + 1 &&
+               memcmp(cf.buff, key, klen) == 0 && cf.buff[klen] == '\n');
+    status = hit ? lua_load(L, cachereader, &cf,
+                               lua_pushfstring(L, "@%s", filename), "b")
+                 : LUA_ERRFILE;
+    fclose(cf.f);
+    if (hit)
+      lua_remove(L, -2);  /* remove chunk name */
+    if (status == LUA_OK)
+      goto done;
+    if (hit)
+      lua_pop(L, 1);  /* remove error message; compile it again */
+  }
+  status = luaL_loadfile(L, filename);
+  if (status == LUA_OK)
+    cachestore(L, key, klen, cname);
+ done:
+  lua_replace(L, -4);  /* put function (or error) in place of 'cachepath' */
+  lua_pop(L, 2);  /* pop key and cache file name */
+  return status;
+}
+
+/* }====================================================== */
+
+
 static int searcher_Lua (lua_State *L) {
   const char *filename;
   const char *name = luaL_checkstring(L, 1);
   filename = findfile(L, name, "path", LUA_LSUBSEP);
   if (filename == NULL) return 1;  /* module not found in this path */
-  return checkload(L, (luaL_loadfile(L, filename) == LUA_OK), filename);
+  return checkload(L, (loadcached(L, filename) == LUA_OK), filename);
 }
 
 
@@ -740,6 +905,7 @@ LUAMOD_API int luaopen_package (lua_State *L) {
   /* set paths */
   setpath(L, "path", LUA_PATH_VAR, LUA_PATH_DEFAULT);
   setpath(L, "cpath", LUA_CPATH_VAR, LUA_CPATH_DEFAULT);
+  setcachepath(L);
   /* store config information */
   lua_pushliteral(L, LUA_DIRSEP "\n" LUA_PATH_SEP "\n" LUA_PATH_MARK "\n"
                      LUA_EXEC_DIR "\n" LUA_IGMARK "\n");
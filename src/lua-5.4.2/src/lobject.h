@@ -524,6 +524,19 @@ typedef struct AbsLineInfo {
   int line;
 } AbsLineInfo;
 
+/*
+** Inline cache of an instruction that reads a field with a constant
+** key, used when the table does not have the key itself: the node
+** slots of '__index' in its metatable and of the key in the '__index'
+** table. Slots are only hints, checked against the key before use
+** (see 'luaT_getindexcached').
+*/
+typedef struct ICache {
+  unsigned int mslot;
+  unsigned int islot;
+} ICache;
+
+
 /*
 ** Function Prototypes
 */
@@ -539,6 +552,7 @@ typedef struct Proto {
   int sizep;  /* size of 'p' */
   int sizelocvars;
   int sizeabslineinfo;  /* size of 'abslineinfo' */
+  int sizeicache;  /* size of 'icache' (0 or 'sizecode') */
   int linedefined;  /* debug information  */
   int lastlinedefined;  /* debug information  */
   TValue *k;  /* constants used by the function */
@@ -548,8 +562,13 @@ typedef struct Proto {
   ls_byte *lineinfo;  /* information about source lines (debug information) */
   AbsLineInfo *abslineinfo;  /* idem */
   LocVar *locvars;  /* information about local variables (debug information) */
+  ICache *icache;  /* inline caches, indexed by instruction */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
+#if LUAI_VMSTATS
+  lua_Unsigned vmcount;  /* instructions run in this function */
+  lua_Unsigned vmcalls;  /* calls to this function */
+#endif
 } Proto;
 
 /* }================================================================== */
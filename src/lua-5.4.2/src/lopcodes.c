@@ -100,5 +100,32 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, 0, 0, 1, iABC)		/* OP_VARARG */
  ,opmode(0, 0, 1, 0, 1, iABC)		/* OP_VARARGPREP */
  ,opmode(0, 0, 0, 0, 0, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MOVE_MOVE */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MOVE_CALL */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETUPVAL_MOVE */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETUPVAL_GETFIELD */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETTABUP_GETFIELD */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETFIELD_GETFIELD */
+ ,opmode(0, 0, 0, 0, 0, iABC)		/* OP_SETFIELD_SETFIELD */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SELF_MOVE */
+};
+
+
+/*
+** Superinstructions get the mode of their first half. The pairs come
+** from the 'oppairs' histogram of typical scripts: moving arguments
+** into place before a call, chains of field reads ('a.b.c', 'M.f'),
+** method calls with local arguments and table constructors.
+*/
+LUAI_DDEF const lu_byte luaP_superops[NUM_OPCODES - FIRST_SUPEROP][2] = {
+/* first		second		   superinstruction */
+  {OP_MOVE,		OP_MOVE}	/* OP_MOVE_MOVE */
+ ,{OP_MOVE,		OP_CALL}	/* OP_MOVE_CALL */
+ ,{OP_GETUPVAL,		OP_MOVE}	/* OP_GETUPVAL_MOVE */
+ ,{OP_GETUPVAL,		OP_GETFIELD}	/* OP_GETUPVAL_GETFIELD */
+ ,{OP_GETTABUP,		OP_GETFIELD}	/* OP_GETTABUP_GETFIELD */
+ ,{OP_GETFIELD,		OP_GETFIELD}	/* OP_GETFIELD_GETFIELD */
+ ,{OP_SETFIELD,		OP_SETFIELD}	/* OP_SETFIELD_SETFIELD */
+ ,{OP_SELF,		OP_MOVE}	/* OP_SELF_MOVE */
 };
 
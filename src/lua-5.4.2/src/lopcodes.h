@@ -305,11 +305,23 @@ OP_VARARG,/*	A C	R[A], R[A+1], ..., R[A+C-2] = vararg		*/
 
 OP_VARARGPREP,/*A	(adjust vararg parameters)			*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/* superinstructions (see notes) */
+OP_MOVE_MOVE,/*	A B	R[A] := R[B]; MOVE				*/
+OP_MOVE_CALL,/*	A B	R[A] := R[B]; CALL				*/
+OP_GETUPVAL_MOVE,/* A B	R[A] := UpValue[B]; MOVE			*/
+OP_GETUPVAL_GETFIELD,/* A B	R[A] := UpValue[B]; GETFIELD		*/
+OP_GETTABUP_GETFIELD,/* A B C	R[A] := UpValue[B][K[C]:string]; GETFIELD	*/
+OP_GETFIELD_GETFIELD,/* A B C	R[A] := R[B][K[C]:string]; GETFIELD	*/
+OP_SETFIELD_SETFIELD,/* A B C	R[A][K[B]:string] := RK(C); SETFIELD	*/
+OP_SELF_MOVE/*	A B C	R[A+1] := R[B]; R[A] := R[B][RK(C):string]; MOVE */
 } OpCode;
 
 
-#define NUM_OPCODES	((int)(OP_EXTRAARG) + 1)
+#define NUM_OPCODES	((int)(OP_SELF_MOVE) + 1)
+
+#define FIRST_SUPEROP	((int)(OP_EXTRAARG) + 1)
 
 
 
@@ -352,6 +364,13 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   original operand was a float. (It must be corrected in case of
   metamethods.)
 
+  (*) A superinstruction is the first instruction of a frequent pair,
+  with its arguments unchanged and its opcode replaced ('luaK_fuse').
+  It does the work of that instruction and then runs the next one,
+  which is left in place, without going through the dispatcher. So
+  jumps into the middle of a pair are still valid, and everything that
+  only inspects the code can treat it as its first half ('baseOp').
+
 ===========================================================================*/
 
 
@@ -386,6 +405,17 @@ LUAI_DDEC(const lu_byte luaP_opmodes[NUM_OPCODES];)
     (((mm) << 7) | ((ot) << 6) | ((it) << 5) | ((t) << 4) | ((a) << 3) | (m))
 
 
+/* first and second halves of each superinstruction */
+LUAI_DDEC(const lu_byte luaP_superops[NUM_OPCODES - FIRST_SUPEROP][2];)
+
+#define isSuperOp(o)	(cast_int(o) >= FIRST_SUPEROP)
+
+/* opcode that 'o' behaves like, as far as its own arguments go */
+#define baseOp(o)  \
+	(isSuperOp(o) ? cast(OpCode, luaP_superops[(o) - FIRST_SUPEROP][0]) \
+                      : cast(OpCode, o))
+
+
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
 
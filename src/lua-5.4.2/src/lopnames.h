@@ -96,6 +96,14 @@ static const char *const opnames[] = {
   "VARARG",
   "VARARGPREP",
   "EXTRAARG",
+  "MOVE_MOVE",
+  "MOVE_CALL",
+  "GETUPVAL_MOVE",
+  "GETUPVAL_GETFIELD",
+  "GETTABUP_GETFIELD",
+  "GETFIELD_GETFIELD",
+  "SETFIELD_SETFIELD",
+  "SELF_MOVE",
   NULL
 };
 
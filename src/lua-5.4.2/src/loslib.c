@@ -11,7 +11,10 @@
 
 
 #include <errno.h>
+#include <limits.h>
 #include <locale.h>
+#include <math.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -138,6 +141,85 @@
 /* }================================================================== */
 
 
+/*
+** {==================================================================
+** Configuration for the monotonic clock ('os.nanotime') and the CPU
+** cycle counter ('os.rdtsc')
+** ===================================================================
+*/
+#if !defined(l_nanotime)	/* { */
+
+#if defined(LUA_USE_WINDOWS)	/* { */
+
+#include <windows.h>
+
+/* performance counter scaled to nanoseconds, without overflowing */
+static lua_Unsigned l_nanotime (void) {
+  static LARGE_INTEGER freq;  /* counts per second; 0 before first call */
+  LARGE_INTEGER count;
+  lua_Unsigned f;
+  if (freq.QuadPart == 0)
+    QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  f = (lua_Unsigned)freq.QuadPart;
+  return ((lua_Unsigned)count.QuadPart / f) * 1000000000u +
+         ((lua_Unsigned)count.QuadPart % f) * 1000000000u / f;
+}
+
+#elif defined(LUA_USE_POSIX)	/* }{ */
+
+static lua_Unsigned l_nanotime (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (lua_Unsigned)ts.tv_sec * 1000000000u + (lua_Unsigned)ts.tv_nsec;
+}
+
+#elif defined(TIME_UTC)		/* }{ */
+
+/* ISO C 2011: calendar time, which may jump */
+static lua_Unsigned l_nanotime (void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (lua_Unsigned)ts.tv_sec * 1000000000u + (lua_Unsigned)ts.tv_nsec;
+}
+
+#else				/* }{ */
+
+/* ISO C 89: processor time is all there is */
+#define l_nanotime()  \
+	((lua_Unsigned)clock() * (1000000000u / CLOCKS_PER_SEC))
+
+#endif				/* } */
+
+#endif				/* } */
+
+
+/* 'l_rdtsc' stays undefined where there is no cycle counter */
+#if !defined(l_rdtsc)	/* { */
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define l_rdtsc()	((lua_Unsigned)__rdtsc())
+
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define l_rdtsc()	((lua_Unsigned)__rdtsc())
+
+#elif defined(__GNUC__) && defined(__aarch64__)
+/* the virtual counter; it runs at a fixed frequency, not at CPU clock */
+static lua_Unsigned l_rdtsc (void) {
+  lua_Unsigned v;
+  __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (v));
+  return v;
+}
+#define l_rdtsc		l_rdtsc
+
+#endif
+
+#endif				/* } */
+/* }================================================================== */
+
+
 
 static int os_execute (lua_State *L) {
   const char *cmd = luaL_optstring(L, 1, NULL);
@@ -404,6 +486,343 @@ static int os_exit (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** High-resolution time: os.nanotime, os.rdtsc, timers and
+** latency histograms
+** =======================================================
+*/
+
+#define TIMERHANDLE	"os.timer"
+#define HISTHANDLE	"os.hist"
+
+
+static int os_nanotime (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)l_nanotime());
+  return 1;
+}
+
+
+#if defined(l_rdtsc)
+static int os_rdtsc (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)l_rdtsc());
+  return 1;
+}
+#endif
+
+
+/*
+** A timer keeps its start and the end of its last lap; all values
+** are in nanoseconds of 'l_nanotime'.
+*/
+typedef struct LTimer {
+  lua_Unsigned start;
+  lua_Unsigned lap;
+} LTimer;
+
+
+static int os_timer (lua_State *L) {
+  LTimer *t = (LTimer *)lua_newuserdatauv(L, sizeof(LTimer), 0);
+  t->start = t->lap = l_nanotime();
+  luaL_setmetatable(L, TIMERHANDLE);
+  return 1;
+}
+
+
+/* nanoseconds since the timer started */
+static int t_elapsed (lua_State *L) {
+  LTimer *t = (LTimer *)luaL_checkudata(L, 1, TIMERHANDLE);
+  lua_pushinteger(L, (lua_Integer)(l_nanotime() - t->start));
+  return 1;
+}
+
+
+/* nanoseconds since the previous lap (or the start); starts a new lap */
+static int t_lap (lua_State *L) {
+  LTimer *t = (LTimer *)luaL_checkudata(L, 1, TIMERHANDLE);
+  lua_Unsigned now = l_nanotime();
+  lua_pushinteger(L, (lua_Integer)(now - t->lap));
+  t->lap = now;
+  return 1;
+}
+
+
+static int t_reset (lua_State *L) {
+  LTimer *t = (LTimer *)luaL_checkudata(L, 1, TIMERHANDLE);
+  t->start = t->lap = l_nanotime();
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int t_tostring (lua_State *L) {
+  LTimer *t = (LTimer *)luaL_checkudata(L, 1, TIMERHANDLE);
+  lua_pushfstring(L, "timer (%f s)",
+                  (lua_Number)(l_nanotime() - t->start) / 1e9);
+  return 1;
+}
+
+
+/*
+** A histogram counts values (usually nanoseconds) in log-linear
+** buckets, as HdrHistogram does: values below 2^bits have a bucket
+** each, and every larger power-of-two range [2^k, 2^(k+1)) is split
+** into 2^(bits-1) equal buckets. So a bucket is never wider than
+** 1/2^(bits-1) of its values (1.6% for the default of 7 bits), and
+** recording a value is an index computation and an increment.
+*/
+#define HISTDEFBITS	7
+#define HISTMAXBITS	14
+#define UNSIGNEDBITS	((int)(sizeof(lua_Unsigned) * CHAR_BIT))
+
+typedef struct LHist {
+  int bits;  /* significant bits of a value kept by its bucket */
+  int nbuckets;
+  lua_Unsigned total;  /* number of values recorded */
+  lua_Unsigned min, max;
+  lua_Number sum, sumsq;  /* for mean and standard deviation */
+  lua_Unsigned counts[1];  /* 'nbuckets' counters */
+} LHist;
+
+
+#define histsize(nb)	(offsetof(LHist, counts) + (nb) * sizeof(lua_Unsigned))
+
+
+/* index of the highest set bit of 'v' (-1 for 0) */
+static int highbit (lua_Unsigned v) {
+  int b = -1;
+  int step;
+  for (step = UNSIGNEDBITS / 2; step > 0; step /= 2) {
+    if (v >> step) {
+      v >>= step;
+      b += step;
+    }
+  }
+  return b + (int)v;
+}
+
+
+static int histindex (const LHist *h, lua_Unsigned v) {
+  int shift = highbit(v) - (h->bits - 1);
+  if (shift <= 0)
+    return (int)v;  /* exact bucket */
+  return (shift << (h->bits - 1)) + (int)(v >> shift);
+}
+
+
+/* largest value that falls into bucket 'i' */
+static lua_Unsigned histhigh (const LHist *h, int i) {
+  int half = 1 << (h->bits - 1);
+  int shift = i / half - 1;
+  if (shift <= 0)
+    return (lua_Unsigned)i;
+  else {
+    lua_Unsigned m = (lua_Unsigned)(i - shift * half);
+    return (m << shift) + (((lua_Unsigned)1 << shift) - 1);
+  }
+}
+
+
+static void histclear (LHist *h) {
+  h->total = 0;
+  h->min = ~(lua_Unsigned)0;
+  h->max = 0;
+  h->sum = h->sumsq = 0;
+  memset(h->counts, 0, h->nbuckets * sizeof(lua_Unsigned));
+}
+
+
+/* os.hist([bits]) */
+static int os_hist (lua_State *L) {
+  int bits = (int)luaL_optinteger(L, 1, HISTDEFBITS);
+  int nbuckets;
+  LHist *h;
+  luaL_argcheck(L, 2 <= bits && bits <= HISTMAXBITS, 1, "out of range");
+  nbuckets = (UNSIGNEDBITS - bits + 2) << (bits - 1);
+  h = (LHist *)lua_newuserdatauv(L, histsize(nbuckets), 0);
+  h->bits = bits;
+  h->nbuckets = nbuckets;
+  histclear(h);
+  luaL_setmetatable(L, HISTHANDLE);
+  return 1;
+}
+
+
+#define checkhist(L,i)	((LHist *)luaL_checkudata(L, i, HISTHANDLE))
+
+
+/* h:record(value [, count]) */
+static int h_record (lua_State *L) {
+  LHist *h = checkhist(L, 1);
+  lua_Integer v = luaL_checkinteger(L, 2);
+  lua_Integer n = luaL_optinteger(L, 3, 1);
+  lua_Unsigned u;
+  luaL_argcheck(L, v >= 0, 2, "negative value");
+  luaL_argcheck(L, n >= 0, 3, "negative count");
+  u = (lua_Unsigned)v;
+  h->counts[histindex(h, u)] += (lua_Unsigned)n;
+  h->total += (lua_Unsigned)n;
+  if (n > 0) {
+    if (u < h->min) h->min = u;
+    if (u > h->max) h->max = u;
+  }
+  h->sum += (lua_Number)n * (lua_Number)v;
+  h->sumsq += (lua_Number)n * (lua_Number)v * (lua_Number)v;
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int h_count (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)checkhist(L, 1)->total);
+  return 1;
+}
+
+
+static int h_min (lua_State *L) {
+  LHist *h = checkhist(L, 1);
+  lua_pushinteger(L, h->total ? (lua_Integer)h->min : 0);
+  return 1;
+}
+
+
+static int h_max (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)checkhist(L, 1)->max);
+  return 1;
+}
+
+
+static int h_mean (lua_State *L) {
+  LHist *h = checkhist(L, 1);
+  lua_pushnumber(L, h->total ? h->sum / (lua_Number)h->total : 0);
+  return 1;
+}
+
+
+static int h_stddev (lua_State *L) {
+  LHist *h = checkhist(L, 1);
+  lua_Number var = 0;
+  if (h->total > 1) {
+    lua_Number n = (lua_Number)h->total;
+    var = (h->sumsq - h->sum * h->sum / n) / (n - 1);
+  }
+  lua_pushnumber(L, (var > 0) ? l_mathop(sqrt)(var) : 0);
+  return 1;
+}
+
+
+/*
+** h:percentile(p, ...): for each 'p' in [0, 100], the largest value
+** of the bucket that holds the value of rank ceil(p% of count),
+** clamped to the recorded minimum and maximum.
+*/
+static int h_percentile (lua_State *L) {
+  LHist *h = checkhist(L, 1);
+  int top = lua_gettop(L);
+  int arg;
+  luaL_checknumber(L, 2);
+  for (arg = 2; arg <= top; arg++) {
+    lua_Number p = luaL_checknumber(L, arg);
+    lua_Unsigned v = 0;
+    luaL_argcheck(L, 0 <= p && p <= 100, arg, "out of range");
+    if (h->total > 0) {
+      lua_Number r = l_mathop(ceil)(p / 100 * (lua_Number)h->total);
+      lua_Unsigned rank = (r < 1) ? 1 : (lua_Unsigned)r;
+      lua_Unsigned seen = 0;
+      int i;
+      for (i = 0; i < h->nbuckets - 1; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) break;
+      }
+      v = histhigh(h, i);
+      if (v > h->max) v = h->max;
+      if (v < h->min) v = h->min;
+    }
+    lua_pushinteger(L, (lua_Integer)v);
+  }
+  return top - 1;
+}
+
+
+/* h:merge(other): adds the values of a histogram with the same bits */
+static int h_merge (lua_State *L) {
+  LHist *h = checkhist(L, 1);
+  LHist *o = checkhist(L, 2);
+  int i;
+  luaL_argcheck(L, o->bits == h->bits, 2, "histograms of different precision");
+  for (i = 0; i < h->nbuckets; i++)
+    h->counts[i] += o->counts[i];
+  if (o->total > 0) {
+    if (o->min < h->min) h->min = o->min;
+    if (o->max > h->max) h->max = o->max;
+  }
+  h->total += o->total;
+  h->sum += o->sum;
+  h->sumsq += o->sumsq;
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int h_reset (lua_State *L) {
+  histclear(checkhist(L, 1));
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int h_tostring (lua_State *L) {
+  LHist *h = checkhist(L, 1);
+  lua_settop(L, 1);
+  lua_pushnumber(L, 50);
+  lua_pushnumber(L, 99);
+  h_percentile(L);  /* pushes p50 and p99 */
+  lua_pushfstring(L, "hist (count %I, min %I, p50 %I, p99 %I, max %I)",
+                  (LUAI_UACINT)h->total,
+                  (LUAI_UACINT)(h->total ? h->min : 0),
+                  (LUAI_UACINT)lua_tointeger(L, -2),
+                  (LUAI_UACINT)lua_tointeger(L, -1),
+                  (LUAI_UACINT)h->max);
+  return 1;
+}
+
+
+static const luaL_Reg timermeth[] = {
+  {"elapsed", t_elapsed},
+  {"lap", t_lap},
+  {"reset", t_reset},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg histmeth[] = {
+  {"record", h_record},
+  {"count", h_count},
+  {"min", h_min},
+  {"max", h_max},
+  {"mean", h_mean},
+  {"stddev", h_stddev},
+  {"percentile", h_percentile},
+  {"merge", h_merge},
+  {"reset", h_reset},
+  {NULL, NULL}
+};
+
+
+static void createmeta (lua_State *L, const char *tname,
+                        const luaL_Reg *meth, lua_CFunction tostr) {
+  luaL_newmetatable(L, tname);
+  lua_pushcfunction(L, tostr);
+  lua_setfield(L, -2, "__tostring");
+  lua_newtable(L);  /* method table */
+  luaL_setfuncs(L, meth, 0);
+  lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+  lua_pop(L, 1);  /* pop metatable */
+}
+
+/* }====================================================== */
+
+
 static const luaL_Reg syslib[] = {
   {"clock",     os_clock},
   {"date",      os_date},
@@ -411,10 +830,16 @@ static const luaL_Reg syslib[] = {
   {"execute",   os_execute},
   {"exit",      os_exit},
   {"getenv",    os_getenv},
+  {"hist",      os_hist},
+  {"nanotime",  os_nanotime},
+#if defined(l_rdtsc)
+  {"rdtsc",     os_rdtsc},
+#endif
   {"remove",    os_remove},
   {"rename",    os_rename},
   {"setlocale", os_setlocale},
   {"time",      os_time},
+  {"timer",     os_timer},
   {"tmpname",   os_tmpname},
   {NULL, NULL}
 };
@@ -425,6 +850,8 @@ static const luaL_Reg syslib[] = {
 
 LUAMOD_API int luaopen_os (lua_State *L) {
   luaL_newlib(L, syslib);
+  createmeta(L, TIMERHANDLE, timermeth, t_tostring);
+  createmeta(L, HISTHANDLE, histmeth, h_tostring);
   return 1;
 }
 
@@ -757,6 +757,10 @@ static void close_func (LexState *ls) {
   luaM_shrinkvector(L, f->p, f->sizep, fs->np, Proto *);
   luaM_shrinkvector(L, f->locvars, f->sizelocvars, fs->ndebugvars, LocVar);
   luaM_shrinkvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
+#if LUAI_SUPERINSTR
+  luaK_fuse(f);
+#endif
+  luaF_initcache(L, f);
   ls->fs = fs->prev;
   luaC_checkGC(L);
 }
@@ -1906,6 +1910,213 @@ static void statement (LexState *ls) {
 /* }====================================================================== */
 
 
+/*
+** {======================================================================
+** Data-only parser: a chunk 'return <literal>' (the 'return' is optional)
+** where a literal is nil, a boolean, a number (optionally negated), a
+** string or a table constructor containing only literals. The value is
+** built directly; no code is generated, so there are no limits on the
+** number of constants or table items.
+** =======================================================================
+*/
+
+
+/*
+** Tables at the same nesting level tend to have the same shape (records
+** in a list), so the hash part of a new table is presized with the size
+** of the previous table at its level.
+*/
+#define MAXDATALEVELS	16
+
+
+typedef struct DataState {
+  LexState *ls;
+  int level;  /* nesting level of the current table */
+  unsigned int hsize[MAXDATALEVELS];  /* last hash sizes per level */
+} DataState;
+
+
+static void datavalue (DataState *ds);
+
+
+/*
+** Push the string of the current token and skip it. There is no scanner
+** table, so the string has to be anchored before the next token is read.
+*/
+static void datastring (DataState *ds) {
+  LexState *ls = ds->ls;
+  setsvalue2s(ls->L, ls->L->top, ls->t.seminfo.ts);
+  luaD_inctop(ls->L);
+  luaX_next(ls);
+}
+
+
+/*
+** Store the value on the top of the stack in table 't' with the key below
+** it, popping both
+*/
+static void datasetfield (LexState *ls, Table *t) {
+  lua_State *L = ls->L;
+  TValue *key = s2v(L->top - 2);
+  TValue *val = s2v(L->top - 1);
+  TValue *slot;
+  if (ttisnil(key))
+    luaX_syntaxerror(ls, "table index is nil");
+  if (ttisfloat(key) && luai_numisnan(fltvalue(key)))
+    luaX_syntaxerror(ls, "table index is NaN");
+  slot = luaH_set(L, t, key);
+  setobj2t(L, slot, val);
+  luaC_barrierback(L, obj2gco(t), val);
+  L->top -= 2;
+}
+
+
+/*
+** Move the 'na' list items on the top of the stack to table 't' after
+** its 'n' items stored before, like OP_SETLIST. The array part grows to
+** powers of 2, as a rehash would size it.
+*/
+static void dataflush (lua_State *L, Table *t, lua_Integer n, int na) {
+  unsigned int last = cast_uint(n) + na;
+  if (last > luaH_realasize(t))
+    luaH_resizearray(L, t, (last <= (1u << 30)) ? 1u << luaO_ceillog2(last)
+                                                 : last);
+  for (; na > 0; na--) {
+    TValue *val = s2v(L->top - 1);
+    setobj2t(L, &t->array[last - 1], val);
+    last--;
+    luaC_barrierback(L, obj2gco(t), val);
+    L->top--;
+  }
+}
+
+
+static void datatable (DataState *ds) {
+  /* table -> '{' [ field { sep field } [sep] ] '}' */
+  LexState *ls = ds->ls;
+  lua_State *L = ls->L;
+  int line = ls->linenumber;
+  int level = ds->level++;
+  lua_Integer n = 0;  /* list items stored */
+  int na = 0;  /* list items waiting on the stack */
+  unsigned int nh = 0;  /* other fields */
+  Table *t = luaH_new(L);
+  sethvalue2s(L, L->top, t);
+  luaD_inctop(L);
+  if (level < MAXDATALEVELS && ds->hsize[level] > 0)
+    luaH_resize(L, t, 0, ds->hsize[level]);
+  checknext(ls, '{');
+  while (ls->t.token != '}') {
+    switch (ls->t.token) {
+      case TK_NAME: {  /* NAME '=' value */
+        datastring(ds);
+        checknext(ls, '=');
+        datavalue(ds);
+        datasetfield(ls, t);
+        nh++;
+        break;
+      }
+      case '[': {  /* '[' value ']' '=' value */
+        luaX_next(ls);
+        datavalue(ds);
+        checknext(ls, ']');
+        checknext(ls, '=');
+        datavalue(ds);
+        datasetfield(ls, t);
+        nh++;
+        break;
+      }
+      default: {  /* value */
+        datavalue(ds);
+        if (++na == LFIELDS_PER_FLUSH) {
+          dataflush(L, t, n, na);
+          n += na;
+          na = 0;
+        }
+        break;
+      }
+    }
+    if (!testnext(ls, ',') && !testnext(ls, ';'))
+      break;
+  }
+  check_match(ls, '}', '{', line);
+  if (na > 0)
+    dataflush(L, t, n, na);
+  if (level < MAXDATALEVELS)
+    ds->hsize[level] = nh;
+  ds->level--;
+}
+
+
+static void datavalue (DataState *ds) {
+  LexState *ls = ds->ls;
+  lua_State *L = ls->L;
+  int neg = 0;
+  while (testnext(ls, '-'))
+    neg = !neg;
+  switch (ls->t.token) {
+    case TK_INT: {
+      lua_Integer i = ls->t.seminfo.i;
+      setivalue(s2v(L->top), neg ? l_castU2S(0u - l_castS2U(i)) : i);
+      break;
+    }
+    case TK_FLT: {
+      lua_Number r = ls->t.seminfo.r;
+      setfltvalue(s2v(L->top), neg ? luai_numunm(L, r) : r);
+      break;
+    }
+    default: {
+      if (neg)
+        luaX_syntaxerror(ls, "number expected");
+      switch (ls->t.token) {
+        case TK_NIL: setnilvalue(s2v(L->top)); break;
+        case TK_TRUE: setbtvalue(s2v(L->top)); break;
+        case TK_FALSE: setbfvalue(s2v(L->top)); break;
+        case TK_STRING: datastring(ds); return;
+        case '{': {
+          enterlevel(ls);
+          datatable(ds);
+          leavelevel(ls);
+          return;
+        }
+        default: luaX_syntaxerror(ls, "unexpected symbol");
+      }
+    }
+  }
+  luaD_inctop(L);
+  luaX_next(ls);
+}
+
+
+/*
+** Parse a data chunk and push its value
+*/
+void luaY_data (lua_State *L, ZIO *z, Mbuffer *buff, const char *name,
+                int firstchar) {
+  LexState lexstate;
+  DataState ds;
+  TString *source = luaS_new(L, name);
+  setsvalue2s(L, L->top, source);  /* anchor it */
+  luaD_inctop(L);
+  lexstate.h = NULL;  /* strings are anchored by 'datastring' */
+  lexstate.buff = buff;
+  lexstate.dyd = NULL;
+  luaX_setinput(L, &lexstate, z, source, firstchar);
+  ds.ls = &lexstate;
+  ds.level = 0;
+  memset(ds.hsize, 0, sizeof(ds.hsize));
+  luaX_next(&lexstate);  /* read first token */
+  testnext(&lexstate, TK_RETURN);
+  datavalue(&ds);
+  testnext(&lexstate, ';');
+  check(&lexstate, TK_EOS);
+  setobjs2s(L, L->top - 2, L->top - 1);  /* move value over the anchor */
+  L->top--;
+}
+
+/* }====================================================================== */
+
+
 /*
 ** compiles the main function, which is a regular vararg function with an
 ** upvalue named LUA_ENV
@@ -151,6 +151,8 @@ typedef struct stringtable {
   TString **hash;
   int nuse;  /* number of elements */
   int size;
+  lu_mem nlookup;  /* short strings interned (see 'lua_strstats') */
+  lu_mem nhit;  /* ...that were already in the table */
 } stringtable;
 
 
@@ -213,6 +215,32 @@ typedef struct CallInfo {
 #define getoah(st)	((st) & CIST_OAH)
 
 
+#if LUAI_VMSTATS
+
+#include "lopcodes.h"
+
+/*
+** Counters of the instrumented interpreter (see 'lua_vmstats'); each
+** function counts its own instructions and calls in its 'Proto'
+*/
+typedef struct VMStats {
+  lua_Unsigned ops[NUM_OPCODES];  /* instructions run, per opcode */
+  lua_Unsigned getmiss;  /* reads through 'luaV_finishget' */
+  lua_Unsigned setmiss;  /* writes through 'luaV_finishset' */
+  lua_Unsigned tmcalls;  /* metamethods called */
+  lua_Unsigned ccalls;  /* calls to C functions */
+  lua_Unsigned luacalls;  /* calls to Lua functions */
+} VMStats;
+
+#define vmstat(L,c)	(G(L)->vmstats.c++)
+
+#else
+
+#define vmstat(L,c)	((void)0)
+
+#endif
+
+
 /*
 ** 'global state', shared by all threads of this state
 */
@@ -223,6 +251,7 @@ typedef struct global_State {
   l_mem GCdebt;  /* bytes allocated not yet compensated by the collector */
   lu_mem GCestimate;  /* an estimate of the non-garbage memory in use */
   lu_mem lastatomic;  /* see function 'genstep' in file 'lgc.c' */
+  struct GCStats *gcstats;  /* collector statistics (NULL if disabled) */
   stringtable strt;  /* hash table for strings */
   TValue l_registry;
   TValue nilvalue;  /* a nil value */
@@ -264,6 +293,9 @@ typedef struct global_State {
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
   lua_WarnFunction warnf;  /* warning function */
   void *ud_warn;         /* auxiliary data to 'warnf' */
+#if LUAI_VMSTATS
+  VMStats vmstats;  /* execution counters */
+#endif
 } global_State;
 
 
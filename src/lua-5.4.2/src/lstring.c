@@ -40,11 +40,47 @@ int luaS_eqlngstr (TString *a, TString *b) {
 }
 
 
+/*
+** Read a word of the string. Words are in machine order: a hash lives
+** only as long as its state, so it need not agree across platforms.
+*/
+#define HWORD	sizeof(l_uint32)
+
+static l_uint32 loadword (const char *p) {
+  l_uint32 w;
+  memcpy(&w, p, HWORD);
+  return w;
+}
+
+
+/*
+** Hash a string a word at a time. The last word is read so that it
+** ends with the string, overlapping the one before; strings shorter
+** than a word combine their first, middle and last bytes. The seed
+** enters the first mixing step, and a final avalanche spreads all bits
+** of the state over the low bits used by 'lmod'.
+*/
 unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
-  unsigned int h = seed ^ cast_uint(l);
-  for (; l > 0; l--)
-    h ^= ((h<<5) + (h>>2) + cast_byte(str[l - 1]));
-  return h;
+  l_uint32 h = cast(l_uint32, seed ^ cast_uint(l));
+  if (l >= HWORD) {
+    for (; l > HWORD; l -= HWORD, str += HWORD) {
+      h = (h ^ loadword(str)) * 0x9e3779b1u;
+      h = (h << 13) | (h >> 19);
+    }
+    h = (h ^ loadword(str + l - HWORD)) * 0x85ebca77u;
+  }
+  else if (l > 0) {
+    l_uint32 w = cast(l_uint32, cast_byte(str[0])) |
+                 (cast(l_uint32, cast_byte(str[l >> 1])) << 8) |
+                 (cast(l_uint32, cast_byte(str[l - 1])) << 16);
+    h = (h ^ w) * 0x85ebca77u;
+  }
+  h ^= h >> 15;
+  h *= 0x2c1b3c6du;
+  h ^= h >> 12;
+  h *= 0x297a2d39u;
+  h ^= h >> 15;
+  return cast_uint(h);
 }
 
 
@@ -192,9 +228,11 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   unsigned int h = luaS_hash(str, l, g->seed);
   TString **list = &tb->hash[lmod(h, tb->size)];
   lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
+  tb->nlookup++;
   for (ts = *list; ts != NULL; ts = ts->u.hnext) {
     if (l == ts->shrlen && (memcmp(str, getstr(ts), l * sizeof(char)) == 0)) {
       /* found! */
+      tb->nhit++;
       if (isdead(g, ts))  /* dead (but not collected yet)? */
         changewhite(ts);  /* resurrect it */
       return ts;
@@ -667,12 +667,114 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
+/*
+** Two-Way string matching (Crochemore-Perrin): linear time and
+** constant space for any needle and haystack. 'l2' >= 2 and 'l2' <= 'l1'.
+** The needle is split at a critical factorization: its right half is
+** compared left to right, its left half right to left, and shifts
+** come from the period of the needle (or from the last haystack byte
+** of the window when that byte does not fit).
+*/
+#define BITOP(a,b,op) \
+  ((a)[(size_t)(b)/(8*sizeof *(a))] op (size_t)1<<((size_t)(b)%(8*sizeof *(a))))
+
+static size_t maxsuffix (const unsigned char *n, size_t l, size_t *period,
+                         int rev) {
+  size_t ip = (size_t)-1;  /* start of maximal suffix, minus 1 */
+  size_t jp = 0;  /* candidate suffix */
+  size_t k = 1, p = 1;
+  while (jp + k < l) {
+    unsigned char a = n[ip + k], b = n[jp + k];
+    if (a == b) {
+      if (k == p) { jp += p; k = 1; }
+      else k++;
+    }
+    else if (rev ? a < b : a > b) {
+      jp += k; k = 1;
+      p = jp - ip;
+    }
+    else {
+      ip = jp++;
+      k = p = 1;
+    }
+  }
+  *period = p;
+  return ip;
+}
+
+
+static const char *twoway (const char *s1, size_t l1,
+                           const char *s2, size_t l2) {
+  const unsigned char *h = (const unsigned char *)s1;
+  const unsigned char *z = h + l1;  /* end of haystack */
+  const unsigned char *n = (const unsigned char *)s2;
+  size_t byteset[32 / sizeof(size_t)];
+  size_t shift[256];
+  size_t i, k, p, p0, ms, ms0, mem, mem0;
+  memset(byteset, 0, sizeof(byteset));
+  for (i = 0; i < l2; i++) {
+    BITOP(byteset, n[i], |=);
+    shift[n[i]] = i + 1;  /* last position of each needle byte, plus 1 */
+  }
+  /* critical factorization: the larger of the two maximal suffixes */
+  ms0 = maxsuffix(n, l2, &p0, 0);
+  ms = maxsuffix(n, l2, &p, 1);
+  if (ms + 1 <= ms0 + 1) {
+    ms = ms0;
+    p = p0;
+  }
+  if (memcmp(n, n + p, ms + 1) != 0) {  /* needle not periodic? */
+    mem0 = 0;
+    p = ((ms > l2 - ms - 1) ? ms : l2 - ms - 1) + 1;
+  }
+  else mem0 = l2 - p;
+  mem = 0;
+  while ((size_t)(z - h) >= l2) {
+    if (BITOP(byteset, h[l2 - 1], &)) {  /* last byte occurs in needle? */
+      k = l2 - shift[h[l2 - 1]];
+      if (k) {  /* align it with its last occurrence */
+        h += (k < mem) ? mem : k;
+        mem = 0;
+        continue;
+      }
+    }
+    else {  /* no match can overlap that byte */
+      h += l2;
+      mem = 0;
+      continue;
+    }
+    for (k = (ms + 1 > mem) ? ms + 1 : mem; k < l2 && n[k] == h[k]; k++) ;
+    if (k < l2) {  /* mismatch in right half */
+      h += k - ms;
+      mem = 0;
+      continue;
+    }
+    for (k = ms + 1; k > mem && n[k - 1] == h[k - 1]; k--) ;
+    if (k <= mem)  /* left half matches too */
+      return (const char *)h;
+    h += p;
+    mem = mem0;
+  }
+  return NULL;
+}
+
+
+/*
+** Plain search. Scanning candidates with 'memchr' (vectorized in
+** the C library) is fastest on ordinary text, but degrades to
+** O(l1 * l2) when the first byte of 's2' is common in 's1' (as in
+** repetitive haystacks). When verifications fail too often for the
+** distance covered, the rest of the search switches to Two-Way.
+*/
 static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
   else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
+  else if (l2 == 1) return (const char *)memchr(s1, *s2, l1);
   else {
+    const char *start = s1;
     const char *init;  /* to search for a '*s2' inside 's1' */
+    size_t fails = 0;  /* candidates that did not match */
     l2--;  /* 1st char will be checked by 'memchr' */
     l1 = l1-l2;  /* 's2' cannot be found after that */
     while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
@@ -682,6 +784,8 @@ static const char *lmemfind (const char *s1, size_t l1,
       else {  /* correct 'l1' and 's1' to try again */
         l1 -= init-s1;
         s1 = init;
+        if (++fails > 16 + (size_t)(s1 - start) / 16 && l2 >= 4)
+          return twoway(s1, l1 + l2, s2, l2 + 1);  /* too many candidates */
       }
     }
     return NULL;  /* not found */
@@ -739,6 +843,42 @@ static int push_captures (MatchState *ms, const char *s, const char *e) {
 }
 
 
+/*
+** Copy into 'buff' the literal prefix of pattern 'p' (without its
+** anchor): the characters every match must start with, up to the first
+** special character or optional item. Returns its length, which is 0
+** when the pattern does not start with a literal. Searches can then
+** jump between occurrences of the prefix (found with 'lmemfind')
+** instead of trying a match at every position.
+*/
+#define MAXPREFIX	32
+
+static size_t litprefix (const char *p, size_t lp, char *buff) {
+  const char *ep = p + lp;
+  size_t n = 0;
+  while (p < ep && n < MAXPREFIX) {
+    const char *next;
+    char c = *p;
+    if (c == L_ESC) {
+      if (p + 1 == ep || isalnum(uchar(p[1])))
+        break;  /* class, back reference, '%b', '%f', or malformed */
+      c = p[1];  /* escaped literal */
+      next = p + 2;
+    }
+    else if (strchr(SPECIALS ")", c) != NULL)
+      break;
+    else next = p + 1;
+    if (next < ep && (*next == '*' || *next == '?' || *next == '-'))
+      break;  /* optional item */
+    buff[n++] = c;
+    if (next < ep && *next == '+')
+      break;  /* repetitions follow */
+    p = next;
+  }
+  return n;
+}
+
+
 /* check whether pattern has no special characters */
 static int nospecials (const char *p, size_t l) {
   size_t upto = 0;
@@ -790,12 +930,19 @@ static int str_find_aux (lua_State *L, int find) {
     MatchState ms;
     const char *s1 = s + init;
     int anchor = (*p == '^');
+    char prefix[MAXPREFIX];
+    size_t lprefix;
     if (anchor) {
       p++; lp--;  /* skip anchor character */
     }
+    lprefix = anchor ? 0 : litprefix(p, lp, prefix);
     prepstate(&ms, L, s, ls, p, lp);
     do {
       const char *res;
+      if (lprefix > 0) {  /* go to next possible start of a match */
+        s1 = lmemfind(s1, ms.src_end - s1, prefix, lprefix);
+        if (s1 == NULL) break;
+      }
       reprepstate(&ms);
       if ((res=match(&ms, s1, p)) != NULL) {
         if (find) {
@@ -829,6 +976,8 @@ typedef struct GMatchState {
   const char *p;  /* pattern */
   const char *lastmatch;  /* end of last match */
   MatchState ms;  /* match state */
+  size_t lprefix;  /* length of literal prefix of the pattern */
+  char prefix[MAXPREFIX];
 } GMatchState;
 
 
@@ -838,6 +987,10 @@ static int gmatch_aux (lua_State *L) {
   gm->ms.L = L;
   for (src = gm->src; src <= gm->ms.src_end; src++) {
     const char *e;
+    if (gm->lprefix > 0) {  /* go to next possible start of a match */
+      src = lmemfind(src, gm->ms.src_end - src, gm->prefix, gm->lprefix);
+      if (src == NULL) break;
+    }
     reprepstate(&gm->ms);
     if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
       gm->src = gm->lastmatch = e;
@@ -860,6 +1013,7 @@ static int gmatch (lua_State *L) {
     init = ls + 1;  /* avoid overflows in 's + init' */
   prepstate(&gm->ms, L, s, ls, p, lp);
   gm->src = s + init; gm->p = p; gm->lastmatch = NULL;
+  gm->lprefix = litprefix(p, lp, gm->prefix);
   lua_pushcclosure(L, gmatch_aux, 3);
   return 1;
 }
@@ -948,6 +1102,8 @@ static int str_gsub (lua_State *L) {
   int changed = 0;  /* change flag */
   MatchState ms;
   luaL_Buffer b;
+  char prefix[MAXPREFIX];
+  size_t lprefix;
   luaL_argexpected(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table");
@@ -955,6 +1111,7 @@ static int str_gsub (lua_State *L) {
   if (anchor) {
     p++; lp--;  /* skip anchor character */
   }
+  lprefix = anchor ? 0 : litprefix(p, lp, prefix);
   prepstate(&ms, L, src, srcl, p, lp);
   while (n < max_s) {
     const char *e;
@@ -964,8 +1121,17 @@ static int str_gsub (lua_State *L) {
       changed = add_value(&ms, &b, src, e, tr) | changed;
       src = lastmatch = e;
     }
-    else if (src < ms.src_end)  /* otherwise, skip one character */
-      luaL_addchar(&b, *src++);
+    else if (src < ms.src_end) {  /* otherwise, skip one character */
+      if (lprefix > 0) {  /* copy everything up to next possible match */
+        const char *next = lmemfind(src + 1, ms.src_end - (src + 1),
+                                    prefix, lprefix);
+        if (next == NULL) next = ms.src_end;
+        luaL_addlstring(&b, src, next - src);
+        src = next;
+      }
+      else
+        luaL_addchar(&b, *src++);
+    }
     else break;  /* end of subject */
     if (anchor) break;
   }
@@ -982,6 +1148,201 @@ static int str_gsub (lua_State *L) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** SPLIT
+** =======================================================
+*/
+
+/* state for 'split' and 'isplit' */
+typedef struct SplitState {
+  const char *src;  /* start of next field */
+  const char *sep;  /* separator */
+  size_t lsep;  /* length of separator */
+  int plain;  /* separator is a plain string? */
+  int positions;  /* produce (start, end) instead of substrings? */
+  int done;  /* last field already produced? */
+  lua_Integer left;  /* fields left before the rest is taken whole */
+  MatchState ms;  /* for pattern separators */
+  size_t lprefix;  /* length of literal prefix of the separator */
+  char prefix[MAXPREFIX];
+} SplitState;
+
+
+static void prepsplit (lua_State *L, SplitState *ss) {
+  size_t ls;
+  const char *s = luaL_checklstring(L, 1, &ls);
+  ss->sep = luaL_checklstring(L, 2, &ss->lsep);
+  luaL_argcheck(L, ss->lsep > 0, 2, "empty separator");
+  ss->plain = lua_toboolean(L, 3) || nospecials(ss->sep, ss->lsep);
+  ss->left = luaL_optinteger(L, 4, LUA_MAXINTEGER);
+  luaL_argcheck(L, ss->left > 0, 4, "limit must be positive");
+  ss->positions = lua_toboolean(L, 5);
+  ss->done = 0;
+  ss->src = s;
+  prepstate(&ss->ms, L, s, ls, ss->sep, ss->lsep);
+  ss->lprefix = ss->plain ? 0 : litprefix(ss->sep, ss->lsep, ss->prefix);
+}
+
+
+/*
+** Find next separator at or after 's'. Returns its start (or NULL)
+** and sets '*e' to its end. Empty matches of a pattern separator are
+** not separators.
+*/
+static const char *findsep (SplitState *ss, const char *s, const char **e) {
+  const char *src_end = ss->ms.src_end;
+  if (ss->plain) {
+    const char *d = lmemfind(s, src_end - s, ss->sep, ss->lsep);
+    if (d != NULL) *e = d + ss->lsep;
+    return d;
+  }
+  for (; s < src_end; s++) {
+    if (ss->lprefix > 0) {  /* go to next possible start of a match */
+      s = lmemfind(s, src_end - s, ss->prefix, ss->lprefix);
+      if (s == NULL) break;
+    }
+    reprepstate(&ss->ms);
+    if ((*e = match(&ss->ms, s, ss->sep)) != NULL && *e != s)
+      return s;
+  }
+  return NULL;
+}
+
+
+/*
+** Get next field into ['*fs', '*fe'). Returns 0 when there are no
+** more fields.
+*/
+static int nextfield (SplitState *ss, const char **fs, const char **fe) {
+  const char *d = NULL;
+  const char *de;
+  if (ss->done)
+    return 0;
+  *fs = ss->src;
+  if (--ss->left > 0)
+    d = findsep(ss, ss->src, &de);
+  if (d == NULL) {  /* last field: the rest of the subject */
+    *fe = ss->ms.src_end;
+    ss->done = 1;
+  }
+  else {
+    *fe = d;
+    ss->src = de;
+  }
+  return 1;
+}
+
+
+/*
+** Number of fields for a plain separator, to size the result: counting
+** with 'lmemfind' is cheaper than growing the array while filling it.
+*/
+static int countfields (SplitState *ss) {
+  const char *s = ss->src;
+  const char *e = ss->ms.src_end;
+  lua_Integer n = 1;
+  while (n < ss->left && n < INT_MAX / 2 &&
+         (s = lmemfind(s, e - s, ss->sep, ss->lsep)) != NULL) {
+    s += ss->lsep;
+    n++;
+  }
+  return (int)n;
+}
+
+
+/*
+** string.split(s, sep [, plain [, limit [, positions]]]): array with
+** the fields of 's'; with 'positions', a flat array with the start and
+** end indices of each field instead.
+*/
+static int str_split (lua_State *L) {
+  SplitState ss;
+  const char *fs, *fe;
+  lua_Integer i = 0;
+  prepsplit(L, &ss);
+  if (ss.plain) {
+    int n = countfields(&ss);
+    lua_createtable(L, ss.positions ? 2 * n : n, 0);
+  }
+  else
+    lua_newtable(L);
+  while (nextfield(&ss, &fs, &fe)) {
+    if (ss.positions) {
+      lua_pushinteger(L, (fs - ss.ms.src_init) + 1);
+      lua_rawseti(L, -2, ++i);
+      lua_pushinteger(L, fe - ss.ms.src_init);
+    }
+    else
+      lua_pushlstring(L, fs, fe - fs);
+    lua_rawseti(L, -2, ++i);
+  }
+  return 1;
+}
+
+
+static int isplit_aux (lua_State *L) {
+  SplitState *ss = (SplitState *)lua_touserdata(L, lua_upvalueindex(3));
+  const char *fs, *fe;
+  ss->ms.L = L;  /* the creating thread may be gone (as in 'gmatch_aux') */
+  if (!nextfield(ss, &fs, &fe))
+    return 0;  /* no more fields */
+  if (ss->positions) {
+    lua_pushinteger(L, (fs - ss->ms.src_init) + 1);
+    lua_pushinteger(L, fe - ss->ms.src_init);
+    return 2;
+  }
+  lua_pushlstring(L, fs, fe - fs);
+  return 1;
+}
+
+
+static int isplit (lua_State *L) {
+  SplitState *ss;
+  lua_settop(L, 5);
+  ss = (SplitState *)lua_newuserdatauv(L, sizeof(SplitState), 0);
+  prepsplit(L, ss);
+  lua_replace(L, 3);  /* keep strings on closure to avoid being collected */
+  lua_settop(L, 3);
+  lua_pushcclosure(L, isplit_aux, 3);
+  return 1;
+}
+
+
+/*
+** string.splitlines(s [, positions]): array with the lines of 's',
+** split at "\n" or "\r\n". A final line break does not start a new
+** (empty) line.
+*/
+static int str_splitlines (lua_State *L) {
+  size_t ls;
+  const char *s = luaL_checklstring(L, 1, &ls);
+  const char *e = s + ls;
+  const char *p = s;
+  int positions = lua_toboolean(L, 2);
+  lua_Integer i = 0;
+  lua_newtable(L);
+  while (p < e) {
+    const char *nl = (const char *)memchr(p, '\n', e - p);
+    const char *le = (nl != NULL) ? nl : e;  /* end of line */
+    if (nl != NULL && le > p && le[-1] == '\r')
+      le--;  /* strip CR */
+    if (positions) {
+      lua_pushinteger(L, (p - s) + 1);
+      lua_rawseti(L, -2, ++i);
+      lua_pushinteger(L, le - s);
+    }
+    else
+      lua_pushlstring(L, p, le - p);
+    lua_rawseti(L, -2, ++i);
+    p = (nl != NULL) ? nl + 1 : e;
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
 
 /*
 ** {======================================================
@@ -1763,11 +2124,14 @@ static const luaL_Reg strlib[] = {
   {"format", str_format},
   {"gmatch", gmatch},
   {"gsub", str_gsub},
+  {"isplit", isplit},
   {"len", str_len},
   {"lower", str_lower},
   {"match", str_match},
   {"rep", str_rep},
   {"reverse", str_reverse},
+  {"split", str_split},
+  {"splitlines", str_splitlines},
   {"sub", str_sub},
   {"upper", str_upper},
   {"pack", str_pack},
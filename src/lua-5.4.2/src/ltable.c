@@ -605,6 +605,32 @@ Table *luaH_new (lua_State *L) {
 }
 
 
+/*
+** Empty table 't' without changing the size of its parts: all array
+** slots and nodes become empty, and the whole hash part becomes free
+** again, so that it can be refilled without a rehash.
+*/
+void luaH_clear (Table *t) {
+  unsigned int i;
+  unsigned int asize = luaH_realasize(t);
+  for (i = 0; i < asize; i++)
+    setempty(&t->array[i]);
+  if (!isdummy(t)) {
+    unsigned int size = sizenode(t);
+    for (i = 0; i < size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = 0;
+      setnilkey(n);
+      setempty(gval(n));
+    }
+    t->lastfree = gnode(t, size);  /* all positions are free */
+  }
+  t->alimit = asize;
+  setrealasize(t);
+  invalidateTMcache(t);
+}
+
+
 void luaH_free (lua_State *L, Table *t) {
   freehash(L, t);
   luaM_freearray(L, t->array, luaH_realasize(t));
@@ -171,6 +171,39 @@ static int tconcat (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Presizing
+** =======================================================
+*/
+
+/*
+** table.new(narray, nhash): new table with space preallocated for
+** 'narray' sequence elements and 'nhash' other fields
+*/
+static int tnew (lua_State *L) {
+  lua_Integer na = luaL_optinteger(L, 1, 0);
+  lua_Integer nh = luaL_optinteger(L, 2, 0);
+  luaL_argcheck(L, 0 <= na && na <= INT_MAX, 1, "out of range");
+  luaL_argcheck(L, 0 <= nh && nh <= INT_MAX, 2, "out of range");
+  lua_createtable(L, (int)na, (int)nh);
+  return 1;
+}
+
+
+/*
+** table.clear(t): remove all elements of 't' but keep its memory, so
+** that refilling it up to the same size does not allocate
+*/
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Pack/unpack
@@ -209,6 +242,290 @@ static int tunpack (lua_State *L) {
 
 
 
+/*
+** {======================================================
+** Sorting with options: table.sort(t, {key=f, stable=b, reverse=b})
+** The sort key of each element is computed once and stored, with the
+** element's original position, in a C array. Numbers and strings are
+** compared natively; only other keys go through 'lua_compare'. The
+** array is sorted with introsort (quicksort falling back to heapsort),
+** or with a merge sort of presorted runs when 'stable' is set, and the
+** elements are then stored back in their new order.
+** =======================================================
+*/
+
+/* kinds of sort keys */
+#define SK_INT		0
+#define SK_FLT		1
+#define SK_STR		2
+#define SK_OTHER	3
+
+/* sizes of runs sorted by insertion sort */
+#define SK_SMALL	16
+#define SK_RUN		32
+
+
+typedef struct SortItem {
+  union {
+    lua_Integer i;
+    lua_Number n;
+    const char *s;
+  } u;
+  size_t len;  /* length of string keys */
+  unsigned int pos;  /* original position of the element */
+  int kind;
+} SortItem;
+
+
+typedef struct SortState {
+  lua_State *L;
+  int keys;  /* stack index of the table with the keys */
+  int reverse;  /* sort in descending order? */
+} SortState;
+
+
+/* same order as 'l_strcmp' in lvm.c */
+static int sk_strcmp (const char *l, size_t ll, const char *r, size_t lr) {
+  for (;;) {  /* for each segment */
+    int temp = strcoll(l, r);
+    if (temp != 0)  /* not equal? */
+      return temp;  /* done */
+    else {  /* strings are equal up to a '\0' */
+      size_t len = strlen(l);  /* index of first '\0' in both strings */
+      if (len == lr)  /* 'r' is finished? */
+        return (len == ll) ? 0 : 1;  /* check 'l' */
+      else if (len == ll)  /* 'l' is finished? */
+        return -1;  /* 'l' is less than 'r' ('r' is not finished) */
+      /* both strings longer than 'len'; go on comparing after the '\0' */
+      len++;
+      l += len; ll -= len; r += len; lr -= len;
+    }
+  }
+}
+
+
+/* 'a < b' for keys without a native comparison (mixed numbers, etc.) */
+static int sk_slowlt (SortState *ss, const SortItem *a, const SortItem *b) {
+  lua_State *L = ss->L;
+  int res;
+  lua_rawgeti(L, ss->keys, a->pos);
+  lua_rawgeti(L, ss->keys, b->pos);
+  res = lua_compare(L, -2, -1, LUA_OPLT);
+  lua_pop(L, 2);
+  return res;
+}
+
+
+/* does 'a' go before 'b'? */
+static int sk_lt (SortState *ss, const SortItem *a, const SortItem *b) {
+  if (ss->reverse) {  /* descending order: compare 'b < a' */
+    const SortItem *t = a; a = b; b = t;
+  }
+  if (a->kind == b->kind) {
+    switch (a->kind) {
+      case SK_INT: return (a->u.i < b->u.i);
+      case SK_FLT: return (a->u.n < b->u.n);
+      case SK_STR: return (sk_strcmp(a->u.s, a->len, b->u.s, b->len) < 0);
+      default: break;
+    }
+  }
+  return sk_slowlt(ss, a, b);
+}
+
+
+#define sk_swap(a,i,j)	{ SortItem t_ = a[i]; a[i] = a[j]; a[j] = t_; }
+
+
+/* stable insertion sort of 'a[lo .. hi - 1]' */
+static void sk_insertion (SortState *ss, SortItem *a, size_t lo, size_t hi) {
+  size_t i, j;
+  for (i = lo + 1; i < hi; i++) {
+    SortItem x = a[i];
+    for (j = i; j > lo && sk_lt(ss, &x, &a[j - 1]); j--)
+      a[j] = a[j - 1];
+    a[j] = x;
+  }
+}
+
+
+static void sk_siftdown (SortState *ss, SortItem *a, size_t i, size_t n) {
+  SortItem x = a[i];
+  for (;;) {
+    size_t c = 2 * i + 1;  /* left child */
+    if (c >= n) break;
+    if (c + 1 < n && sk_lt(ss, &a[c], &a[c + 1]))
+      c++;  /* use the greater child */
+    if (!sk_lt(ss, &x, &a[c])) break;
+    a[i] = a[c];
+    i = c;
+  }
+  a[i] = x;
+}
+
+
+static void sk_heapsort (SortState *ss, SortItem *a, size_t n) {
+  size_t i;
+  for (i = n / 2; i-- > 0; )
+    sk_siftdown(ss, a, i, n);
+  for (i = n; i-- > 1; ) {
+    sk_swap(a, 0, i);
+    sk_siftdown(ss, a, 0, i);
+  }
+}
+
+
+/*
+** Quicksort with median-of-three pivots; after 'depth' levels of bad
+** partitions it switches to heapsort, so it is O(n log n) in any case.
+*/
+static void sk_introsort (SortState *ss, SortItem *a, size_t n, int depth) {
+  while (n > SK_SMALL) {
+    size_t i = 0, j = n - 1, m = n / 2;
+    SortItem p;
+    if (depth-- == 0) {
+      sk_heapsort(ss, a, n);
+      return;
+    }
+    /* sort a[0], a[m], a[n - 1]; they also work as sentinels below */
+    if (sk_lt(ss, &a[m], &a[0])) sk_swap(a, 0, m);
+    if (sk_lt(ss, &a[n - 1], &a[m])) {
+      sk_swap(a, m, n - 1);
+      if (sk_lt(ss, &a[m], &a[0])) sk_swap(a, 0, m);
+    }
+    p = a[m];
+    for (;;) {  /* a[0 .. i] <= P; a[j .. n - 1] >= P */
+      /* the sentinels stop both scans unless '__lt' is inconsistent */
+      while (sk_lt(ss, &a[++i], &p)) {
+        if (i == n - 1)  /* a[i] < P but a[n - 1] >= P ?? */
+          luaL_error(ss->L, "invalid order function for sorting");
+      }
+      while (sk_lt(ss, &p, &a[--j])) {
+        if (j == 0)  /* P < a[j] but a[0] <= P ?? */
+          luaL_error(ss->L, "invalid order function for sorting");
+      }
+      if (i >= j) break;
+      sk_swap(a, i, j);
+    }
+    /* a[0 .. j] <= a[j + 1 .. n - 1]; recurse into smaller part */
+    if (j + 1 < n - (j + 1)) {
+      sk_introsort(ss, a, j + 1, depth);
+      a += j + 1;
+      n -= j + 1;
+    }
+    else {
+      sk_introsort(ss, a + j + 1, n - (j + 1), depth);
+      n = j + 1;
+    }
+  }
+  sk_insertion(ss, a, 0, n);
+}
+
+
+/* merge sorted runs a[lo .. mid - 1] and a[mid .. hi - 1] */
+static void sk_merge (SortState *ss, SortItem *a, size_t lo, size_t mid,
+                      size_t hi, SortItem *tmp) {
+  size_t i = lo, j = mid, k = lo;
+  if (!sk_lt(ss, &a[mid], &a[mid - 1]))
+    return;  /* runs are already in order */
+  memcpy(tmp + lo, a + lo, (mid - lo) * sizeof(SortItem));
+  while (i < mid && j < hi) {
+    if (sk_lt(ss, &a[j], &tmp[i]))  /* equal elements keep their order */
+      a[k++] = a[j++];
+    else
+      a[k++] = tmp[i++];
+  }
+  while (i < mid)
+    a[k++] = tmp[i++];
+}
+
+
+/* stable bottom-up merge sort; 'tmp' has room for 'n' items */
+static void sk_mergesort (SortState *ss, SortItem *a, size_t n,
+                          SortItem *tmp) {
+  size_t lo, w;
+  for (lo = 0; lo < n; lo += SK_RUN)
+    sk_insertion(ss, a, lo, (n - lo > SK_RUN) ? lo + SK_RUN : n);
+  for (w = SK_RUN; w < n; w *= 2) {
+    for (lo = 0; lo + w < n; lo += 2 * w)
+      sk_merge(ss, a, lo, lo + w, (n - lo > 2 * w) ? lo + 2 * w : n, tmp);
+  }
+}
+
+
+static int optsort (lua_State *L, lua_Integer n) {
+  SortState ss;
+  SortItem *a;
+  size_t i;
+  int haskey, stable, depth;
+  luaL_argcheck(L, (size_t)n <= (~(size_t)0) / (2 * sizeof(SortItem)), 1,
+                   "array too big");
+  lua_getfield(L, 2, "stable");
+  stable = lua_toboolean(L, -1);
+  lua_getfield(L, 2, "reverse");
+  ss.reverse = lua_toboolean(L, -1);
+  lua_settop(L, 2);
+  haskey = (lua_getfield(L, 2, "key") != LUA_TNIL);  /* key at index 3 */
+  luaL_argcheck(L, !haskey || lua_isfunction(L, 3), 2,
+                   "field 'key' must be a function");
+  lua_createtable(L, (int)n, 0);  /* elements at index 4 */
+  if (haskey)
+    lua_createtable(L, (int)n, 0);  /* keys at index 5 */
+  else
+    lua_pushvalue(L, 4);  /* elements are their own keys */
+  /* items (followed by a work area for the merge sort) */
+  a = (SortItem *)lua_newuserdatauv(L, (stable ? 2 : 1) * (size_t)n *
+                                       sizeof(SortItem), 0);
+  ss.L = L;
+  ss.keys = 5;
+  for (i = 0; i < (size_t)n; i++) {
+    SortItem *it = &a[i];
+    lua_geti(L, 1, i + 1);
+    if (haskey) {
+      lua_pushvalue(L, 3);
+      lua_pushvalue(L, -2);
+      lua_call(L, 1, 1);  /* key(element) */
+      lua_rawseti(L, 5, i + 1);
+    }
+    lua_rawseti(L, 4, i + 1);
+    it->pos = (unsigned int)(i + 1);
+    switch (lua_rawgeti(L, 5, i + 1)) {
+      case LUA_TNUMBER:
+        if (lua_isinteger(L, -1)) {
+          it->kind = SK_INT;
+          it->u.i = lua_tointeger(L, -1);
+        }
+        else {
+          it->kind = SK_FLT;
+          it->u.n = lua_tonumber(L, -1);
+        }
+        break;
+      case LUA_TSTRING:  /* string stays alive in the keys table */
+        it->kind = SK_STR;
+        it->u.s = lua_tolstring(L, -1, &it->len);
+        break;
+      default:
+        it->kind = SK_OTHER;
+        break;
+    }
+    lua_pop(L, 1);
+  }
+  if (stable)
+    sk_mergesort(&ss, a, (size_t)n, a + n);
+  else {
+    for (depth = 0, i = (size_t)n; i > 1; i >>= 1)
+      depth += 2;  /* 2 * log2(n) */
+    sk_introsort(&ss, a, (size_t)n, depth);
+  }
+  for (i = 0; i < (size_t)n; i++) {  /* store elements in new order */
+    lua_rawgeti(L, 4, a[i].pos);
+    lua_seti(L, 1, i + 1);
+  }
+  return 0;
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Quicksort
@@ -398,6 +715,8 @@ static int sort (lua_State *L) {
   lua_Integer n = aux_getn(L, 1, TAB_RW);
   if (n > 1) {  /* non-trivial interval? */
     luaL_argcheck(L, n < INT_MAX, 1, "array too big");
+    if (lua_istable(L, 2))  /* sorting options? */
+      return optsort(L, n);
     if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
       luaL_checktype(L, 2, LUA_TFUNCTION);  /* must be a function */
     lua_settop(L, 2);  /* make sure there are two arguments */
@@ -417,6 +736,8 @@ static const luaL_Reg tab_funcs[] = {
   {"remove", tremove},
   {"move", tmove},
   {"sort", sort},
+  {"new", tnew},
+  {"clear", tclear},
   {NULL, NULL}
 };
 
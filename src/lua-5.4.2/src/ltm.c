@@ -84,6 +84,72 @@ const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o, TMS event) {
 }
 
 
+/*
+** Get short string 'key' from table 'h', trying first the node slot
+** cached in '*c'; a full lookup that finds the key updates the cache.
+*/
+static const TValue *getcached (Table *h, TString *key, unsigned int *c) {
+  const TValue *slot;
+  if (*c < cast_uint(sizenode(h))) {
+    Node *n = gnode(h, *c);
+    if (keyisshrstr(n) && keystrval(n) == key)
+      return gval(n);
+  }
+  slot = luaH_getshortstr(h, key);
+  if (!isabstkey(slot))  /* key is in the table? */
+    *c = cast_uint(nodefromval(slot) - h->node);
+  return slot;
+}
+
+
+/*
+** Get 'key' through the '__index' chain of table 'h', which does not
+** have the key itself and has a metatable. This is the common case of
+** a method call on an object whose class is its metatable's '__index'
+** (or a subclass of it). Only the first link of the chain uses the
+** inline cache 'ic': the slot of '__index' in the metatable and the
+** slot of 'key' in the '__index' table. Returns false, leaving the
+** access to 'luaV_finishget', when the chain reaches an '__index' that
+** is not a table.
+*/
+int luaT_getindexcached (lua_State *L, Table *h, TString *key, ICache *ic,
+                         const TValue **slot) {
+  int loop;
+  for (loop = 0; loop < MAXTAGLOOP; loop++) {
+    const TValue *tm;
+    const TValue *res;
+    if (loop == 0) {
+      Table *mt = h->metatable;
+      if (mt->flags & (1u << TM_INDEX))  /* no '__index'? */
+        tm = NULL;
+      else {
+        tm = getcached(mt, G(L)->tmname[TM_INDEX], &ic->mslot);
+        if (notm(tm)) {
+          mt->flags |= cast_byte(1u << TM_INDEX);  /* cache this fact */
+          tm = NULL;
+        }
+      }
+    }
+    else
+      tm = fasttm(L, h->metatable, TM_INDEX);
+    if (tm == NULL) {  /* no metamethod? */
+      *slot = &G(L)->nilvalue;  /* result is nil */
+      return 1;
+    }
+    if (!ttistable(tm))
+      return 0;
+    h = hvalue(tm);
+    res = (loop == 0) ? getcached(h, key, &ic->islot)
+                      : luaH_getshortstr(h, key);
+    if (!isempty(res)) {
+      *slot = res;
+      return 1;
+    }
+  }
+  return 0;  /* too long a chain; let 'luaV_finishget' raise the error */
+}
+
+
 /*
 ** Return the name of the type of an object. For tables and userdata
 ** with metatable, use their '__name' metafield, if present.
@@ -103,6 +169,7 @@ const char *luaT_objtypename (lua_State *L, const TValue *o) {
 void luaT_callTM (lua_State *L, const TValue *f, const TValue *p1,
                   const TValue *p2, const TValue *p3) {
   StkId func = L->top;
+  vmstat(L, tmcalls);
   setobj2s(L, func, f);  /* push function (assume EXTRA_STACK) */
   setobj2s(L, func + 1, p1);  /* 1st argument */
   setobj2s(L, func + 2, p2);  /* 2nd argument */
@@ -120,6 +187,7 @@ void luaT_callTMres (lua_State *L, const TValue *f, const TValue *p1,
                      const TValue *p2, StkId res) {
   ptrdiff_t result = savestack(L, res);
   StkId func = L->top;
+  vmstat(L, tmcalls);
   setobj2s(L, func, f);  /* push function (assume EXTRA_STACK) */
   setobj2s(L, func + 1, p1);  /* 1st argument */
   setobj2s(L, func + 2, p2);  /* 2nd argument */
@@ -273,6 +273,7 @@ LUA_API void  (lua_rawseti) (lua_State *L, int idx, lua_Integer n);
 LUA_API void  (lua_rawsetp) (lua_State *L, int idx, const void *p);
 LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 LUA_API int   (lua_setiuservalue) (lua_State *L, int idx, int n);
+LUA_API void  (lua_cleartable) (lua_State *L, int idx);
 
 
 /*
@@ -289,6 +290,9 @@ LUA_API int   (lua_pcallk) (lua_State *L, int nargs, int nresults, int errfunc,
 LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
                           const char *chunkname, const char *mode);
 
+LUA_API int   (lua_loaddata) (lua_State *L, lua_Reader reader, void *dt,
+                              const char *chunkname);
+
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data, int strip);
 
 
@@ -329,6 +333,9 @@ LUA_API void (lua_warning)  (lua_State *L, const char *msg, int tocont);
 #define LUA_GCINC		11
 
 LUA_API int (lua_gc) (lua_State *L, int what, ...);
+LUA_API int (lua_setgcstats) (lua_State *L, int idx);
+LUA_API int (lua_gcstats) (lua_State *L);
+LUA_API void (lua_strstats) (lua_State *L, int reset);
 
 
 /*
@@ -465,6 +472,7 @@ LUA_API int (lua_gethookmask) (lua_State *L);
 LUA_API int (lua_gethookcount) (lua_State *L);
 
 LUA_API int (lua_setcstacklimit) (lua_State *L, unsigned int limit);
+LUA_API int (lua_vmstats) (lua_State *L, int nfuncs, int reset);
 
 struct lua_Debug {
   int event;
@@ -15,6 +15,7 @@
 
 #include "lua.h"
 
+#include "lcode.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
@@ -263,6 +264,10 @@ static void loadFunction (LoadState *S, Proto *f, TString *psource) {
   f->is_vararg = loadByte(S);
   f->maxstacksize = loadByte(S);
   loadCode(S, f);
+#if LUAI_SUPERINSTR
+  luaK_fuse(f);
+#endif
+  luaF_initcache(S->L, f);
   loadConstants(S, f);
   loadUpvalues(S, f);
   loadProtos(S, f);
@@ -292,8 +297,10 @@ static void checkHeader (LoadState *S) {
   checkliteral(S, &LUA_SIGNATURE[1], "not a binary chunk");
   if (loadByte(S) != LUAC_VERSION)
     error(S, "version mismatch");
-  if (loadByte(S) != LUAC_FORMAT)
-    error(S, "format mismatch");
+  switch (loadByte(S)) {
+    case LUAC_FORMAT: case LUAC_FORMATSI: break;  /* this VM runs both */
+    default: error(S, "format mismatch");
+  }
   checkliteral(S, LUAC_DATA, "corrupted chunk");
   checksize(S, Instruction);
   checksize(S, lua_Integer);
@@ -25,6 +25,7 @@
 #define LUAC_VERSION	(MYINT(LUA_VERSION_MAJOR)*16+MYINT(LUA_VERSION_MINOR))
 
 #define LUAC_FORMAT	0	/* this is the official format */
+#define LUAC_FORMATSI	0x81	/* code uses the superinstructions (set 1) */
 
 /* load one chunk; from lundump.c */
 LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name);
@@ -45,10 +45,6 @@
 
 
 
-/* limit for table tag-method chains (to avoid infinite loops) */
-#define MAXTAGLOOP	2000
-
-
 /*
 ** 'l_intfitsf' checks whether a given integer is in the range that
 ** can be converted to a float without rounding. Used in comparisons.
@@ -288,6 +284,7 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
                       const TValue *slot) {
   int loop;  /* counter to avoid infinite loops */
   const TValue *tm;  /* metamethod */
+  vmstat(L, getmiss);
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     if (slot == NULL) {  /* 't' is not a table? */
       lua_assert(!ttistable(t));
@@ -330,6 +327,7 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
 void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
                      TValue *val, const TValue *slot) {
   int loop;  /* counter to avoid infinite loops */
+  vmstat(L, setmiss);
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     const TValue *tm;  /* '__newindex' metamethod */
     if (slot != NULL) {  /* is 't' a table? */
@@ -807,7 +805,7 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->func + 1;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = baseOp(GET_OPCODE(inst));
   switch (op) {  /* finish its execution */
     case OP_MMBIN: case OP_MMBINI: case OP_MMBINK: {
       setobjs2s(L, base + GETARG_A(*(ci->u.l.savedpc - 2)), --L->top);
@@ -1041,6 +1039,17 @@ void luaV_finishOp (lua_State *L) {
 #define KC(i)	(k+GETARG_C(i))
 #define RKC(i)	((TESTARG_k(i)) ? k + GETARG_C(i) : s2v(base + GETARG_C(i)))
 
+/* inline cache of the current instruction */
+#define ICACHE()	(&cl->p->icache[pc - cl->p->code - 1])
+
+/*
+** After a raw access to table 't' found nothing ('slot' is NULL if 't'
+** is not a table), try its '__index' chain through the inline cache.
+*/
+#define fastgetindex(L,t,key,slot) \
+  (slot != NULL && hvalue(t)->metatable != NULL &&  \
+   luaT_getindexcached(L, hvalue(t), key, ICACHE(), &slot))
+
 
 
 #define updatetrap(ci)  (trap = ci->u.l.trap)
@@ -1104,6 +1113,15 @@ void luaV_finishOp (lua_State *L) {
            luai_threadyield(L); }
 
 
+/* count instruction 'i' (instrumented interpreter only) */
+#if LUAI_VMSTATS
+#define vmcount(i)  \
+	(G(L)->vmstats.ops[GET_OPCODE(i)]++, cl->p->vmcount++)
+#else
+#define vmcount(i)	((void)0)
+#endif
+
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   if (trap) {  /* stack reallocation or hooks? */ \
@@ -1112,11 +1130,81 @@ void luaV_finishOp (lua_State *L) {
   } \
   i = *(pc++); \
   ra = RA(i); /* WARNING: any stack reallocation invalidates 'ra' */ \
+  vmcount(i); \
 }
 
 #define vmdispatch(o)	switch(o)
 #define vmcase(l)	case l:
 #define vmbreak		break
+#define vmjump(l)	goto fusedop;
+
+/*
+** Finish a superinstruction: fetch its second half, which is always
+** an 'l' instruction, and run it without a new dispatch. With hooks
+** (or after a stack reallocation) it goes through 'vmfetch' instead,
+** so that the second instruction gets its own hook events.
+*/
+#define vmfuse(l)	{ \
+  if (trap) { vmbreak; } \
+  i = *(pc++); \
+  ra = RA(i); \
+  vmcount(i); \
+  vmjump(l); \
+}
+
+
+/*
+** Opcodes that are also the first half of some superinstruction
+*/
+
+#define op_gettabup(L) {  \
+  const TValue *slot;  \
+  TValue *upval = cl->upvals[GETARG_B(i)]->v;  \
+  TValue *rc = KC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a string */  \
+  if (luaV_fastget(L, upval, key, slot, luaH_getshortstr) ||  \
+      fastgetindex(L, upval, key, slot)) {  \
+    setobj2s(L, ra, slot);  \
+  }  \
+  else  \
+    Protect(luaV_finishget(L, upval, rc, ra, slot)); }
+
+#define op_getfield(L) {  \
+  const TValue *slot;  \
+  TValue *rb = vRB(i);  \
+  TValue *rc = KC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a string */  \
+  if (luaV_fastget(L, rb, key, slot, luaH_getshortstr) ||  \
+      fastgetindex(L, rb, key, slot)) {  \
+    setobj2s(L, ra, slot);  \
+  }  \
+  else  \
+    Protect(luaV_finishget(L, rb, rc, ra, slot)); }
+
+#define op_setfield(L) {  \
+  const TValue *slot;  \
+  TValue *rb = KB(i);  \
+  TValue *rc = RKC(i);  \
+  TString *key = tsvalue(rb);  /* key must be a string */  \
+  if (luaV_fastget(L, s2v(ra), key, slot, luaH_getshortstr)) {  \
+    luaV_finishfastset(L, s2v(ra), slot, rc);  \
+  }  \
+  else  \
+    Protect(luaV_finishset(L, s2v(ra), rb, rc, slot)); }
+
+#define op_self(L) {  \
+  const TValue *slot;  \
+  TValue *rb = vRB(i);  \
+  TValue *rc = RKC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a string */  \
+  setobj2s(L, ra + 1, rb);  \
+  if (luaV_fastget(L, rb, key, slot, luaH_getstr) ||  \
+      (key->tt == LUA_VSHRSTR &&  \
+       fastgetindex(L, rb, key, slot))) {  \
+    setobj2s(L, ra, slot);  \
+  }  \
+  else  \
+    Protect(luaV_finishget(L, rb, rc, ra, slot)); }
 
 
 void luaV_execute (lua_State *L, CallInfo *ci) {
@@ -1149,6 +1237,9 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
     Instruction i;  /* instruction being executed */
     StkId ra;  /* instruction's A register */
     vmfetch();
+#if !LUA_USE_JUMPTABLE
+   fusedop:  /* second half of a superinstruction (see 'vmfuse') */
+#endif
     lua_assert(base == ci->func + 1);
     lua_assert(base <= L->top && L->top < L->stack_last);
     /* invalidate top for instructions not expecting it */
@@ -1211,15 +1302,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_GETTABUP) {
-        const TValue *slot;
-        TValue *upval = cl->upvals[GETARG_B(i)]->v;
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a string */
-        if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {
-          setobj2s(L, ra, slot);
-        }
-        else
-          Protect(luaV_finishget(L, upval, rc, ra, slot));
+        op_gettabup(L);
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
@@ -1251,15 +1334,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_GETFIELD) {
-        const TValue *slot;
-        TValue *rb = vRB(i);
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a string */
-        if (luaV_fastget(L, rb, key, slot, luaH_getshortstr)) {
-          setobj2s(L, ra, slot);
-        }
-        else
-          Protect(luaV_finishget(L, rb, rc, ra, slot));
+        op_getfield(L);
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
@@ -1304,15 +1379,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_SETFIELD) {
-        const TValue *slot;
-        TValue *rb = KB(i);
-        TValue *rc = RKC(i);
-        TString *key = tsvalue(rb);  /* key must be a string */
-        if (luaV_fastget(L, s2v(ra), key, slot, luaH_getshortstr)) {
-          luaV_finishfastset(L, s2v(ra), slot, rc);
-        }
-        else
-          Protect(luaV_finishset(L, s2v(ra), rb, rc, slot));
+        op_setfield(L);
         vmbreak;
       }
       vmcase(OP_NEWTABLE) {
@@ -1334,16 +1401,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_SELF) {
-        const TValue *slot;
-        TValue *rb = vRB(i);
-        TValue *rc = RKC(i);
-        TString *key = tsvalue(rc);  /* key must be a string */
-        setobj2s(L, ra + 1, rb);
-        if (luaV_fastget(L, rb, key, slot, luaH_getstr)) {
-          setobj2s(L, ra, slot);
-        }
-        else
-          Protect(luaV_finishget(L, rb, rc, ra, slot));
+        op_self(L);
         vmbreak;
       }
       vmcase(OP_ADDI) {
@@ -1822,6 +1880,38 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         lua_assert(0);
         vmbreak;
       }
+      vmcase(OP_MOVE_MOVE) {
+        setobjs2s(L, ra, RB(i));
+        vmfuse(OP_MOVE);
+      }
+      vmcase(OP_MOVE_CALL) {
+        setobjs2s(L, ra, RB(i));
+        vmfuse(OP_CALL);
+      }
+      vmcase(OP_GETUPVAL_MOVE) {
+        setobj2s(L, ra, cl->upvals[GETARG_B(i)]->v);
+        vmfuse(OP_MOVE);
+      }
+      vmcase(OP_GETUPVAL_GETFIELD) {
+        setobj2s(L, ra, cl->upvals[GETARG_B(i)]->v);
+        vmfuse(OP_GETFIELD);
+      }
+      vmcase(OP_GETTABUP_GETFIELD) {
+        op_gettabup(L);
+        vmfuse(OP_GETFIELD);
+      }
+      vmcase(OP_GETFIELD_GETFIELD) {
+        op_getfield(L);
+        vmfuse(OP_GETFIELD);
+      }
+      vmcase(OP_SETFIELD_SETFIELD) {
+        op_setfield(L);
+        vmfuse(OP_SETFIELD);
+      }
+      vmcase(OP_SELF_MOVE) {
+        op_self(L);
+        vmfuse(OP_MOVE);
+      }
     }
   }
 }
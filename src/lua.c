@@ -15,6 +15,7 @@
 #include <signal.h>
 
 #include "lua_all.h"
+#include "profiler/lprofiler.h"
 
 #include "lauxlib.h"
 #include "lualib.h"
@@ -30,11 +31,17 @@
 
 #define LUA_INITVARVERSION	LUA_INIT_VAR LUA_VERSUFFIX
 
+#if !defined(LUA_ALLOC_VAR)
+#define LUA_ALLOC_VAR		"LUA_ALLOC"
+#endif
+
 
 static lua_State *globalL = NULL;
 
 static const char *progname = LUA_PROGNAME;
 
+static const char *profile_out = NULL;  /* file for option '-p' */
+
 
 /*
 ** Hook set by signal function to stop the interpreter.
@@ -61,7 +68,7 @@ static void laction (int i) {
 
 static void print_usage (const char *badoption) {
   lua_writestringerror("%s: ", progname);
-  if (badoption[1] == 'e' || badoption[1] == 'l')
+  if (badoption[1] == 'e' || badoption[1] == 'l' || badoption[1] == 'p')
     lua_writestringerror("'%s' needs argument\n", badoption);
   else
     lua_writestringerror("unrecognized option '%s'\n", badoption);
@@ -71,8 +78,10 @@ static void print_usage (const char *badoption) {
   "  -e stat  execute string 'stat'\n"
   "  -i       enter interactive mode after executing 'script'\n"
   "  -l name  require library 'name' into global 'name'\n"
+  "  -p file  profile the run, write folded stacks to 'file'\n"
   "  -v       show version information\n"
   "  -E       ignore environment variables\n"
+  "  -P       use the pooled allocator for small blocks\n"
   "  -W       turn warnings on\n"
   "  --       stop handling options\n"
   "  -        stop handling options and execute stdin\n"
@@ -266,6 +275,7 @@ static int collectargs (char **argv, int *first) {
         args |= has_E;
         break;
       case 'W':
+      case 'P':  /* handled by 'usepool' */
         if (argv[i][2] != '\0')  /* extra characters? */
           return has_error;  /* invalid option */
         break;
@@ -285,6 +295,15 @@ static int collectargs (char **argv, int *first) {
             return has_error;  /* no next argument or it is another option */
         }
         break;
+      case 'p':  /* needs an argument, too */
+        if (argv[i][2] != '\0')
+          profile_out = argv[i] + 2;
+        else {
+          profile_out = argv[++i];
+          if (profile_out == NULL || profile_out[0] == '-')
+            return has_error;
+        }
+        break;
       default:  /* invalid option */
         return has_error;
     }
@@ -316,6 +335,9 @@ static int runargs (lua_State *L, char **argv, int n) {
         if (status != LUA_OK) return 0;
         break;
       }
+      case 'p':
+        if (argv[i][2] == '\0') i++;  /* skip file name */
+        break;
       case 'W':
         lua_warning(L, "@on", 0);  /* warnings on */
         break;
@@ -598,6 +620,8 @@ static int pmain (lua_State *L) {
   LUAPORTABLE4WINDOWS_OPENLIBS(L);
   createargtable(L, argv, argc, script);  /* create table 'arg' */
   lua_gc(L, LUA_GCGEN, 0, 0);  /* GC in generational mode */
+  if (profile_out != NULL)  /* option '-p'? */
+    lprofiler_start(L, LPROFILER_INTERVAL, 0, LPROFILER_DEPTH);
   if (!(args & has_E)) {  /* no option '-E'? */
     if (handle_luainit(L) != LUA_OK)  /* run LUA_INIT */
       return 0;  /* error running LUA_INIT */
@@ -621,9 +645,57 @@ static int pmain (lua_State *L) {
 }
 
 
+/*
+** Stop the profiler started by option '-p', write its folded stacks to
+** the file given and the functions with most samples to stderr
+*/
+static void writeprofile (lua_State *L) {
+  FILE *f;
+  lprofiler_stop(L);
+  f = fopen(profile_out, "w");
+  if (f == NULL) {
+    lua_writestringerror("%s: ", progname);
+    lua_writestringerror("cannot open %s\n", profile_out);
+    return;
+  }
+  lprofiler_write_folded(f);
+  fclose(f);
+  lprofiler_write_report(stderr, 20);
+}
+
+
+/*
+** Check whether the pooled allocator was asked for, by option '-P' or
+** by LUA_ALLOC=pool in the environment (unless '-E' is given). This
+** must be known before the state exists, so it scans the options
+** ahead of 'collectargs'.
+*/
+static int usepool (char **argv) {
+  int env = 1;
+  int i;
+  for (i = 1; argv[i] != NULL && argv[i][0] == '-'; i++) {
+    if (argv[i][1] == '-' || argv[i][1] == '\0')
+      break;  /* end of options */
+    else if (strcmp(argv[i], "-P") == 0)
+      return 1;
+    else if (strcmp(argv[i], "-E") == 0)
+      env = 0;
+    else if ((argv[i][1] == 'e' || argv[i][1] == 'l' || argv[i][1] == 'p') &&
+             argv[i][2] == '\0' && argv[i + 1] != NULL)
+      i++;  /* skip option argument */
+  }
+  if (env) {
+    const char *alloc = getenv(LUA_ALLOC_VAR);
+    return (alloc != NULL && strcmp(alloc, "pool") == 0);
+  }
+  return 0;
+}
+
+
 int main (int argc, char **argv) {
   int status, result;
-  lua_State *L = luaL_newstate();  /* create state */
+  lua_State *L = usepool(argv) ? luaL_newpoolstate()
+                               : luaL_newstate();  /* create state */
   if (L == NULL) {
     l_message(argv[0], "cannot create state: not enough memory");
     return EXIT_FAILURE;
@@ -634,6 +706,8 @@ int main (int argc, char **argv) {
   status = lua_pcall(L, 2, 1, 0);  /* do the call */
   result = lua_toboolean(L, -1);  /* get result */
   report(L, status);
+  if (profile_out != NULL)
+    writeprofile(L);
   lua_close(L);
   return (result && status == LUA_OK) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
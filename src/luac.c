@@ -18,15 +18,22 @@
 #include "lua.h"
 #include "lauxlib.h"
 
+#include "lcode.h"
 #include "ldebug.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lopnames.h"
 #include "lstate.h"
+#include "ltm.h"
 #include "lundump.h"
+#include "lvm.h"
 
 static void PrintFunction(const Proto* f, int full);
 #define luaU_print	PrintFunction
+static void OptimizeFunction(lua_State* L, Proto* f, const TValue** up);
 
 #define PROGNAME	"luac"		/* default program name */
 #define OUTPUT		PROGNAME ".out"	/* default output file */
@@ -34,6 +41,7 @@ static void PrintFunction(const Proto* f, int full);
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int optimizing=0;		/* optimize bytecodes? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -62,6 +70,7 @@ static void usage(const char* message)
   "Available options are:\n"
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
+  "  -O       optimize (fold constant locals, remove dead code)\n"
   "  -p       parse only\n"
   "  -s       strip debug information\n"
   "  -v       show version information\n"
@@ -99,6 +108,8 @@ static int doargs(int argc, char* argv[])
     usage("'-o' needs argument");
    if (IS("-")) output=NULL;
   }
+  else if (IS("-O"))			/* optimize */
+   optimizing=1;
   else if (IS("-p"))			/* parse only */
    dumping=0;
   else if (IS("-s"))			/* strip debug information */
@@ -178,6 +189,7 @@ static int pmain(lua_State* L)
  {
   const char* filename=IS("-") ? NULL : argv[i];
   if (luaL_loadfile(L,filename)!=LUA_OK) fatal(lua_tostring(L,-1));
+  if (optimizing) OptimizeFunction(L,toproto(L,-1),NULL);
  }
  f=combine(L,argc);
  if (listing) luaU_print(f,listing>1);
@@ -210,6 +222,924 @@ int main(int argc, char* argv[])
  return EXIT_SUCCESS;
 }
 
+/*
+** optimize bytecodes
+**
+** Each function is rewritten in rounds until nothing changes:
+** - a local that is loaded with a constant and never written again in
+**   its scope (nor through an upvalue) is replaced by that constant
+**   where it is read: moves become loads, arithmetic uses the K forms
+**   or is folded, and tests on it are decided;
+** - so is an upvalue that captures such a local, and a temporary that
+**   the previous instruction loads with a constant (the load goes away
+**   when nothing reads the temporary afterwards);
+** - jumps to jumps go to the final target, jumps to the next
+**   instruction are removed and jumps to a plain return become that
+**   return;
+** - unreachable instructions are removed, with jumps, line information
+**   and the ranges of local variables moved along.
+** Locals changed with debug.setlocal are not seen, and error messages
+** no longer name a variable that was replaced. Reads of globals are left
+** alone: nothing in one chunk proves that other code does not
+** change them (and the inline caches make them cheap already).
+*/
+
+#define MAXROUNDS	16		/* rounds of rewriting per function */
+#define MAXTHREAD	100		/* longest chain of jumps followed */
+#define MAXSCAN		500		/* instructions looked at for a read */
+
+/* as in lcode.c */
+#define MAXIWTHABS	120
+#define LIMLINEDIFF	0x80
+
+typedef struct OptState
+{
+ lua_State* L;
+ Proto* f;
+ lu_byte* dead;			/* instructions to be removed */
+ int* reg;			/* register of each local variable */
+ lu_byte* isconst;		/* local variable is a constant? */
+ TValue* value;			/* ...with this value */
+ int* kindex;			/* ...which is this constant, or -1 */
+ const TValue** up;		/* constant upvalues, or NULL */
+ lu_byte* target;		/* instruction is the target of a jump? */
+ TValue tvalue;			/* constant in a temporary... */
+ int temp;			/* ...and its register, or -1 */
+ int changed;			/* something changed in this round? */
+} OptState;
+
+static int JumpDest(Instruction i, int pc)
+{
+ switch (GET_OPCODE(i))
+ {
+  case OP_JMP:
+	return pc+1+GETARG_sJ(i);
+  case OP_FORPREP:
+	return pc+2+GETARG_Bx(i);
+  case OP_TFORPREP:
+	return pc+1+GETARG_Bx(i);
+  case OP_FORLOOP: case OP_TFORLOOP:
+	return pc+1-GETARG_Bx(i);
+  default:
+	return -1;
+ }
+}
+
+static void SetJumpDest(Instruction* i, int pc, int dest)
+{
+ switch (GET_OPCODE(*i))
+ {
+  case OP_JMP:
+	SETARG_sJ(*i,dest-(pc+1));
+	break;
+  case OP_FORPREP:
+	SETARG_Bx(*i,dest-(pc+2));
+	break;
+  case OP_TFORPREP:
+	SETARG_Bx(*i,dest-(pc+1));
+	break;
+  case OP_FORLOOP: case OP_TFORLOOP:
+	SETARG_Bx(*i,(pc+1)-dest);
+	break;
+  default:
+	break;
+ }
+}
+
+/* may 'i' change register 'r'? (calls and the like: any register >= A) */
+static int Writes(Instruction i, int r)
+{
+ OpCode o=GET_OPCODE(i);
+ int a=GETARG_A(i);
+ switch (o)
+ {
+  case OP_LOADNIL:
+	return a<=r && r<=a+GETARG_B(i);
+  case OP_SELF:
+	return r==a || r==a+1;
+  case OP_FORPREP: case OP_FORLOOP: case OP_TFORPREP:
+	return a<=r && r<=a+3;
+  case OP_CALL: case OP_TAILCALL: case OP_VARARG: case OP_CONCAT:
+  case OP_TFORCALL: case OP_TFORLOOP:
+	return r>=a;
+  default:
+	return testAMode(o) && r==a;
+ }
+}
+
+/* does 'i' leave the straight line (jump, skip or return)? */
+static int IsControl(Instruction i)
+{
+ switch (GET_OPCODE(i))
+ {
+  case OP_JMP: case OP_FORPREP: case OP_FORLOOP: case OP_TFORPREP:
+  case OP_TFORLOOP: case OP_LFALSESKIP: case OP_RETURN: case OP_RETURN0:
+  case OP_RETURN1: case OP_TAILCALL:
+	return 1;
+  default:
+	return testTMode(GET_OPCODE(i));
+ }
+}
+
+static int UpvalueWritten(const Proto* f, int uv);
+
+/* does 'f' capture 'idx' (a register or an upvalue) and change it? */
+static int CapturedAndWritten(const Proto* f, int instack, int idx)
+{
+ int j;
+ for (j=0; j<f->sizeupvalues; j++)
+  if (f->upvalues[j].instack==instack && f->upvalues[j].idx==idx &&
+      UpvalueWritten(f,j)) return 1;
+ return 0;
+}
+
+static int UpvalueWritten(const Proto* f, int uv)
+{
+ int pc;
+ for (pc=0; pc<f->sizecode; pc++)
+ {
+  Instruction i=f->code[pc];
+  OpCode o=baseOp(GET_OPCODE(i));
+  if (o==OP_SETUPVAL && GETARG_B(i)==uv) return 1;
+  if (o==OP_CLOSURE && CapturedAndWritten(f->p[GETARG_Bx(i)],0,uv)) return 1;
+ }
+ return 0;
+}
+
+/* value that 'i' loads, if it is a constant */
+static int ConstLoad(lua_State* L, const Proto* f, Instruction i, TValue* v,
+		     int* k)
+{
+ *k=-1;
+ switch (GET_OPCODE(i))
+ {
+  case OP_LOADI:
+	setivalue(v,GETARG_sBx(i));
+	return 1;
+  case OP_LOADF:
+	setfltvalue(v,cast_num(GETARG_sBx(i)));
+	return 1;
+  case OP_LOADK:
+	*k=GETARG_Bx(i);
+	setobj(L,v,&f->k[*k]);
+	return 1;
+  case OP_LOADFALSE:
+	setbfvalue(v);
+	return 1;
+  case OP_LOADTRUE:
+	setbtvalue(v);
+	return 1;
+  case OP_LOADNIL:
+	setnilvalue(v);
+	return 1;
+  default:
+	return 0;
+ }
+}
+
+/* is there a jump into (d,s), or to s from outside [s,e)? */
+static int JumpsInto(const Proto* f, int d, int s, int e)
+{
+ int pc;
+ for (pc=0; pc<f->sizecode; pc++)
+ {
+  int t=JumpDest(f->code[pc],pc);
+  if ((t>d && t<s) || (t==s && (pc<s || pc>=e))) return 1;
+ }
+ return 0;
+}
+
+/*
+** A local variable is a constant when the last instruction that sets
+** its register before its scope begins loads a constant, is always run
+** on the way into the scope, and nothing in the scope changes it.
+*/
+static void FindConstants(OptState* S)
+{
+ Proto* f=S->f;
+ int v;
+ for (v=0; v<f->sizelocvars; v++)
+ {
+  int s=f->locvars[v].startpc;
+  int e=f->locvars[v].endpc;
+  int r=0,d,pc,u;
+  S->isconst[v]=0;
+  for (u=0; u<v; u++)
+   if (f->locvars[u].startpc<=s && s<f->locvars[u].endpc) r++;
+  S->reg[v]=r;
+  if (s>=e) continue;
+  for (d=s-1; d>=0; d--)
+  {
+   if (Writes(f->code[d],r)) break;
+   if (IsControl(f->code[d])) { d=-1; break; }
+  }
+  if (d<0) continue;
+  if (d>0 && (testTMode(GET_OPCODE(f->code[d-1])) ||
+	      GET_OPCODE(f->code[d-1])==OP_LFALSESKIP)) continue;
+  if (!ConstLoad(S->L,f,f->code[d],&S->value[v],&S->kindex[v])) continue;
+  if (JumpsInto(f,d,s,e)) continue;
+  for (pc=d+1; pc<e; pc++)
+  {
+   Instruction i=f->code[pc];
+   if (pc>=s && Writes(i,r)) break;
+   if (GET_OPCODE(i)==OP_TBC && GETARG_A(i)==r) break;
+   if (GET_OPCODE(i)==OP_CLOSURE &&
+       CapturedAndWritten(f->p[GETARG_Bx(i)],1,r)) break;
+  }
+  S->isconst[v]=(pc==e);
+ }
+}
+
+/* number of local variables (and registers they use) active at 'pc' */
+static int ActiveLocals(const Proto* f, int pc)
+{
+ int v,n=0;
+ for (v=0; v<f->sizelocvars; v++)
+  if (f->locvars[v].startpc<=pc && pc<f->locvars[v].endpc) n++;
+ return n;
+}
+
+/* the constant in register 'r' at 'pc', or NULL */
+static const TValue* GetConst(OptState* S, int pc, int r, int* k)
+{
+ Proto* f=S->f;
+ Instruction i;
+ int v;
+ for (v=0; v<f->sizelocvars; v++)
+  if (S->isconst[v] && S->reg[v]==r &&
+      f->locvars[v].startpc<=pc && pc<f->locvars[v].endpc)
+  {
+   *k=S->kindex[v];
+   return &S->value[v];
+  }
+ /* a temporary loaded just before, with no other way into 'pc'? */
+ if (r<ActiveLocals(f,pc) || pc==0 || S->dead[pc-1] || S->target[pc])
+  return NULL;
+ if (pc>1 && (testTMode(GET_OPCODE(f->code[pc-2])) ||
+	      GET_OPCODE(f->code[pc-2])==OP_LFALSESKIP)) return NULL;
+ i=f->code[pc-1];
+ if (GETARG_A(i)!=r || (GET_OPCODE(i)==OP_LOADNIL && GETARG_B(i)!=0) ||
+     !ConstLoad(S->L,f,i,&S->tvalue,k)) return NULL;
+ S->temp=r;
+ return &S->tvalue;
+}
+
+/* does 'i' read register 'r' (or might it)? */
+static int Reads(Instruction i, int r)
+{
+ OpCode o=GET_OPCODE(i);
+ int a=GETARG_A(i);
+ switch (o)
+ {
+  case OP_LOADI: case OP_LOADF: case OP_LOADK: case OP_LOADKX:
+  case OP_LOADFALSE: case OP_LFALSESKIP: case OP_LOADTRUE: case OP_LOADNIL:
+  case OP_GETUPVAL: case OP_GETTABUP: case OP_NEWTABLE: case OP_EXTRAARG:
+  case OP_JMP:
+	return 0;
+  case OP_SETUPVAL: case OP_MMBINI: case OP_MMBINK:
+	return a==r;
+  case OP_MOVE: case OP_GETI: case OP_GETFIELD: case OP_ADDI: case OP_ADDK:
+  case OP_SUBK: case OP_MULK: case OP_MODK: case OP_POWK: case OP_DIVK:
+  case OP_IDIVK: case OP_BANDK: case OP_BORK: case OP_BXORK: case OP_SHRI:
+  case OP_SHLI: case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+	return GETARG_B(i)==r;
+  case OP_GETTABLE: case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+  case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR:
+  case OP_BXOR: case OP_SHL: case OP_SHR:
+	return GETARG_B(i)==r || GETARG_C(i)==r;
+  case OP_MMBIN:
+	return a==r || GETARG_B(i)==r;
+  case OP_SETTABUP:
+	return !GETARG_k(i) && GETARG_C(i)==r;
+  case OP_SETI: case OP_SETFIELD:
+	return a==r || (!GETARG_k(i) && GETARG_C(i)==r);
+  case OP_SETTABLE:
+	return a==r || GETARG_B(i)==r || (!GETARG_k(i) && GETARG_C(i)==r);
+  case OP_SELF:
+	return GETARG_B(i)==r || (!GETARG_k(i) && GETARG_C(i)==r);
+  case OP_RETURN0:
+	return 0;
+  case OP_RETURN1:
+	return a==r;
+  case OP_CALL: case OP_TAILCALL: case OP_RETURN: case OP_SETLIST:
+  case OP_CONCAT: case OP_TFORCALL: case OP_VARARG: case OP_CLOSE:
+  case OP_TBC:
+	return r>=a;
+  default:
+	return a==r || (getOpMode(o)==iABC &&
+	       (GETARG_B(i)==r || GETARG_C(i)==r));
+ }
+}
+
+/* is register 'r' written before it is read again, from 'pc' on? */
+static int TempDead(OptState* S, int pc, int r, int* steps)
+{
+ Proto* f=S->f;
+ while (pc<f->sizecode && (*steps)++<MAXSCAN)
+ {
+  Instruction i=f->code[pc];
+  OpCode o=GET_OPCODE(i);
+  if (S->dead[pc])
+  {
+   pc++;
+   continue;
+  }
+  switch (o)
+  {
+   case OP_JMP:
+	pc=JumpDest(i,pc);
+	continue;
+   case OP_RETURN: case OP_RETURN0: case OP_RETURN1:
+	return !Reads(i,r);
+   case OP_FORLOOP: case OP_TFORLOOP:
+	if (GETARG_A(i)<=r && r<=GETARG_A(i)+3) return 0;
+	return TempDead(S,pc+1,r,steps) && TempDead(S,JumpDest(i,pc),r,steps);
+   default:
+	if (testTMode(o))
+	 return !Reads(i,r) && TempDead(S,pc+1,r,steps) &&
+		TempDead(S,pc+2,r,steps);
+	if (IsControl(i) || o==OP_CLOSURE || Reads(i,r)) return 0;
+	if (GETARG_A(i)==r && testAMode(o)) return 1;
+	pc++;
+  }
+ }
+ return 0;
+}
+
+/*
+** can 'i' read register 'r' holding constant 'v' without an error? The
+** messages of errors name where a register came from ('getobjname' in
+** ldebug.c), and a constant load would show there instead of a variable.
+*/
+static int QuietRead(Instruction i, int r, const TValue* v)
+{
+ lua_Integer n;
+ switch (GET_OPCODE(i))
+ {
+  case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+  case OP_DIV: case OP_IDIV: case OP_ADDK: case OP_SUBK: case OP_MULK:
+  case OP_MODK: case OP_POWK: case OP_DIVK: case OP_IDIVK: case OP_ADDI:
+  case OP_UNM:
+	return ttisnumber(v);
+  case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
+  case OP_BANDK: case OP_BORK: case OP_BXORK: case OP_SHRI: case OP_SHLI:
+  case OP_BNOT:
+	return ttisnumber(v) && tointegerns(v,&n);
+  case OP_CONCAT:
+	return ttisnumber(v) || ttisstring(v);
+  case OP_LEN:
+	return ttisstring(v);
+  case OP_GETTABLE: case OP_GETI: case OP_GETFIELD: case OP_SELF:
+	return GETARG_B(i)!=r || ttisstring(v);
+  case OP_SETTABLE: case OP_SETI: case OP_SETFIELD: case OP_CALL:
+  case OP_TAILCALL:
+	return GETARG_A(i)!=r;
+  case OP_MMBIN: case OP_MMBINI: case OP_MMBINK:	/* after their operation */
+  case OP_EQ: case OP_EQK: case OP_EQI: case OP_LT: case OP_LE: case OP_LTI:
+  case OP_LEI: case OP_GTI: case OP_GEI:	/* messages name no variables */
+  case OP_TEST: case OP_TESTSET: case OP_NOT: case OP_SETTABUP:
+  case OP_SETUPVAL: case OP_SETLIST: case OP_RETURN: case OP_RETURN1:
+	return 1;
+  default:
+	return 0;
+ }
+}
+
+/* are the reads of register 'r' (holding 'v') from 'pc' on quiet? */
+static int QuietReads(OptState* S, int pc, int r, const TValue* v, int* steps)
+{
+ Proto* f=S->f;
+ while (pc<f->sizecode && (*steps)++<MAXSCAN)
+ {
+  Instruction i=f->code[pc];
+  OpCode o=GET_OPCODE(i);
+  if (S->dead[pc])
+  {
+   pc++;
+   continue;
+  }
+  if (Reads(i,r) && !QuietRead(i,r,v)) return 0;
+  switch (o)
+  {
+   case OP_JMP:
+	pc=JumpDest(i,pc);
+	continue;
+   case OP_RETURN: case OP_RETURN0: case OP_RETURN1: case OP_TAILCALL:
+	return 1;
+   default:
+	if (testTMode(o))
+	 return QuietReads(S,pc+1,r,v,steps) && QuietReads(S,pc+2,r,v,steps);
+	if (IsControl(i) || o==OP_CLOSURE) return 0;
+	if (Writes(i,r)) return 1;
+	pc++;
+  }
+ }
+ return 0;
+}
+
+/*
+** may the load into register 'a' at 'pc' become a constant load? Only
+** if the register is a local (errors give its name) or its reads cannot
+** fail, so that no error message loses the name of a variable.
+*/
+static int KeepsNames(OptState* S, int pc, int a, const TValue* v)
+{
+ int steps=0;
+ return a<ActiveLocals(S->f,pc+1) || QuietReads(S,pc+1,a,v,&steps);
+}
+
+/* index of constant 'v' in 'f->k', added if needed; -1 if not possible */
+static int AddK(OptState* S, const TValue* v, int k)
+{
+ Proto* f=S->f;
+ int i;
+ if (k>=0) return k;
+ for (i=0; i<f->sizek; i++)
+  if (ttypetag(&f->k[i])==ttypetag(v) && luaV_rawequalobj(&f->k[i],v))
+   return i;
+ f->k=luaM_reallocvector(S->L,f->k,f->sizek,f->sizek+1,TValue);
+ setobj(S->L,&f->k[f->sizek],v);
+ luaC_barrier(S->L,f,v);		/* a string from an enclosing function */
+ return f->sizek++;
+}
+
+/* replace instruction 'pc' with a load of 'v' into register 'a' */
+static int LoadConst(OptState* S, int pc, int a, const TValue* v, int k)
+{
+ Instruction i;
+ lua_Integer n;
+ if (ttisnil(v))
+  i=CREATE_ABCk(OP_LOADNIL,a,0,0,0);
+ else if (ttisfalse(v))
+  i=CREATE_ABCk(OP_LOADFALSE,a,0,0,0);
+ else if (ttistrue(v))
+  i=CREATE_ABCk(OP_LOADTRUE,a,0,0,0);
+ else if (ttisinteger(v) && -OFFSET_sBx<=ivalue(v) &&
+	  ivalue(v)<=MAXARG_Bx-OFFSET_sBx)
+  i=CREATE_ABx(OP_LOADI,a,cast_uint(ivalue(v)+OFFSET_sBx));
+ else if (ttisfloat(v) && k<0 && luaV_flttointeger(fltvalue(v),&n,F2Ieq) &&
+	  -OFFSET_sBx<=n && n<=MAXARG_Bx-OFFSET_sBx)
+  i=CREATE_ABx(OP_LOADF,a,cast_uint(n+OFFSET_sBx));
+ else
+ {
+  k=AddK(S,v,k);
+  if (k<0 || k>MAXARG_Bx) return 0;
+  i=CREATE_ABx(OP_LOADK,a,k);
+ }
+ if (S->f->code[pc]!=i)
+ {
+  S->f->code[pc]=i;
+  S->changed=1;
+ }
+ return 1;
+}
+
+/* fold 'v1 op v2' into 'res', like 'constfolding' in lcode.c */
+static int Arith(OptState* S, int op, const TValue* v1, const TValue* v2,
+		 TValue* res)
+{
+ lua_Integer i;
+ lua_Number n;
+ if (!ttisnumber(v1) || !ttisnumber(v2)) return 0;
+ switch (op)
+ {
+  case LUA_OPBAND: case LUA_OPBOR: case LUA_OPBXOR:
+  case LUA_OPSHL: case LUA_OPSHR: case LUA_OPBNOT:
+	if (!tointegerns(v1,&i) || !tointegerns(v2,&i)) return 0;
+	break;
+  case LUA_OPDIV: case LUA_OPIDIV: case LUA_OPMOD:
+	if (nvalue(v2)==0) return 0;
+	break;
+  default:
+	break;
+ }
+ luaO_rawarith(S->L,op,v1,v2,res);
+ if (ttisinteger(res)) return 1;
+ n=fltvalue(res);
+ return !(luai_numisnan(n) || n==0);	/* no NaN nor -0.0 */
+}
+
+/* a test at 'pc' (followed by its jump) is decided */
+static void Decide(OptState* S, int pc, int jumps)
+{
+ if (jumps)
+  S->dead[pc]=1;			/* the jump is always taken */
+ else
+  S->f->code[pc]=CREATE_sJ(OP_JMP,1+OFFSET_sJ,0);	/* jump over the jump */
+ S->changed=1;
+}
+
+static int Compare(const TValue* a, const TValue* b, int le)
+{
+ if (ttisinteger(a))
+  return le ? ivalue(a)<=ivalue(b) : ivalue(a)<ivalue(b);
+ else
+  return le ? luai_numle(fltvalue(a),fltvalue(b))
+	    : luai_numlt(fltvalue(a),fltvalue(b));
+}
+
+static void FoldCode(OptState* S)
+{
+ Proto* f=S->f;
+ Instruction* code=f->code;
+ int pc;
+ for (pc=0; pc<f->sizecode; pc++)
+ {
+  Instruction i=code[pc];
+  OpCode o=GET_OPCODE(i);
+  int a=GETARG_A(i);
+  int b=getarg(i,POS_B,SIZE_B);		/* not all of mode iABC */
+  int c=getarg(i,POS_C,SIZE_C);
+  int kb,kc;
+  const TValue* vb;
+  const TValue* vc;
+  TValue res,imm;
+  if (S->dead[pc]) continue;
+  S->temp=-1;
+  switch (o)
+  {
+   case OP_MOVE:
+	if ((vb=GetConst(S,pc,b,&kb))!=NULL && KeepsNames(S,pc,a,vb))
+	 LoadConst(S,pc,a,vb,kb);
+	break;
+   case OP_GETUPVAL:
+	if (S->up!=NULL && S->up[b]!=NULL && KeepsNames(S,pc,a,S->up[b]))
+	 LoadConst(S,pc,a,S->up[b],-1);
+	break;
+   case OP_LOADI: case OP_LOADF: case OP_LOADK: case OP_LOADFALSE:
+   case OP_LOADTRUE: case OP_LOADNIL:
+   {
+	int steps=0;
+	if ((o!=OP_LOADNIL || b==0) && a>=ActiveLocals(f,pc) &&
+	    a>=ActiveLocals(f,pc+1) && TempDead(S,pc+1,a,&steps))
+	{
+	 S->dead[pc]=1;			/* a temporary nobody reads */
+	 S->changed=1;
+	}
+	break;
+   }
+   case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+   case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+   case OP_SHL: case OP_SHR:
+   {
+	int op=o-OP_ADD;
+	Instruction mm=code[pc+1];
+	if (GET_OPCODE(mm)!=OP_MMBIN || GETARG_A(mm)!=b || GETARG_B(mm)!=c)
+	 break;
+	vb=GetConst(S,pc,b,&kb);
+	vc=GetConst(S,pc,c,&kc);
+	if (vb!=NULL && vc!=NULL)
+	{
+	 if (Arith(S,op,vb,vc,&res) && LoadConst(S,pc,a,&res,-1))
+	  S->dead[pc+1]=1;
+	}
+	else if (op<=LUA_OPBXOR)		/* has a K form? */
+	{
+	 int flip=0,k;
+	 const TValue* v=vc;
+	 if (v==NULL && (op==LUA_OPADD || op==LUA_OPMUL || op>=LUA_OPBAND))
+	 {
+	  v=vb; kc=kb; b=c; flip=1;	/* commutative: constant goes right */
+	 }
+	 if (v==NULL || !ttisnumber(v) || (op>=LUA_OPBAND && !ttisinteger(v)))
+	  break;
+	 k=AddK(S,v,kc);
+	 if (k<0 || k>MAXARG_C) break;
+	 code[pc]=CREATE_ABCk(OP_ADDK+op,a,b,k,0);
+	 code[pc+1]=CREATE_ABCk(OP_MMBINK,b,k,TM_ADD+op,flip);
+	 S->changed=1;
+	}
+	break;
+   }
+   case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK: case OP_POWK:
+   case OP_DIVK: case OP_IDIVK: case OP_BANDK: case OP_BORK: case OP_BXORK:
+	if ((vb=GetConst(S,pc,b,&kb))!=NULL &&
+	    Arith(S,o-OP_ADDK,vb,&f->k[c],&res) && LoadConst(S,pc,a,&res,-1))
+	 S->dead[pc+1]=1;		/* its OP_MMBINK */
+	break;
+   case OP_ADDI: case OP_SHRI: case OP_SHLI:
+	if ((vb=GetConst(S,pc,b,&kb))==NULL) break;
+	setivalue(&imm,GETARG_sC(i));
+	if ((o==OP_ADDI && Arith(S,LUA_OPADD,vb,&imm,&res)) ||
+	    (o==OP_SHRI && Arith(S,LUA_OPSHR,vb,&imm,&res)) ||
+	    (o==OP_SHLI && Arith(S,LUA_OPSHL,&imm,vb,&res)))
+	 if (LoadConst(S,pc,a,&res,-1)) S->dead[pc+1]=1;	/* OP_MMBINI */
+	break;
+   case OP_UNM: case OP_BNOT:
+	if ((vb=GetConst(S,pc,b,&kb))==NULL) break;
+	setivalue(&imm,0);
+	if (Arith(S,o==OP_UNM ? LUA_OPUNM : LUA_OPBNOT,vb,&imm,&res))
+	 LoadConst(S,pc,a,&res,-1);
+	break;
+   case OP_NOT:
+	if ((vb=GetConst(S,pc,b,&kb))==NULL) break;
+	if (l_isfalse(vb))
+	 { setbtvalue(&res); }
+	else
+	 { setbfvalue(&res); }
+	LoadConst(S,pc,a,&res,-1);
+	break;
+   case OP_LEN:
+	if ((vb=GetConst(S,pc,b,&kb))==NULL || !ttisstring(vb)) break;
+	setivalue(&res,cast(lua_Integer,tsslen(tsvalue(vb))));
+	LoadConst(S,pc,a,&res,-1);
+	break;
+   case OP_TEST:
+	if ((vb=GetConst(S,pc,a,&kb))!=NULL)
+	 Decide(S,pc,(!l_isfalse(vb))==GETARG_k(i));
+	break;
+   case OP_TESTSET:
+	if ((vb=GetConst(S,pc,b,&kb))==NULL) break;
+	if ((!l_isfalse(vb))==GETARG_k(i))	/* jumps, with R[A] := R[B] */
+	 LoadConst(S,pc,a,vb,kb);
+	else
+	 Decide(S,pc,0);
+	break;
+   case OP_EQ:
+	if ((vb=GetConst(S,pc,a,&kb))!=NULL && (vc=GetConst(S,pc,b,&kc))!=NULL)
+	 Decide(S,pc,luaV_rawequalobj(vb,vc)==GETARG_k(i));
+	break;
+   case OP_LT: case OP_LE:
+	if ((vb=GetConst(S,pc,a,&kb))!=NULL && (vc=GetConst(S,pc,b,&kc))!=NULL &&
+	    ttisnumber(vb) && ttypetag(vb)==ttypetag(vc))
+	 Decide(S,pc,Compare(vb,vc,o==OP_LE)==GETARG_k(i));
+	break;
+   case OP_EQK:
+	if ((vb=GetConst(S,pc,a,&kb))!=NULL)
+	 Decide(S,pc,luaV_rawequalobj(vb,&f->k[b])==GETARG_k(i));
+	break;
+   case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+	if ((vb=GetConst(S,pc,a,&kb))==NULL || (!ttisnumber(vb) && o!=OP_EQI))
+	 break;
+	if (ttisinteger(vb))
+	 { setivalue(&imm,GETARG_sB(i)); }
+	else
+	 { setfltvalue(&imm,cast_num(GETARG_sB(i))); }
+	if (o==OP_EQI)
+	 Decide(S,pc,luaV_rawequalobj(vb,&imm)==GETARG_k(i));
+	else if (o==OP_LTI || o==OP_LEI)
+	 Decide(S,pc,Compare(vb,&imm,o==OP_LEI)==GETARG_k(i));
+	else
+	 Decide(S,pc,Compare(&imm,vb,o==OP_GEI)==GETARG_k(i));
+	break;
+   case OP_SETTABUP: case OP_SETTABLE: case OP_SETI: case OP_SETFIELD:
+	if (!GETARG_k(i) && (vc=GetConst(S,pc,c,&kc))!=NULL)
+	{
+	 int k=AddK(S,vc,kc);
+	 if (k<0 || k>MAXARG_C) break;
+	 SETARG_C(code[pc],k);
+	 SETARG_k(code[pc],1);
+	 S->changed=1;
+	}
+	break;
+   default:
+	break;
+  }
+  if (S->temp>=0 && (code[pc]!=i || S->dead[pc]))	/* 'temp' used up? */
+  {
+   int steps=0;
+   if (TempDead(S,pc,S->temp,&steps)) S->dead[pc-1]=1;
+  }
+ }
+}
+
+static void ThreadJumps(OptState* S)
+{
+ Proto* f=S->f;
+ Instruction* code=f->code;
+ int pc;
+ for (pc=0; pc<f->sizecode; pc++)
+ {
+  int dest,t,n;
+  if (GET_OPCODE(code[pc])!=OP_JMP) continue;
+  dest=t=JumpDest(code[pc],pc);
+  for (n=0; n<MAXTHREAD && t!=pc && GET_OPCODE(code[t])==OP_JMP; n++)
+   t=JumpDest(code[t],t);
+  if (t!=dest)
+  {
+   SetJumpDest(&code[pc],pc,t);
+   S->changed=1;
+  }
+  if (pc>0 && testTMode(GET_OPCODE(code[pc-1]))) continue;  /* conditional */
+  if (t==pc+1)
+  {
+   S->dead[pc]=1;
+   S->changed=1;
+  }
+  else if (GET_OPCODE(code[t])==OP_RETURN0 || GET_OPCODE(code[t])==OP_RETURN1)
+  {
+   code[pc]=code[t];
+   S->changed=1;
+  }
+ }
+}
+
+/* mark the instructions that cannot be reached (removed ones fall through) */
+static void FindUnreachable(OptState* S)
+{
+ Proto* f=S->f;
+ int n=f->sizecode;
+ int* stack=luaM_newvector(S->L,2*n+2,int);
+ lu_byte* seen=luaM_newvector(S->L,n,lu_byte);
+ int top=0,pc;
+ for (pc=0; pc<n; pc++) seen[pc]=0;
+ stack[top++]=0;
+ while (top>0)
+ {
+  Instruction i;
+  pc=stack[--top];
+  if (pc>=n || seen[pc]) continue;
+  seen[pc]=1;
+  i=f->code[pc];
+  if (S->dead[pc])
+  {
+   stack[top++]=pc+1;
+   continue;
+  }
+  switch (GET_OPCODE(i))
+  {
+   case OP_JMP: case OP_TFORPREP:
+	stack[top++]=JumpDest(i,pc);
+	break;
+   case OP_RETURN: case OP_RETURN0: case OP_RETURN1:
+	break;
+   case OP_LFALSESKIP:
+	stack[top++]=pc+2;
+	break;
+   case OP_FORPREP: case OP_FORLOOP: case OP_TFORLOOP:
+	stack[top++]=pc+1;
+	stack[top++]=JumpDest(i,pc);
+	break;
+   default:
+	stack[top++]=pc+1;
+	if (testTMode(GET_OPCODE(i))) stack[top++]=pc+2;
+	break;
+  }
+ }
+ for (pc=0; pc<n; pc++)
+  if (!seen[pc] && !S->dead[pc])
+  {
+   S->dead[pc]=1;
+   S->changed=1;
+  }
+ luaM_freearray(S->L,seen,n);
+ luaM_freearray(S->L,stack,2*n+2);
+}
+
+/* remove the dead instructions, moving jumps, lines and locals along */
+static void Compact(OptState* S)
+{
+ lua_State* L=S->L;
+ Proto* f=S->f;
+ int n=f->sizecode;
+ int m=0,pc,j,v;
+ int* newpc;
+ int* line=NULL;
+ Instruction* code;
+ for (pc=0; pc<n; pc++) if (!S->dead[pc]) m++;
+ if (m==n) return;
+ newpc=luaM_newvector(L,n+1,int);
+ for (pc=n; pc>=0; pc--)
+  newpc[pc]=(pc==n) ? m : (S->dead[pc] ? newpc[pc+1] : newpc[pc+1]-1);
+ if (f->sizelineinfo>0)
+ {
+  line=luaM_newvector(L,m,int);
+  for (pc=0; pc<n; pc++)
+   if (!S->dead[pc]) line[newpc[pc]]=luaG_getfuncline(f,pc);
+ }
+ code=luaM_newvector(L,m,Instruction);
+ for (pc=0; pc<n; pc++)
+ {
+  Instruction i=f->code[pc];
+  int t=JumpDest(i,pc);
+  if (S->dead[pc]) continue;
+  if (GET_OPCODE(i)==OP_LFALSESKIP && S->dead[pc+1])
+   SET_OPCODE(i,OP_LOADFALSE);		/* nothing left to skip */
+  if (t>=0) SetJumpDest(&i,newpc[pc],newpc[t]);
+  code[newpc[pc]]=i;
+ }
+ luaM_freearray(L,f->code,n);
+ f->code=code;
+ f->sizecode=m;
+ for (v=0; v<f->sizelocvars; v++)
+ {
+  f->locvars[v].startpc=newpc[f->locvars[v].startpc];
+  f->locvars[v].endpc=newpc[f->locvars[v].endpc];
+ }
+ if (line!=NULL)			/* encode lines as 'savelineinfo' does */
+ {
+  int nabs=0,previous=f->linedefined,iwthabs=0;
+  ls_byte* lineinfo=luaM_newvector(L,m,ls_byte);
+  AbsLineInfo* abslineinfo=luaM_newvector(L,m,AbsLineInfo);
+  for (j=0; j<m; j++)
+  {
+   int linedif=line[j]-previous;
+   if (abs(linedif)>=LIMLINEDIFF || iwthabs++>MAXIWTHABS)
+   {
+    abslineinfo[nabs].pc=j;
+    abslineinfo[nabs++].line=line[j];
+    linedif=ABSLINEINFO;
+    iwthabs=0;
+   }
+   lineinfo[j]=cast(ls_byte,linedif);
+   previous=line[j];
+  }
+  luaM_freearray(L,f->lineinfo,f->sizelineinfo);
+  luaM_freearray(L,f->abslineinfo,f->sizeabslineinfo);
+  f->lineinfo=lineinfo;
+  f->sizelineinfo=m;
+  f->abslineinfo=luaM_reallocvector(L,abslineinfo,m,nabs,AbsLineInfo);
+  f->sizeabslineinfo=nabs;
+  luaM_freearray(L,line,m);
+ }
+ luaM_freearray(L,newpc,n+1);
+}
+
+/* constant values of the upvalues of the closure made at 'pc' */
+static const TValue** ClosureConstants(OptState* S, int pc)
+{
+ Proto* f=S->f;
+ Proto* p=f->p[GETARG_Bx(f->code[pc])];
+ const TValue** up=luaM_newvector(S->L,p->sizeupvalues,const TValue*);
+ int j,v;
+ for (j=0; j<p->sizeupvalues; j++)
+ {
+  up[j]=NULL;
+  if (!p->upvalues[j].instack)
+   up[j]=(S->up!=NULL) ? S->up[p->upvalues[j].idx] : NULL;
+  else
+   for (v=0; v<f->sizelocvars; v++)
+    if (S->isconst[v] && S->reg[v]==p->upvalues[j].idx &&
+	f->locvars[v].startpc<=pc && pc<f->locvars[v].endpc)
+     up[j]=&S->value[v];
+ }
+ return up;
+}
+
+static void OptimizeFunction(lua_State* L, Proto* f, const TValue** up)
+{
+ OptState S;
+ int pc,round;
+ int nv=f->sizelocvars;
+ S.L=L;
+ S.f=f;
+ S.up=up;
+ S.reg=luaM_newvector(L,nv,int);
+ S.isconst=luaM_newvector(L,nv,lu_byte);
+ S.value=luaM_newvector(L,nv,TValue);
+ S.kindex=luaM_newvector(L,nv,int);
+ for (pc=0; pc<f->sizecode; pc++)	/* superinstructions are redone below */
+  SET_OPCODE(f->code[pc],baseOp(GET_OPCODE(f->code[pc])));
+ for (round=0; round<MAXROUNDS; round++)
+ {
+  int n=f->sizecode;
+  S.changed=0;
+  S.dead=luaM_newvector(L,n,lu_byte);
+  S.target=luaM_newvector(L,n+1,lu_byte);
+  memset(S.dead,0,n);
+  memset(S.target,0,n+1);
+  for (pc=0; pc<n; pc++)
+  {
+   int t=JumpDest(f->code[pc],pc);
+   if (t>=0) S.target[t]=1;
+  }
+  FindConstants(&S);
+  FoldCode(&S);
+  Compact(&S);
+  luaM_freearray(L,S.target,n+1);
+  luaM_freearray(L,S.dead,n);
+  n=f->sizecode;
+  S.dead=luaM_newvector(L,n,lu_byte);
+  memset(S.dead,0,n);
+  ThreadJumps(&S);
+  FindUnreachable(&S);
+  Compact(&S);
+  luaM_freearray(L,S.dead,n);
+  if (!S.changed) break;
+ }
+ FindConstants(&S);
+ for (pc=0; pc<f->sizecode; pc++)
+  if (GET_OPCODE(f->code[pc])==OP_CLOSURE)
+  {
+   Proto* p=f->p[GETARG_Bx(f->code[pc])];
+   int nup=p->sizeupvalues;
+   const TValue** pup=ClosureConstants(&S,pc);
+   OptimizeFunction(L,p,pup);
+   luaM_freearray(L,pup,nup);
+  }
+ luaM_freearray(L,S.reg,nv);
+ luaM_freearray(L,S.isconst,nv);
+ luaM_freearray(L,S.value,nv);
+ luaM_freearray(L,S.kindex,nv);
+#if LUAI_SUPERINSTR
+ luaK_fuse(f);
+#endif
+ luaM_freearray(L,f->icache,f->sizeicache);	/* code has changed */
+ f->icache=NULL;
+ f->sizeicache=0;
+ luaF_initcache(L,f);
+}
+
 /*
 ** print bytecodes
 */
@@ -353,7 +1283,7 @@ static void PrintCode(const Proto* f)
   printf("\t%d\t",pc+1);
   if (line>0) printf("[%d]\t",line); else printf("[-]\t");
   printf("%-9s\t",opnames[o]);
-  switch (o)
+  switch (baseOp(o))			/* superinstructions: first half */
   {
    case OP_MOVE:
 	printf("%d %d",a,b);
@@ -651,6 +1581,11 @@ static void PrintCode(const Proto* f)
    case OP_EXTRAARG:
 	printf("%d",ax);
 	break;
+   case OP_MOVE_MOVE: case OP_MOVE_CALL:
+   case OP_GETUPVAL_MOVE: case OP_GETUPVAL_GETFIELD:
+   case OP_GETTABUP_GETFIELD: case OP_GETFIELD_GETFIELD:
+   case OP_SETFIELD_SETFIELD: case OP_SELF_MOVE:
+	break;				/* not reached: see 'baseOp' above */
 #if 0
    default:
 	printf("%d %d %d",a,b,c);
@@ -0,0 +1,200 @@
+/*
+** $Id: oppairs.c $
+** Dynamic opcode-pair histogram (runs a script and counts which
+** instructions execute back to back)
+** See Copyright Notice in lua.h
+*/
+
+#define oppairs_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lopnames.h"
+#include "lstate.h"
+
+#if defined(OPPAIRS_ALLLIBS)
+#include "lua_all.h"
+#endif
+
+#define PROGNAME	"oppairs"	/* default program name */
+
+static const char* progname=PROGNAME;	/* actual program name */
+static int top=40;			/* number of pairs to list */
+
+/*
+** Only pairs that run in sequence inside the same function are counted:
+** those are the ones a superinstruction can replace. A superinstruction
+** is counted as its first half, so the histogram is the same whether
+** the code was fused or not. Pairs that already have a superinstruction
+** are marked with '*'; the 'fused' total is roughly the number of
+** dispatches they save.
+*/
+static unsigned long long pairs[NUM_OPCODES][NUM_OPCODES];
+static unsigned long long singles[NUM_OPCODES];
+static unsigned long long total;
+static const Instruction* lastpc=NULL;
+static int lastop;
+
+typedef struct Pair { unsigned long long n; int a,b; } Pair;
+
+static void fatal(const char* message)
+{
+ fprintf(stderr,"%s: %s\n",progname,message);
+ exit(EXIT_FAILURE);
+}
+
+static void usage(const char* message)
+{
+ if (*message=='-')
+  fprintf(stderr,"%s: unrecognized option '%s'\n",progname,message);
+ else
+  fprintf(stderr,"%s: %s\n",progname,message);
+ fprintf(stderr,
+  "usage: %s [options] script [args]\n"
+  "Available options are:\n"
+  "  -n num   list the 'num' most frequent pairs (default %d, 0 for all)\n"
+  "  --       stop handling options\n"
+  ,progname,top);
+ exit(EXIT_FAILURE);
+}
+
+#define IS(s)	(strcmp(argv[i],s)==0)
+
+static int doargs(int argc, char* argv[])
+{
+ int i;
+ if (argv[0]!=NULL && *argv[0]!=0) progname=argv[0];
+ for (i=1; i<argc; i++)
+ {
+  if (*argv[i]!='-')			/* end of options; keep it */
+   break;
+  else if (IS("--"))			/* end of options; skip it */
+  {
+   ++i;
+   break;
+  }
+  else if (IS("-n"))			/* number of pairs */
+  {
+   const char* n=argv[++i];
+   if (n==NULL || *n<'0' || *n>'9') usage("'-n' needs a number");
+   top=atoi(n);
+  }
+  else					/* unknown option */
+   usage(argv[i]);
+ }
+ return i;
+}
+
+static void hook(lua_State* L, lua_Debug* ar)
+{
+ CallInfo* ci=ar->i_ci;
+ const Instruction* pc;
+ int op;
+ UNUSED(L);
+ if (!isLua(ci)) return;
+ pc=ci->u.l.savedpc-1;			/* instruction about to run */
+ op=baseOp(GET_OPCODE(*pc));
+ singles[op]++;
+ total++;
+ if (pc==lastpc+1) pairs[lastop][op]++;
+ lastpc=pc;
+ lastop=op;
+}
+
+static int issuper(int a, int b)
+{
+ int op;
+ for (op=FIRST_SUPEROP; op<NUM_OPCODES; op++)
+  if (luaP_superops[op-FIRST_SUPEROP][0]==a && luaP_superops[op-FIRST_SUPEROP][1]==b)
+   return 1;
+ return 0;
+}
+
+static int cmppair(const void* a, const void* b)
+{
+ const Pair* x=(const Pair*)a;
+ const Pair* y=(const Pair*)b;
+ return (x->n<y->n) - (x->n>y->n);
+}
+
+static void PrintPairs(void)
+{
+ Pair* p=(Pair*)malloc(NUM_OPCODES*NUM_OPCODES*sizeof(Pair));
+ int a,b,n=0,i;
+ unsigned long long sum=0,fused=0;
+ if (p==NULL) fatal("not enough memory");
+ for (a=0; a<NUM_OPCODES; a++)
+  for (b=0; b<NUM_OPCODES; b++)
+   if (pairs[a][b]!=0)
+   {
+    p[n].n=pairs[a][b]; p[n].a=a; p[n].b=b;
+    sum+=p[n].n;
+    if (issuper(a,b)) fused+=p[n].n;
+    n++;
+   }
+ qsort(p,n,sizeof(Pair),cmppair);
+ printf("%llu instructions, %llu sequential pairs, %llu (%.1f%%) fused\n",
+	total,sum,fused,100.0*fused/(total ? total : 1));
+ printf("%14s %6s %6s  %-10s %s\n","count","pair%","first%","first","second");
+ if (top>0 && top<n) n=top;
+ for (i=0; i<n; i++)
+  printf("%14llu %5.2f%% %5.1f%%  %-10s %s%s\n",p[i].n,
+	100.0*p[i].n/(sum ? sum : 1),100.0*p[i].n/singles[p[i].a],
+	opnames[p[i].a],opnames[p[i].b],issuper(p[i].a,p[i].b) ? " *" : "");
+ free(p);
+}
+
+static int pmain(lua_State* L)
+{
+ int argc=(int)lua_tointeger(L,1);
+ char** argv=(char**)lua_touserdata(L,2);
+ int i;
+ luaL_openlibs(L);
+#if defined(OPPAIRS_ALLLIBS)
+ LUAPORTABLE4WINDOWS_OPENLIBS(L);
+#endif
+ lua_createtable(L,argc-1,1);		/* script arguments, as in 'lua' */
+ for (i=0; i<argc; i++)
+ {
+  lua_pushstring(L,argv[i]);
+  lua_rawseti(L,-2,i);
+ }
+ lua_setglobal(L,"arg");
+ if (luaL_loadfile(L,argv[0])!=LUA_OK) lua_error(L);
+ for (i=1; i<argc; i++) lua_pushstring(L,argv[i]);
+ lua_sethook(L,hook,LUA_MASKCOUNT,1);
+ lua_call(L,argc-1,0);
+ lua_sethook(L,NULL,0,0);
+ return 0;
+}
+
+int main(int argc, char* argv[])
+{
+ lua_State* L;
+ int i=doargs(argc,argv);
+ int status;
+ argc-=i; argv+=i;
+ if (argc<=0) usage("no script given");
+ L=luaL_newstate();
+ if (L==NULL) fatal("cannot create state: not enough memory");
+ lua_pushcfunction(L,&pmain);
+ lua_pushinteger(L,argc);
+ lua_pushlightuserdata(L,argv);
+ status=lua_pcall(L,2,0,0);
+ if (status!=LUA_OK)			/* report, but keep what was counted */
+  fprintf(stderr,"%s: %s\n",progname,lua_tostring(L,-1));
+ lua_close(L);
+ PrintPairs();
+ return (status==LUA_OK) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
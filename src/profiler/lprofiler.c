@@ -0,0 +1,828 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#endif
+#include "lua_all.h"
+#include "lprofiler.h"
+
+
+/* Upper limit for the depth option */
+#define PROF_MAXDEPTH 1024
+
+#define PROF_NOFUNC UINT32_MAX
+
+
+/* A function seen in the samples */
+typedef struct prof_func {
+	char *name;          /* for output: "name@source:line" */
+	char *src;           /* short_src, with line identifies Lua functions */
+	int line;            /* linedefined */
+	lua_CFunction cfunc; /* identifies C functions */
+	uint32_t hash;
+	uint32_t mark;       /* last stack counted in total */
+	uint64_t self;       /* samples where it was running */
+	uint64_t total;      /* samples where it was on the stack */
+} prof_func;
+
+
+/* A distinct call stack and the number of samples taken in it */
+typedef struct prof_stack {
+	uint32_t hash;
+	uint32_t depth;
+	size_t first; /* its function indices in prof.frames, innermost first */
+	uint64_t count;
+} prof_stack;
+
+
+/* The profiler is process wide: a hook has no way to find per-state data
+ * cheaply, and only one profile is taken at a time anyway. Samples are
+ * kept in malloc'ed memory, so they survive the Lua state.
+ * The state that starts the profiler owns it while it runs: the hook
+ * only runs in its threads, and other states (of other OS threads) may
+ * not stop it or touch the samples until it stops. A guard in the
+ * registry of the owner stops it when the state is closed. */
+static struct {
+	lua_State *L; /* main thread of the owner */
+	int running;
+	int period_us;
+	int depth;
+	uint64_t samples;
+	uint64_t dropped; /* samples lost for lack of memory */
+
+	prof_func *funcs;
+	size_t nfuncs, capfuncs;
+	uint32_t *funcidx; /* open addressing hash, entries are index + 1 */
+	size_t funcidxsize;
+
+	prof_stack *stacks;
+	size_t nstacks, capstacks;
+	uint32_t *stackidx;
+	size_t stackidxsize;
+
+	uint32_t *frames;
+	size_t nframes, capframes;
+} prof;
+
+
+#ifdef _WIN32
+static volatile LONG prof_due;
+static HANDLE prof_timer;
+static SRWLOCK prof_lock = SRWLOCK_INIT;
+#define owner_lock() AcquireSRWLockExclusive(&prof_lock)
+#define owner_unlock() ReleaseSRWLockExclusive(&prof_lock)
+#else
+static volatile sig_atomic_t prof_due;
+static struct sigaction prof_oldaction;
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+#define owner_lock() pthread_mutex_lock(&prof_lock)
+#define owner_unlock() pthread_mutex_unlock(&prof_lock)
+#endif
+
+
+/* Key of the pseudo function standing for the frames cut off by the depth
+ * limit; never called */
+static int prof_truncated(lua_State *L)
+{
+	(void)L;
+	return 0;
+}
+
+
+static uint32_t hash_bytes(const void *p, size_t len, uint32_t h)
+{
+	const unsigned char *s = (const unsigned char *)p;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ s[i]) * 16777619u;
+	}
+	return h;
+}
+
+
+static int grow(void **p, size_t *cap, size_t need, size_t elemsize)
+{
+	size_t ncap = (*cap < 64) ? 64 : *cap;
+	void *np;
+	if (need <= *cap) {
+		return 1;
+	}
+	while (ncap < need) {
+		ncap *= 2;
+	}
+	np = realloc(*p, ncap * elemsize);
+	if (np == NULL) {
+		return 0;
+	}
+	*p = np;
+	*cap = ncap;
+	return 1;
+}
+
+
+static uint32_t func_hash_at(size_t i)
+{
+	return prof.funcs[i].hash;
+}
+
+
+static uint32_t stack_hash_at(size_t i)
+{
+	return prof.stacks[i].hash;
+}
+
+
+/* Make an index large enough for n entries, keeping it at most half full */
+static int index_reserve(uint32_t **idx, size_t *size, size_t n, uint32_t (*hash_at)(size_t))
+{
+	size_t nsize = 256;
+	uint32_t *nidx;
+	while (nsize < 2 * n) {
+		nsize *= 2;
+	}
+	if (nsize <= *size) {
+		return 1;
+	}
+	nidx = (uint32_t *)calloc(nsize, sizeof(uint32_t));
+	if (nidx == NULL) {
+		return 0;
+	}
+	for (size_t i = 0; i + 1 < n; i++) {
+		size_t j = hash_at(i) & (nsize - 1);
+		while (nidx[j] != 0) {
+			j = (j + 1) & (nsize - 1);
+		}
+		nidx[j] = (uint32_t)(i + 1);
+	}
+	free(*idx);
+	*idx = nidx;
+	*size = nsize;
+	return 1;
+}
+
+
+static char *func_name(const lua_Debug *d, lua_CFunction cf)
+{
+	char buf[LUA_IDSIZE + 128];
+	const char *name = (d->name != NULL) ? d->name : "?";
+	size_t len;
+	char *s;
+
+	if (cf == prof_truncated) {
+		snprintf(buf, sizeof(buf), "(truncated)");
+	}
+	else if (*d->what == 'C') {
+		snprintf(buf, sizeof(buf), "%s@[C]", name);
+	}
+	else if (*d->what == 'm') {
+		snprintf(buf, sizeof(buf), "main chunk@%s", d->short_src);
+	}
+	else {
+		snprintf(buf, sizeof(buf), "%s@%s:%d", name, d->short_src, d->linedefined);
+	}
+	/* ';' separates frames in folded stacks */
+	for (s = buf; *s != '\0'; s++) {
+		if ((*s == ';') || (*s == '\n') || (*s == '\r')) {
+			*s = ':';
+		}
+	}
+	len = strlen(buf) + 1;
+	s = (char *)malloc(len);
+	if (s != NULL) {
+		memcpy(s, buf, len);
+	}
+	return s;
+}
+
+
+/* Index of the function of frame d (cf: the C function or NULL) */
+static uint32_t func_id(const lua_Debug *d, lua_CFunction cf)
+{
+	uint32_t h = 2166136261u;
+	size_t j, mask;
+	prof_func *f;
+
+	if (cf != NULL) {
+		h = hash_bytes(&cf, sizeof(cf), h);
+	}
+	else {
+		h = hash_bytes(&d->linedefined, sizeof(d->linedefined), h);
+		h = hash_bytes(d->short_src, strlen(d->short_src), h);
+	}
+	if (!index_reserve(&prof.funcidx, &prof.funcidxsize, prof.nfuncs + 1, func_hash_at)) {
+		return PROF_NOFUNC;
+	}
+
+	mask = prof.funcidxsize - 1;
+	for (j = h & mask; prof.funcidx[j] != 0; j = (j + 1) & mask) {
+		f = &prof.funcs[prof.funcidx[j] - 1];
+		if ((f->hash == h) && (f->cfunc == cf) &&
+		    ((cf != NULL) || ((f->line == d->linedefined) && !strcmp(f->src, d->short_src)))) {
+			if ((f->name[0] == '?') && (d->name != NULL)) {
+				/* first seen without a name, e.g. called by a hook */
+				char *name = func_name(d, cf);
+				if (name != NULL) {
+					free(f->name);
+					f->name = name;
+				}
+			}
+			return prof.funcidx[j] - 1;
+		}
+	}
+
+	if (!grow((void **)&prof.funcs, &prof.capfuncs, prof.nfuncs + 1, sizeof(prof_func))) {
+		return PROF_NOFUNC;
+	}
+	f = &prof.funcs[prof.nfuncs];
+	memset(f, 0, sizeof(prof_func));
+	f->name = func_name(d, cf);
+	f->src = (char *)malloc(strlen(d->short_src) + 1);
+	if ((f->name == NULL) || (f->src == NULL)) {
+		free(f->name);
+		free(f->src);
+		return PROF_NOFUNC;
+	}
+	strcpy(f->src, d->short_src);
+	f->line = d->linedefined;
+	f->cfunc = cf;
+	f->hash = h;
+	prof.funcidx[j] = (uint32_t)(++prof.nfuncs);
+	return (uint32_t)(prof.nfuncs - 1);
+}
+
+
+/* Count one sample of the stack given by n function indices */
+static int stack_add(const uint32_t *ids, uint32_t n)
+{
+	uint32_t h = hash_bytes(ids, n * sizeof(uint32_t), 2166136261u);
+	size_t j, mask;
+	prof_stack *st;
+
+	if (!index_reserve(&prof.stackidx, &prof.stackidxsize, prof.nstacks + 1, stack_hash_at)) {
+		return 0;
+	}
+	mask = prof.stackidxsize - 1;
+	for (j = h & mask; prof.stackidx[j] != 0; j = (j + 1) & mask) {
+		st = &prof.stacks[prof.stackidx[j] - 1];
+		if ((st->hash == h) && (st->depth == n) &&
+		    !memcmp(prof.frames + st->first, ids, n * sizeof(uint32_t))) {
+			st->count++;
+			return 1;
+		}
+	}
+
+	if (!grow((void **)&prof.stacks, &prof.capstacks, prof.nstacks + 1, sizeof(prof_stack)) ||
+	    !grow((void **)&prof.frames, &prof.capframes, prof.nframes + n, sizeof(uint32_t))) {
+		return 0;
+	}
+	st = &prof.stacks[prof.nstacks];
+	st->hash = h;
+	st->depth = n;
+	st->first = prof.nframes;
+	st->count = 1;
+	memcpy(prof.frames + prof.nframes, ids, n * sizeof(uint32_t));
+	prof.nframes += n;
+	prof.stackidx[j] = (uint32_t)(++prof.nstacks);
+	return 1;
+}
+
+
+static void prof_sample(lua_State *L)
+{
+	uint32_t ids[PROF_MAXDEPTH + 1];
+	uint32_t n = 0;
+	int level;
+	lua_Debug d;
+
+	for (level = 0; ((int)n < prof.depth) && lua_getstack(L, level, &d); level++) {
+		lua_CFunction cf;
+		if (!lua_getinfo(L, "Snf", &d)) {
+			break;
+		}
+		cf = lua_tocfunction(L, -1);
+		lua_pop(L, 1);
+		ids[n] = func_id(&d, cf);
+		if (ids[n] == PROF_NOFUNC) {
+			prof.dropped++;
+			return;
+		}
+		n++;
+	}
+	if (((int)n == prof.depth) && lua_getstack(L, level, &d)) {
+		/* the outer frames do not fit, mark them as one */
+		memset(&d, 0, sizeof(d));
+		d.what = "C";
+		ids[n] = func_id(&d, prof_truncated);
+		if (ids[n] == PROF_NOFUNC) {
+			prof.dropped++;
+			return;
+		}
+		n++;
+	}
+	if (n == 0) {
+		return;
+	}
+	if (stack_add(ids, n)) {
+		prof.samples++;
+	}
+	else {
+		prof.dropped++;
+	}
+}
+
+
+static lua_State *main_thread(lua_State *L)
+{
+	lua_State *M;
+	lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+	M = lua_tothread(L, -1);
+	lua_pop(L, 1);
+	return M;
+}
+
+
+static void prof_hook(lua_State *L, lua_Debug *ar)
+{
+	lua_State *M = main_thread(L);
+	int mine;
+
+	(void)ar;
+	/* read under the lock that start and stop take in other threads */
+	owner_lock();
+	mine = prof.running && (prof.L == M);
+	owner_unlock();
+	if (!mine) {
+		/* a coroutine that inherited the hook before the profiler stopped,
+		 * maybe restarted by another state since */
+		lua_sethook(L, NULL, 0, 0);
+		return;
+	}
+	if (prof.period_us > 0) {
+		if (!prof_due) {
+			return;
+		}
+		prof_due = 0;
+	}
+	prof_sample(L);
+}
+
+
+#ifdef _WIN32
+
+static VOID CALLBACK prof_timer_callback(PVOID param, BOOLEAN fired)
+{
+	(void)param;
+	(void)fired;
+	prof_due = 1;
+}
+
+
+static int timer_start(int period_us)
+{
+	DWORD ms = (period_us < 1000) ? 1 : (DWORD)(period_us / 1000);
+	return CreateTimerQueueTimer(&prof_timer, NULL, prof_timer_callback, NULL, ms, ms, WT_EXECUTEDEFAULT) ? 1 : 0;
+}
+
+
+static void timer_stop(void)
+{
+	if (prof_timer != NULL) {
+		DeleteTimerQueueTimer(NULL, prof_timer, INVALID_HANDLE_VALUE);
+		prof_timer = NULL;
+	}
+}
+
+#else
+
+static void prof_signal(int sig)
+{
+	(void)sig;
+	prof_due = 1;
+}
+
+
+static int timer_start(int period_us)
+{
+	struct sigaction sa;
+	struct itimerval it;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = prof_signal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGPROF, &sa, &prof_oldaction) != 0) {
+		return 0;
+	}
+	it.it_interval.tv_sec = period_us / 1000000;
+	it.it_interval.tv_usec = period_us % 1000000;
+	it.it_value = it.it_interval;
+	if (setitimer(ITIMER_PROF, &it, NULL) != 0) {
+		sigaction(SIGPROF, &prof_oldaction, NULL);
+		return 0;
+	}
+	return 1;
+}
+
+
+static void timer_stop(void)
+{
+	struct itimerval it;
+	memset(&it, 0, sizeof(it));
+	setitimer(ITIMER_PROF, &it, NULL);
+	sigaction(SIGPROF, &prof_oldaction, NULL);
+}
+
+#endif
+
+
+/* Stop the profiler if it still runs in the state being closed */
+static int prof_guard_gc(lua_State *L)
+{
+	lua_State *M = *(lua_State **)lua_touserdata(L, 1);
+	owner_lock();
+	if (prof.running && (prof.L == M)) {
+		prof.running = 0;
+		if (prof.period_us > 0) {
+			timer_stop();
+		}
+	}
+	if (prof.L == M) {
+		prof.L = NULL;
+	}
+	owner_unlock();
+	return 0;
+}
+
+
+/* Make sure the state of main thread M has its guard */
+static void prof_guard(lua_State *L, lua_State *M)
+{
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, &prof) == LUA_TNIL) {
+		lua_State **g = (lua_State **)lua_newuserdatauv(L, sizeof(lua_State *), 0);
+		*g = M;
+		lua_newtable(L);
+		lua_pushcfunction(L, prof_guard_gc);
+		lua_setfield(L, -2, "__gc");
+		lua_setmetatable(L, -2);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &prof);
+	}
+	lua_pop(L, 1);
+}
+
+
+/* Whether L belongs to the state running the profiler, or it is stopped */
+static int prof_mine(lua_State *L)
+{
+	lua_State *M = main_thread(L);
+	int mine;
+	owner_lock();
+	mine = !prof.running || (prof.L == M);
+	owner_unlock();
+	return mine;
+}
+
+
+int lprofiler_start(lua_State *L, int interval, int period_us, int depth)
+{
+	lua_State *M = main_thread(L);
+
+	if (interval < 1) {
+		interval = LPROFILER_INTERVAL;
+	}
+	if ((depth < 1) || (depth > PROF_MAXDEPTH)) {
+		depth = (depth < 1) ? LPROFILER_DEPTH : PROF_MAXDEPTH;
+	}
+	prof_guard(L, M);
+
+	owner_lock();
+	if (prof.running) {
+		owner_unlock();
+		return 0;
+	}
+	prof_due = 0;
+	if ((period_us > 0) && !timer_start(period_us)) {
+		owner_unlock();
+		return -1;
+	}
+	prof.L = M;
+	prof.period_us = (period_us > 0) ? period_us : 0;
+	prof.depth = depth;
+	prof.running = 1;
+	owner_unlock();
+	/* new coroutines inherit the hook of the thread creating them */
+	lua_sethook(M, prof_hook, LUA_MASKCOUNT, interval);
+	if (L != M) {
+		lua_sethook(L, prof_hook, LUA_MASKCOUNT, interval);
+	}
+	return 1;
+}
+
+
+int lprofiler_stop(lua_State *L)
+{
+	lua_State *M = main_thread(L);
+
+	owner_lock();
+	if (!prof.running) {
+		owner_unlock();
+		return 1;
+	}
+	if (prof.L != M) {
+		owner_unlock();
+		return 0;
+	}
+	prof.running = 0;
+	if (prof.period_us > 0) {
+		timer_stop();
+	}
+	owner_unlock();
+	if (lua_gethook(M) == prof_hook) {
+		lua_sethook(M, NULL, 0, 0);
+	}
+	if ((L != M) && (lua_gethook(L) == prof_hook)) {
+		lua_sethook(L, NULL, 0, 0);
+	}
+	return 1;
+}
+
+
+int lprofiler_reset(lua_State *L)
+{
+	lua_State *M = main_thread(L);
+
+	/* the lock keeps other states from starting the hook meanwhile */
+	owner_lock();
+	if (prof.running && (prof.L != M)) {
+		owner_unlock();
+		return 0;
+	}
+	for (size_t i = 0; i < prof.nfuncs; i++) {
+		free(prof.funcs[i].name);
+		free(prof.funcs[i].src);
+	}
+	free(prof.funcs);
+	free(prof.funcidx);
+	free(prof.stacks);
+	free(prof.stackidx);
+	free(prof.frames);
+	prof.funcs = NULL;
+	prof.funcidx = NULL;
+	prof.stacks = NULL;
+	prof.stackidx = NULL;
+	prof.frames = NULL;
+	prof.nfuncs = prof.capfuncs = prof.funcidxsize = 0;
+	prof.nstacks = prof.capstacks = prof.stackidxsize = 0;
+	prof.nframes = prof.capframes = 0;
+	prof.samples = prof.dropped = 0;
+	owner_unlock();
+	return 1;
+}
+
+
+/* Output goes to a FILE or a luaL_Buffer */
+typedef void (*prof_writer)(void *ud, const char *s, size_t len);
+
+
+static void write_file(void *ud, const char *s, size_t len)
+{
+	fwrite(s, 1, len, (FILE *)ud);
+}
+
+
+static void write_buffer(void *ud, const char *s, size_t len)
+{
+	luaL_addlstring((luaL_Buffer *)ud, s, len);
+}
+
+
+static void write_string(prof_writer w, void *ud, const char *s)
+{
+	w(ud, s, strlen(s));
+}
+
+
+static void write_folded(prof_writer w, void *ud)
+{
+	char count[32];
+	for (size_t i = 0; i < prof.nstacks; i++) {
+		const prof_stack *st = &prof.stacks[i];
+		const uint32_t *ids = prof.frames + st->first;
+		for (uint32_t k = st->depth; k > 0; k--) {
+			write_string(w, ud, prof.funcs[ids[k - 1]].name);
+			if (k > 1) {
+				w(ud, ";", 1);
+			}
+		}
+		snprintf(count, sizeof(count), " %llu\n", (unsigned long long)st->count);
+		write_string(w, ud, count);
+	}
+}
+
+
+static int cmp_func(const void *a, const void *b)
+{
+	const prof_func *fa = &prof.funcs[*(const uint32_t *)a];
+	const prof_func *fb = &prof.funcs[*(const uint32_t *)b];
+	if (fa->self != fb->self) {
+		return (fa->self < fb->self) ? 1 : -1;
+	}
+	if (fa->total != fb->total) {
+		return (fa->total < fb->total) ? 1 : -1;
+	}
+	return strcmp(fa->name, fb->name);
+}
+
+
+static void write_report(prof_writer w, void *ud, int maxlines)
+{
+	char line[LUA_IDSIZE + 256];
+	uint32_t *order;
+	double all = (prof.samples > 0) ? (double)prof.samples : 1.0;
+	size_t n = prof.nfuncs;
+
+	/* self and total per function; recursive calls count once in total */
+	for (size_t i = 0; i < prof.nfuncs; i++) {
+		prof.funcs[i].self = prof.funcs[i].total = 0;
+		prof.funcs[i].mark = 0;
+	}
+	for (size_t i = 0; i < prof.nstacks; i++) {
+		const prof_stack *st = &prof.stacks[i];
+		const uint32_t *ids = prof.frames + st->first;
+		prof.funcs[ids[0]].self += st->count;
+		for (uint32_t k = 0; k < st->depth; k++) {
+			prof_func *f = &prof.funcs[ids[k]];
+			if (f->mark != (uint32_t)(i + 1)) {
+				f->mark = (uint32_t)(i + 1);
+				f->total += st->count;
+			}
+		}
+	}
+
+	snprintf(line, sizeof(line), "%llu samples (%llu dropped)\n%10s %7s %10s %7s  %s\n",
+	         (unsigned long long)prof.samples, (unsigned long long)prof.dropped,
+	         "self", "self%", "total", "total%", "function");
+	write_string(w, ud, line);
+
+	order = (uint32_t *)malloc((n + 1) * sizeof(uint32_t));
+	if (order == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < n; i++) {
+		order[i] = (uint32_t)i;
+	}
+	qsort(order, n, sizeof(uint32_t), cmp_func);
+	if ((maxlines > 0) && ((size_t)maxlines < n)) {
+		n = (size_t)maxlines;
+	}
+	for (size_t i = 0; i < n; i++) {
+		const prof_func *f = &prof.funcs[order[i]];
+		snprintf(line, sizeof(line), "%10llu %6.2f%% %10llu %6.2f%%  %s\n",
+		         (unsigned long long)f->self, 100.0 * (double)f->self / all,
+		         (unsigned long long)f->total, 100.0 * (double)f->total / all, f->name);
+		write_string(w, ud, line);
+	}
+	free(order);
+}
+
+
+void lprofiler_write_folded(FILE *f)
+{
+	write_folded(write_file, f);
+}
+
+
+void lprofiler_write_report(FILE *f, int maxlines)
+{
+	write_report(write_file, f, maxlines);
+}
+
+
+/* profiler.start([opts]): opts.interval (VM instructions between samples),
+ * opts.timer (sampling period in milliseconds, 0: count instructions
+ * only), opts.depth (frames per sample) */
+static int lua_profiler_start(lua_State *L)
+{
+	lua_Integer interval = LPROFILER_INTERVAL;
+	lua_Number timer = 0;
+	lua_Integer depth = LPROFILER_DEPTH;
+	int ret;
+
+	if (lua_istable(L, 1)) {
+		lua_getfield(L, 1, "interval");
+		lua_getfield(L, 1, "timer");
+		lua_getfield(L, 1, "depth");
+		interval = luaL_optinteger(L, -3, interval);
+		timer = luaL_optnumber(L, -2, timer);
+		depth = luaL_optinteger(L, -1, depth);
+		lua_pop(L, 3);
+	}
+	else if (!lua_isnoneornil(L, 1)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	if ((interval < 1) || (interval > INT32_MAX) || (timer < 0) || (timer > 1e6) ||
+	    (depth < 1) || (depth > PROF_MAXDEPTH)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+
+	ret = lprofiler_start(L, (int)interval, (int)(timer * 1000), (int)depth);
+	if (ret < 0) {
+		return luaL_error(L, "%s cannot start timer", __func__);
+	}
+	lua_pushboolean(L, ret);
+	return 1;
+}
+
+
+static int lua_profiler_stop(lua_State *L)
+{
+	if (!lprofiler_stop(L)) {
+		return luaL_error(L, "%s profiler is running in another state", __func__);
+	}
+	return 0;
+}
+
+
+static int lua_profiler_reset(lua_State *L)
+{
+	if (!lprofiler_reset(L)) {
+		return luaL_error(L, "%s profiler is running in another state", __func__);
+	}
+	return 0;
+}
+
+
+static int lua_profiler_running(lua_State *L)
+{
+	lua_pushboolean(L, prof.running);
+	return 1;
+}
+
+
+/* profiler.samples(): number of samples taken and dropped */
+static int lua_profiler_samples(lua_State *L)
+{
+	if (!prof_mine(L)) {
+		return luaL_error(L, "%s profiler is running in another state", __func__);
+	}
+	lua_pushinteger(L, (lua_Integer)prof.samples);
+	lua_pushinteger(L, (lua_Integer)prof.dropped);
+	return 2;
+}
+
+
+static int lua_profiler_folded(lua_State *L)
+{
+	luaL_Buffer b;
+	if (!prof_mine(L)) {
+		return luaL_error(L, "%s profiler is running in another state", __func__);
+	}
+	luaL_buffinit(L, &b);
+	write_folded(write_buffer, &b);
+	luaL_pushresult(&b);
+	return 1;
+}
+
+
+/* profiler.report([maxlines]): functions by samples, as text */
+static int lua_profiler_report(lua_State *L)
+{
+	lua_Integer maxlines = luaL_optinteger(L, 1, 0);
+	luaL_Buffer b;
+	if ((maxlines < 0) || (maxlines > INT32_MAX)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	if (!prof_mine(L)) {
+		return luaL_error(L, "%s profiler is running in another state", __func__);
+	}
+	luaL_buffinit(L, &b);
+	write_report(write_buffer, &b, (int)maxlines);
+	luaL_pushresult(&b);
+	return 1;
+}
+
+
+static const struct luaL_Reg funclist[] = {
+	{ "start", lua_profiler_start },
+	{ "stop", lua_profiler_stop },
+	{ "reset", lua_profiler_reset },
+	{ "running", lua_profiler_running },
+	{ "samples", lua_profiler_samples },
+	{ "folded", lua_profiler_folded },
+	{ "report", lua_profiler_report },
+
+	{ NULL, NULL },
+};
+
+
+int luaopen_profiler(lua_State *L)
+{
+	luaL_newlib(L, funclist);
+	lua_pushvalue(L, -1);
+	lua_setglobal(L, "profiler");
+	return 1;
+}
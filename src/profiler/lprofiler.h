@@ -0,0 +1,44 @@
+#ifndef LPROFILER_H
+#define LPROFILER_H
+
+#include <stdio.h>
+#include "lua.h"
+
+
+/* Default number of VM instructions between two samples (or between two
+ * checks of the timer flag) */
+#define LPROFILER_INTERVAL 1000
+
+/* Default number of stack frames recorded per sample */
+#define LPROFILER_DEPTH 64
+
+
+/* Start sampling L (and coroutines it creates afterwards) from a count
+ * hook called every 'interval' VM instructions. If period_us > 0, a timer
+ * raises a flag every period_us microseconds of CPU time (wall clock time
+ * on Windows), and the hook only takes a sample when the flag is set.
+ * Samples are added to those taken before. Returns 0 if the profiler is
+ * already running (in this or another state). The profiler stops by
+ * itself when the state that started it is closed. */
+int lprofiler_start(lua_State *L, int interval, int period_us, int depth);
+
+/* Stop sampling (the samples are kept until the next reset). Returns 0
+ * if another state started the profiler, which keeps running. */
+int lprofiler_stop(lua_State *L);
+
+/* Discard all samples. Returns 0 if the profiler is running in another
+ * state. */
+int lprofiler_reset(lua_State *L);
+
+/* Write the samples as folded stacks ("root;caller;function count"),
+ * the input format of flamegraph.pl */
+void lprofiler_write_folded(FILE *f);
+
+/* Write a table of the functions with most samples, at most maxlines
+ * lines (0: all) */
+void lprofiler_write_report(FILE *f, int maxlines);
+
+
+int luaopen_profiler(lua_State *L);
+
+#endif /* LPROFILER_H */
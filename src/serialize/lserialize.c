@@ -0,0 +1,709 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "lua_all.h"
+#include "lualib.h"
+#include "strbuf/lstrbuf.h"
+#include "lserialize.h"
+
+
+#define LSERIALIZE_DECODER "serialize.decoder"
+
+/* Limit for nested tables, deeper data raises an error. Encoder and
+ * decoder recurse in C once per level, so this stays in the range of
+ * the interpreter's own C call limit (LUAI_MAXCCALLS). */
+#define SER_MAXDEPTH 200
+
+/* Read buffer of a decoder reading from a file */
+#define SER_BUFSIZE 65536
+
+/* Strings with a length in this range are encoded once and referenced
+ * like tables afterwards. Table keys repeat a lot, and the decoder then
+ * does not have to intern the same short string again. */
+#define SER_MINSHARED 4
+#define SER_MAXSHARED 40
+
+/* Largest table presize taken from a file, where the remaining input
+ * size is not known */
+#define SER_MAXHINT 65536
+
+
+/* {====================================================== */
+/* Encoder */
+
+typedef struct Encoder {
+	lua_State *L;
+	lstrbuf *sb;
+	const char *func;
+	int refs; /* stack index of table -> reference index */
+	lua_Integer nrefs;
+	int depth;
+	int maxdepth;
+} Encoder;
+
+
+static void put_byte(Encoder *E, int b)
+{
+	*lstrbuf_prepare(E->L, E->sb, 1) = (char)b;
+	lstrbuf_addsize(E->sb, 1);
+}
+
+
+static void put_varint(Encoder *E, uint64_t v)
+{
+	char *p = lstrbuf_prepare(E->L, E->sb, 10);
+	size_t n = 0;
+	while (v >= 0x80) {
+		p[n++] = (char)((v & 0x7F) | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (char)v;
+	lstrbuf_addsize(E->sb, n);
+}
+
+
+static void encode_value(Encoder *E, int idx);
+
+
+static int is_arraykey(lua_State *L, int idx, lua_Unsigned narr)
+{
+	if (lua_isinteger(L, idx)) {
+		lua_Integer k = lua_tointeger(L, idx);
+		return (k >= 1) && ((lua_Unsigned)k <= narr);
+	}
+	return 0;
+}
+
+
+/* Tables and shared strings are numbered in the order they are first
+ * met. Later occurrences (shared references and cycles) are encoded as
+ * reference to that number. Returns 1 if a reference was written. */
+static int encode_ref(Encoder *E, int idx)
+{
+	lua_State *L = E->L;
+
+	lua_pushvalue(L, idx);
+	if (lua_rawget(L, E->refs) == LUA_TNUMBER) {
+		put_byte(E, LSERIALIZE_REF);
+		put_varint(E, (uint64_t)lua_tointeger(L, -1));
+		lua_pop(L, 1);
+		return 1;
+	}
+	lua_pop(L, 1);
+	lua_pushvalue(L, idx);
+	lua_pushinteger(L, E->nrefs++);
+	lua_rawset(L, E->refs);
+	return 0;
+}
+
+
+static void encode_table(Encoder *E, int idx)
+{
+	lua_State *L = E->L;
+	lua_Unsigned narr, i;
+	uint64_t nhash = 0;
+
+	luaL_checkstack(L, 4, "too many nested tables");
+	if (encode_ref(E, idx)) {
+		return;
+	}
+
+	if (E->depth >= E->maxdepth) {
+		luaL_error(L, "%s nesting too deep", E->func);
+	}
+
+	/* lua_rawlen gives a border, there may be holes below it */
+	narr = lua_rawlen(L, idx);
+	lua_pushnil(L);
+	while (lua_next(L, idx)) {
+		if (!is_arraykey(L, -2, narr)) {
+			nhash++;
+		}
+		lua_pop(L, 1);
+	}
+
+	put_byte(E, LSERIALIZE_TABLE);
+	put_varint(E, (uint64_t)narr);
+	put_varint(E, nhash);
+
+	E->depth++;
+	for (i = 1; i <= narr; i++) {
+		lua_rawgeti(L, idx, (lua_Integer)i);
+		encode_value(E, lua_gettop(L));
+		lua_pop(L, 1);
+	}
+	lua_pushnil(L);
+	while (lua_next(L, idx)) {
+		if (!is_arraykey(L, -2, narr)) {
+			encode_value(E, lua_gettop(L) - 1);
+			encode_value(E, lua_gettop(L));
+		}
+		lua_pop(L, 1);
+	}
+	E->depth--;
+}
+
+
+static void encode_value(Encoder *E, int idx)
+{
+	lua_State *L = E->L;
+
+	switch (lua_type(L, idx)) {
+	case LUA_TNIL:
+		put_byte(E, LSERIALIZE_NIL);
+		break;
+	case LUA_TBOOLEAN:
+		put_byte(E, lua_toboolean(L, idx) ? LSERIALIZE_TRUE : LSERIALIZE_FALSE);
+		break;
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, idx)) {
+			lua_Integer v = lua_tointeger(L, idx);
+			if ((v >= 0) && (v < 0x80)) {
+				put_byte(E, LSERIALIZE_FIXINT + (int)v);
+			}
+			else {
+				/* zigzag: small negative numbers get short varints too */
+				uint64_t u = ((uint64_t)v) << 1;
+				put_byte(E, LSERIALIZE_INT);
+				put_varint(E, (v < 0) ? ~u : u);
+			}
+		}
+		else {
+			double d = (double)lua_tonumber(L, idx);
+			uint64_t u;
+			char *p;
+			memcpy(&u, &d, sizeof(u));
+			put_byte(E, LSERIALIZE_FLOAT);
+			p = lstrbuf_prepare(L, E->sb, 8);
+			for (int i = 0; i < 8; i++) {
+				p[i] = (char)(u >> (8 * i));
+			}
+			lstrbuf_addsize(E->sb, 8);
+		}
+		break;
+	case LUA_TSTRING: {
+		size_t len = 0;
+		const char *s = lua_tolstring(L, idx, &len);
+		if ((len >= SER_MINSHARED) && (len <= SER_MAXSHARED) && encode_ref(E, idx)) {
+			break;
+		}
+		if (len < 0x40) {
+			put_byte(E, LSERIALIZE_FIXSTR + (int)len);
+		}
+		else {
+			put_byte(E, LSERIALIZE_STRING);
+			put_varint(E, (uint64_t)len);
+		}
+		lstrbuf_append(L, E->sb, s, len);
+		break;
+	}
+	case LUA_TTABLE:
+		encode_table(E, idx);
+		break;
+	default:
+		luaL_error(L, "%s cannot encode %s values", E->func, luaL_typename(L, idx));
+		break;
+	}
+}
+
+
+static void encode_top(Encoder *E, int idx)
+{
+	lua_State *L = E->L;
+
+	lua_newtable(L);
+	E->refs = lua_gettop(L);
+	lstrbuf_append(L, E->sb, LSERIALIZE_MAGIC, LSERIALIZE_MAGICLEN);
+	encode_value(E, idx);
+	lua_remove(L, E->refs);
+}
+
+
+void lserialize_encode(lua_State *L, int idx, lstrbuf *sb, const char *func)
+{
+	Encoder E;
+
+	E.L = L;
+	E.sb = sb;
+	E.func = func;
+	E.nrefs = 0;
+	E.depth = 0;
+	E.maxdepth = SER_MAXDEPTH;
+	encode_top(&E, lua_absindex(L, idx));
+}
+
+
+/* serialize.encode(value [, opts]): binary representation of value.
+ * opts.buffer: strbuf to append to (it is returned instead of a string)
+ * opts.maxdepth: limit for nested tables (at most SER_MAXDEPTH) */
+static int lua_serialize_encode(lua_State *L)
+{
+	Encoder E;
+	int own = 1;
+
+	E.L = L;
+	E.func = __func__;
+	E.nrefs = 0;
+	E.depth = 0;
+	E.maxdepth = SER_MAXDEPTH;
+
+	lua_settop(L, 2);
+	if (lua_istable(L, 2)) {
+		lua_getfield(L, 2, "maxdepth");
+		if (!lua_isnil(L, -1)) {
+			lua_Integer d = lua_tointeger(L, -1);
+			if ((d < 1) || (d > SER_MAXDEPTH)) {
+				return luaL_error(L, "%s parameter error", __func__);
+			}
+			E.maxdepth = (int)d;
+		}
+		lua_pop(L, 1);
+		lua_getfield(L, 2, "buffer");
+		if (!lua_isnil(L, -1)) {
+			E.sb = lstrbuf_test(L, -1);
+			if (E.sb == NULL) {
+				return luaL_error(L, "%s parameter error", __func__);
+			}
+			own = 0;
+		}
+		else {
+			lua_pop(L, 1);
+		}
+	}
+	else if (!lua_isnil(L, 2)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	if (own) {
+		E.sb = lstrbuf_new(L);
+	}
+	encode_top(&E, 1);
+
+	if (!own) {
+		lua_pushvalue(L, 3);
+		return 1;
+	}
+	lua_pushlstring(L, E.sb->data, E.sb->len);
+	{
+		/* release the temporary buffer now instead of at the next GC */
+		void *ud;
+		lua_Alloc allocf = lua_getallocf(L, &ud);
+		allocf(ud, E.sb->data, E.sb->cap, 0);
+		E.sb->data = NULL;
+		E.sb->len = E.sb->cap = 0;
+	}
+	return 1;
+}
+
+/* }====================================================== */
+
+
+/* {====================================================== */
+/* Decoder */
+
+typedef struct Decoder {
+	lua_State *L;
+	const char *func;
+	const char *p;   /* next byte */
+	const char *end; /* end of available bytes */
+	FILE *f;         /* file to refill buf from, or NULL */
+	char *buf;
+	size_t bufsize;
+	int refs; /* stack index of reference index -> table */
+	lua_Integer nrefs;
+	int depth;
+} Decoder;
+
+
+static void decode_error(Decoder *D)
+{
+	luaL_error(D->L, "%s input error", D->func);
+}
+
+
+/* Make at least n bytes available. Returns 0 at end of input. */
+static int need(Decoder *D, size_t n)
+{
+	size_t avail = (size_t)(D->end - D->p);
+	if (avail >= n) {
+		return 1;
+	}
+	if (D->f == NULL) {
+		return 0;
+	}
+	memmove(D->buf, D->p, avail);
+	D->p = D->buf;
+	D->end = D->buf + avail;
+	while (avail < n) {
+		size_t got = fread(D->buf + avail, 1, D->bufsize - avail, D->f);
+		if (got == 0) {
+			return 0;
+		}
+		avail += got;
+		D->end += got;
+	}
+	return 1;
+}
+
+
+static int get_byte(Decoder *D)
+{
+	if (!need(D, 1)) {
+		decode_error(D);
+	}
+	return (unsigned char)*D->p++;
+}
+
+
+static uint64_t get_varint(Decoder *D)
+{
+	uint64_t v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int b = get_byte(D);
+		v |= ((uint64_t)(b & 0x7F)) << shift;
+		if ((b & 0x80) == 0) {
+			return v;
+		}
+	}
+	decode_error(D);
+	return 0;
+}
+
+
+static void get_string(Decoder *D, uint64_t len)
+{
+	lua_State *L = D->L;
+	uint64_t len0 = len;
+
+	if (D->f == NULL) {
+		if ((uint64_t)(D->end - D->p) < len) {
+			decode_error(D);
+		}
+		lua_pushlstring(L, D->p, (size_t)len);
+		D->p += len;
+	}
+	else {
+		/* may be longer than the read buffer: copy it in chunks */
+		luaL_Buffer b;
+		luaL_buffinit(L, &b);
+		while (len > 0) {
+			size_t n;
+			if (!need(D, 1)) {
+				decode_error(D);
+			}
+			n = (size_t)(D->end - D->p);
+			if (n > len) {
+				n = (size_t)len;
+			}
+			luaL_addlstring(&b, D->p, n);
+			D->p += n;
+			len -= n;
+		}
+		luaL_pushresult(&b);
+	}
+	if ((len0 >= SER_MINSHARED) && (len0 <= SER_MAXSHARED)) {
+		lua_pushvalue(L, -1);
+		lua_rawseti(L, D->refs, ++D->nrefs);
+	}
+}
+
+
+/* Presize for n table entries of at least minsize bytes each, not more
+ * than the remaining input can hold */
+static int size_hint(Decoder *D, uint64_t n, size_t minsize)
+{
+	uint64_t max = (D->f != NULL) ? SER_MAXHINT : (uint64_t)(D->end - D->p) / minsize;
+	return (int)((n < max) ? n : max);
+}
+
+
+static void decode_value(Decoder *D)
+{
+	lua_State *L = D->L;
+	int t = get_byte(D);
+
+	if (t >= LSERIALIZE_FIXINT) {
+		lua_pushinteger(L, t - LSERIALIZE_FIXINT);
+		return;
+	}
+	if (t >= LSERIALIZE_FIXSTR) {
+		get_string(D, (uint64_t)(t - LSERIALIZE_FIXSTR));
+		return;
+	}
+
+	switch (t) {
+	case LSERIALIZE_NIL:
+		lua_pushnil(L);
+		break;
+	case LSERIALIZE_FALSE:
+		lua_pushboolean(L, 0);
+		break;
+	case LSERIALIZE_TRUE:
+		lua_pushboolean(L, 1);
+		break;
+	case LSERIALIZE_INT: {
+		uint64_t u = get_varint(D);
+		lua_pushinteger(L, (lua_Integer)((u >> 1) ^ (0 - (u & 1))));
+		break;
+	}
+	case LSERIALIZE_FLOAT: {
+		uint64_t u = 0;
+		double d;
+		if (!need(D, 8)) {
+			decode_error(D);
+		}
+		for (int i = 0; i < 8; i++) {
+			u |= ((uint64_t)(unsigned char)D->p[i]) << (8 * i);
+		}
+		D->p += 8;
+		memcpy(&d, &u, sizeof(d));
+		lua_pushnumber(L, (lua_Number)d);
+		break;
+	}
+	case LSERIALIZE_STRING:
+		get_string(D, get_varint(D));
+		break;
+	case LSERIALIZE_TABLE: {
+		uint64_t narr = get_varint(D);
+		uint64_t nhash = get_varint(D);
+		if (narr > (uint64_t)LUA_MAXINTEGER) {
+			decode_error(D);
+		}
+		if (D->depth >= SER_MAXDEPTH) {
+			luaL_error(L, "%s input too deeply nested", D->func);
+		}
+		luaL_checkstack(L, 4, "too many nested tables");
+		lua_createtable(L, size_hint(D, narr, 1), size_hint(D, nhash, 2));
+		lua_pushvalue(L, -1);
+		lua_rawseti(L, D->refs, ++D->nrefs);
+		D->depth++;
+		for (uint64_t i = 1; i <= narr; i++) {
+			decode_value(D);
+			lua_rawseti(L, -2, (lua_Integer)i);
+		}
+		for (uint64_t i = 0; i < nhash; i++) {
+			decode_value(D);
+			if (lua_isnil(L, -1)) {
+				decode_error(D);
+			}
+			decode_value(D);
+			lua_rawset(L, -3);
+		}
+		D->depth--;
+		break;
+	}
+	case LSERIALIZE_REF: {
+		uint64_t id = get_varint(D);
+		if (id >= (uint64_t)D->nrefs) {
+			decode_error(D);
+		}
+		lua_rawgeti(L, D->refs, (lua_Integer)id + 1);
+		break;
+	}
+	default:
+		decode_error(D);
+		break;
+	}
+}
+
+
+/* Decode one value including its header and push it.
+ * Returns 0 (pushing nothing) if the input is at its end. */
+static int decode_top(Decoder *D)
+{
+	lua_State *L = D->L;
+
+	if (!need(D, 1)) {
+		return 0;
+	}
+	if (!need(D, LSERIALIZE_MAGICLEN) || (memcmp(D->p, LSERIALIZE_MAGIC, LSERIALIZE_MAGICLEN) != 0)) {
+		decode_error(D);
+	}
+	D->p += LSERIALIZE_MAGICLEN;
+
+	lua_newtable(L);
+	D->refs = lua_gettop(L);
+	D->nrefs = 0;
+	D->depth = 0;
+	decode_value(D);
+	lua_remove(L, D->refs);
+	return 1;
+}
+
+
+/* Bytes of a string or strbuf argument, or NULL */
+static const char *check_bytes(lua_State *L, int idx, size_t *len)
+{
+	lstrbuf *sb;
+	if (lua_type(L, idx) == LUA_TSTRING) {
+		return lua_tolstring(L, idx, len);
+	}
+	sb = lstrbuf_test(L, idx);
+	if (sb != NULL) {
+		*len = sb->len;
+		return (sb->data != NULL) ? sb->data : "";
+	}
+	return NULL;
+}
+
+
+size_t lserialize_decode(lua_State *L, const char *s, size_t len, const char *func)
+{
+	Decoder D;
+
+	memset(&D, 0, sizeof(D));
+	D.L = L;
+	D.func = func;
+	D.p = s;
+	D.end = s + len;
+	if (!decode_top(&D)) {
+		decode_error(&D);
+	}
+	return (size_t)(D.p - s);
+}
+
+
+/* serialize.decode(bytes [, pos]): the value encoded at (1-based) pos of a
+ * string or strbuf, and the position following it */
+static int lua_serialize_decode(lua_State *L)
+{
+	Decoder D;
+	size_t len = 0;
+	const char *s = check_bytes(L, 1, &len);
+	lua_Integer pos = luaL_optinteger(L, 2, 1);
+
+	if ((s == NULL) || (pos < 1) || ((size_t)(pos - 1) > len)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	memset(&D, 0, sizeof(D));
+	D.L = L;
+	D.func = __func__;
+	D.p = s + (pos - 1);
+	D.end = s + len;
+	if (!decode_top(&D)) {
+		decode_error(&D);
+	}
+	lua_pushinteger(L, (lua_Integer)(D.p - s) + 1);
+	return 2;
+}
+
+
+/* Streaming decoder: reads one value after the other from a file, a
+ * string or a strbuf (uservalue 1). Files are read through a buffer
+ * (uservalue 2), memory is decoded in place. */
+typedef struct SerDecoder {
+	int isfile;
+	size_t pos;   /* memory: offset of the next value */
+	size_t start; /* file: offset of the next byte in the buffer */
+	size_t end;   /* file: bytes in the buffer */
+} SerDecoder;
+
+
+static int lua_serialize_decoder(lua_State *L)
+{
+	size_t len = 0;
+	luaL_Stream *stream = NULL;
+	int isfile = 0;
+
+	if (check_bytes(L, 1, &len) == NULL) {
+		stream = (luaL_Stream *)luaL_testudata(L, 1, LUA_FILEHANDLE);
+		if ((stream == NULL) || (stream->closef == NULL)) {
+			return luaL_error(L, "%s parameter error", __func__);
+		}
+		isfile = 1;
+	}
+
+	SerDecoder *sd = (SerDecoder *)lua_newuserdatauv(L, sizeof(SerDecoder), 2);
+	memset(sd, 0, sizeof(SerDecoder));
+	sd->isfile = isfile;
+	luaL_setmetatable(L, LSERIALIZE_DECODER);
+	lua_pushvalue(L, 1);
+	lua_setiuservalue(L, -2, 1);
+	if (isfile) {
+		lua_newuserdatauv(L, SER_BUFSIZE, 0);
+		lua_setiuservalue(L, -2, 2);
+	}
+	return 1;
+}
+
+
+/* d:next(): the next value, or nothing at the end of the input.
+ * Also the __call metamethod, so "for v in d do" reads all values. */
+static int lua_serialize_next(lua_State *L)
+{
+	SerDecoder *sd = (SerDecoder *)luaL_checkudata(L, 1, LSERIALIZE_DECODER);
+	Decoder D;
+
+	lua_settop(L, 1);
+	memset(&D, 0, sizeof(D));
+	D.L = L;
+	D.func = __func__;
+	lua_getiuservalue(L, 1, 1);
+
+	if (sd->isfile) {
+		luaL_Stream *stream = (luaL_Stream *)luaL_checkudata(L, 2, LUA_FILEHANDLE);
+		if (stream->closef == NULL) {
+			return luaL_error(L, "%s file closed", __func__);
+		}
+		lua_getiuservalue(L, 1, 2);
+		D.f = stream->f;
+		D.buf = (char *)lua_touserdata(L, 3);
+		D.bufsize = SER_BUFSIZE;
+		D.p = D.buf + sd->start;
+		D.end = D.buf + sd->end;
+		if (decode_top(&D)) {
+			sd->start = (size_t)(D.p - D.buf);
+			sd->end = (size_t)(D.end - D.buf);
+			return 1;
+		}
+		sd->start = sd->end = 0;
+		return 0;
+	}
+	else {
+		size_t len = 0;
+		const char *s = check_bytes(L, 2, &len);
+		if (sd->pos > len) {
+			return 0;
+		}
+		D.p = s + sd->pos;
+		D.end = s + len;
+		if (decode_top(&D)) {
+			sd->pos = (size_t)(D.p - s);
+			return 1;
+		}
+		return 0;
+	}
+}
+
+/* }====================================================== */
+
+
+static const struct luaL_Reg decoder_methods[] = {
+	{ "next", lua_serialize_next },
+
+	{ NULL, NULL },
+};
+
+
+static const struct luaL_Reg funclist[] = {
+	{ "encode", lua_serialize_encode },
+	{ "decode", lua_serialize_decode },
+	{ "decoder", lua_serialize_decoder },
+
+	{ NULL, NULL },
+};
+
+
+int luaopen_serialize(lua_State *L)
+{
+	luaL_newmetatable(L, LSERIALIZE_DECODER);
+	lua_pushcfunction(L, lua_serialize_next);
+	lua_setfield(L, -2, "__call");
+	luaL_newlib(L, decoder_methods);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
+	luaL_newlib(L, funclist);
+	lua_pushvalue(L, -1);
+	lua_setglobal(L, "serialize");
+	return 1;
+}
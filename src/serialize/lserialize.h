@@ -0,0 +1,40 @@
+#ifndef LSERIALIZE_H
+#define LSERIALIZE_H
+
+#include "lua.h"
+
+
+/* Every encoded value starts with this header: ESC 'L' 'S' version */
+#define LSERIALIZE_MAGIC "\x1bLS\x01"
+#define LSERIALIZE_MAGICLEN 4
+
+
+/* Value tags. Small non-negative integers and short strings are stored
+ * in the tag byte itself. */
+#define LSERIALIZE_NIL 0x00
+#define LSERIALIZE_FALSE 0x01
+#define LSERIALIZE_TRUE 0x02
+#define LSERIALIZE_INT 0x03    /* zigzag varint */
+#define LSERIALIZE_FLOAT 0x04  /* 8 bytes IEEE 754, little endian */
+#define LSERIALIZE_STRING 0x05 /* varint length, bytes */
+#define LSERIALIZE_TABLE 0x06  /* varint narr, varint nhash, narr values, nhash key/value pairs */
+#define LSERIALIZE_REF 0x07    /* varint index of a table encoded before */
+#define LSERIALIZE_FIXSTR 0x40 /* 0x40 + length (0..63), bytes */
+#define LSERIALIZE_FIXINT 0x80 /* 0x80 + value (0..127) */
+
+
+struct lstrbuf;
+
+/* Append the encoding of the value at idx (header included) to sb, whose
+ * memory belongs to L. Errors are raised like in serialize.encode, with
+ * func as the name in the message. */
+void lserialize_encode(lua_State *L, int idx, struct lstrbuf *sb, const char *func);
+
+/* Decode the value at the start of the len bytes at s and push it.
+ * Returns the number of bytes it took. */
+size_t lserialize_decode(lua_State *L, const char *s, size_t len, const char *func);
+
+
+int luaopen_serialize(lua_State *L);
+
+#endif /* LSERIALIZE_H */
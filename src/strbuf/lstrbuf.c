@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lua_all.h"
+#include "lualib.h"
+#include "lstrbuf.h"
+
+
+/* Longest number representation produced by append */
+#define STRBUF_MAXNUMBER 64
+
+
+static lstrbuf *check_strbuf(lua_State *L, int idx)
+{
+	return (lstrbuf *)luaL_checkudata(L, idx, LSTRBUF_META);
+}
+
+
+/* Append a number in the same format as tostring() */
+static void append_number(lua_State *L, lstrbuf *sb, int idx)
+{
+	char *buff = lstrbuf_prepare(L, sb, STRBUF_MAXNUMBER);
+	int len;
+	if (lua_isinteger(L, idx)) {
+		len = lua_integer2str(buff, STRBUF_MAXNUMBER, lua_tointeger(L, idx));
+	}
+	else {
+		len = lua_number2str(buff, STRBUF_MAXNUMBER - 2, lua_tonumber(L, idx));
+		buff[len] = 0;
+		if (buff[strspn(buff, "-0123456789")] == '\0') {
+			/* looks like an int: add '.0' to show it is a float */
+			buff[len++] = '.';
+			buff[len++] = '0';
+		}
+	}
+	lstrbuf_addsize(sb, len);
+}
+
+
+static int lua_strbuf_new(lua_State *L)
+{
+	size_t cap = 0;
+	if (lua_type(L, 1) == LUA_TNUMBER) {
+		lua_Integer n = lua_tointeger(L, 1);
+		if (n < 0) {
+			return luaL_error(L, "%s parameter error", __func__);
+		}
+		cap = (size_t)n;
+	}
+	else if ((lua_type(L, 1) != LUA_TNONE) && (lua_type(L, 1) != LUA_TNIL)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+
+	lstrbuf *sb = lstrbuf_new(L);
+	if (cap > 0) {
+		lstrbuf_prepare(L, sb, cap);
+	}
+	return 1;
+}
+
+
+static int lua_strbuf_append(lua_State *L)
+{
+	lstrbuf *sb = check_strbuf(L, 1);
+	int top = lua_gettop(L);
+
+	for (int i = 2; i <= top; i++) {
+		switch (lua_type(L, i)) {
+		case LUA_TSTRING:
+		{
+			size_t len = 0;
+			const char *s = lua_tolstring(L, i, &len);
+			lstrbuf_append(L, sb, s, len);
+			break;
+		}
+		case LUA_TNUMBER:
+			append_number(L, sb, i);
+			break;
+		case LUA_TUSERDATA:
+		{
+			lstrbuf *other = lstrbuf_test(L, i);
+			if (other == NULL) {
+				return luaL_error(L, "%s parameter error", __func__);
+			}
+			size_t len = other->len;
+			char *dst = lstrbuf_prepare(L, sb, len);
+			/* prepare may move the data if other is sb itself */
+			memcpy(dst, other->data, len);
+			lstrbuf_addsize(sb, len);
+			break;
+		}
+		default:
+			return luaL_error(L, "%s parameter error", __func__);
+		}
+	}
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+
+static int lua_strbuf_appendf(lua_State *L)
+{
+	lstrbuf *sb = check_strbuf(L, 1);
+	if (lua_type(L, 2) != LUA_TSTRING) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+
+	/* string.format(fmt, ...), kept as upvalue */
+	int nargs = lua_gettop(L) - 1;
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_rotate(L, 2, 1);
+	lua_call(L, nargs, 1);
+
+	size_t len = 0;
+	const char *s = lua_tolstring(L, -1, &len);
+	lstrbuf_append(L, sb, s, len);
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+
+static int lua_strbuf_reserve(lua_State *L)
+{
+	lstrbuf *sb = check_strbuf(L, 1);
+	if (lua_type(L, 2) != LUA_TNUMBER) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	lua_Integer n = lua_tointeger(L, 2);
+	if (n < 0) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+
+	lstrbuf_prepare(L, sb, (size_t)n);
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+
+static int lua_strbuf_tostring(lua_State *L)
+{
+	lstrbuf *sb = check_strbuf(L, 1);
+	lua_pushlstring(L, sb->data, sb->len);
+	return 1;
+}
+
+
+static int lua_strbuf_len(lua_State *L)
+{
+	lstrbuf *sb = check_strbuf(L, 1);
+	lua_pushinteger(L, (lua_Integer)sb->len);
+	return 1;
+}
+
+
+static int lua_strbuf_capacity(lua_State *L)
+{
+	lstrbuf *sb = check_strbuf(L, 1);
+	lua_pushinteger(L, (lua_Integer)sb->cap);
+	return 1;
+}
+
+
+static int lua_strbuf_clear(lua_State *L)
+{
+	lstrbuf *sb = check_strbuf(L, 1);
+	sb->len = 0; /* keep the memory for reuse */
+	lua_settop(L, 1);
+	return 1;
+}
+
+
+static int lua_strbuf_write_to(lua_State *L)
+{
+	lstrbuf *sb = check_strbuf(L, 1);
+	luaL_Stream *p = (luaL_Stream *)luaL_testudata(L, 2, LUA_FILEHANDLE);
+	if ((p == NULL) || (p->closef == NULL)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+
+	int ok = (fwrite(sb->data, 1, sb->len, p->f) == sb->len);
+	return luaL_fileresult(L, ok, NULL);
+}
+
+
+static int lua_strbuf_gc(lua_State *L)
+{
+	lstrbuf *sb = check_strbuf(L, 1);
+	if (sb->data != NULL) {
+		void *ud;
+		lua_Alloc allocf = lua_getallocf(L, &ud);
+		allocf(ud, sb->data, sb->cap, 0);
+		sb->data = NULL;
+		sb->len = sb->cap = 0;
+	}
+	return 0;
+}
+
+
+static const struct luaL_Reg methodlist[] = {
+	{ "append", lua_strbuf_append },
+	{ "reserve", lua_strbuf_reserve },
+	{ "tostring", lua_strbuf_tostring },
+	{ "len", lua_strbuf_len },
+	{ "capacity", lua_strbuf_capacity },
+	{ "clear", lua_strbuf_clear },
+	{ "write_to", lua_strbuf_write_to },
+	{ "appendf", NULL }, /* placeholder, needs string.format as upvalue */
+
+	{ NULL, NULL },
+};
+
+
+static const struct luaL_Reg metalist[] = {
+	{ "__tostring", lua_strbuf_tostring },
+	{ "__len", lua_strbuf_len },
+	{ "__gc", lua_strbuf_gc },
+	{ "__index", NULL }, /* placeholder */
+
+	{ NULL, NULL },
+};
+
+
+static const struct luaL_Reg funclist[] = {
+	{ "new", lua_strbuf_new },
+
+	{ NULL, NULL },
+};
+
+
+int luaopen_strbuf(lua_State *L)
+{
+	luaL_newmetatable(L, LSTRBUF_META);
+	luaL_setfuncs(L, metalist, 0);
+	luaL_newlibtable(L, methodlist);
+	luaL_setfuncs(L, methodlist, 0);
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+	lua_getfield(L, -1, LUA_STRLIBNAME);
+	lua_getfield(L, -1, "format");
+	lua_pushcclosure(L, lua_strbuf_appendf, 1);
+	lua_setfield(L, -4, "appendf");
+	lua_pop(L, 2);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
+	luaL_newlib(L, funclist);
+	lua_pushvalue(L, -1);
+	lua_setglobal(L, "strbuf");
+	return 1;
+}
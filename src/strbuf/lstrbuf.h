@@ -0,0 +1,98 @@
+#ifndef LSTRBUF_H
+#define LSTRBUF_H
+
+#include <limits.h>
+#include <string.h>
+#include "lua.h"
+#include "lauxlib.h"
+
+
+/* Metatable of strbuf userdata */
+#define LSTRBUF_META "strbuf"
+
+
+/* Growable byte buffer (the body of a strbuf userdata).
+ * The memory is taken from the allocator of the Lua state, so other
+ * libraries can write into a strbuf they get as an argument by including
+ * this header only - they do not need to link lstrbuf.c.
+ * The collector does not see that memory, so every growth is added to
+ * its debt (in whole KB): a script dropping large buffers still gets
+ * them collected at the pace of its allocations. */
+typedef struct lstrbuf {
+	char *data;
+	size_t len;
+	size_t cap;
+} lstrbuf;
+
+
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#define LSTRBUF_INLINE static __inline
+#else
+#define LSTRBUF_INLINE static inline
+#endif
+
+
+/* Return the strbuf at stack index idx, or NULL if it is something else */
+LSTRBUF_INLINE lstrbuf *lstrbuf_test(lua_State *L, int idx)
+{
+	return (lstrbuf *)luaL_testudata(L, idx, LSTRBUF_META);
+}
+
+
+/* Push a new, empty strbuf. The memory is released by the __gc metamethod
+ * registered by luaopen_strbuf, so the library must have been opened. */
+LSTRBUF_INLINE lstrbuf *lstrbuf_new(lua_State *L)
+{
+	lstrbuf *sb = (lstrbuf *)lua_newuserdatauv(L, sizeof(lstrbuf), 0);
+	memset(sb, 0, sizeof(lstrbuf));
+	luaL_setmetatable(L, LSTRBUF_META);
+	return sb;
+}
+
+
+/* Make room for n more bytes and return a pointer to them.
+ * Bytes actually written are committed with lstrbuf_addsize. */
+LSTRBUF_INLINE char *lstrbuf_prepare(lua_State *L, lstrbuf *sb, size_t n)
+{
+	if ((sb->cap - sb->len) < n) {
+		void *ud;
+		lua_Alloc allocf = lua_getallocf(L, &ud);
+		size_t cap = (sb->cap < 64) ? 64 : sb->cap;
+		char *data;
+		size_t kb;
+		if (n > (((size_t)-1) / 2) - sb->len) {
+			luaL_error(L, "strbuf too large");
+		}
+		while ((cap - sb->len) < n) {
+			cap *= 2;
+		}
+		data = (char *)allocf(ud, sb->data, sb->cap, cap);
+		if (data == NULL) {
+			luaL_error(L, "strbuf out of memory");
+		}
+		kb = (cap >> 10) - (sb->cap >> 10);
+		sb->data = data;
+		sb->cap = cap;
+		if ((kb > 0) && lua_gc(L, LUA_GCISRUNNING)) {
+			lua_gc(L, LUA_GCSTEP, (kb > INT_MAX) ? INT_MAX : (int)kb);
+		}
+	}
+	return sb->data + sb->len;
+}
+
+
+#define lstrbuf_addsize(sb, n) ((sb)->len += (n))
+
+
+LSTRBUF_INLINE void lstrbuf_append(lua_State *L, lstrbuf *sb, const char *s, size_t n)
+{
+	if (n > 0) {
+		memcpy(lstrbuf_prepare(L, sb, n), s, n);
+		lstrbuf_addsize(sb, n);
+	}
+}
+
+
+int luaopen_strbuf(lua_State *L);
+
+#endif /* LSTRBUF_H */
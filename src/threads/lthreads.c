@@ -0,0 +1,1452 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#endif
+#include "lua_all.h"
+#include "lualib.h"
+#include "strbuf/lstrbuf.h"
+#include "serialize/lserialize.h"
+#include "lthreads.h"
+
+
+/* Keeps the positions of a channel on cache lines of their own */
+#define THREADS_CACHELINE 64
+
+/* threads.map waits this long (ms) for a result before it checks
+ * whether its workers are still alive */
+#define THREADS_MAPPOLL 100
+
+
+/* {====================================================== */
+/* Atomics, the wait lock and the clock */
+
+#ifdef _WIN32
+
+/* Volatile reads are acquire loads with the MSVC default /volatile:ms,
+ * the Interlocked functions are full barriers. */
+typedef volatile LONG thr_atomic;
+#define thr_load(p) (*(p))
+#define thr_store(p, v) ((void)InterlockedExchange((p), (LONG)(v)))
+#define thr_inc(p) InterlockedIncrement(p)
+#define thr_dec(p) InterlockedDecrement(p)
+#define thr_fence() MemoryBarrier()
+
+static int thr_cas(thr_atomic *p, LONG o, LONG n)
+{
+	return InterlockedCompareExchange(p, n, o) == o;
+}
+
+static SRWLOCK thr_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE thr_cond = CONDITION_VARIABLE_INIT;
+
+#define wait_lock() AcquireSRWLockExclusive(&thr_lock)
+#define wait_unlock() ReleaseSRWLockExclusive(&thr_lock)
+#define wait_wakeall() WakeAllConditionVariable(&thr_cond)
+
+static void wait_sleep(long ms)
+{
+	SleepConditionVariableSRW(&thr_cond, &thr_lock, (ms < 0) ? INFINITE : (DWORD)ms, 0);
+}
+
+static uint64_t thr_now_ms(void)
+{
+	return (uint64_t)GetTickCount64();
+}
+
+static int thr_cpus(void)
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return (si.dwNumberOfProcessors > 0) ? (int)si.dwNumberOfProcessors : 1;
+}
+
+#else
+
+typedef int32_t thr_atomic;
+#define thr_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define thr_store(p, v) __atomic_store_n((p), (int32_t)(v), __ATOMIC_RELEASE)
+#define thr_inc(p) __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define thr_dec(p) __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define thr_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static int thr_cas(thr_atomic *p, int32_t o, int32_t n)
+{
+	return __atomic_compare_exchange_n(p, &o, n, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static pthread_mutex_t thr_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t thr_cond = PTHREAD_COND_INITIALIZER;
+
+#define wait_lock() pthread_mutex_lock(&thr_lock)
+#define wait_unlock() pthread_mutex_unlock(&thr_lock)
+#define wait_wakeall() pthread_cond_broadcast(&thr_cond)
+
+static void wait_sleep(long ms)
+{
+	struct timespec ts;
+	if (ms < 0) {
+		pthread_cond_wait(&thr_cond, &thr_lock);
+		return;
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	pthread_cond_timedwait(&thr_cond, &thr_lock, &ts);
+}
+
+static uint64_t thr_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)(ts.tv_nsec / 1000000);
+}
+
+static int thr_cpus(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? (int)n : 1;
+}
+
+#endif
+
+
+/* Signed distance between two wrapping queue positions */
+#define thr_diff(a, b) ((int32_t)((uint32_t)(a) - (uint32_t)(b)))
+
+
+/* Threads blocked in wait_until. Channel operations never take the lock,
+ * they only wake the sleepers when there are any. */
+static thr_atomic thr_waiters;
+
+
+typedef int (*thr_attempt)(void *ud);
+
+
+/* Call attempt until it returns nonzero or timeout_ms (< 0: no limit) has
+ * passed. Returns 0 on timeout.
+ * A sleeper counts itself in thr_waiters before its last attempt, and a
+ * channel operation checks thr_waiters after its change (wait_notify).
+ * Both are sequentially consistent, so either the attempt sees the change
+ * or the operation sees the sleeper and wakes it - and it cannot wake it
+ * too early, since the sleeper holds the lock from its attempt until it
+ * sleeps. */
+static int wait_until(thr_attempt attempt, void *ud, long timeout_ms)
+{
+	uint64_t deadline;
+	int done;
+
+	if (attempt(ud)) {
+		return 1;
+	}
+	if (timeout_ms == 0) {
+		return 0;
+	}
+	deadline = thr_now_ms() + (uint64_t)timeout_ms;
+	wait_lock();
+	thr_inc(&thr_waiters);
+	for (;;) {
+		long ms = -1;
+		done = attempt(ud);
+		if (done) {
+			break;
+		}
+		if (timeout_ms > 0) {
+			uint64_t now = thr_now_ms();
+			if (now >= deadline) {
+				break;
+			}
+			ms = (long)(deadline - now);
+		}
+		wait_sleep(ms);
+	}
+	thr_dec(&thr_waiters);
+	wait_unlock();
+	return done;
+}
+
+
+/* Wake all sleepers after a channel changed */
+static void wait_notify(void)
+{
+	thr_fence();
+	if (thr_load(&thr_waiters) > 0) {
+		wait_lock();
+		wait_wakeall();
+		wait_unlock();
+	}
+}
+
+
+/* Timeout argument in seconds, converted to ms. nil means no limit (-1). */
+static long check_timeout(lua_State *L, int idx, const char *func)
+{
+	lua_Number t;
+	if (lua_isnoneornil(L, idx)) {
+		return -1;
+	}
+	if (lua_type(L, idx) != LUA_TNUMBER) {
+		luaL_error(L, "%s parameter error", func);
+	}
+	t = lua_tonumber(L, idx);
+	if (!(t >= 0)) {
+		luaL_error(L, "%s parameter error", func);
+	}
+	if (t * 1000 > 0x7FFFFFFF) {
+		return -1;
+	}
+	return (long)(t * 1000 + 0.5);
+}
+
+/* }====================================================== */
+
+
+/* {====================================================== */
+/* Messages */
+
+/* Value tags in a message */
+#define MSG_NIL 0
+#define MSG_FALSE 1
+#define MSG_TRUE 2
+#define MSG_INTEGER 3 /* lua_Integer */
+#define MSG_NUMBER 4  /* lua_Number */
+#define MSG_STRING 5  /* size_t length, bytes */
+#define MSG_CHANNEL 6 /* thr_channel pointer, holding a reference */
+#define MSG_ENCODED 7 /* next value of the encoded area */
+
+
+/* A message: the tagged values, then the serialize encoding of all values
+ * that have no tag of their own (tables) */
+typedef struct thr_msg {
+	int n;          /* number of values */
+	int channels;   /* number of MSG_CHANNEL values */
+	size_t encoded; /* offset of the encoded area in data */
+	size_t len;     /* size of data */
+	char data[1];
+} thr_msg;
+
+
+typedef struct thr_channel thr_channel;
+
+static void channel_release(thr_channel *ch);
+static void channel_pushref(lua_State *L, thr_channel *ch);
+static thr_channel *channel_test(lua_State *L, int idx);
+
+
+/* Give the memory of a temporary strbuf back now instead of at the
+ * next GC */
+static void sb_release(lua_State *L, lstrbuf *sb)
+{
+	void *ud;
+	lua_Alloc allocf = lua_getallocf(L, &ud);
+	allocf(ud, sb->data, sb->cap, 0);
+	sb->data = NULL;
+	sb->len = sb->cap = 0;
+}
+
+
+/* A message with one string, made without a Lua state. NULL if there is
+ * no memory. */
+static thr_msg *msg_string(const char *s)
+{
+	size_t len = strlen(s);
+	thr_msg *msg = (thr_msg *)malloc(sizeof(thr_msg) + 1 + sizeof(size_t) + len);
+	if (msg != NULL) {
+		msg->n = 1;
+		msg->channels = 0;
+		msg->len = msg->encoded = 1 + sizeof(size_t) + len;
+		msg->data[0] = MSG_STRING;
+		memcpy(msg->data + 1, &len, sizeof(size_t));
+		memcpy(msg->data + 1 + sizeof(size_t), s, len);
+	}
+	return msg;
+}
+
+
+/* Copy the n values from stack index first on into a new message. Values
+ * that cannot be sent raise an error before anything is allocated. */
+static thr_msg *msg_pack(lua_State *L, int first, int n, const char *func)
+{
+	lstrbuf *sb = NULL;
+	size_t size = 0, extra;
+	thr_msg *msg;
+	char *p;
+
+	for (int i = first; i < first + n; i++) {
+		switch (lua_type(L, i)) {
+		case LUA_TNIL:
+		case LUA_TBOOLEAN:
+			size += 1;
+			break;
+		case LUA_TNUMBER:
+			size += 1 + (lua_isinteger(L, i) ? sizeof(lua_Integer) : sizeof(lua_Number));
+			break;
+		case LUA_TSTRING:
+			size += 1 + sizeof(size_t) + lua_rawlen(L, i);
+			break;
+		case LUA_TUSERDATA:
+			if (channel_test(L, i) != NULL) {
+				size += 1 + sizeof(thr_channel *);
+				break;
+			}
+			/* other userdata: serialize raises the error */
+			/* FALLTHROUGH */
+		default:
+			if (sb == NULL) {
+				sb = lstrbuf_new(L);
+			}
+			size += 1;
+			lserialize_encode(L, i, sb, func);
+			break;
+		}
+	}
+
+	extra = (sb != NULL) ? sb->len : 0;
+	msg = (thr_msg *)malloc(sizeof(thr_msg) + size + extra);
+	if (msg == NULL) {
+		luaL_error(L, "%s out of memory", func);
+	}
+	msg->n = n;
+	msg->channels = 0;
+	msg->encoded = size;
+	msg->len = size + extra;
+
+	p = msg->data;
+	for (int i = first; i < first + n; i++) {
+		switch (lua_type(L, i)) {
+		case LUA_TNIL:
+			*p++ = MSG_NIL;
+			break;
+		case LUA_TBOOLEAN:
+			*p++ = lua_toboolean(L, i) ? MSG_TRUE : MSG_FALSE;
+			break;
+		case LUA_TNUMBER:
+			if (lua_isinteger(L, i)) {
+				lua_Integer v = lua_tointeger(L, i);
+				*p++ = MSG_INTEGER;
+				memcpy(p, &v, sizeof(v));
+				p += sizeof(v);
+			}
+			else {
+				lua_Number v = lua_tonumber(L, i);
+				*p++ = MSG_NUMBER;
+				memcpy(p, &v, sizeof(v));
+				p += sizeof(v);
+			}
+			break;
+		case LUA_TSTRING: {
+			size_t len = 0;
+			const char *s = lua_tolstring(L, i, &len);
+			*p++ = MSG_STRING;
+			memcpy(p, &len, sizeof(len));
+			memcpy(p + sizeof(len), s, len);
+			p += sizeof(len) + len;
+			break;
+		}
+		default: {
+			thr_channel *ch = channel_test(L, i);
+			if (ch != NULL) {
+				*p++ = MSG_CHANNEL;
+				memcpy(p, &ch, sizeof(ch));
+				p += sizeof(ch);
+				thr_inc((thr_atomic *)ch);
+				msg->channels++;
+			}
+			else {
+				*p++ = MSG_ENCODED;
+			}
+			break;
+		}
+		}
+	}
+
+	if (sb != NULL) {
+		memcpy(p, sb->data, extra);
+		sb_release(L, sb);
+		lua_pop(L, 1);
+	}
+	return msg;
+}
+
+
+/* Push the values of a message, returns their number */
+static int msg_unpack(lua_State *L, const thr_msg *msg, const char *func)
+{
+	const char *p = msg->data;
+	const char *enc = msg->data + msg->encoded;
+	const char *end = msg->data + msg->len;
+
+	luaL_checkstack(L, msg->n, "too many values in message");
+	for (int i = 0; i < msg->n; i++) {
+		switch (*p++) {
+		case MSG_NIL:
+			lua_pushnil(L);
+			break;
+		case MSG_FALSE:
+			lua_pushboolean(L, 0);
+			break;
+		case MSG_TRUE:
+			lua_pushboolean(L, 1);
+			break;
+		case MSG_INTEGER: {
+			lua_Integer v;
+			memcpy(&v, p, sizeof(v));
+			p += sizeof(v);
+			lua_pushinteger(L, v);
+			break;
+		}
+		case MSG_NUMBER: {
+			lua_Number v;
+			memcpy(&v, p, sizeof(v));
+			p += sizeof(v);
+			lua_pushnumber(L, v);
+			break;
+		}
+		case MSG_STRING: {
+			size_t len;
+			memcpy(&len, p, sizeof(len));
+			lua_pushlstring(L, p + sizeof(len), len);
+			p += sizeof(len) + len;
+			break;
+		}
+		case MSG_CHANNEL: {
+			thr_channel *ch;
+			memcpy(&ch, p, sizeof(ch));
+			p += sizeof(ch);
+			channel_pushref(L, ch);
+			break;
+		}
+		default:
+			enc += lserialize_decode(L, enc, (size_t)(end - enc), func);
+			break;
+		}
+	}
+	return msg->n;
+}
+
+
+/* Free a message, dropping the channel references it holds */
+static void msg_free(thr_msg *msg)
+{
+	const char *p = msg->data;
+	if (msg->channels > 0) {
+		for (int i = 0; i < msg->n; i++) {
+			switch (*p++) {
+			case MSG_INTEGER:
+				p += sizeof(lua_Integer);
+				break;
+			case MSG_NUMBER:
+				p += sizeof(lua_Number);
+				break;
+			case MSG_STRING: {
+				size_t len;
+				memcpy(&len, p, sizeof(len));
+				p += sizeof(len) + len;
+				break;
+			}
+			case MSG_CHANNEL: {
+				thr_channel *ch;
+				memcpy(&ch, p, sizeof(ch));
+				p += sizeof(ch);
+				channel_release(ch);
+				break;
+			}
+			default:
+				break;
+			}
+		}
+	}
+	free(msg);
+}
+
+/* }====================================================== */
+
+
+/* {====================================================== */
+/* Channels */
+
+/* Bounded MPMC queue (D. Vyukov): every cell has a sequence number that
+ * tells whose turn it is. A sender may fill the cell at position pos when
+ * its sequence is pos, a receiver may empty it when it is pos + 1. Each
+ * side claims a position with one compare-and-swap and then publishes
+ * the cell with a store, so senders and receivers only meet on the cells
+ * they actually share. */
+typedef struct thr_cell {
+	thr_atomic seq;
+	thr_msg *msg;
+} thr_cell;
+
+
+struct thr_channel {
+	thr_atomic refs; /* first member, msg_pack counts with it. A channel
+	                  * with a message holding itself is never freed. */
+	thr_atomic closed;
+	uint32_t mask;   /* capacity - 1 */
+	thr_cell *cells;
+#ifdef _WIN32
+	HANDLE volatile wake; /* event of ch:getfd(), or NULL */
+#else
+	thr_atomic wake;      /* eventfd of ch:getfd() plus 1, or 0 */
+#endif
+	char pad1[THREADS_CACHELINE];
+	thr_atomic head; /* next position to send to */
+	char pad2[THREADS_CACHELINE];
+	thr_atomic tail; /* next position to receive from */
+	char pad3[THREADS_CACHELINE];
+};
+
+
+/* Channel userdata. A message received by it is kept in pending while its
+ * values are pushed, so an error on the way does not leak it. */
+typedef struct thr_chanref {
+	thr_channel *ch;
+	thr_msg *pending;
+	int autoclose; /* close the channel when the userdata is collected */
+	unsigned next; /* select: channel to try first */
+} thr_chanref;
+
+
+static thr_channel *channel_new(uint32_t capacity)
+{
+	thr_channel *ch = (thr_channel *)calloc(1, sizeof(thr_channel));
+	if (ch == NULL) {
+		return NULL;
+	}
+	ch->cells = (thr_cell *)malloc(capacity * sizeof(thr_cell));
+	if (ch->cells == NULL) {
+		free(ch);
+		return NULL;
+	}
+	for (uint32_t i = 0; i < capacity; i++) {
+		ch->cells[i].seq = (int32_t)i;
+		ch->cells[i].msg = NULL;
+	}
+	ch->mask = capacity - 1;
+	ch->refs = 1;
+	return ch;
+}
+
+
+/* Signal the descriptor of ch:getfd(), if anyone asked for it */
+static void channel_signal(thr_channel *ch)
+{
+#ifdef _WIN32
+	HANDLE ev = ch->wake;
+	if (ev != NULL) {
+		SetEvent(ev);
+	}
+#else
+	int32_t fd = thr_load(&ch->wake);
+	if (fd != 0) {
+		uint64_t one = 1;
+		ssize_t r = write(fd - 1, &one, sizeof(one));
+		(void)r; /* only fails while the counter is not read anyway */
+	}
+#endif
+}
+
+
+/* Returns 0 if the channel is full */
+static int channel_push(thr_channel *ch, thr_msg *msg)
+{
+	int32_t pos = thr_load(&ch->head);
+	thr_cell *cell;
+
+	for (;;) {
+		int32_t d;
+		cell = &ch->cells[(uint32_t)pos & ch->mask];
+		d = thr_diff(thr_load(&cell->seq), pos);
+		if (d == 0) {
+			if (thr_cas(&ch->head, pos, (int32_t)((uint32_t)pos + 1))) {
+				break;
+			}
+			pos = thr_load(&ch->head);
+		}
+		else if (d < 0) {
+			return 0;
+		}
+		else {
+			pos = thr_load(&ch->head);
+		}
+	}
+	cell->msg = msg;
+	thr_store(&cell->seq, (uint32_t)pos + 1);
+	channel_signal(ch);
+	return 1;
+}
+
+
+/* Returns NULL if the channel is empty */
+static thr_msg *channel_pop(thr_channel *ch)
+{
+	int32_t pos = thr_load(&ch->tail);
+	thr_cell *cell;
+	thr_msg *msg;
+
+	for (;;) {
+		int32_t d;
+		cell = &ch->cells[(uint32_t)pos & ch->mask];
+		d = thr_diff(thr_load(&cell->seq), (uint32_t)pos + 1);
+		if (d == 0) {
+			if (thr_cas(&ch->tail, pos, (int32_t)((uint32_t)pos + 1))) {
+				break;
+			}
+			pos = thr_load(&ch->tail);
+		}
+		else if (d < 0) {
+			return NULL;
+		}
+		else {
+			pos = thr_load(&ch->tail);
+		}
+	}
+	msg = cell->msg;
+	thr_store(&cell->seq, (uint32_t)pos + ch->mask + 1);
+	return msg;
+}
+
+
+static void channel_release(thr_channel *ch)
+{
+	if (thr_dec(&ch->refs) == 0) {
+		thr_msg *msg;
+		while ((msg = channel_pop(ch)) != NULL) {
+			msg_free(msg);
+		}
+#ifdef _WIN32
+		if (ch->wake != NULL) {
+			CloseHandle(ch->wake);
+		}
+#else
+		if (ch->wake != 0) {
+			close(ch->wake - 1);
+		}
+#endif
+		free(ch->cells);
+		free(ch);
+	}
+}
+
+
+static void channel_close(thr_channel *ch)
+{
+	thr_store(&ch->closed, 1);
+	wait_notify();
+	channel_signal(ch);
+}
+
+
+/* Number of messages waiting (a snapshot) */
+static int32_t channel_count(thr_channel *ch)
+{
+	int32_t n = thr_diff(thr_load(&ch->head), thr_load(&ch->tail));
+	return (n > 0) ? n : 0;
+}
+
+
+static thr_chanref *check_channel(lua_State *L, int idx)
+{
+	return (thr_chanref *)luaL_checkudata(L, idx, LTHREADS_CHANNEL);
+}
+
+
+static thr_channel *channel_test(lua_State *L, int idx)
+{
+	thr_chanref *cr = (thr_chanref *)luaL_testudata(L, idx, LTHREADS_CHANNEL);
+	return (cr != NULL) ? cr->ch : NULL;
+}
+
+
+static thr_chanref *channel_newref(lua_State *L, thr_channel *ch)
+{
+	thr_chanref *cr = (thr_chanref *)lua_newuserdatauv(L, sizeof(thr_chanref), 0);
+	memset(cr, 0, sizeof(thr_chanref));
+	luaL_setmetatable(L, LTHREADS_CHANNEL);
+	cr->ch = ch;
+	return cr;
+}
+
+
+/* Push a new userdata for a channel received in a message */
+static void channel_pushref(lua_State *L, thr_channel *ch)
+{
+	channel_newref(L, ch);
+	thr_inc(&ch->refs);
+}
+
+
+/* Push the values of a message received by cr and free it */
+static int channel_deliver(lua_State *L, thr_chanref *cr, thr_msg *msg, const char *func)
+{
+	int n;
+	if (cr->pending != NULL) {
+		msg_free(cr->pending); /* left by an error */
+	}
+	cr->pending = msg;
+	n = msg_unpack(L, msg, func);
+	cr->pending = NULL;
+	msg_free(msg);
+	return n;
+}
+
+
+typedef struct thr_transfer {
+	thr_channel *ch;
+	thr_msg *msg;
+	int closed;
+} thr_transfer;
+
+
+static int send_attempt(void *ud)
+{
+	thr_transfer *t = (thr_transfer *)ud;
+	if (thr_load(&t->ch->closed)) {
+		t->closed = 1;
+		return 1;
+	}
+	return channel_push(t->ch, t->msg);
+}
+
+
+static int recv_attempt(void *ud)
+{
+	thr_transfer *t = (thr_transfer *)ud;
+	t->msg = channel_pop(t->ch);
+	if ((t->msg == NULL) && thr_load(&t->ch->closed)) {
+		/* a message may have been sent right before the close */
+		t->msg = channel_pop(t->ch);
+		t->closed = (t->msg == NULL);
+		return 1;
+	}
+	return (t->msg != NULL);
+}
+
+
+typedef struct thr_select {
+	thr_chanref *refs[LTHREADS_MAXSELECT];
+	int count;
+	int first;
+	int which; /* index of the channel received from, -1: all closed */
+	thr_msg *msg;
+} thr_select;
+
+
+static int select_attempt(void *ud)
+{
+	thr_select *s = (thr_select *)ud;
+	int closed = 0;
+
+	for (int i = 0; i < s->count; i++) {
+		int k = (s->first + i) % s->count;
+		thr_channel *ch = s->refs[k]->ch;
+		s->msg = channel_pop(ch);
+		if (s->msg == NULL && thr_load(&ch->closed)) {
+			s->msg = channel_pop(ch);
+			closed++;
+		}
+		if (s->msg != NULL) {
+			s->which = k;
+			return 1;
+		}
+	}
+	if (closed == s->count) {
+		s->which = -1;
+		return 1;
+	}
+	return 0;
+}
+
+
+/* threads.channel([capacity]) */
+static int lua_threads_channel(lua_State *L)
+{
+	lua_Integer n = LTHREADS_CAPACITY;
+	uint32_t capacity = 2; /* a single cell could not tell full from empty */
+	thr_chanref *cr;
+
+	if (lua_type(L, 1) == LUA_TNUMBER) {
+		n = lua_tointeger(L, 1);
+	}
+	else if (!lua_isnoneornil(L, 1)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	if ((n < 1) || (n > LTHREADS_MAXCAPACITY)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	while (capacity < (uint32_t)n) {
+		capacity *= 2;
+	}
+
+	cr = channel_newref(L, NULL);
+	cr->ch = channel_new(capacity);
+	if (cr->ch == NULL) {
+		return luaL_error(L, "%s out of memory", __func__);
+	}
+	return 1;
+}
+
+
+/* ch:send(value, ...): blocks while the channel is full. Returns true,
+ * or nil and "closed". The first value must not be nil. */
+static int lua_channel_send(lua_State *L)
+{
+	thr_chanref *cr = check_channel(L, 1);
+	int n = lua_gettop(L) - 1;
+	thr_transfer t;
+
+	if ((n < 1) || lua_isnil(L, 2)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	t.ch = cr->ch;
+	t.msg = msg_pack(L, 2, n, __func__);
+	t.closed = 0;
+	wait_until(send_attempt, &t, -1);
+	if (t.closed) {
+		msg_free(t.msg);
+		lua_pushnil(L);
+		lua_pushliteral(L, "closed");
+		return 2;
+	}
+	wait_notify();
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+
+/* ch:recv([timeout]): the values of the next message, or nil and
+ * "timeout" or "closed" (closed and empty) */
+static int lua_channel_recv(lua_State *L)
+{
+	thr_chanref *cr = check_channel(L, 1);
+	long ms = check_timeout(L, 2, __func__);
+	thr_transfer t;
+
+	t.ch = cr->ch;
+	t.msg = NULL;
+	t.closed = 0;
+	if (!wait_until(recv_attempt, &t, ms)) {
+		lua_pushnil(L);
+		lua_pushliteral(L, "timeout");
+		return 2;
+	}
+	if (t.closed) {
+		lua_pushnil(L);
+		lua_pushliteral(L, "closed");
+		return 2;
+	}
+	wait_notify();
+	return channel_deliver(L, cr, t.msg, __func__);
+}
+
+
+/* ch:select(ch2, ... [, timeout]), also threads.select(ch1, ...): receive
+ * from the first of the channels that has a message. Returns the channel
+ * and the values, or nil and "timeout" or "closed" (all closed and empty).
+ * The channel tried first rotates, so a busy channel cannot starve the
+ * others. */
+static int lua_channel_select(lua_State *L)
+{
+	thr_select s;
+	int top = lua_gettop(L);
+	long ms = -1;
+
+	if ((top > 0) && (lua_type(L, top) == LUA_TNUMBER)) {
+		ms = check_timeout(L, top, __func__);
+		top--;
+	}
+	if ((top < 1) || (top > LTHREADS_MAXSELECT)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	for (int i = 0; i < top; i++) {
+		s.refs[i] = check_channel(L, i + 1);
+	}
+	s.count = top;
+	s.first = (int)(s.refs[0]->next++ % (unsigned)top);
+	s.which = -1;
+	s.msg = NULL;
+
+	if (!wait_until(select_attempt, &s, ms)) {
+		lua_pushnil(L);
+		lua_pushliteral(L, "timeout");
+		return 2;
+	}
+	if (s.which < 0) {
+		lua_pushnil(L);
+		lua_pushliteral(L, "closed");
+		return 2;
+	}
+	wait_notify();
+	lua_pushvalue(L, s.which + 1);
+	return 1 + channel_deliver(L, s.refs[s.which], s.msg, __func__);
+}
+
+
+/* ch:close(): no more sends, receivers get the messages already sent.
+ * Also the __close metamethod: a channel in a to-be-closed variable is
+ * closed when the variable goes out of scope. */
+static int lua_channel_close(lua_State *L)
+{
+	thr_chanref *cr = check_channel(L, 1);
+	channel_close(cr->ch);
+	return 0;
+}
+
+
+/* ch:count(): number of messages waiting (a snapshot) */
+static int lua_channel_count(lua_State *L)
+{
+	thr_chanref *cr = check_channel(L, 1);
+	lua_pushinteger(L, channel_count(cr->ch));
+	return 1;
+}
+
+
+/* ch:getfd(): a descriptor (an event handle on Windows) that is signaled
+ * when a message is sent or the channel is closed, for async.readable.
+ * It stays signaled until a waiter resets it (reads the eventfd, or
+ * ResetEvent) before looking for messages. Receivers that do not wait
+ * for it leave it alone, so a waiter may find nothing. */
+static int lua_channel_getfd(lua_State *L)
+{
+	thr_chanref *cr = check_channel(L, 1);
+	thr_channel *ch = cr->ch;
+#ifdef _WIN32
+	if (ch->wake == NULL) {
+		HANDLE ev = CreateEventA(NULL, TRUE, FALSE, NULL);
+		if (ev == NULL) {
+			return luaL_error(L, "%s cannot create event", __func__);
+		}
+		if (InterlockedCompareExchangePointer((PVOID volatile *)&ch->wake, ev, NULL) != NULL) {
+			CloseHandle(ev);
+		}
+	}
+	lua_pushlightuserdata(L, ch->wake);
+	return 1;
+#elif defined(__linux__)
+	if (thr_load(&ch->wake) == 0) {
+		int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd < 0) {
+			return luaL_error(L, "%s cannot create event", __func__);
+		}
+		if (!thr_cas(&ch->wake, 0, fd + 1)) {
+			close(fd);
+		}
+	}
+	lua_pushinteger(L, thr_load(&ch->wake) - 1);
+	return 1;
+#else
+	lua_pushnil(L);
+	lua_pushliteral(L, "not supported");
+	return 2;
+#endif
+}
+
+
+static int lua_channel_gc(lua_State *L)
+{
+	thr_chanref *cr = check_channel(L, 1);
+	if (cr->pending != NULL) {
+		msg_free(cr->pending);
+		cr->pending = NULL;
+	}
+	if (cr->ch != NULL) {
+		if (cr->autoclose) {
+			channel_close(cr->ch);
+		}
+		channel_release(cr->ch);
+		cr->ch = NULL;
+	}
+	return 0;
+}
+
+/* }====================================================== */
+
+
+/* {====================================================== */
+/* Threads */
+
+typedef struct thr_thread {
+	thr_atomic refs; /* the handle and the thread itself */
+	thr_atomic done;
+	int ok;
+	thr_msg *args;   /* code and arguments */
+	thr_msg *result; /* return values, or the error message */
+#ifdef _WIN32
+	HANDLE h;
+#else
+	pthread_t h;
+#endif
+} thr_thread;
+
+
+typedef struct thr_threadref {
+	thr_thread *t;
+	int joined;
+} thr_threadref;
+
+
+static void thread_release(thr_thread *t)
+{
+	if (thr_dec(&t->refs) == 0) {
+		if (t->args != NULL) {
+			msg_free(t->args);
+		}
+		if (t->result != NULL) {
+			msg_free(t->result);
+		}
+		free(t);
+	}
+}
+
+
+/* Message handler of the thread code: error message with traceback */
+static int thread_msgh(lua_State *L)
+{
+	const char *msg = lua_tostring(L, 1);
+	if (msg == NULL) {
+		if (luaL_callmeta(L, 1, "__tostring") && (lua_type(L, -1) == LUA_TSTRING)) {
+			return 1;
+		}
+		msg = lua_pushfstring(L, "(error object is a %s value)", luaL_typename(L, 1));
+	}
+	luaL_traceback(L, L, msg, 1);
+	return 1;
+}
+
+
+static int thread_main(lua_State *L)
+{
+	thr_thread *t = (thr_thread *)lua_touserdata(L, 1);
+	size_t len = 0;
+	const char *code;
+	int base, n;
+
+	luaL_openlibs(L);
+	LUAPORTABLE4WINDOWS_OPENLIBS(L);
+
+	lua_pushcfunction(L, thread_msgh);
+	base = lua_gettop(L);
+	n = msg_unpack(L, t->args, __func__);
+	code = lua_tolstring(L, base + 1, &len);
+	if (luaL_loadbufferx(L, code, len, "=(thread)", "bt") != LUA_OK) {
+		return lua_error(L);
+	}
+	lua_replace(L, base + 1);
+	if (lua_pcall(L, n - 1, LUA_MULTRET, base) != LUA_OK) {
+		return lua_error(L);
+	}
+	t->result = msg_pack(L, base + 1, lua_gettop(L) - base, __func__);
+	return 0;
+}
+
+
+static void thread_run(thr_thread *t)
+{
+	lua_State *L = luaL_newstate();
+	if (L == NULL) {
+		t->result = msg_string("cannot create state: not enough memory");
+	}
+	else {
+		lua_pushcfunction(L, thread_main);
+		lua_pushlightuserdata(L, t);
+		if (lua_pcall(L, 1, 0, 0) == LUA_OK) {
+			t->ok = 1;
+		}
+		else {
+			const char *msg = lua_tostring(L, -1);
+			t->result = msg_string((msg != NULL) ? msg : "(error object is not a string)");
+		}
+		lua_close(L);
+	}
+	thr_store(&t->done, 1);
+	wait_notify();
+	thread_release(t);
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI thread_start(LPVOID param)
+{
+	thread_run((thr_thread *)param);
+	return 0;
+}
+#else
+static void *thread_start(void *param)
+{
+	thread_run((thr_thread *)param);
+	return NULL;
+}
+#endif
+
+
+static int dump_writer(lua_State *L, const void *p, size_t size, void *ud)
+{
+	lstrbuf_append(L, (lstrbuf *)ud, (const char *)p, size);
+	return 0;
+}
+
+
+/* Replace the Lua function at idx by its binary chunk, like string.dump.
+ * In the other state its upvalues are nil, except _ENV. */
+static void dump_function(lua_State *L, int idx, const char *func)
+{
+	lstrbuf *sb = lstrbuf_new(L);
+	lua_pushvalue(L, idx);
+	if (lua_dump(L, dump_writer, sb, 0) != 0) {
+		luaL_error(L, "%s cannot send C functions", func);
+	}
+	lua_pop(L, 1);
+	lua_pushlstring(L, sb->data, sb->len);
+	lua_replace(L, idx);
+	sb_release(L, sb);
+	lua_pop(L, 1);
+}
+
+
+static void thread_join(thr_threadref *tr)
+{
+	if (!tr->joined) {
+#ifdef _WIN32
+		WaitForSingleObject(tr->t->h, INFINITE);
+		CloseHandle(tr->t->h);
+#else
+		pthread_join(tr->t->h, NULL);
+#endif
+		tr->joined = 1;
+	}
+}
+
+
+/* threads.spawn(code, ...): run code (Lua source or a function) with the
+ * arguments in a new thread, returns its handle */
+static int lua_threads_spawn(lua_State *L)
+{
+	int top = lua_gettop(L);
+	thr_threadref *tr;
+	thr_thread *t;
+	thr_msg *msg;
+	int ok;
+
+	if (lua_type(L, 1) == LUA_TFUNCTION) {
+		dump_function(L, 1, __func__);
+	}
+	else if (lua_type(L, 1) != LUA_TSTRING) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+
+	tr = (thr_threadref *)lua_newuserdatauv(L, sizeof(thr_threadref), 0);
+	tr->t = NULL;
+	tr->joined = 1;
+	luaL_setmetatable(L, LTHREADS_THREAD);
+
+	msg = msg_pack(L, 1, top, __func__);
+	t = (thr_thread *)calloc(1, sizeof(thr_thread));
+	if (t == NULL) {
+		msg_free(msg);
+		return luaL_error(L, "%s out of memory", __func__);
+	}
+	t->refs = 2;
+	t->args = msg;
+#ifdef _WIN32
+	t->h = CreateThread(NULL, 0, thread_start, t, 0, NULL);
+	ok = (t->h != NULL);
+#else
+	ok = (pthread_create(&t->h, NULL, thread_start, t) == 0);
+#endif
+	if (!ok) {
+		msg_free(msg);
+		free(t);
+		return luaL_error(L, "%s cannot create thread", __func__);
+	}
+	tr->t = t;
+	tr->joined = 0;
+	return 1;
+}
+
+
+static thr_threadref *check_thread(lua_State *L, int idx)
+{
+	return (thr_threadref *)luaL_checkudata(L, idx, LTHREADS_THREAD);
+}
+
+
+/* t:join(): wait for the thread to end. Returns true and the values its
+ * code returned, or false and the error message. */
+static int lua_thread_join(lua_State *L)
+{
+	thr_threadref *tr = check_thread(L, 1);
+	thr_thread *t = tr->t;
+
+	thread_join(tr);
+	lua_pushboolean(L, t->ok);
+	if (t->result == NULL) {
+		if (t->ok) {
+			return 1;
+		}
+		lua_pushliteral(L, "not enough memory");
+		return 2;
+	}
+	return 1 + msg_unpack(L, t->result, __func__);
+}
+
+
+/* t:done(): true when the thread has ended (join will not block) */
+static int lua_thread_done(lua_State *L)
+{
+	thr_threadref *tr = check_thread(L, 1);
+	lua_pushboolean(L, thr_load(&tr->t->done) != 0);
+	return 1;
+}
+
+
+/* A thread that is not joined runs on detached */
+static int lua_thread_gc(lua_State *L)
+{
+	thr_threadref *tr = check_thread(L, 1);
+	if (tr->t != NULL) {
+		if (!tr->joined) {
+#ifdef _WIN32
+			CloseHandle(tr->t->h);
+#else
+			pthread_detach(tr->t->h);
+#endif
+			tr->joined = 1;
+		}
+		thread_release(tr->t);
+		tr->t = NULL;
+	}
+	return 0;
+}
+
+/* }====================================================== */
+
+
+/* {====================================================== */
+/* Parallel map */
+
+/* Code of the threads.map workers: apply the function to (index, value)
+ * jobs until the job channel is closed and empty, or the result channel
+ * is closed */
+static const char map_worker[] =
+	"local src, jobs, results = ...\n"
+	"local f, err = load(src, '=(map)', 'bt')\n"
+	"while true do\n"
+	"  local i, v = jobs:recv()\n"
+	"  if not i then break end\n"
+	"  local ok, r = false, err\n"
+	"  if f then ok, r = pcall(f, v) end\n"
+	"  local sendok, sent = pcall(results.send, results, i, ok, r)\n"
+	"  if not sendok then\n"
+	"    sent = results:send(i, false, 'result of item ' .. i .. ' cannot be sent')\n"
+	"  end\n"
+	"  if not sent then break end\n"
+	"end\n";
+
+
+/* threads.map(fn, list [, n]): {fn(list[1]), fn(list[2]), ...} computed by
+ * n threads (default: one per CPU). fn is a function (see spawn) or the
+ * source of a chunk that gets the item as '...'. An error of fn is raised
+ * once all items are done. */
+static int lua_threads_map(lua_State *L)
+{
+	lua_Integer len, n, next = 1, got = 0;
+	thr_chanref *jobs, *results;
+
+	if (lua_type(L, 1) == LUA_TFUNCTION) {
+		dump_function(L, 1, __func__);
+	}
+	else if (lua_type(L, 1) != LUA_TSTRING) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	if (lua_type(L, 2) != LUA_TTABLE) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	len = (lua_Integer)lua_rawlen(L, 2);
+	n = thr_cpus();
+	if (lua_type(L, 3) == LUA_TNUMBER) {
+		n = lua_tointeger(L, 3);
+		if ((n < 1) || (n > 1024)) {
+			return luaL_error(L, "%s parameter error", __func__);
+		}
+	}
+	else if (!lua_isnoneornil(L, 3)) {
+		return luaL_error(L, "%s parameter error", __func__);
+	}
+	if (n > len) {
+		n = len;
+	}
+	lua_settop(L, 3);
+	lua_createtable(L, (len < INT32_MAX) ? (int)len : 0, 0); /* 4: result */
+	if (len == 0) {
+		return 1;
+	}
+
+	jobs = channel_newref(L, channel_new(LTHREADS_CAPACITY)); /* 5 */
+	results = channel_newref(L, channel_new(LTHREADS_CAPACITY)); /* 6 */
+	if ((jobs->ch == NULL) || (results->ch == NULL)) {
+		return luaL_error(L, "%s out of memory", __func__);
+	}
+	/* both channels are closed when this function ends, also by an error
+	 * (an item that cannot be sent, a result that cannot be received):
+	 * the workers then end instead of waiting for room for their results */
+	lua_toclose(L, 5);
+	lua_toclose(L, 6);
+
+	lua_createtable(L, (int)n, 0); /* 7: workers */
+	for (lua_Integer i = 1; i <= n; i++) {
+		lua_pushcfunction(L, lua_threads_spawn);
+		lua_pushstring(L, map_worker);
+		lua_pushvalue(L, 1);
+		lua_pushvalue(L, 5);
+		lua_pushvalue(L, 6);
+		lua_call(L, 4, 1);
+		lua_rawseti(L, 7, i);
+	}
+	lua_pushnil(L); /* 8: first error */
+
+	while (got < len) {
+		thr_transfer t;
+
+		/* queue as many jobs as fit, never block on them: the workers
+		 * may be waiting for room in the result channel */
+		while (next <= len) {
+			if (jobs->pending == NULL) {
+				lua_pushinteger(L, next);
+				lua_rawgeti(L, 2, next);
+				jobs->pending = msg_pack(L, lua_gettop(L) - 1, 2, __func__);
+				lua_pop(L, 2);
+			}
+			if (!channel_push(jobs->ch, jobs->pending)) {
+				break;
+			}
+			jobs->pending = NULL;
+			next++;
+			wait_notify();
+		}
+		if (next > len) {
+			channel_close(jobs->ch);
+		}
+
+		t.ch = results->ch;
+		t.msg = NULL;
+		t.closed = 0;
+		if (!wait_until(recv_attempt, &t, THREADS_MAPPOLL)) {
+			lua_Integer alive = 0;
+			for (lua_Integer i = 1; i <= n; i++) {
+				lua_rawgeti(L, 7, i);
+				alive += !thr_load(&((thr_threadref *)lua_touserdata(L, -1))->t->done);
+				lua_pop(L, 1);
+			}
+			if ((alive == 0) && (channel_count(results->ch) == 0)) {
+				return luaL_error(L, "%s workers ended early", __func__);
+			}
+			continue;
+		}
+		wait_notify();
+		channel_deliver(L, results, t.msg, __func__); /* i, ok, r */
+		if (lua_toboolean(L, -2)) {
+			lua_pushvalue(L, -1);
+			lua_rawseti(L, 4, lua_tointeger(L, -4));
+		}
+		else if (lua_isnil(L, 8)) {
+			lua_pushvalue(L, -1);
+			lua_replace(L, 8);
+		}
+		lua_pop(L, 3);
+		got++;
+	}
+
+	for (lua_Integer i = 1; i <= n; i++) {
+		lua_rawgeti(L, 7, i);
+		thread_join((thr_threadref *)lua_touserdata(L, -1));
+		lua_pop(L, 1);
+	}
+	if (!lua_isnil(L, 8)) {
+		lua_pushvalue(L, 8);
+		return lua_error(L);
+	}
+	lua_settop(L, 4);
+	return 1;
+}
+
+/* }====================================================== */
+
+
+/* threads.cpus(): number of logical processors */
+static int lua_threads_cpus(lua_State *L)
+{
+	lua_pushinteger(L, thr_cpus());
+	return 1;
+}
+
+
+static const struct luaL_Reg channel_methods[] = {
+	{ "send", lua_channel_send },
+	{ "recv", lua_channel_recv },
+	{ "select", lua_channel_select },
+	{ "close", lua_channel_close },
+	{ "count", lua_channel_count },
+	{ "getfd", lua_channel_getfd },
+
+	{ NULL, NULL },
+};
+
+
+static const struct luaL_Reg thread_methods[] = {
+	{ "join", lua_thread_join },
+	{ "done", lua_thread_done },
+
+	{ NULL, NULL },
+};
+
+
+static const struct luaL_Reg funclist[] = {
+	{ "spawn", lua_threads_spawn },
+	{ "channel", lua_threads_channel },
+	{ "select", lua_channel_select },
+	{ "map", lua_threads_map },
+	{ "cpus", lua_threads_cpus },
+
+	{ NULL, NULL },
+};
+
+
+static void new_class(lua_State *L, const char *name, const luaL_Reg *methods, lua_CFunction gc)
+{
+	luaL_newmetatable(L, name);
+	lua_pushcfunction(L, gc);
+	lua_setfield(L, -2, "__gc");
+	lua_newtable(L);
+	luaL_setfuncs(L, methods, 0);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+}
+
+
+int luaopen_threads(lua_State *L)
+{
+	new_class(L, LTHREADS_CHANNEL, channel_methods, lua_channel_gc);
+	luaL_getmetatable(L, LTHREADS_CHANNEL);
+	lua_pushcfunction(L, lua_channel_close);
+	lua_setfield(L, -2, "__close");
+	lua_pop(L, 1);
+	new_class(L, LTHREADS_THREAD, thread_methods, lua_thread_gc);
+
+	luaL_newlib(L, funclist);
+	lua_pushvalue(L, -1);
+	lua_setglobal(L, "threads");
+	return 1;
+}
@@ -0,0 +1,28 @@
+#ifndef LTHREADS_H
+#define LTHREADS_H
+
+#include "lua.h"
+
+
+/* Metatables of channel and thread handle userdata */
+#define LTHREADS_CHANNEL "threads.channel"
+#define LTHREADS_THREAD "threads.thread"
+
+/* Default and largest number of messages a channel can hold. The
+ * capacity is rounded up to a power of two, at least 2. */
+#define LTHREADS_CAPACITY 256
+#define LTHREADS_MAXCAPACITY (1 << 24)
+
+/* Most channels a single select can wait for */
+#define LTHREADS_MAXSELECT 64
+
+
+/* Worker threads run in a Lua state of their own (luaL_newstate with the
+ * standard and lp4w libraries). They share nothing but channels: bounded
+ * lock-free queues of messages, where a message is a malloc'ed block with
+ * copies of the values sent. Strings are copied into the message as they
+ * are, tables go through the serialize encoding, and channels are passed
+ * by reference. */
+int luaopen_threads(lua_State *L);
+
+#endif /* LTHREADS_H */
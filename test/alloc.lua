@@ -0,0 +1,84 @@
+-- alloc.lua
+-- Tests for the pooled allocator (lua -P). Run without -P, the script
+-- runs itself again under the pooled allocator.
+
+if not collectgarbage("allocstats") then
+  local interp = assert(arg and arg[-1], "no interpreter")
+  assert(os.execute(string.format('"%s" -P "%s"', interp, arg[0])))
+  return
+end
+
+print("testing pooled allocator")
+
+local function slabs()
+  return collectgarbage("allocstats").slabs
+end
+
+-- slabs whose blocks are all free go back to the system
+do
+  collectgarbage()
+  local before = slabs()
+  local t = {}
+  for i = 1, 200000 do t[i] = { i } end
+  local peak = slabs()
+  assert(peak > before + 100)
+  t = nil
+  collectgarbage()
+  collectgarbage()
+  assert(slabs() < before + (peak - before) // 4)
+end
+
+-- a sparse survivor per slab keeps it alive, but memory is reused
+do
+  local t = {}
+  for i = 1, 100000 do t[i] = { i } end
+  for i = 1, #t do
+    if i % 1000 ~= 0 then t[i] = false end
+  end
+  collectgarbage()
+  local held = slabs()
+  for i = 1, 50000 do t[#t + 1] = { i } end
+  assert(slabs() <= held + 10)
+end
+
+-- the free bytes counted by the pool match its free lists, also after
+-- many slab switches that leave the tail of a slab as a free block
+local function freetotal(s)
+  local total = 0
+  for _, c in ipairs(s) do total = total + c.free * c.size end
+  return total
+end
+
+do
+  collectgarbage()
+  local before = slabs()
+  local t = {}
+  for i = 1, 40000 do  -- strings of 256 and 160 bytes, interleaved
+    t[i] = ("x"):rep(i % 2 == 0 and 220 or 120) .. i
+  end
+  assert(slabs() > 100)
+  local s = collectgarbage("allocstats")
+  assert(s.freebytes == freetotal(s))
+  for i = 1, #t, 2 do t[i] = false end  -- reuse the tails
+  collectgarbage()
+  for i = 1, #t, 2 do t[i] = ("y"):rep(120) .. i end
+  s = collectgarbage("allocstats")
+  assert(s.freebytes == freetotal(s) and s.freebytes < s.slabbytes)
+  t = nil
+  collectgarbage()
+  collectgarbage()
+  s = collectgarbage("allocstats")
+  assert(s.freebytes == freetotal(s) and s.freebytes < s.slabbytes)
+  assert(s.slabs <= before + 10)  -- and the slabs went back
+end
+
+-- the counters stay consistent
+do
+  local s = collectgarbage("allocstats")
+  for _, c in ipairs(s) do
+    assert(c.allocs - c.frees == c.inuse and c.inuse <= c.peak)
+  end
+  assert(s.slabbytes == s.slabs * 64 * 1024)
+end
+
+print("OK")
@@ -0,0 +1,28 @@
+-- array.lua
+-- Tests for typed arrays: construction and min/max.
+
+print("testing array")
+
+local a = array.new("i32", 3)
+assert(#a == 3 and a[1] == 0 and a:type() == "i32")
+assert(#array.new("f64", 2.0) == 2)
+assert(not pcall(array.new, "f64", 2.5))
+assert(not pcall(array.new, "f64", -1))
+
+a = array.new("i64", { 5, -3, 9, 0 })
+assert(a:min() == -3 and a:max() == 9)
+assert(math.type(a:max()) == "integer")
+a = array.new("u8", { 200, 7, 255 })
+assert(a:min() == 7 and a:max() == 255)
+
+-- float arrays never convert their extremes to integers, so values
+-- outside the int64 range and NaN are fine
+a = array.new("f64", { 1e300, -1e300, 0.5 })
+assert(a:max() == 1e300 and a:min() == -1e300)
+assert(math.type(a:min()) == "float")
+a = array.new("f64", { 0 / 0 })
+assert(a:max() ~= a:max())
+a = array.new("f32", { 3.5, -2.25, 1e30 })
+assert(a:min() == -2.25 and a:max() > 1e29)
+
+print("OK")
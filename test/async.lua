@@ -0,0 +1,108 @@
+-- async.lua
+-- Tests for the async library: stream reads, process:wait, async.recv
+-- on threads channels, and collected processes.
+
+print("testing async")
+
+local async = assert(async)
+
+local WINDOWS = package.config:sub(1, 1) == "\\"
+
+local function tempfile(content)
+  local name = os.tmpname()
+  local f = assert(io.open(name, "wb"))
+  f:write(content)
+  f:close()
+  return name
+end
+
+-- reads before anything is buffered, and at the end
+do
+  local name = tempfile("")
+  local s = assert(async.open(name))
+  assert(s:read("l") == nil)
+  assert(s:read("a") == "")
+  assert(s:read(0) == nil)
+  s:close()
+  os.remove(name)
+
+  name = tempfile("one\ntwo")
+  async.run(function()
+    local s = assert(async.open(name))
+    assert(s:read(0) == "")
+    assert(s:read("l") == "one")
+    assert(s:read("L") == "two")
+    assert(s:read("l") == nil)
+    assert(s:read("a") == "")
+    s:close()
+  end)
+  os.remove(name)
+end
+
+-- two tasks waiting for the same process both get its exit code
+if not WINDOWS then
+  local codes = {}
+  async.run(function()
+    local p = assert(async.process("sleep 0.1; exit 3"))
+    local t = async.now()
+    async.spawn(function() local c = p:wait(); codes[#codes + 1] = c end)
+    local c = p:wait()
+    codes[#codes + 1] = c
+    assert(async.now() - t < 2)
+  end)
+  assert(#codes == 2 and codes[1] == 3 and codes[2] == 3)
+end
+
+if threads then
+  -- a task waiting on a channel gets messages sent by a thread, the
+  -- other tasks keep running meanwhile
+  local ch = threads.channel()
+  local got, ticks = {}, 0
+  async.run(function()
+    async.spawn(function()
+      for _ = 1, 5 do async.sleep(0.01); ticks = ticks + 1 end
+    end)
+    async.spawn(function()
+      local v = async.recv(ch)
+      got[#got + 1] = v
+    end)
+    local t = threads.spawn(function(c)
+      local t0 = os.clock()
+      while os.clock() - t0 < 0.1 do end
+      c:send(1)
+      c:send(2)
+    end, ch)
+    local v = async.recv(ch)
+    got[#got + 1] = v
+    assert(t:join())
+  end)
+  table.sort(got)
+  assert(got[1] == 1 and got[2] == 2 and ticks == 5)
+
+  -- a timeout ends the wait, and closing the channel wakes the waiter
+  async.run(function()
+    local t = async.now()
+    local v, err = async.recv(ch, 0.05)
+    assert(v == nil and err == "timeout")
+    assert(async.now() - t >= 0.04 and async.now() - t < 2)
+    async.spawn(function() async.sleep(0.02); ch:close() end)
+    v, err = async.recv(ch)
+    assert(v == nil and err == "closed")
+  end)
+end
+
+-- a process that is collected while it runs does not stay a zombie
+if not WINDOWS and lfs and lfs.attributes("/proc/self", "mode") == "directory" then
+  local p = assert(async.process("sleep 0.1"))
+  local pid = p:pid()
+  p = nil
+  collectgarbage()
+  collectgarbage()
+  local t = os.time()
+  while lfs.attributes("/proc/" .. pid, "mode") and os.time() - t < 5 do
+    async.sleep(0.01)
+  end
+  assert(not lfs.attributes("/proc/" .. pid, "mode"))
+end
+
+print("OK")
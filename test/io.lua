@@ -0,0 +1,42 @@
+-- io.lua
+-- Tests for line reading: pieces of growing size, embedded zeros and
+-- the batched "l*"/"L*" formats.
+
+print("testing io")
+
+local name = os.tmpname()
+
+local function check(content)
+  local f = assert(io.open(name, "wb"))
+  f:write(content)
+  f:close()
+  local expect = {}
+  for line in content:gmatch("([^\n]*)\n") do expect[#expect + 1] = line end
+  local last = content:match("([^\n]+)$")
+  if last then expect[#expect + 1] = last end
+  local got = {}
+  for line in io.lines(name) do got[#got + 1] = line end
+  assert(#got == #expect)
+  for i = 1, #got do assert(got[i] == expect[i]) end
+  got = {}
+  for line in io.lines(name, "L") do got[#got + 1] = line end
+  assert(table.concat(got) == content)
+  got = {}
+  for batch in io.lines(name, "l*", 7) do
+    for _, line in ipairs(batch) do got[#got + 1] = line end
+  end
+  assert(#got == #expect and got[#got] == expect[#expect])
+end
+
+check("")
+check("\n")
+check("a\nbb\n\nccc")
+check("zero\0inside\n\0\n\0\0\nlast\0line\0")
+-- lines around the piece sizes (128, 256, 512, ...)
+for _, n in ipairs { 126, 127, 128, 129, 254, 255, 256, 383, 384, 385,
+                     1023, 1024, 1025, 5000 } do
+  check(("x"):rep(n) .. "\n" .. ("y"):rep(n) .. "\0z\n" .. ("w"):rep(n))
+end
+
+os.remove(name)
+print("OK")
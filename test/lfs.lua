@@ -0,0 +1,132 @@
+-- lfs.lua
+-- Tests for the additions to LuaFileSystem: lfs.watch and glob patterns.
+
+print("testing lfs")
+
+local lfs = assert(lfs)
+
+local WINDOWS = package.config:sub(1, 1) == "\\"
+
+local function tempdir()
+  local name = os.tmpname()
+  os.remove(name)
+  assert(lfs.mkdir(name))
+  return name
+end
+
+local function rmtree(path)
+  for entry in lfs.dir(path) do
+    if entry ~= "." and entry ~= ".." then
+      local sub = path .. "/" .. entry
+      if lfs.symlinkattributes(sub, "mode") == "directory" then
+        rmtree(sub)
+      else
+        os.remove(sub)
+      end
+    end
+  end
+  lfs.rmdir(path)
+end
+
+local function touch(path)
+  local f = assert(io.open(path, "w"))
+  f:write("x")
+  f:close()
+end
+
+-- events of the next poll(s), as a set of "event path [from]" strings
+local function collect(w, root)
+  local seen = {}
+  for _ = 1, 3 do
+    for _, e in ipairs(w:poll(100)) do
+      local s = e.event .. " " .. (e.path or ""):sub(#root + 2)
+      if e.from then s = s .. " <- " .. e.from:sub(#root + 2) end
+      seen[s] = true
+    end
+  end
+  return seen
+end
+
+if lfs.watch and not WINDOWS then
+  local root = tempdir()
+  assert(lfs.mkdir(root .. "/sub"))
+  local w = assert(lfs.watch(root, { recursive = true }))
+
+  -- renaming a subdirectory is one "renamed" event, not a removal
+  assert(os.rename(root .. "/sub", root .. "/moved"))
+  local ev = collect(w, root)
+  assert(ev["renamed moved <- sub"])
+  assert(not ev["removed sub"] and not ev["removed moved"])
+
+  -- and the watch below it reports the new path
+  touch(root .. "/moved/f")
+  ev = collect(w, root)
+  assert(ev["created moved/f"])
+  assert(not ev["created sub/f"])
+
+  -- files created right after mkdir, before the new directory is
+  -- watched, are still reported
+  assert(lfs.mkdir(root .. "/new"))
+  touch(root .. "/new/a")
+  assert(lfs.mkdir(root .. "/new/deep"))
+  touch(root .. "/new/deep/b")
+  ev = collect(w, root)
+  assert(ev["created new"] and ev["created new/a"])
+  assert(ev["created new/deep"] and ev["created new/deep/b"])
+
+  -- moving a file out of the tree is a removal, once the rename has
+  -- waited in vain for its second half
+  local outside = tempdir()
+  assert(os.rename(root .. "/new/a", outside .. "/a"))
+  ev = collect(w, root)
+  assert(ev["removed new/a"])
+
+  -- moving a directory in from outside reports its contents
+  assert(lfs.mkdir(outside .. "/tree"))
+  touch(outside .. "/tree/c")
+  assert(os.rename(outside .. "/tree", root .. "/tree"))
+  ev = collect(w, root)
+  assert(ev["created tree"] and ev["created tree/c"])
+
+  -- a directory moved out is not watched any more
+  assert(os.rename(root .. "/tree", outside .. "/tree"))
+  ev = collect(w, root)
+  assert(ev["removed tree"])
+  touch(outside .. "/tree/d")
+  ev = collect(w, root)
+  assert(next(ev) == nil)
+
+  -- waiting forever is not ended by changes that are filtered out
+  touch(outside .. "/e0")
+  local only = assert(lfs.watch(outside, { events = { "created" } }))
+  assert(os.execute(string.format('(sleep 1; touch "%s/e1") &', outside)))
+  touch(outside .. "/e0")  -- a modification, then a creation a second later
+  ev = only:poll(-1)
+  assert(#ev > 0 and ev[1].event == "created")
+  only:close()
+
+  -- a timeout with nothing to report still returns an empty table
+  assert(#w:poll(0) == 0)
+  assert(math.type(w:getfd()) == "integer")
+  w:close()
+  rmtree(outside)
+  rmtree(root)
+end
+
+-- glob matching is linear in the subject, even with many stars
+do
+  local g = lfs.compile_glob("*a*a*a*a*a*a*a*a*a*a*b")
+  local t = os.clock()
+  assert(not g:match(("a"):rep(40)))
+  assert(g:match(("a"):rep(40) .. "b"))
+  assert(os.clock() - t < 1)
+  g = lfs.compile_glob("src/**/*.c")
+  assert(g:match("src/a.c") and g:match("src/x/y/a.c"))
+  assert(not g:match("src/x/a.h") and not g:match("lib/a.c"))
+  assert(lfs.compile_glob("a/*/c"):match("a/b/c"))
+  assert(not lfs.compile_glob("a/*/c"):match("a/b/x/c"))
+  assert(lfs.compile_glob("**/x"):match("x"))
+  assert(lfs.compile_glob("a*b?[cd]"):match("axxbzd"))
+end
+
+print("OK")
@@ -0,0 +1,46 @@
+-- load_data.lua
+-- Tests for load_data: telling data from file names, and the mode
+-- argument.
+
+print("testing load_data")
+
+local lfs = assert(lfs)
+
+-- data given as a string
+assert(load_data("return { 1, 2 }")[2] == 2)
+assert(load_data("return{ 1 }")[1] == 1)
+assert(load_data("  -- comment\nreturn\n{ 1 }")[1] == 1)
+assert(load_data("{ 1 }")[1] == 1)
+assert(load_data("return 1.5") == 1.5)
+assert(load_data("return 1.5", nil, "string") == 1.5)
+
+-- file names that start like data are still file names
+local dir = os.tmpname()
+os.remove(dir)
+assert(lfs.mkdir(dir))
+local cwd = assert(lfs.currentdir())
+assert(lfs.chdir(dir))
+for _, name in ipairs { "return.lua", "return_values", "{x}.lua", "--x.lua" } do
+  local f = assert(io.open(name, "w"))
+  f:write("return { 'file' }")
+  f:close()
+  assert(load_data(name)[1] == "file")
+  assert(load_data(name, nil, "file")[1] == "file")
+  os.remove(name)
+end
+
+-- the mode wins over the guess
+local f = assert(io.open("return", "w"))
+f:write("return { 'file' }")
+f:close()
+assert(load_data("return", nil, "file")[1] == "file")
+assert(load_data("return", nil, "string") == nil)
+os.remove("return")
+assert(lfs.chdir(cwd))
+lfs.rmdir(dir)
+
+local v, msg = load_data("missing.lua")
+assert(v == nil and msg:find("cannot open"))
+assert(not pcall(load_data, "return {}", nil, "text"))
+
+print("OK")
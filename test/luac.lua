@@ -0,0 +1,55 @@
+-- luac.lua
+-- Tests for luac -O: optimized chunks compute the same results and raise
+-- the same errors, naming the same variables. Needs the luac built next
+-- to the interpreter.
+
+print("testing luac")
+
+local interp = arg and arg[-1]
+local dir = interp and interp:match("^(.*[/\\])") or ""
+local WINDOWS = package.config:sub(1, 1) == "\\"
+local LUAC = dir .. (WINDOWS and "luac.exe" or "luac")
+
+local SOURCE = [[
+local sn, n, s, A = "5", 5, "abc", 4
+local cases = {
+  function() return sn() end,
+  function() return n.x end,
+  function() return s + 1 end,
+  function() local q = sn; return q() end,
+  function() return #n end,
+  function() return n .. nil end,
+  function() return (A * 2 + n) .. sn, A & 3, -A end,
+}
+local out = {}
+for i, f in ipairs(cases) do
+  local r = table.pack(pcall(f))
+  for j = 1, r.n do r[j] = tostring(r[j]) end
+  out[i] = table.concat(r, " ")
+end
+return table.concat(out, "\n")
+]]
+
+-- compile the source file 'src' with luac and the given options
+local function compile(src, opts)
+  local out = os.tmpname()
+  local ok = os.execute(string.format('"%s" %s -o "%s" "%s"', LUAC, opts, out, src))
+  local fn = ok and loadfile(out, "b")
+  os.remove(out)
+  return assert(fn, "cannot compile with luac " .. opts)
+end
+
+local f = io.open(LUAC, "rb")
+if f then
+  f:close()
+  local src = os.tmpname()
+  local h = assert(io.open(src, "wb"))
+  h:write(SOURCE)
+  h:close()
+  local plain, optimized = compile(src, "")(), compile(src, "-O")()
+  os.remove(src)
+  assert(plain:find("upvalue 'sn'") and plain:find("local 'q'"))
+  assert(optimized == plain, optimized)
+end
+
+print("OK")
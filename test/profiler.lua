@@ -0,0 +1,61 @@
+-- profiler.lua
+-- Tests for the profiler library: which state owns a running profiler.
+
+print("testing profiler")
+
+assert(profiler) -- a global, so the functions run by threads see it too
+
+local function work()
+  local s = 0
+  for i = 1, 200000 do s = s + i % 7 end
+  return s
+end
+
+-- samples of a plain run
+do
+  profiler.reset()
+  assert(profiler.start())
+  assert(not profiler.start())
+  work()
+  profiler.stop()
+  assert(not profiler.running())
+  assert(profiler.samples() > 0)
+  assert(profiler.report():find("work@"))
+  profiler.reset()
+  assert(profiler.samples() == 0)
+end
+
+if threads then
+  -- a thread that ends without stopping the profiler does not leave it
+  -- running (its hook and state are gone)
+  local t = threads.spawn(function()
+    assert(profiler.start())
+    local s = 0
+    for i = 1, 100000 do s = s + i end
+    return s
+  end)
+  assert(t:join())
+  assert(not profiler.running())
+  assert(profiler.start())
+  work()
+  profiler.stop()
+  assert(profiler.samples() > 0)
+
+  -- while this state profiles, other states cannot stop or reset it
+  assert(profiler.start())
+  t = threads.spawn(function()
+    assert(not profiler.start())
+    assert(not pcall(profiler.stop))
+    assert(not pcall(profiler.reset))
+    assert(not pcall(profiler.report))
+    return profiler.running()
+  end)
+  local ok, running = t:join()
+  assert(ok and running)
+  work()
+  assert(profiler.running())
+  profiler.stop()
+  profiler.reset()
+end
+
+print("OK")
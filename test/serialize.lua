@@ -0,0 +1,42 @@
+-- serialize.lua
+-- Tests for the serialize library: nesting limits of encoder and decoder.
+
+print("testing serialize")
+
+local serialize = assert(serialize)
+
+local function nested(n)
+  local t = {}
+  for _ = 2, n do t = { t } end
+  return t
+end
+
+-- the deepest input the decoder takes round-trips
+do
+  local t = serialize.decode(serialize.encode(nested(200)))
+  local n = 0
+  while t do n = n + 1; t = t[1] end
+  assert(n == 200)
+end
+
+-- deeper tables are refused by the encoder ...
+do
+  local ok, msg = pcall(serialize.encode, nested(201))
+  assert(not ok and msg:find("nesting too deep"))
+  assert(not pcall(serialize.encode, {}, { maxdepth = 100000 }))
+  ok, msg = pcall(serialize.encode, nested(20), { maxdepth = 10 })
+  assert(not ok and msg:find("nesting too deep"))
+end
+
+-- ... and by the decoder, even for input far too deep for the C stack
+-- (a one-element table holding a table, 300000 times)
+do
+  local s = "\27LS\1" .. ("\6\1\0"):rep(300000) .. "\0"
+  local ok, msg = pcall(serialize.decode, s)
+  assert(not ok and msg:find("input too deeply nested"))
+  local d = serialize.decoder(s)
+  ok, msg = pcall(d.next, d)
+  assert(not ok and msg:find("input too deeply nested"))
+end
+
+print("OK")
@@ -0,0 +1,51 @@
+-- sort.lua
+-- Tests for table.sort with an options table (key, stable, reverse).
+
+print("testing sort")
+
+local function sorted(t, lt)
+  for i = 2, #t do assert(not lt(t[i], t[i - 1])) end
+end
+
+local t = {}
+for i = 1, 1000 do t[i] = (i * 7919) % 1009 end
+table.sort(t, {})
+sorted(t, function(a, b) return a < b end)
+table.sort(t, { reverse = true })
+sorted(t, function(a, b) return a > b end)
+
+local words = {}
+for i = 1, 500 do words[i] = { name = "w" .. (i * 31) % 97, i = i } end
+table.sort(words, { key = function(w) return w.name end, stable = true })
+for i = 2, #words do
+  local a, b = words[i - 1], words[i]
+  assert(a.name < b.name or (a.name == b.name and a.i < b.i))
+end
+
+-- keys without a native order go through '__lt'
+local mt = { __lt = function(a, b) return a.v < b.v end }
+local objs = {}
+for i = 1, 300 do objs[i] = setmetatable({ v = (i * 13) % 301 }, mt) end
+table.sort(objs, { key = function(o) return o end })
+sorted(objs, function(a, b) return a.v < b.v end)
+
+-- an inconsistent '__lt' raises an error instead of running off the
+-- array
+local bad = { __lt = function() return true end }
+for _, n in ipairs { 17, 100, 1000 } do
+  local items = {}
+  for i = 1, n do items[i] = i end
+  local ok, msg = pcall(table.sort, items,
+    { key = function(x) return setmetatable({}, bad) end })
+  assert(not ok and msg:find("invalid order function"))
+end
+local rnd = { __lt = function() return math.random() < 0.5 end }
+for _ = 1, 50 do
+  local items = {}
+  for i = 1, 200 do items[i] = i end
+  local ok, msg = pcall(table.sort, items,
+    { key = function(x) return setmetatable({}, rnd) end })
+  assert(ok or msg:find("invalid order function"))
+end
+
+print("OK")
@@ -0,0 +1,39 @@
+-- strbuf.lua
+-- Tests for strbuf: appending, and buffer memory counted by the
+-- collector.
+
+print("testing strbuf")
+
+local sb = strbuf.new()
+sb:append("a", 1, 2.5, "b")
+assert(sb:tostring() == "a12.5b" and #sb == 6)
+sb:clear()
+assert(#sb == 0 and sb:capacity() >= 64)
+sb:appendf("%d-%s", 7, "x")
+assert(tostring(sb) == "7-x")
+
+-- dropped buffers are collected although they hardly grow the Lua heap
+do
+  local alive = setmetatable({}, { __mode = "v" })
+  collectgarbage()
+  for i = 1, 400 do
+    local b = strbuf.new(256 * 1024)
+    alive[i] = b
+  end
+  local n = 0
+  for _ in pairs(alive) do n = n + 1 end
+  assert(n < 400)
+end
+
+-- with the collector stopped, growing a buffer does not collect
+do
+  collectgarbage("stop")
+  local alive = setmetatable({}, { __mode = "v" })
+  for i = 1, 50 do alive[i] = strbuf.new(256 * 1024) end
+  local n = 0
+  for _ in pairs(alive) do n = n + 1 end
+  assert(n == 50)
+  collectgarbage("restart")
+end
+
+print("OK")
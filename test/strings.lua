@@ -0,0 +1,47 @@
+-- strings.lua
+-- Tests for string.split, string.isplit and string.splitlines.
+
+print("testing strings")
+
+local function same(a, b)
+  assert(#a == #b)
+  for i = 1, #a do assert(a[i] == b[i]) end
+end
+
+same(string.split("a,b,,c", ","), { "a", "b", "", "c" })
+same(string.split(",", ","), { "", "" })
+same(string.split("abc", ","), { "abc" })
+same(string.split("a::b::c", "::"), { "a", "b", "c" })
+same(string.split("a,b,c,d", ",", true, 2), { "a", "b,c,d" })
+same(string.split("a,b", ",", true, 1), { "a,b" })
+same(string.split("a1b22c", "%d+"), { "a", "b", "c" })
+same(string.split("a.b", ".", true), { "a", "b" })
+same(string.split("ab,c", ",", false, nil, true), { 1, 2, 4, 4 })
+same(string.splitlines("x\r\ny\n\nz\n"), { "x", "y", "", "z" })
+assert(not pcall(string.split, "a", ""))
+
+local t = {}
+for f in string.isplit("a, b,c", ",%s*") do t[#t + 1] = f end
+same(t, { "a", "b", "c" })
+
+-- the iterator may outlive the coroutine that created it
+do
+  local it = coroutine.wrap(function()
+    coroutine.yield(string.isplit("x1y22z333w", "%d+"))
+  end)()
+  collectgarbage()
+  collectgarbage()
+  t = {}
+  for f in it do t[#t + 1] = f end
+  same(t, { "x", "y", "z", "w" })
+  -- errors are raised in the thread calling the iterator
+  it = coroutine.wrap(function()
+    coroutine.yield(string.isplit("ab1c", "%d%"))
+  end)()
+  collectgarbage()
+  collectgarbage()
+  local ok, msg = pcall(it)
+  assert(not ok and msg:find("malformed pattern"))
+end
+
+print("OK")
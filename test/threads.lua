@@ -0,0 +1,61 @@
+-- threads.lua
+-- Tests for threads.map: results, errors, and its workers ending.
+
+print("testing threads")
+
+local threads = assert(threads)
+
+-- items slower than the poll interval of map still all arrive
+do
+  local r = threads.map("local t = os.clock() while os.clock() - t < 0.15 do end return ... * 2",
+    { 1, 2, 3, 4, 5 }, 2)
+  assert(#r == 5)
+  for i = 1, 5 do assert(r[i] == 2 * i) end
+end
+
+-- an error of fn is raised once all items are done
+do
+  local ok, msg = pcall(threads.map, "local x = ... if x == 3 then error('three') end return x",
+    { 1, 2, 3, 4 })
+  assert(not ok and msg:find("three"))
+end
+
+-- an item that cannot be sent stops the map, and its workers end at once
+-- (not only when the collector finds the channels)
+local TASKS = "/proc/self/task"
+if lfs and lfs.attributes(TASKS, "mode") == "directory" then
+  local function nthreads()
+    local n = 0
+    for e in lfs.dir(TASKS) do
+      if e ~= "." and e ~= ".." then n = n + 1 end
+    end
+    return n
+  end
+
+  collectgarbage()
+  collectgarbage("stop")
+  local before = nthreads()
+  local list = {}
+  for i = 1, 2000 do list[i] = i end
+  list[600] = print
+  local ok, msg = pcall(threads.map, "return ...", list, 4)
+  assert(not ok and msg:find("function"))
+  local t = os.time()
+  while nthreads() > before and os.time() - t < 5 do end
+  assert(nthreads() == before)
+  collectgarbage("restart")
+end
+
+-- a channel in a to-be-closed variable is closed at the end of its scope
+do
+  local ch = threads.channel()
+  do
+    local c <close> = ch
+    assert(c:send(1))
+  end
+  assert(ch:send(2) == nil)
+  assert(ch:recv() == 1)
+  assert(select(2, ch:recv()) == "closed")
+end
+
+print("OK")